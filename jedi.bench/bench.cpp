@@ -0,0 +1,164 @@
+#include "../jedi/buffer.h"
+#include "../jedi/edit.h"
+#include "../jedi/encoding.h"
+#include "../jedi/search.h"
+
+#define JTK_FILE_UTILS_IMPLEMENTATION
+#include "jtk/file_utils.h"
+#include "jtk/utf8.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdio.h>
+#include <string>
+
+namespace
+  {
+  template <class TFun>
+  double measure(TFun fun, int repetitions)
+    {
+    auto tic = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i)
+      fun();
+    auto toc = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(toc - tic).count() / repetitions;
+    }
+
+  void report(const char* name, double seconds, uint64_t bytes)
+    {
+    printf("%-32s %10.3f ms %10.1f MB/s\n", name, seconds * 1000.0, (double)bytes / seconds / (1024.0 * 1024.0));
+    }
+
+  std::string make_text(uint64_t size, bool ascii_only)
+    {
+    std::string txt;
+    txt.reserve(size + 64);
+    uint64_t line_nr = 0;
+    while (txt.size() < size)
+      {
+      txt.append("  for (int i = 0; i < number_of_items; ++i) // line ");
+      txt.append(std::to_string(line_nr++));
+      if (!ascii_only && line_nr % 4 == 0)
+        txt.append(" r\xc3\xa9sum\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80");
+      txt.push_back('\n');
+      }
+    return txt;
+    }
+
+  void bench(const char* title, const std::string& txt)
+    {
+    const int repetitions = 10;
+    printf("%s (%llu bytes)\n", title, (unsigned long long)txt.size());
+
+    volatile uint64_t sink = 0;
+    report("scan_encoding", measure([&]()
+      {
+      std::vector<uint64_t> offsets;
+      sink = sink + scan_encoding(txt.data(), txt.size(), &offsets) + offsets.size();
+      }, repetitions), txt.size());
+
+    report("std::count newlines", measure([&]()
+      {
+      sink = sink + std::count(txt.begin(), txt.end(), '\n');
+      }, repetitions), txt.size());
+
+    std::wstring wtxt;
+    report("decode", measure([&]()
+      {
+      wtxt.clear();
+      decode(wtxt, txt.data(), txt.data() + txt.size(), enc_utf8);
+      }, repetitions), txt.size());
+
+    report("utf8::utf8to16", measure([&]()
+      {
+      std::wstring w;
+      w.reserve(txt.size());
+      utf8::utf8to16(txt.begin(), txt.end(), std::back_inserter(w));
+      sink = sink + w.size();
+      }, repetitions), txt.size());
+
+    report("encode", measure([&]()
+      {
+      std::string out;
+      encode(out, wtxt.data(), wtxt.data() + wtxt.size());
+      sink = sink + out.size();
+      }, repetitions), txt.size());
+
+    report("utf8::utf16to8", measure([&]()
+      {
+      std::string out;
+      out.reserve(wtxt.size());
+      utf8::utf16to8(wtxt.begin(), wtxt.end(), std::back_inserter(out));
+      sink = sink + out.size();
+      }, repetitions), txt.size());
+
+    const std::wstring pattern(L"number_of_items; --i");
+    report("search_forward", measure([&]()
+      {
+      sink = sink + (uint64_t)(search_forward(wtxt.data(), wtxt.data() + wtxt.size(), pattern.data(), pattern.size()) - wtxt.data());
+      }, repetitions), txt.size());
+
+    report("search_backward", measure([&]()
+      {
+      sink = sink + (uint64_t)(search_backward(wtxt.data(), wtxt.data() + wtxt.size(), pattern.data(), pattern.size()) - wtxt.data());
+      }, repetitions), txt.size());
+
+    report("std::wstring::find", measure([&]()
+      {
+      sink = sink + wtxt.find(pattern);
+      }, repetitions), txt.size());
+    printf("\n");
+    }
+
+  uint64_t write_source_file(const std::string& filename, uint64_t size)
+    {
+    std::ofstream f(filename, std::ios::binary);
+    uint64_t bytes = 0;
+    std::string ln;
+    for (uint64_t line_nr = 0; bytes < size; ++line_nr)
+      {
+      ln = "\tif (value_" + std::to_string(line_nr) + " > limit)\t\treturn value_" + std::to_string(line_nr) + ";\n";
+      f << ln;
+      bytes += ln.size();
+      }
+    return bytes;
+    }
+
+  void bench_substitute(uint64_t size)
+    {
+    const int repetitions = 3;
+    const std::string filename("jedi.bench.substitute.txt");
+    const uint64_t bytes = write_source_file(filename, size);
+    printf("substitute (%llu bytes)\n", (unsigned long long)bytes);
+
+    env_settings s;
+    s.tab_space = 8;
+    s.show_all_characters = false;
+    s.perform_syntax_highlighting = true;
+    file_buffer fb = init_lexer_status(read_from_file(filename), s);
+
+    volatile uint64_t sink = 0;
+    const char* commands[] = { ", s/\\t/    /g", ", s/value_(\\d+)/v[\\1]/g", ", s2/\\t/ /g", ", x/\\t/ c/    /" };
+    for (const char* command : commands)
+      {
+      report(command, measure([&]()
+        {
+        sink = sink + handle_command(fb, command, s).content.size();
+        }, repetitions), bytes);
+      }
+    std::remove(filename.c_str());
+    printf("\n");
+    }
+  }
+
+int main(int /*argc*/, const char* /*argv*/[])
+  {
+  const uint64_t size = 64 * 1024 * 1024;
+  bench("ascii text", make_text(size, true));
+  bench("utf8 text", make_text(size, false));
+  bench_substitute(100 * 1024 * 1024);
+  return 0;
+  }
@@ -0,0 +1,1354 @@
+#include "buffer_tests.h"
+#include "../jedi/buffer.h"
+#include "../jedi/encoding.h"
+#include "../jedi/keyword_matcher.h"
+#include "../jedi/line_width_cache.h"
+#include "../jedi/look.h"
+#include "../jedi/lsp.h"
+#include "../jedi/match_set.h"
+#include "../jedi/offset_index.h"
+#include "../jedi/search.h"
+#include "../jedi/syntax_lexer.h"
+#include "../jedi/token_span_cache.h"
+#include "../jedi/trigram_index.h"
+#include "../jedi/utils.h"
+#include "test_assert.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include <json.hpp>
+
+namespace
+  {
+  std::wstring to_wide(text txt)
+    {
+    std::wstring wtxt;
+    for (const auto& ln : txt)
+      wtxt.append(ln.begin(), ln.end());
+    return wtxt;
+    }
+
+  /*
+  Applies the changes since version to follower, as a language server does with incremental changes.
+  */
+  bool follow_changes(std::wstring& follower, uint64_t& version, const file_buffer& fb)
+    {
+    std::vector<text_change> changes;
+    if (!get_changes_since(changes, fb, version))
+      return false;
+    auto offset = [&](position pos)
+      {
+      size_t off = 0;
+      for (int64_t r = 0; r < pos.row; ++r)
+        off = follower.find(L'\n', off) + 1;
+      return off + (size_t)pos.col;
+      };
+    for (const auto& c : changes)
+      {
+      const size_t first = offset(c.first);
+      follower.replace(first, offset(c.last) - first, c.txt);
+      }
+    version = fb.content_version;
+    return true;
+    }
+
+  /*
+  What the stub language server knows: the text of the open documents, and the methods it was sent.
+  */
+  struct stub_lsp_state
+    {
+    std::mutex mut;
+    std::map<std::string, std::wstring> documents;
+    std::vector<std::string> methods;
+    nlohmann::json last_position; // of the last completion or definition request
+    int incremental_changes = 0;
+    int full_changes = 0;
+    };
+
+  /*
+  A language server that runs inside the test, behind the transport that the client writes to and reads from.
+  */
+  class stub_lsp_transport : public lsp_transport
+    {
+    public:
+      stub_lsp_transport(std::shared_ptr<stub_lsp_state> state) : _state(state) {}
+
+      virtual bool write(const std::string& data) override
+        {
+        _reader.append(data);
+        std::string content;
+        while (_reader.next(content))
+          _handle(nlohmann::json::parse(content));
+        return true;
+        }
+
+      virtual std::string read(int timeout_ms) override
+        {
+          {
+          std::scoped_lock lock(_state->mut);
+          if (!_output.empty())
+            {
+            std::string output;
+            output.swap(_output);
+            return output;
+            }
+          }
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::min(timeout_ms, 1)));
+        return std::string();
+        }
+
+    private:
+      void _answer(const nlohmann::json& id, const nlohmann::json& result)
+        {
+        nlohmann::json j;
+        j["jsonrpc"] = "2.0";
+        j["id"] = id;
+        j["result"] = result;
+        _output.append(make_lsp_message(j.dump()));
+        }
+
+      size_t _offset(const std::wstring& txt, const nlohmann::json& pos)
+        {
+        size_t offset = 0;
+        for (int64_t line = 0; line < pos["line"].get<int64_t>(); ++line)
+          offset = txt.find(L'\n', offset) + 1;
+        return offset + pos["character"].get<size_t>();
+        }
+
+      void _handle(const nlohmann::json& j)
+        {
+        std::scoped_lock lock(_state->mut);
+        const std::string method = j["method"].get<std::string>();
+        _state->methods.push_back(method);
+        const nlohmann::json& params = j["params"];
+        if (method == "initialize")
+          {
+          nlohmann::json result;
+          result["capabilities"]["textDocumentSync"] = 2;
+          _answer(j["id"], result);
+          }
+        else if (method == "textDocument/didOpen")
+          {
+          const std::string uri = params["textDocument"]["uri"].get<std::string>();
+          _state->documents[uri] = decode(params["textDocument"]["text"].get<std::string>());
+          nlohmann::json diagnostic;
+          diagnostic["range"]["start"]["line"] = 1;
+          diagnostic["range"]["start"]["character"] = 2;
+          diagnostic["range"]["end"]["line"] = 1;
+          diagnostic["range"]["end"]["character"] = 3;
+          diagnostic["severity"] = 2;
+          diagnostic["message"] = "stub warning";
+          nlohmann::json notification;
+          notification["jsonrpc"] = "2.0";
+          notification["method"] = "textDocument/publishDiagnostics";
+          notification["params"]["uri"] = uri;
+          notification["params"]["diagnostics"] = nlohmann::json::array({ diagnostic });
+          _output.append(make_lsp_message(notification.dump()));
+          }
+        else if (method == "textDocument/didChange")
+          {
+          std::wstring& txt = _state->documents[params["textDocument"]["uri"].get<std::string>()];
+          for (const auto& change : params["contentChanges"])
+            {
+            if (change.find("range") == change.end())
+              {
+              ++_state->full_changes;
+              txt = decode(change["text"].get<std::string>());
+              continue;
+              }
+            ++_state->incremental_changes;
+            const size_t first = _offset(txt, change["range"]["start"]);
+            const size_t last = _offset(txt, change["range"]["end"]);
+            txt.replace(first, last - first, decode(change["text"].get<std::string>()));
+            }
+          }
+        else if (method == "textDocument/didClose")
+          _state->documents.erase(params["textDocument"]["uri"].get<std::string>());
+        else if (method == "textDocument/completion")
+          {
+          _state->last_position = params["position"];
+          nlohmann::json items = nlohmann::json::array();
+          items.push_back({ {"label", " alpha_item"} });
+          items.push_back({ {"label", "alphabet()"}, {"insertText", "alphabet"} });
+          items.push_back({ {"label", "alpha_item"} });
+          _answer(j["id"], { {"isIncomplete", false}, {"items", items} });
+          }
+        else if (method == "textDocument/definition")
+          {
+          _state->last_position = params["position"];
+          nlohmann::json location;
+          location["uri"] = params["textDocument"]["uri"];
+          location["range"]["start"]["line"] = 2;
+          location["range"]["start"]["character"] = 9;
+          location["range"]["end"] = location["range"]["start"];
+          _answer(j["id"], nlohmann::json::array({ location }));
+          }
+        else if (method == "shutdown")
+          _answer(j["id"], nullptr);
+        }
+
+    private:
+      std::shared_ptr<stub_lsp_state> _state;
+      lsp_message_reader _reader;
+      std::string _output; // guarded by the mutex of the state
+    };
+
+  template <class TPredicate>
+  bool wait_for(TPredicate done)
+    {
+    for (int i = 0; i < 5000; ++i)
+      {
+      if (done())
+        return true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    return done();
+    }
+  void write_binary_file(const std::string& filename, const std::string& content)
+    {
+    std::ofstream f(filename, std::ios::binary);
+    f << content;
+    f.close();
+    }
+  }
+
+void scan_encoding_test()
+  {
+  std::string txt("first\nsecond\n\nlast");
+  std::vector<uint64_t> offsets;
+  TEST_EQ(enc_ascii, scan_encoding(txt.data(), txt.size(), &offsets));
+  TEST_EQ(3, offsets.size());
+  TEST_EQ(6, offsets[0]);
+  TEST_EQ(13, offsets[1]);
+  TEST_EQ(14, offsets[2]);
+  std::string long_txt;
+  for (int i = 0; i < 20; ++i)
+    long_txt.append("0123456789\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\n");
+  offsets.clear();
+  TEST_EQ(enc_utf8, scan_encoding(long_txt.data(), long_txt.size(), &offsets));
+  TEST_EQ(20, offsets.size());
+  TEST_EQ(20, offsets[0]);
+  TEST_EQ(400, offsets.back());
+  std::wstring wtxt = decode(long_txt);
+  TEST_EQ(20 * 15, wtxt.size());
+  TEST_ASSERT(wtxt[10] == L'\x00e9');
+  TEST_ASSERT(wtxt[11] == L'\x20ac');
+  TEST_ASSERT(wtxt[12] == (wchar_t)0xD83D);
+  TEST_ASSERT(wtxt[13] == (wchar_t)0xDE00);
+  TEST_ASSERT(encode(wtxt) == long_txt);
+  long_txt[300] = '\xc3';
+  TEST_EQ(enc_ansi, scan_encoding(long_txt.data(), long_txt.size()));
+  TEST_ASSERT(!is_valid_utf8("\xed\xa0\x80", 3)); // surrogate
+  TEST_ASSERT(!is_valid_utf8("\xc0\xaf", 2)); // overlong
+  TEST_ASSERT(!is_valid_utf8("\xe2\x82", 2)); // truncated
+  TEST_ASSERT(is_ascii(txt.data(), txt.size()));
+  TEST_ASSERT(!is_ascii(long_txt.data(), long_txt.size()));
+  }
+
+void read_from_file_test()
+  {
+  std::string filename("jedi_buffer_test_1.txt");
+  write_binary_file(filename, "Hello\nW\xc3\xb6rld\n");
+  file_buffer fb = read_from_file(filename);
+  TEST_EQ(3, fb.content.size());
+  TEST_EQ(6, fb.content[0].size());
+  TEST_EQ(6, fb.content[1].size());
+  TEST_EQ(0, fb.content[2].size());
+  TEST_ASSERT(fb.content[1][1] == L'\x00f6');
+  TEST_ASSERT(to_string(fb.content) == std::string("Hello\nW\xc3\xb6rld\n"));
+  std::remove(filename.c_str());
+  }
+
+void read_from_file_empty_test()
+  {
+  std::string filename("jedi_buffer_test_2.txt");
+  write_binary_file(filename, "");
+  file_buffer fb = read_from_file(filename);
+  TEST_EQ(1, fb.content.size());
+  TEST_EQ(0, fb.content[0].size());
+  std::remove(filename.c_str());
+  }
+
+void read_from_file_invalid_utf8_test()
+  {
+  std::string filename("jedi_buffer_test_3.txt");
+  write_binary_file(filename, "abc\n\xe9t\xe9");
+  file_buffer fb = read_from_file(filename);
+  TEST_EQ(2, fb.content.size());
+  TEST_EQ(3, fb.content[1].size());
+  TEST_ASSERT(fb.content[1][0] == ascii_to_utf16(0xe9));
+  std::remove(filename.c_str());
+  }
+
+void read_from_file_parallel_test()
+  {
+  std::string filename("jedi_buffer_test_4.txt");
+  std::string content;
+  for (int i = 0; i < 300000; ++i)
+    content.append("line " + std::to_string(i) + "\n");
+  write_binary_file(filename, content);
+  file_buffer fb = read_from_file(filename);
+  TEST_EQ(300001, fb.content.size());
+  TEST_ASSERT(to_string(fb.content[123456]) == std::string("line 123456\n"));
+  TEST_ASSERT(to_string(fb.content) == content);
+  std::remove(filename.c_str());
+  }
+
+void read_from_file_mixed_encoding_test()
+  {
+  std::string filename("jedi_buffer_test_5.txt");
+  std::string content;
+  for (int i = 0; i < 300000; ++i)
+    content.append("r\xc3\xa9sum\xc3\xa9 " + std::to_string(i) + "\n");
+  content[1] = '\xe9'; // invalid utf8 in the first chunk only
+  write_binary_file(filename, content);
+  file_buffer fb = read_from_file(filename);
+  TEST_EQ(300001, fb.content.size());
+  TEST_ASSERT(fb.content[0][1] == ascii_to_utf16(0xe9));
+  TEST_ASSERT(fb.content[299999][1] == L'\x00e9');
+  std::remove(filename.c_str());
+  }
+
+void read_from_files_test()
+  {
+  std::vector<std::string> filenames;
+  for (int i = 0; i < 5; ++i)
+    {
+    filenames.push_back("jedi_buffer_test_files_" + std::to_string(i) + ".txt");
+    write_binary_file(filenames.back(), "file " + std::to_string(i));
+    }
+  auto buffers = read_from_files(filenames);
+  TEST_EQ(5, buffers.size());
+  for (int i = 0; i < 5; ++i)
+    {
+    TEST_ASSERT(buffers[i].name == filenames[i]);
+    TEST_ASSERT(to_string(buffers[i].content) == "file " + std::to_string(i));
+    std::remove(filenames[i].c_str());
+    }
+  }
+
+void save_to_file_test()
+  {
+  std::string filename("jedi_buffer_test_6.txt");
+  write_binary_file(filename, "old content");
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, std::string("r\xc3\xa9sum\xc3\xa9\nline 2\n"), s);
+  TEST_EQ(1, fb.modification_mask & 1);
+  bool success = false;
+  fb = save_to_file(success, fb, filename);
+  TEST_ASSERT(success);
+  TEST_EQ(0, fb.modification_mask);
+  file_buffer fb2 = read_from_file(filename);
+  TEST_ASSERT(to_string(fb2.content) == std::string("r\xc3\xa9sum\xc3\xa9\nline 2\n"));
+  std::remove(filename.c_str());
+
+  TEST_ASSERT(!write_to_file(fb.content, "this_folder_does_not_exist/jedi_buffer_test_7.txt"));
+  }
+
+void undo_coalesce_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  std::wstring txt(L"hello world");
+  for (auto ch : txt)
+    fb = insert(fb, std::wstring(1, ch), s);
+  TEST_EQ(2, fb.history.size());
+  fb = erase(fb, s);
+  fb = erase(fb, s);
+  TEST_EQ(3, fb.history.size());
+  TEST_ASSERT(to_string(fb.content) == std::string("hello wor"));
+  fb = undo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("hello world"));
+  fb = undo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("hello"));
+  fb = undo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string(""));
+  const auto history_size = fb.history.size();
+  fb = undo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string(""));
+  fb = redo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("hello"));
+  fb = redo(fb, s);
+  fb = redo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("hello wor"));
+  fb = redo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("hello wor"));
+  TEST_EQ(history_size, fb.history.size());
+  fb = undo(fb, s);
+  fb = undo(fb, s);
+  fb = insert(fb, std::wstring(L"!"), s); // starts a new branch in the undo tree
+  TEST_ASSERT(to_string(fb.content) == std::string("hello!"));
+  fb = redo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("hello!"));
+  fb = undo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("hello"));
+  }
+
+void undo_moved_cursor_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, std::wstring(L"a"), s);
+  fb = insert(fb, std::wstring(L"b"), s);
+  fb = move_left(fb, s);
+  fb = insert(fb, std::wstring(L"c"), s);
+  TEST_ASSERT(to_string(fb.content) == std::string("acb"));
+  fb = undo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("ab"));
+  fb = undo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string(""));
+  }
+
+void undo_tree_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, std::string("a\n"), s);
+  fb = insert(fb, std::string("b\n"), s);
+  fb = undo(fb, s);
+  fb = insert(fb, std::string("c\n"), s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a\nc\n"));
+  TEST_ASSERT(!can_redo(fb));
+  fb = undo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a\n"));
+  fb = redo(fb, s); // redo follows the last branch
+  TEST_ASSERT(to_string(fb.content) == std::string("a\nc\n"));
+  fb = undo_earlier(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a\nb\n")); // the abandoned branch is still there
+  fb = undo_earlier(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a\n"));
+  fb = redo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a\nb\n"));
+  fb = redo_later(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a\nc\n"));
+  fb = redo_later(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a\nc\n"));
+  }
+
+void undo_save_point_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, std::string("a\n"), s);
+  fb = insert(fb, std::string("b\n"), s);
+  fb = mark_saved(fb);
+  TEST_EQ(0, fb.modification_mask);
+  fb = undo(fb, s);
+  TEST_EQ(1, fb.modification_mask);
+  fb = redo(fb, s);
+  TEST_EQ(0, fb.modification_mask);
+  fb = undo(fb, s);
+  fb = undo(fb, s);
+  TEST_EQ(1, fb.modification_mask);
+  fb = mark_saved(fb);
+  fb = redo(fb, s);
+  TEST_EQ(1, fb.modification_mask);
+  fb = mark_modified(fb);
+  fb = undo(fb, s);
+  TEST_EQ(1, fb.modification_mask);
+  // typing right after saving is not coalesced into the saved text
+  fb = make_empty_buffer();
+  fb = insert(fb, std::wstring(L"a"), s);
+  fb = mark_saved(fb);
+  fb = insert(fb, std::wstring(L"b"), s);
+  TEST_EQ(1, fb.modification_mask);
+  fb = undo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a"));
+  TEST_EQ(0, fb.modification_mask);
+  fb = redo(fb, s);
+  TEST_ASSERT(to_string(fb.content) == std::string("ab"));
+  TEST_EQ(1, fb.modification_mask);
+  }
+
+void undo_memory_budget_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  for (int i = 0; i < 100; ++i)
+    fb = insert(fb, std::string("a line of text\n"), s);
+  TEST_EQ(100, fb.history.size());
+  const uint64_t used = history_memory_used(fb);
+  TEST_ASSERT(used > 0);
+  fb = trim_history(fb, used / 2);
+  TEST_ASSERT(history_memory_used(fb) <= used / 2);
+  TEST_ASSERT(fb.history.size() < 100);
+  fb = trim_history(fb, 0);
+  TEST_EQ(1, fb.history.size()); // the last change can still be undone
+  TEST_ASSERT(can_undo(fb));
+  fb = undo(fb, s);
+  TEST_EQ(100, fb.content.size());
+  TEST_ASSERT(!can_undo(fb));
+  fb = redo(fb, s);
+  TEST_EQ(101, fb.content.size());
+  // a state is charged for all the rows that were changed since its parent state
+  file_buffer bulk = make_empty_buffer();
+  std::string rows;
+  for (int i = 0; i < 1000; ++i)
+    rows.append("foo\n");
+  bulk = insert(bulk, rows, s);
+  bulk = replace_text(bulk, L"foo", L"bazz", true, s);
+  const uint64_t before = history_memory_used(bulk);
+  bulk = push_undo(bulk);
+  TEST_ASSERT(history_memory_used(bulk) - before > 1000 * 5 * sizeof(wchar_t));
+  }
+
+void line_width_index_test()
+  {
+  env_settings s;
+  s.tab_space = 4;
+  for (int show_all = 0; show_all < 2; ++show_all)
+    {
+    s.show_all_characters = show_all != 0;
+    std::wstring wtxt;
+    for (int i = 0; i < 300; ++i)
+      wtxt.push_back(i % 37 == 36 ? L'\t' : (wchar_t)(L'a' + i % 26));
+    wtxt.append(L"\r\n");
+    line ln;
+    for (auto ch : wtxt)
+      ln = ln.push_back(ch);
+    line_width_index widths(ln, s);
+    for (int64_t col = -1; col < (int64_t)ln.size() + 2; ++col)
+      TEST_EQ(line_length_up_to_column(ln, col, s), widths.line_length_up_to_column(col));
+    line_width_index widths2(ln, s); // query in the other direction
+    const int64_t total = line_length_up_to_column(ln, ln.size(), s);
+    for (int64_t length = total + 2; length >= -1; --length)
+      TEST_EQ(get_col_from_line_length(ln, length, s), widths2.get_col_from_line_length(length));
+    }
+  }
+
+void line_width_cache_test()
+  {
+  env_settings s;
+  s.tab_space = 4;
+  s.show_all_characters = false;
+  std::wstring wtxt;
+  for (int i = 0; i < 300; ++i)
+    wtxt.push_back(i % 37 == 36 ? L'\t' : (wchar_t)(L'a' + i % 26));
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, wtxt + L"\nshort\trow\n" + wtxt + L"\n", s);
+  line_width_cache cache(4);
+  for (int tab_space = 4; tab_space <= 8; tab_space += 4)
+    {
+    s.tab_space = tab_space;
+    for (int64_t row = 0; row < 3; ++row)
+      {
+      for (int64_t col = 0; col < (int64_t)fb.content[row].size(); col += 7)
+        TEST_EQ(line_length_up_to_column(fb.content[row], col, s), cache.line_length_up_to_column(fb, row, col, s));
+      for (int64_t length = 0; length < 400; length += 5)
+        TEST_EQ(get_col_from_line_length(fb.content[row], length, s), cache.get_col_from_line_length(fb, row, length, s));
+      }
+    }
+  TEST_EQ(2, cache.size()); // the equal long rows share an entry, the short row is not cached
+  // an edited row is measured again
+  fb.pos = position(2, 0);
+  fb = insert(fb, std::wstring(L"\t\t"), s);
+  TEST_EQ(line_length_up_to_column(fb.content[2], 200, s), cache.line_length_up_to_column(fb, 2, 200, s));
+  TEST_EQ(line_length_up_to_column(fb.content[2], 200, s), line_length_up_to_column(fb, 2, 200, s));
+  }
+
+void offset_index_test()
+  {
+  text txt = to_text(std::wstring(L"ab\n\u00e9\u20ac\nlast"));
+  offset_index index(txt);
+  TEST_EQ(10, index.size());
+  TEST_EQ(13, index.byte_size());
+  TEST_EQ(0, index.get_offset(position(0, 0)));
+  TEST_EQ(4, index.get_offset(position(1, 1)));
+  TEST_EQ(7, index.get_offset(position(2, 1)));
+  TEST_ASSERT(index.get_position(3) == position(1, 0));
+  TEST_ASSERT(index.get_position(7) == position(2, 1));
+  TEST_ASSERT(index.get_position(10) == position(2, 4));
+  TEST_ASSERT(index.get_position(100) == position(2, 4));
+  TEST_EQ(5, index.get_byte_offset(position(1, 1)));
+  TEST_EQ(9, index.get_byte_offset(position(2, 0)));
+  TEST_ASSERT(index.get_position_from_byte_offset(5) == position(1, 1));
+  TEST_ASSERT(index.get_position_from_byte_offset(6) == position(1, 1)); // inside the euro sign
+  TEST_ASSERT(index.get_position_from_byte_offset(9) == position(2, 0));
+  // walking gives the same positions as the index
+  for (int64_t from = 0; from <= index.size(); ++from)
+    {
+    for (int64_t distance = 0; distance <= index.size() + 1; ++distance)
+      {
+      position pos = index.get_position(from);
+      const bool inside = from + distance <= index.size();
+      TEST_EQ(inside, move_over_characters(pos, txt, distance, false));
+      TEST_ASSERT(pos == index.get_position(from + distance));
+      pos = index.get_position(from);
+      TEST_EQ(distance <= from, move_over_characters(pos, txt, distance, true));
+      if (distance <= from)
+        TEST_ASSERT(pos == index.get_position(from - distance));
+      }
+    }
+  // the index of a buffer is built once per version of its text
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, std::wstring(L"ab\ncd"), s);
+  auto first = get_offset_index(fb);
+  TEST_ASSERT(first == get_offset_index(fb));
+  TEST_ASSERT(get_offset_index(fb)->get_position(4) == position(1, 1));
+  fb = insert(fb, std::wstring(L"x"), s);
+  TEST_ASSERT(first != get_offset_index(fb));
+  TEST_EQ(6, get_offset_index(fb)->size());
+  }
+
+void replace_text_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, std::string("foo bar Foo\nbar foo\nfoo\n"), s);
+  const size_t undo_states = fb.history.size();
+  file_buffer fb2 = replace_text(fb, L"foo", L"x", true, s);
+  TEST_ASSERT(to_string(fb2.content) == std::string("x bar Foo\nbar x\nx\n"));
+  TEST_EQ(4, fb2.content.size());
+  TEST_EQ(fb2.content.size(), fb2.lex.size());
+  TEST_EQ(undo_states + 1, fb2.history.size());
+  TEST_ASSERT(fb2.pos == position(2, 1));
+  fb2 = undo(fb2, s);
+  TEST_ASSERT(to_string(fb2.content) == to_string(fb.content));
+  fb2 = replace_text(fb, L"FOO", L"a\nb", false, s);
+  TEST_ASSERT(to_string(fb2.content) == std::string("a\nb bar a\nb\nbar a\nb\na\nb\n"));
+  TEST_EQ(fb2.content.size(), fb2.lex.size());
+  fb2 = replace_text(fb, L"\nbar", L"", true, s);
+  TEST_ASSERT(to_string(fb2.content) == std::string("foo bar Foo foo\nfoo\n"));
+  TEST_EQ(3, fb2.content.size());
+  // only the occurrences that lie completely inside [first, last] are replaced
+  fb2 = replace_text(fb, L"foo", L"longer", true, position(0, 0), position(1, 5), s);
+  TEST_ASSERT(to_string(fb2.content) == std::string("longer bar Foo\nbar foo\nfoo\n"));
+  fb2 = replace_text(fb, L"foo", L"longer", true, position(0, 0), position(1, 6), s);
+  TEST_ASSERT(to_string(fb2.content) == std::string("longer bar Foo\nbar longer\nfoo\n"));
+  fb2 = replace_text(fb, L"nothing", L"x", true, s);
+  TEST_EQ(undo_states, fb2.history.size());
+  }
+
+void change_log_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, std::string("foo bar\nbaz\nlast"), s);
+  std::wstring follower = to_wide(fb.content);
+  uint64_t version = fb.content_version;
+  const std::wstring initial = follower;
+  const uint64_t initial_version = version;
+
+  fb.pos = position(0, 3);
+  fb = insert(fb, std::string("x\ny"), s);
+  TEST_ASSERT(follow_changes(follower, version, fb));
+  TEST_ASSERT(follower == to_wide(fb.content));
+  fb = erase(fb, s);
+  fb = erase(fb, s);
+  fb = erase(fb, s);
+  TEST_ASSERT(follow_changes(follower, version, fb));
+  TEST_ASSERT(follower == to_wide(fb.content));
+  fb.pos = position(0, 7);
+  fb = erase_right(fb, s);
+  fb.pos = position(1, 3);
+  fb = erase_right(fb, s);
+  TEST_ASSERT(follow_changes(follower, version, fb));
+  TEST_ASSERT(follower == to_wide(fb.content));
+  fb.start_selection = position(0, 1);
+  fb.pos = position(0, 5);
+  fb = erase(fb, s);
+  TEST_ASSERT(follow_changes(follower, version, fb));
+  TEST_ASSERT(follower == to_wide(fb.content));
+  fb = insert(fb, std::string("\nmore rows\nand more\n"), s);
+  fb.start_selection = position(0, 1);
+  fb.pos = position(2, 3);
+  fb = erase_right(fb, s);
+  TEST_ASSERT(follow_changes(follower, version, fb));
+  TEST_ASSERT(follower == to_wide(fb.content));
+  fb = replace_text(fb, L"e", L"E\n", true, s);
+  TEST_ASSERT(follow_changes(follower, version, fb));
+  TEST_ASSERT(follower == to_wide(fb.content));
+  TEST_ASSERT(follow_changes(follower, version, fb));
+
+  // a follower that lags behind applies all changes at once
+  std::wstring lagging = initial;
+  uint64_t lagging_version = initial_version;
+  TEST_ASSERT(follow_changes(lagging, lagging_version, fb));
+  TEST_ASSERT(lagging == to_wide(fb.content));
+
+  // undo is not logged, so the whole text has to be taken again
+  fb = undo(fb, s);
+  std::vector<text_change> changes;
+  TEST_ASSERT(!get_changes_since(changes, fb, version));
+  TEST_ASSERT(!get_changes_since(changes, fb, initial_version));
+  version = fb.content_version;
+  follower = to_wide(fb.content);
+  fb.pos = position(0, 0);
+  fb = insert(fb, std::string("y"), s);
+  TEST_ASSERT(follow_changes(follower, version, fb));
+  TEST_ASSERT(follower == to_wide(fb.content));
+  }
+
+void lsp_message_reader_test()
+  {
+  lsp_message_reader reader;
+  std::string content;
+  const std::string messages = make_lsp_message("{\"id\":1}") + make_lsp_message("{}");
+  TEST_EQ(std::string("Content-Length: 8\r\n\r\n{\"id\":1}"), messages.substr(0, 29));
+  reader.append(messages.substr(0, 10));
+  TEST_ASSERT(!reader.next(content));
+  reader.append(messages.substr(10, 20));
+  TEST_ASSERT(reader.next(content));
+  TEST_EQ(std::string("{\"id\":1}"), content);
+  TEST_ASSERT(!reader.next(content));
+  reader.append(messages.substr(30));
+  TEST_ASSERT(reader.next(content));
+  TEST_EQ(std::string("{}"), content);
+  }
+
+void lsp_client_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  auto server = std::make_shared<stub_lsp_state>();
+  std::atomic<int> notifications(0);
+  const std::string uri("file:///project/main.cpp");
+  auto server_text = [&]()
+    {
+    std::scoped_lock lock(server->mut);
+    return encode(server->documents[uri]);
+    };
+    {
+    lsp_client client(std::make_unique<stub_lsp_transport>(server), "/project", "cpp", [&]() { ++notifications; });
+    file_buffer fb = make_empty_buffer();
+    fb.name = "/project/main.cpp";
+    fb = insert(fb, std::string("int main()\n  {\n  return 0;\n  }\n"), s);
+    TEST_ASSERT(wait_for([&]() { return client.is_initialized(); }));
+    client.sync(fb);
+    TEST_ASSERT(wait_for([&]() { return server_text() == encode(to_wide(fb.content)); }));
+
+    fb.pos = position(2, 9);
+    fb = erase(fb, s);
+    fb = insert(fb, std::string("alp"), s);
+    client.sync(fb);
+    fb.start_selection = position(0, 0);
+    fb.pos = position(0, 2);
+    fb = insert(fb, std::string("long"), s);
+    fb.pos = position(1, 3);
+    fb = insert(fb, std::string("\n  // \xc3\xa9t\xc3\xa9\n"), s);
+    client.sync(fb);
+    TEST_ASSERT(wait_for([&]() { return server_text() == encode(to_wide(fb.content)); }));
+      {
+      std::scoped_lock lock(server->mut);
+      TEST_EQ(0, server->full_changes);
+      TEST_ASSERT(server->incremental_changes >= 5);
+      }
+
+    std::vector<lsp_result> results;
+    auto has_result = [&](e_lsp_result type)
+      {
+      for (const auto& r : client.take_results())
+        results.push_back(r);
+      return std::find_if(results.begin(), results.end(), [&](const lsp_result& r) { return r.type == type; }) != results.end();
+      };
+    const uint64_t completion = client.request_completion(fb, fb.pos);
+    TEST_ASSERT(completion != 0);
+    TEST_ASSERT(wait_for([&]() { return has_result(lsp_completion); }));
+    const uint64_t definition = client.request_definition(fb, fb.pos);
+    TEST_ASSERT(definition != 0 && definition != completion);
+    TEST_ASSERT(wait_for([&]() { return has_result(lsp_definition) && has_result(lsp_diagnostics); }));
+    for (const auto& r : results)
+      {
+      if (r.type == lsp_completion)
+        {
+        TEST_EQ(completion, r.request);
+        TEST_ASSERT(r.completions == std::vector<std::wstring>({ L"alpha_item", L"alphabet" }));
+        }
+      else if (r.type == lsp_definition)
+        {
+        TEST_EQ(definition, r.request);
+        TEST_EQ(1, r.locations.size());
+        TEST_ASSERT(r.locations.front().first.find("main.cpp") != std::string::npos);
+        TEST_ASSERT(r.locations.front().second == position(2, 9));
+        }
+      else
+        {
+        TEST_EQ(0, r.request);
+        TEST_ASSERT(r.filename.find("main.cpp") != std::string::npos);
+        TEST_EQ(1, r.diagnostics.size());
+        TEST_EQ(2, r.diagnostics.front().severity);
+        TEST_ASSERT(r.diagnostics.front().first == position(1, 2));
+        TEST_ASSERT(r.diagnostics.front().message == L"stub warning");
+        }
+      }
+    TEST_ASSERT(notifications > 0);
+
+    // columns are sent in utf16 code units, also where wchar_t holds a character outside the basic multilingual plane
+    std::wstring smiley = decode(std::string("\xf0\x9f\x98\x80"));
+    if (sizeof(wchar_t) == 4)
+      smiley = std::wstring(1, (wchar_t)0x1F600);
+    fb.pos = position(0, 0);
+    fb = insert(fb, smiley + L"x", s);
+    fb = insert(fb, std::wstring(L"y"), s);
+    client.sync(fb);
+    TEST_ASSERT(wait_for([&]() { return server_text() == encode(to_wide(fb.content)); }));
+    TEST_ASSERT(client.request_definition(fb, fb.pos) != 0);
+    TEST_ASSERT(wait_for([&]() { std::scoped_lock lock(server->mut); return server->last_position["character"] == 4; }));
+    TEST_EQ(4, column_to_utf16(fb.content[0], fb.pos.col));
+    TEST_EQ(fb.pos.col, utf16_to_column(fb.content[0], 4));
+
+    // an undo is not in the change log, so the whole text is sent
+    fb = undo(fb, s);
+    client.sync(fb);
+    TEST_ASSERT(wait_for([&]() { return server_text() == encode(to_wide(fb.content)); }));
+      {
+      std::scoped_lock lock(server->mut);
+      TEST_EQ(1, server->full_changes);
+      }
+
+    TEST_EQ(1, client.get_open_documents().size());
+    client.close(fb.name);
+    TEST_EQ(0, client.get_open_documents().size());
+    }
+  std::scoped_lock lock(server->mut);
+  TEST_ASSERT(server->documents.empty());
+  TEST_ASSERT(std::find(server->methods.begin(), server->methods.end(), "initialized") != server->methods.end());
+  TEST_ASSERT(server->methods.size() >= 2 && server->methods[server->methods.size() - 2] == "shutdown");
+  TEST_EQ(std::string("exit"), server->methods.back());
+  }
+
+void lexer_status_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  s.perform_syntax_highlighting = true;
+  file_buffer fb = make_empty_buffer();
+  syntax_definition sd;
+  sd.multiline_comment_begin.push_back(L"/*");
+  sd.multiline_comment_end.push_back(L"*/");
+  sd.single_line_comment.push_back(L"//");
+  fb.syntax.lexer = std::make_shared<const syntax_lexer>(sd);
+  fb.syntax.should_highlight = true;
+  fb.content = to_text(std::string("a /* b\nc\nd */ e\n// /*\nf /*\ng\n"));
+  file_buffer lexed = init_lexer_status(fb, s);
+  TEST_ASSERT(!lexed.lex_pending);
+  const std::vector<uint8_t> expected = { lexer_normal, lexer_inside_multiline_comment, lexer_inside_multiline_comment, lexer_normal, lexer_normal, lexer_inside_multiline_comment };
+  TEST_ASSERT(std::vector<uint8_t>(lexed.lex.begin(), lexed.lex.end()) == expected);
+  // the rows after the first ones are provisional until they are lexed
+  file_buffer provisional = init_lexer_status(fb, 2, s);
+  TEST_ASSERT(provisional.lex_pending);
+  TEST_EQ(fb.content.size(), provisional.lex.size());
+  TEST_EQ(lexer_inside_multiline_comment, provisional.lex[2]);
+  TEST_EQ(lexer_normal, provisional.lex[5]);
+  std::vector<uint8_t> status;
+  TEST_EQ(lexer_normal, lex_rows(status, provisional, 0, 4, lexer_normal));
+  TEST_ASSERT(status == std::vector<uint8_t>(expected.begin(), expected.begin() + 4));
+  TEST_EQ(lexer_inside_multiline_comment, lex_rows(status, provisional, 4, 6, provisional.lex[4]));
+  TEST_ASSERT(!init_lexer_status(fb, 5, s).lex_pending);
+  // edits in the lexed rows keep the rows after them lexed, other edits only keep the rows before them
+  TEST_EQ(3, get_lexed_rows(provisional));
+  file_buffer edited = provisional;
+  edited.pos = position(0, 0);
+  edited = insert(edited, std::string("new row\n"), s);
+  TEST_EQ(4, get_lexed_rows(edited));
+  edited = undo(edited, s);
+  TEST_EQ(0, get_lexed_rows(edited));
+  edited = provisional;
+  edited.pos = position(5, 0);
+  edited = insert(edited, std::string("x"), s);
+  TEST_EQ(3, get_lexed_rows(edited));
+  edited.pos = position(1, 0);
+  edited = insert(edited, std::string("/*"), s);
+  TEST_EQ(2, get_lexed_rows(edited));
+  // large ranges are lexed in parallel, with the same result
+  std::string big;
+  for (int i = 0; i < 100000; ++i)
+    big.append(i % 7 == 0 ? "x /* y\n" : i % 11 == 0 ? "y */ z // /*\n" : "z\n");
+  fb.content = to_text(big);
+  std::vector<uint8_t> row_by_row;
+  uint8_t st = lexer_normal;
+  for (int64_t row = 0; row < (int64_t)fb.content.size(); ++row)
+    {
+    std::vector<uint8_t> single;
+    st = lex_rows(single, fb, row, row + 1, st);
+    row_by_row.push_back(single[0]);
+    }
+  TEST_EQ(st, lex_rows(status, fb, 0, (int64_t)fb.content.size(), lexer_normal));
+  TEST_ASSERT(status == row_by_row);
+  lexed = init_lexer_status(fb, s);
+  TEST_ASSERT(std::vector<uint8_t>(lexed.lex.begin(), lexed.lex.end()) == row_by_row);
+  }
+
+void keyword_matcher_test()
+  {
+  keyword_matcher km({ L"if", L"int", L"for", L"set!", L"<=" }, { L"int", L"int64_t", L"\u00e9t\u00e9" });
+  TEST_ASSERT(!km.empty());
+  TEST_ASSERT(keyword_matcher().empty());
+  line ln = to_text(std::wstring(L"int64_t x; if(a) int i; set! \u00e9t\u00e9 fo <= i"))[0];
+  auto it = ln.begin();
+  std::vector<std::pair<std::wstring, uint8_t>> words;
+  while (it != ln.end())
+    {
+    uint8_t type;
+    const int64_t length = km.match(type, it, ln.end());
+    TEST_EQ(read_next_word(it, ln.end()).size(), (size_t)length);
+    if (length > 0)
+      words.emplace_back(std::wstring(it, it + length), type);
+    it += length > 0 ? length : 1;
+    }
+  const std::vector<std::pair<std::wstring, uint8_t>> expected = { {L"int64_t", 2}, {L"x;", 0}, {L"if", 1}, {L"a", 0}, {L"int", 1}, {L"i;", 0}, {L"set!", 1}, {L"\u00e9t\u00e9", 2}, {L"fo", 0}, {L"=", 0}, {L"i", 0} };
+  TEST_ASSERT(words == expected);
+  }
+
+void token_span_cache_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  s.perform_syntax_highlighting = true;
+  keyword_matcher km({ L"if" }, { L"int" });
+  file_buffer fb = make_empty_buffer();
+  syntax_definition sd;
+  sd.multiline_comment_begin.push_back(L"/*");
+  sd.multiline_comment_end.push_back(L"*/");
+  sd.single_line_comment.push_back(L"//");
+  fb.syntax.lexer = std::make_shared<const syntax_lexer>(sd);
+  fb.syntax.should_highlight = true;
+  fb = insert(fb, std::string("int x; // if\nif \"int\" /* c\nd */ int\n"), s);
+  fb = init_lexer_status(fb, s);
+  token_span_cache cache(3);
+  TEST_ASSERT(cache.get(fb, 0, km, s) == token_spans({ {0, tt_keyword_2}, {3, tt_normal}, {7, tt_comment} }));
+  TEST_ASSERT(cache.get(fb, 1, km, s) == token_spans({ {0, tt_keyword_1}, {2, tt_normal}, {3, tt_string}, {8, tt_normal}, {9, tt_comment} }));
+  TEST_ASSERT(cache.get(fb, 2, km, s) == token_spans({ {0, tt_comment}, {4, tt_normal}, {5, tt_keyword_2}, {8, tt_normal} }));
+  TEST_EQ(3, cache.size());
+  // rows that were not edited are found again, also when they moved
+  fb.pos = position(0, 0);
+  fb = insert(fb, std::string("\n"), s);
+  const token_spans* row = &cache.get(fb, 1, km, s);
+  TEST_EQ(3, cache.size());
+  TEST_ASSERT(row == &cache.get(fb, 1, km, s));
+  TEST_ASSERT(cache.get(fb, 0, km, s) == token_spans({ {0, tt_normal} }));
+  TEST_EQ(3, cache.size());
+  // a row that starts inside a comment has other spans
+  fb = insert(fb, std::string("/*"), s);
+  TEST_ASSERT(cache.get(fb, 2, km, s) == token_spans({ {0, tt_comment} }));
+  TEST_EQ(3, cache.size());
+  }
+
+void syntax_lexer_test()
+  {
+  syntax_definition sd;
+  sd.multiline_comment_begin = { L"/*", L"(*" };
+  sd.multiline_comment_end = { L"*/", L"*)" };
+  sd.multiline_string_begin.push_back(L"R\"(");
+  sd.multiline_string_end.push_back(L")\"");
+  sd.single_line_comment.push_back(L"//");
+  sd.raw_string_prefix.push_back(L"r");
+  sd.preprocessor = L"#";
+  sd.uses_quotes_for_chars = true;
+  sd.nested_comments = true;
+  sd.numbers = true;
+  syntax_lexer lexer(sd);
+  const uint8_t first_comment = 1, second_comment = first_comment + 8, multiline_string = second_comment + 8;
+  TEST_EQ(multiline_string + 1, lexer.number_of_statuses());
+  TEST_EQ(tt_comment, lexer.get_text_type(second_comment + 1));
+  TEST_EQ(tt_string, lexer.get_text_type(multiline_string));
+  token_spans spans;
+  // comments nest, each pair of delimiters only with itself
+  TEST_EQ(second_comment, lexer.lex(to_text(std::wstring(L"x (* a (* b */ *) c"))[0], lexer_normal, &spans));
+  TEST_ASSERT(spans == token_spans({ {0, tt_normal}, {2, tt_comment} }));
+  TEST_EQ(lexer_normal, lexer.lex(to_text(std::wstring(L"d *) y"))[0], second_comment, &spans));
+  TEST_ASSERT(spans == token_spans({ {0, tt_comment}, {4, tt_normal} }));
+  // a preprocessor row keeps its comments
+  TEST_EQ(lexer_normal, lexer.lex(to_text(std::wstring(L"  #include \"a.h\" // c"))[0], lexer_normal, &spans));
+  TEST_ASSERT(spans == token_spans({ {0, tt_preprocessor}, {17, tt_comment} }));
+  // numbers, and strings with and without escapes
+  TEST_EQ(lexer_normal, lexer.lex(to_text(std::wstring(L"x = 0x1F + 1.5e-3; s = r\"\\\" + \"a\\\"b\"; a1"))[0], lexer_normal, &spans));
+  TEST_ASSERT(spans == token_spans({ {0, tt_normal}, {4, tt_number}, {8, tt_normal}, {11, tt_number}, {17, tt_normal}, {23, tt_string}, {27, tt_normal}, {30, tt_string}, {36, tt_normal} }));
+  TEST_EQ(multiline_string, lexer.lex(to_text(std::wstring(L"R\"(abc"))[0], lexer_normal));
+  TEST_EQ(lexer_normal, lexer.lex(to_text(std::wstring(L")\" 'c'"))[0], multiline_string, &spans));
+  TEST_ASSERT(spans == token_spans({ {0, tt_string}, {2, tt_normal}, {3, tt_string}, {6, tt_normal} }));
+  // ranges of rows are lexed in parallel for any number of statuses
+  file_buffer fb = make_empty_buffer();
+  fb.syntax.lexer = std::make_shared<const syntax_lexer>(sd);
+  fb.syntax.should_highlight = true;
+  std::string big;
+  for (int i = 0; i < 100000; ++i)
+    big.append(i % 7 == 0 ? "x (* y\n" : i % 11 == 0 ? "y *) z /* (*\n" : i % 13 == 0 ? "*/ R\"( // \n" : i % 17 == 0 ? ")\" w\n" : "z\n");
+  fb.content = to_text(big);
+  std::vector<uint8_t> row_by_row, status;
+  uint8_t st = lexer_normal;
+  for (int64_t row = 0; row < (int64_t)fb.content.size(); ++row)
+    {
+    row_by_row.push_back(st);
+    st = lexer.lex(fb.content[row], st);
+    }
+  TEST_EQ(st, lex_rows(status, fb, 0, (int64_t)fb.content.size(), lexer_normal));
+  TEST_ASSERT(status == row_by_row);
+  // a nested comment over several ranges never agrees with lexer_normal, so its rows are lexed when it is reached
+  big = "(* (*\n";
+  for (int i = 0; i < 50000; ++i)
+    big.append(i == 40000 ? "*) *)\n" : "z\n");
+  fb.content = to_text(big);
+  row_by_row.clear();
+  st = lexer_normal;
+  for (int64_t row = 0; row < (int64_t)fb.content.size(); ++row)
+    {
+    row_by_row.push_back(st);
+    st = lexer.lex(fb.content[row], st);
+    }
+  TEST_EQ(st, lex_rows(status, fb, 0, (int64_t)fb.content.size(), lexer_normal));
+  TEST_ASSERT(status == row_by_row);
+  }
+
+void search_kernel_test()
+  {
+  std::wstring hay;
+  for (int i = 0; i < 1000; ++i)
+    hay.push_back((wchar_t)(L'a' + (i * 7 + i / 13) % 5));
+  const wchar_t* first = hay.data();
+  const wchar_t* last = hay.data() + hay.size();
+  for (size_t length = 1; length < 40; length += 3)
+    {
+    for (size_t start = 0; start + length <= hay.size(); start += 97)
+      {
+      std::wstring pattern = hay.substr(start, length);
+      TEST_EQ(hay.find(pattern), (size_t)(search_forward(first, last, pattern.data(), length) - first));
+      TEST_EQ(hay.rfind(pattern), (size_t)(search_backward(first, last, pattern.data(), length) - first));
+      }
+    }
+  std::wstring absent(L"ccccc");
+  TEST_ASSERT(search_forward(first, last, absent.data(), absent.size()) == last);
+  TEST_ASSERT(search_backward(first, last, absent.data(), absent.size()) == last);
+  }
+
+void find_text_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  std::string content;
+  for (int i = 0; i < 20000; ++i)
+    content.append("line " + std::to_string(i) + "\n");
+  fb = insert(fb, content, s);
+  fb.pos = position(0, 0);
+  fb = find_text(fb, std::string("9999\nline 10000"));
+  TEST_ASSERT(*fb.start_selection == position(9999, 5));
+  TEST_ASSERT(fb.pos == position(10000, 9));
+  fb = find_text(fb, std::string("line 19999"));
+  TEST_ASSERT(*fb.start_selection == position(19999, 0));
+  fb = find_text(fb, std::string("line 1999\n"));
+  TEST_ASSERT(fb.pos == get_last_position(fb)); // there is no wrap around
+  fb = find_text(fb, std::string("line 1999\n"));
+  TEST_ASSERT(*fb.start_selection == position(1999, 0));
+  TEST_ASSERT(find_next_occurence(fb.content, position(0, 0), L"ne 123\n") == position(123, 2));
+  TEST_ASSERT(find_next_occurence_reverse(fb.content, position(18000, 0), L"line 123") == position(12399, 0));
+  TEST_ASSERT(find_next_occurence_reverse(fb.content, position(123, 2), L"line 123") == position(123, 0));
+  TEST_ASSERT(find_next_occurence_reverse(fb.content, position(123, 0), L"line 123") == position(-1, -1));
+  fb = make_empty_buffer();
+  fb = insert(fb, std::string("aab"), s);
+  fb.pos = position(0, 0);
+  fb = find_text(fb, std::string("ab"));
+  TEST_ASSERT(*fb.start_selection == position(0, 1));
+  }
+
+void fold_case_test()
+  {
+  TEST_ASSERT(fold_case(L'A') == L'a');
+  TEST_ASSERT(fold_case(L'z') == L'z');
+  TEST_ASSERT(fold_case(L'@') == L'@');
+  TEST_ASSERT(fold_case(L'\u00c9') == L'\u00e9');
+  TEST_ASSERT(fold_case(L'\u00d7') == L'\u00d7'); // multiplication sign
+  TEST_ASSERT(fold_case(L'\u0178') == L'\u00ff');
+  TEST_ASSERT(fold_case(L'\u0141') == L'\u0142');
+  TEST_ASSERT(fold_case(L'\u03a3') == L'\u03c3');
+  TEST_ASSERT(fold_case(L'\u03c2') == L'\u03c3');
+  TEST_ASSERT(fold_case(L'\u0416') == L'\u0436');
+  TEST_ASSERT(fold_case(L'\u0401') == L'\u0451');
+  TEST_ASSERT(fold_case(L'\uff21') == L'\uff41');
+  std::wstring wtxt(L"Hello W\u00d6RLD, THIS IS A LONGER LINE WITH \u0394\u0395\u039b\u03a4\u0391 AND Mixed Case.");
+  std::wstring folded(wtxt);
+  fold_case(&folded[0], &folded[0] + folded.size());
+  for (size_t i = 0; i < wtxt.size(); ++i)
+    TEST_ASSERT(folded[i] == fold_case(wtxt[i]));
+  TEST_ASSERT(folded.substr(0, 11) == std::wstring(L"hello w\u00f6rld"));
+  }
+
+void find_text_case_insensitive_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  std::string content;
+  for (int i = 0; i < 20000; ++i)
+    content.append("Line " + std::to_string(i) + (i == 15000 ? " \xc3\x89t\xc3\xa9 \xce\xa3\xce\xbf\xcf\x86\xce\xaf\xce\xb1\n" : "\n"));
+  fb = insert(fb, content, s);
+  fb.pos = position(0, 0);
+  fb = find_text_case_insensitive(fb, std::string("lINE 9999\nline 10000"));
+  TEST_ASSERT(*fb.start_selection == position(9999, 0));
+  TEST_ASSERT(fb.pos == position(10000, 9));
+  fb = find_text_case_insensitive(fb, std::wstring(L"\u00e9T\u00c9 \u03c3\u039f\u03a6\u038a\u0391"));
+  TEST_ASSERT(*fb.start_selection == position(15000, 11));
+  fb = find_text(fb, std::wstring(L"\u00e9T\u00c9"));
+  TEST_ASSERT(fb.pos == get_last_position(fb));
+  fb = make_empty_buffer();
+  fb = insert(fb, std::string("aAb"), s);
+  fb.pos = position(0, 0);
+  fb = find_text_case_insensitive(fb, std::string("AB"));
+  TEST_ASSERT(*fb.start_selection == position(0, 1));
+  }
+
+void trigram_index_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  std::string content;
+  for (int i = 0; i < 1000; ++i)
+    content.append("entry " + std::to_string(i) + (i % 100 == 42 ? " Needle" : "") + "\n");
+  fb = insert(fb, content, s);
+  std::vector<std::pair<int64_t, int64_t>> ranges;
+  TEST_ASSERT(!get_candidate_rows(ranges, fb, L"needle"));
+  fb.trigrams = std::make_shared<const trigram_index>(fb.content, fb.content_version, 1 << 20);
+  TEST_EQ(1, fb.trigrams->rows_per_group());
+  TEST_ASSERT(!get_candidate_rows(ranges, fb, L"ne"));
+  TEST_ASSERT(!get_candidate_rows(ranges, fb, L"needle\nentry"));
+  TEST_ASSERT(get_candidate_rows(ranges, fb, L"NEEDLE"));
+  int64_t nr_of_candidates = 0;
+  for (const auto& r : ranges)
+    nr_of_candidates += r.second - r.first;
+  TEST_ASSERT(nr_of_candidates >= 10 && nr_of_candidates < 100);
+  for (int i = 42; i < 1000; i += 100)
+    TEST_ASSERT(std::any_of(ranges.begin(), ranges.end(), [&](const std::pair<int64_t, int64_t>& r) { return r.first <= i && i < r.second; }));
+  fb.pos = position(500, 0);
+  fb = find_text_case_insensitive(fb, std::string("needle"));
+  TEST_ASSERT(*fb.start_selection == position(542, 10));
+
+  // after an edit the index is not used, until it is updated
+  fb.pos = position(700, 0);
+  fb.start_selection = std::nullopt;
+  fb = insert(fb, std::string("needle\n"), s);
+  TEST_ASSERT(!get_candidate_rows(ranges, fb, L"needle"));
+  fb.trigrams = std::make_shared<const trigram_index>(*fb.trigrams, fb.content, fb.content_version, 1 << 20);
+  TEST_ASSERT(get_candidate_rows(ranges, fb, L"needle"));
+  std::vector<std::pair<int64_t, int64_t>> full_ranges;
+  trigram_index full(fb.content, fb.content_version, 1 << 20);
+  TEST_ASSERT(full.get_candidate_rows(full_ranges, L"needle"));
+  TEST_ASSERT(ranges == full_ranges);
+  fb.pos = position(600, 0);
+  fb.start_selection = std::nullopt;
+  fb = find_text(fb, std::string("needle"));
+  TEST_ASSERT(*fb.start_selection == position(700, 0));
+  fb = undo(fb, s);
+  TEST_ASSERT(!get_candidate_rows(ranges, fb, L"needle"));
+
+  // a small budget groups rows
+  trigram_index small(fb.content, fb.content_version, 1024);
+  TEST_ASSERT(small.rows_per_group() > 1);
+  TEST_ASSERT(small.memory_used() <= 1024);
+  TEST_ASSERT(small.get_candidate_rows(ranges, L"Needle"));
+  for (int i = 42; i < 1000; i += 100)
+    TEST_ASSERT(std::any_of(ranges.begin(), ranges.end(), [&](const std::pair<int64_t, int64_t>& r) { return r.first <= i && i < r.second; }));
+
+  // the signatures of long rows grow with the rows, so they do not match every pattern
+  file_buffer long_rows = make_empty_buffer();
+  content.clear();
+  for (int i = 0; i < 100; ++i)
+    {
+    for (int j = 0; j < 1000; ++j)
+      content.append(std::to_string(i * 7919 + j * 104729) + " ");
+    content.append(i == 42 ? "needle\n" : "\n");
+    }
+  long_rows = insert(long_rows, content, s);
+  trigram_index long_index(long_rows.content, long_rows.content_version, 1 << 20);
+  TEST_ASSERT(long_index.get_candidate_rows(ranges, L"needle"));
+  TEST_ASSERT(std::any_of(ranges.begin(), ranges.end(), [&](const std::pair<int64_t, int64_t>& r) { return r.first <= 42 && 42 < r.second; }));
+  nr_of_candidates = 0;
+  for (const auto& r : ranges)
+    nr_of_candidates += r.second - r.first;
+  TEST_ASSERT(nr_of_candidates < 5);
+  }
+
+void match_set_test()
+  {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  std::string content;
+  for (int i = 0; i < 10000; ++i)
+    content.append("entry " + std::to_string(i) + (i % 1000 == 7 ? " Needle needle" : "") + "\n");
+  fb = insert(fb, content, s);
+  TEST_ASSERT(get_match_set(fb) == nullptr);
+  fb.matches = std::make_shared<const match_set>(fb.content, fb.content_version, L"NEEDLE", false);
+  TEST_ASSERT(get_match_set(fb) == fb.matches.get());
+  TEST_EQ(20, fb.matches->size());
+  TEST_EQ(2, fb.matches->count(0, 1000));
+  TEST_EQ(0, fb.matches->count(8, 1007));
+  std::vector<int64_t> columns;
+  fb.matches->get_matches(columns, 3007);
+  TEST_ASSERT(columns == std::vector<int64_t>({ 11, 18 }));
+  TEST_EQ(0, match_set(fb.content, fb.content_version, L"NEEDLE", true).size());
+  TEST_EQ(0, match_set(fb.content, fb.content_version, L"needle\nentry", false).size());
+
+  // after an edit only the edited rows are searched again, the result equals a full search
+  fb.pos = position(5000, 0);
+  fb = insert(fb, std::string("needle\nneedle and needle\n"), s);
+  TEST_ASSERT(get_match_set(fb) == nullptr);
+  fb.matches = std::make_shared<const match_set>(*fb.matches, fb.content, fb.content_version);
+  TEST_EQ(23, fb.matches->size());
+  match_set full(fb.content, fb.content_version, L"NEEDLE", false);
+  for (int64_t row = 0; row < (int64_t)fb.content.size(); ++row)
+    {
+    std::vector<int64_t> full_columns;
+    full.get_matches(full_columns, row);
+    fb.matches->get_matches(columns, row);
+    TEST_ASSERT(columns == full_columns);
+    }
+  fb.matches->get_matches(columns, 9009);
+  TEST_ASSERT(columns == std::vector<int64_t>({ 11, 18 }));
+  fb = undo(fb, s);
+  fb.matches = std::make_shared<const match_set>(*fb.matches, fb.content, fb.content_version);
+  TEST_EQ(20, fb.matches->size());
+  TEST_EQ(2, fb.matches->count(9007, 9008));
+  TEST_EQ(2, fb.matches->count_before(position(1007, 11)));
+  TEST_EQ(3, fb.matches->count_before(position(1007, 12)));
+
+  // the edited rows can be taken from the change log instead of comparing the texts
+  const uint64_t version = fb.content_version;
+  fb.pos = position(3007, 0);
+  fb = erase_right(fb, s);
+  fb.pos = position(100, 3);
+  fb = insert(fb, std::string("needle\n"), s);
+  int64_t equal_prefix, equal_suffix;
+  TEST_ASSERT(get_equal_rows(equal_prefix, equal_suffix, fb, version));
+  TEST_EQ(100, equal_prefix);
+  TEST_EQ((int64_t)fb.content.size() - 3009, equal_suffix);
+  fb.matches = std::make_shared<const match_set>(*fb.matches, fb.content, fb.content_version, equal_prefix, equal_suffix);
+  TEST_EQ(21, fb.matches->size());
+  TEST_EQ(match_set(fb.content, fb.content_version, L"NEEDLE", false).count_before(position(3008, 12)), fb.matches->count_before(position(3008, 12)));
+  fb = undo(fb, s);
+  TEST_ASSERT(!get_equal_rows(equal_prefix, equal_suffix, fb, version));
+  }
+
+void match_set_narrow_test()
+  {
+  text txt = to_text(std::string("aaab aab\nabab ababab\nxAAB\n"));
+  const std::vector<std::wstring> patterns = { L"a", L"aa", L"aab", L"ab", L"aba", L"abab", L"b" };
+  for (bool case_sensitive : { true, false })
+    {
+    for (const auto& prefix : patterns)
+      {
+      match_set prefix_set(txt, 1, prefix, case_sensitive);
+      for (const auto& pattern : patterns)
+        {
+        if (pattern.compare(0, prefix.size(), prefix) != 0)
+          continue;
+        match_set narrowed(prefix_set, pattern);
+        match_set full(txt, 1, pattern, case_sensitive);
+        TEST_EQ(full.size(), narrowed.size());
+        for (int64_t row = 0; row < (int64_t)txt.size(); ++row)
+          {
+          std::vector<int64_t> full_columns, narrowed_columns;
+          full.get_matches(full_columns, row);
+          narrowed.get_matches(narrowed_columns, row);
+          TEST_ASSERT(full_columns == narrowed_columns);
+          }
+        }
+      }
+    }
+  TEST_EQ(3, match_set(match_set(txt, 1, L"a", false), L"aab").size());
+  }
+
+void look_test()
+  {
+  std::vector<look_snapshot> snapshots;
+  snapshots.push_back(look_snapshot{ "a.cpp", to_text(std::string("int main()\n  {\n  return Main();\n  }\n")) });
+  snapshots.push_back(look_snapshot{ "b.txt", to_text(std::string("nothing here\n")) });
+  std::string big;
+  for (int i = 0; i < 40000; ++i)
+    big.append(i % 10000 == 5 ? "the main road\n" : "a side street\n");
+  snapshots.push_back(look_snapshot{ "c.txt", to_text(big) });
+  std::vector<std::string> results(snapshots.size());
+  std::vector<uint64_t> counts(snapshots.size(), 0);
+  std::vector<int> calls(snapshots.size(), 0);
+  std::mutex mut;
+  look(snapshots, L"MAIN", false, [&](size_t index, const std::string& lines, uint64_t nr_of_lines)
+    {
+    std::scoped_lock lock(mut);
+    results[index] = lines;
+    counts[index] = nr_of_lines;
+    ++calls[index];
+    });
+  TEST_ASSERT(calls == std::vector<int>({ 1, 1, 1 }));
+  TEST_EQ(std::string("a.cpp:1: int main()\na.cpp:3:   return Main();\n"), results[0]);
+  TEST_EQ(2, counts[0]);
+  TEST_EQ(std::string(), results[1]);
+  TEST_EQ(0, counts[1]);
+  TEST_EQ(std::string("c.txt:6: the main road\nc.txt:10006: the main road\nc.txt:20006: the main road\nc.txt:30006: the main road\n"), results[2]);
+  TEST_EQ(4, counts[2]);
+
+  look(snapshots, L"Main", true, [&](size_t index, const std::string& lines, uint64_t)
+    {
+    std::scoped_lock lock(mut);
+    results[index] = lines;
+    });
+  TEST_EQ(std::string("a.cpp:3:   return Main();\n"), results[0]);
+  TEST_EQ(std::string(), results[2]);
+  }
+
+void run_all_buffer_tests()
+  {
+  scan_encoding_test();
+  read_from_file_test();
+  read_from_file_empty_test();
+  read_from_file_invalid_utf8_test();
+  read_from_file_parallel_test();
+  read_from_file_mixed_encoding_test();
+  read_from_files_test();
+  save_to_file_test();
+  undo_coalesce_test();
+  undo_moved_cursor_test();
+  undo_tree_test();
+  undo_save_point_test();
+  undo_memory_budget_test();
+  line_width_index_test();
+  line_width_cache_test();
+  offset_index_test();
+  replace_text_test();
+  change_log_test();
+  lsp_message_reader_test();
+  lsp_client_test();
+  lexer_status_test();
+  keyword_matcher_test();
+  token_span_cache_test();
+  syntax_lexer_test();
+  search_kernel_test();
+  find_text_test();
+  fold_case_test();
+  find_text_case_insensitive_test();
+  trigram_index_test();
+  match_set_test();
+  match_set_narrow_test();
+  look_test();
+  }
@@ -1,6 +1,8 @@
 #include "edit_tests.h"
 
 #include "../jedi/edit.h"
+#include "../jedi/text_regex.h"
+#include "../jedi/trigram_index.h"
 
 #include "test_assert.h"
 
@@ -319,6 +321,190 @@ void handle_command_test_16() {
   printf("%s\n", to_string(fb.content).c_str());
   }
 
+void handle_command_test_17() {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  std::string content;
+  for (int i = 0; i < 500; ++i)
+    content.append("row " + std::to_string(i) + (i % 50 == 7 ? " found it\n" : "\n"));
+  fb = insert(fb, content, s);
+  file_buffer indexed = fb;
+  indexed.trigrams = std::make_shared<const trigram_index>(fb.content, fb.content_version, 1 << 20);
+  const std::string commands[] = { "/fo+und? it/", "/fo+und? it/", "/(row|found) it$/", "-/[f]ound it/", "-/found it/", "/row 49/" };
+  for (const auto& cmd : commands) {
+    fb = handle_command(fb, cmd, s);
+    indexed = handle_command(indexed, cmd, s);
+    TEST_ASSERT(fb.pos == indexed.pos);
+    TEST_ASSERT(fb.start_selection == indexed.start_selection);
+  }
+  TEST_ASSERT(fb.pos != position(0, 0));
+}
+
+void handle_command_test_18() {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = handle_command(fb, "a/hyphen-\nated text\nsecond line-\nbreak/", s);
+  fb = handle_command(fb, ", x/-\\n/ d", s); // matches span rows
+  TEST_ASSERT(to_string(fb.content) == std::string("hyphenated text\nsecond linebreak"));
+  fb = handle_command(fb, ", x/(hyphen|line)\\B/ d", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("ated text\nsecond break"));
+  std::string error;
+  try {
+    fb = handle_command(fb, "/(T/", s);
+  } catch (std::runtime_error e) {
+    error = std::string(e.what());
+  }
+  TEST_ASSERT(error == std::string("Invalid regular expression: unmatched ("));
+}
+
+void handle_command_test_19() {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, "The quick brown fox\njumps over the lazy dog\n", s);
+  fb = handle_command(fb, ", x/o/ c/0/", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("The quick br0wn f0x\njumps 0ver the lazy d0g\n"));
+  fb = handle_command(fb, ", x/[a-z]+/ g/u/ a/!/", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("The quick! br0wn f0x\njumps! 0ver the lazy d0g\n"));
+  fb = handle_command(fb, ", x/\\w+!/ i/[/", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("The [quick! br0wn f0x\n[jumps! 0ver the lazy d0g\n"));
+  fb = handle_command(fb, "u", s); // all changes of a loop are undone together
+  TEST_ASSERT(to_string(fb.content) == std::string("The quick! br0wn f0x\njumps! 0ver the lazy d0g\n"));
+  fb = handle_command(fb, ", x/.*\\n/ x/0/ d", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("The quick! brwn fx\njumps! ver the lazy dg\n"));
+
+  std::string many;
+  for (int i = 0; i < 10000; ++i)
+    many.append("foo bar foo\n");
+  fb = make_empty_buffer();
+  fb = insert(fb, many, s);
+  fb = handle_command(fb, ", x/foo/ c/baz/", s);
+  TEST_ASSERT(fb.content.size() == 10001);
+  TEST_ASSERT(to_string(fb.content[0]) == std::string("baz bar baz\n"));
+  TEST_ASSERT(to_string(fb.content[9999]) == std::string("baz bar baz\n"));
+  fb = handle_command(fb, "u", s);
+  TEST_ASSERT(to_string(fb.content) == many);
+}
+
+void handle_command_test_20() {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, "a\tb\tc\nd\te\n", s);
+  fb = handle_command(fb, ", s/\\t/    /g", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a    b    c\nd    e\n"));
+  fb = handle_command(fb, "u", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a\tb\tc\nd\te\n"));
+  fb = handle_command(fb, ", s2/\\t/-/", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a\tb-c\nd\te\n"));
+  fb = handle_command(fb, ", s2/\\t/\\n/g", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("a\tb-c\nd\ne\n"));
+
+  fb = make_empty_buffer();
+  fb = insert(fb, "name = value\nkey = 42\n", s);
+  fb = handle_command(fb, ", s/(\\w+) = (\\w+)/\\2: \\1 (\\0)/g", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("value: name (name = value)\n42: key (key = 42)\n"));
+  fb = handle_command(fb, ", x/.*\\n/ s/ \\(.*\\)//", s);
+  TEST_ASSERT(to_string(fb.content) == std::string("value: name\n42: key\n"));
+  std::string error;
+  try {
+    fb = handle_command(fb, ", s/(\\w+)/\\2/g", s);
+  } catch (std::runtime_error e) {
+    error = std::string(e.what());
+  }
+  TEST_ASSERT(error == std::string("Invalid regular expression: there is no group 2"));
+  TEST_ASSERT(to_string(fb.content) == std::string("value: name\n42: key\n"));
+}
+
+void handle_file_command_test() {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  std::vector<file_buffer> files(3, make_empty_buffer());
+  files[0].name = "main.cpp";
+  files[1].name = "engine.h";
+  files[2].name = "engine.cpp";
+  files[0] = insert(files[0], "int old_name = 0;\n", s);
+  files[1] = insert(files[1], "int old_name;\n", s);
+  files[2] = insert(files[2], "old_name = old_name + 1;\n", s);
+  TEST_ASSERT(is_file_command(" X/\\.cpp$/ , s/old/new/g"));
+  TEST_ASSERT(!is_file_command(", x/old/ d"));
+  auto results = handle_file_command(files, "X/\\.cpp$/ , s/old/new/g", s);
+  TEST_ASSERT(results.size() == 3);
+  TEST_ASSERT(results[0].selected && !results[1].selected && results[2].selected);
+  TEST_ASSERT(to_string(results[0].buffer.content) == std::string("int new_name = 0;\n"));
+  TEST_ASSERT(to_string(results[1].buffer.content) == std::string("int old_name;\n"));
+  TEST_ASSERT(to_string(results[2].buffer.content) == std::string("new_name = new_name + 1;\n"));
+  results = handle_file_command(files, "Y/main/ , x/old_name = / d", s);
+  TEST_ASSERT(!results[0].selected && results[1].selected && results[2].selected);
+  TEST_ASSERT(to_string(results[1].buffer.content) == std::string("int old_name;\n"));
+  TEST_ASSERT(to_string(results[2].buffer.content) == std::string("old_name + 1;\n"));
+  results = handle_file_command(files, "X/engine/ , s/(old/new/", s);
+  TEST_ASSERT(results[1].error == std::string("Invalid regular expression: unmatched ("));
+  TEST_ASSERT(to_string(results[1].buffer.content) == std::string("int old_name;\n"));
+  bool nested = false;
+  try {
+    handle_command(files[0], ", X/main/ d", s);
+  } catch (std::runtime_error e) {
+    nested = true;
+  }
+  TEST_ASSERT(nested);
+}
+
+void text_regex_test() {
+  env_settings s;
+  s.show_all_characters = false;
+  s.tab_space = 8;
+  file_buffer fb = make_empty_buffer();
+  fb = insert(fb, "mail jan@example.com or\nPIET@site.com\n", s);
+  const position end = get_end_position(fb.content);
+  regex_match m;
+  auto mail = get_regex(L"(\\w+)@(\\w+)\\.com");
+  TEST_ASSERT(mail == get_regex(L"(\\w+)@(\\w+)\\.com"));
+  TEST_ASSERT(mail->search(m, fb.content, position(0, 0), end));
+  TEST_ASSERT(m.begin == position(0, 5));
+  TEST_ASSERT(m.end == position(0, 20));
+  TEST_ASSERT(m.groups[1].first == position(0, 5));
+  TEST_ASSERT(m.groups[1].second == position(0, 8));
+  TEST_ASSERT(mail->search_backward(m, fb.content, position(0, 0), end));
+  TEST_ASSERT(m.begin == position(1, 0));
+  auto across = get_regex(L"or\\nPIET");
+  TEST_ASSERT(across->can_match_newline());
+  TEST_ASSERT(!mail->can_match_newline());
+  TEST_ASSERT(across->search(m, fb.content, position(0, 0), end));
+  TEST_ASSERT(m.begin == position(0, 21));
+  TEST_ASSERT(m.end == position(1, 4));
+  TEST_ASSERT(get_regex(L"a.*?b")->search(m, to_text(L"aXbXb"), position(0, 0), position(0, 5)));
+  TEST_ASSERT(m.end == position(0, 3));
+  TEST_ASSERT(get_regex(L"ab{2,3}c", false)->match(L"ABBC"));
+  TEST_ASSERT(!get_regex(L"ab{2,3}c")->match(L"abbcd"));
+  TEST_ASSERT(get_regex(L"^(https?:\\/\\/).*")->match(L"https://github.com"));
+  TEST_ASSERT(get_regex(L"[^a-z]+$")->match(L"ABC 123"));
+  std::vector<position> found;
+  get_regex(L"o")->search_all(fb.content, position(0, 0), end, [&](const regex_match& m) {
+    found.push_back(m.begin);
+    return true;
+  });
+  TEST_ASSERT(found.size() == 3);
+  TEST_ASSERT(found[2] == position(1, 11));
+  bool invalid = false;
+  try {
+    get_regex(L"(ab");
+  } catch (text_regex_error&) {
+    invalid = true;
+  }
+  TEST_ASSERT(invalid);
+  fb = find_regex(fb, L"\\bp\\w+", false);
+  TEST_ASSERT(*fb.start_selection == position(1, 0));
+  TEST_ASSERT(fb.pos == position(1, 3));
+}
+
 void run_all_edit_tests() {
   parse_test_1();
   parse_test_2();
@@ -342,4 +528,10 @@ void run_all_edit_tests() {
   handle_command_test_14();
   handle_command_test_15();
   handle_command_test_16();
+  handle_command_test_17();
+  handle_command_test_18();
+  handle_command_test_19();
+  handle_command_test_20();
+  handle_file_command_test();
+  text_regex_test();
 }
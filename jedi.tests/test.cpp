@@ -1,4 +1,5 @@
 #include "test_assert.h"
+#include "buffer_tests.h"
 #include "edit_tests.h"
 #include "trie_tests.h"
 
@@ -12,6 +13,7 @@ int main(int /*argc*/, const char* /*argv*/[])
   InitTestEngine();
 
   auto tic = std::clock();
+  run_all_buffer_tests();
   run_all_edit_tests();
   run_all_trie_tests();
   auto toc = std::clock();
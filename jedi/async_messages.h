@@ -6,7 +6,15 @@
 
 enum async_message_type
   {
-  ASYNC_MESSAGE_LOAD
+  ASYNC_MESSAGE_LOAD,
+  ASYNC_MESSAGE_SAVED,
+  ASYNC_MESSAGE_SAVE_FAILED,
+  ASYNC_MESSAGE_SEARCH_INDEX,
+  ASYNC_MESSAGE_MATCH_SET,
+  ASYNC_MESSAGE_LOOK,
+  ASYNC_MESSAGE_LEXER,
+  ASYNC_MESSAGE_LSP,
+  ASYNC_MESSAGE_FILE_READ
   };
 
 struct async_message
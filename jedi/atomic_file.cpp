@@ -0,0 +1,141 @@
+#include "atomic_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include "jtk/file_utils.h"
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+atomic_file::atomic_file()
+#ifdef _WIN32
+  : _file(INVALID_HANDLE_VALUE)
+#else
+  : _fd(-1)
+#endif
+  {
+  }
+
+atomic_file::~atomic_file()
+  {
+  abort();
+  }
+
+bool atomic_file::open(const std::string& filename)
+  {
+  abort();
+  _target = filename;
+#ifdef _WIN32
+  DWORD attributes = GetFileAttributesW(jtk::convert_string_to_wstring(filename).c_str());
+  if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_READONLY))
+    return false;
+  _temp = filename + ".jedi_save";
+  std::wstring wtemp = jtk::convert_string_to_wstring(_temp); // filenames are in utf8 encoding
+  _file = CreateFileW(wtemp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  return _file != INVALID_HANDLE_VALUE;
+#else
+  mode_t mode = 0666;
+  struct stat st;
+  if (stat(filename.c_str(), &st) == 0)
+    {
+    if (access(filename.c_str(), W_OK) != 0)
+      return false;
+    mode = st.st_mode & 07777;
+    char resolved[PATH_MAX];
+    if (realpath(filename.c_str(), resolved)) // don't replace a symbolic link by a regular file, but write to the file it points to
+      _target = resolved;
+    }
+  _temp = _target + ".jedi_save";
+  _fd = ::open(_temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (_fd < 0)
+    return false;
+  fchmod(_fd, mode);
+  return true;
+#endif
+  }
+
+bool atomic_file::write(const char* data, uint64_t size)
+  {
+#ifdef _WIN32
+  if (_file == INVALID_HANDLE_VALUE)
+    return false;
+  while (size > 0)
+    {
+    DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+    DWORD written = 0;
+    if (!WriteFile((HANDLE)_file, data, chunk, &written, nullptr))
+      return false;
+    data += written;
+    size -= written;
+    }
+#else
+  if (_fd < 0)
+    return false;
+  while (size > 0)
+    {
+    ssize_t written = ::write(_fd, data, (size_t)size);
+    if (written < 0)
+      {
+      if (errno == EINTR)
+        continue;
+      return false;
+      }
+    data += written;
+    size -= (uint64_t)written;
+    }
+#endif
+  return true;
+  }
+
+bool atomic_file::commit()
+  {
+#ifdef _WIN32
+  if (_file == INVALID_HANDLE_VALUE)
+    return false;
+  bool success = FlushFileBuffers((HANDLE)_file) != 0;
+  success &= CloseHandle((HANDLE)_file) != 0;
+  _file = INVALID_HANDLE_VALUE;
+  if (success)
+    {
+    std::wstring wtemp = jtk::convert_string_to_wstring(_temp);
+    std::wstring wtarget = jtk::convert_string_to_wstring(_target);
+    success = MoveFileExW(wtemp.c_str(), wtarget.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+    }
+#else
+  if (_fd < 0)
+    return false;
+  bool success = fsync(_fd) == 0;
+  success &= ::close(_fd) == 0;
+  _fd = -1;
+  if (success)
+    success = rename(_temp.c_str(), _target.c_str()) == 0;
+#endif
+  if (!success)
+    abort();
+  _temp.clear();
+  return success;
+  }
+
+void atomic_file::abort()
+  {
+#ifdef _WIN32
+  if (_file != INVALID_HANDLE_VALUE)
+    CloseHandle((HANDLE)_file);
+  _file = INVALID_HANDLE_VALUE;
+  if (!_temp.empty())
+    DeleteFileW(jtk::convert_string_to_wstring(_temp).c_str());
+#else
+  if (_fd >= 0)
+    ::close(_fd);
+  _fd = -1;
+  if (!_temp.empty())
+    unlink(_temp.c_str());
+#endif
+  _temp.clear();
+  }
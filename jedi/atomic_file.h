@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+
+/*
+Writes a file atomically: the data is written to a temporary file next to the target,
+flushed to disk, and then renamed over the target. If anything fails before commit,
+the target file is left untouched.
+*/
+class atomic_file
+  {
+  public:
+    atomic_file();
+    ~atomic_file();
+
+    atomic_file(const atomic_file&) = delete;
+    atomic_file& operator = (const atomic_file&) = delete;
+
+    bool open(const std::string& filename);
+
+    bool write(const char* data, uint64_t size);
+
+    bool commit();
+
+    void abort();
+
+  private:
+    std::string _target;
+    std::string _temp;
+#ifdef _WIN32
+    void* _file;
+#else
+    int _fd;
+#endif
+  };
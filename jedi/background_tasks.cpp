@@ -0,0 +1,58 @@
+#include "background_tasks.h"
+
+background_tasks::background_tasks()
+  {
+  }
+
+background_tasks::~background_tasks()
+  {
+  wait();
+  }
+
+void background_tasks::run(std::function<void()> task)
+  {
+  std::scoped_lock lock(_mut);
+  _join_finished_tasks();
+  task_thread tt;
+  tt.finished = std::make_shared<std::atomic<bool>>(false);
+  auto finished = tt.finished;
+  tt.t = std::thread([task, finished]()
+    {
+    task();
+    *finished = true;
+    });
+  _tasks.push_back(std::move(tt));
+  }
+
+void background_tasks::wait()
+  {
+  std::list<task_thread> tasks;
+    {
+    std::scoped_lock lock(_mut);
+    tasks.swap(_tasks);
+    }
+  for (auto& tt : tasks)
+    tt.t.join();
+  }
+
+uint32_t background_tasks::number_of_running_tasks()
+  {
+  std::scoped_lock lock(_mut);
+  _join_finished_tasks();
+  return (uint32_t)_tasks.size();
+  }
+
+void background_tasks::_join_finished_tasks()
+  {
+  auto it = _tasks.begin();
+  while (it != _tasks.end())
+    {
+    if (*it->finished)
+      {
+      it->t.join();
+      it = _tasks.erase(it);
+      }
+    else
+      ++it;
+    }
+  }
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+Runs tasks on their own thread. Tasks should only work on persistent snapshots,
+and report back through async_messages.
+*/
+class background_tasks
+  {
+  public:
+    background_tasks();
+    ~background_tasks();
+
+    background_tasks(const background_tasks&) = delete;
+    background_tasks& operator = (const background_tasks&) = delete;
+
+    void run(std::function<void()> task);
+
+    // blocks until all tasks have finished
+    void wait();
+
+    uint32_t number_of_running_tasks();
+
+  private:
+    void _join_finished_tasks();
+
+  private:
+    struct task_thread
+      {
+      std::thread t;
+      std::shared_ptr<std::atomic<bool>> finished;
+      };
+    std::list<task_thread> _tasks;
+    std::mutex _mut;
+  };
@@ -1,12 +1,59 @@
 #include "buffer.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cwctype>
 #include <fstream>
+#include <functional>
 
 #include "jtk/file_utils.h"
-#include "jtk/utf8.h"
 
+#include "atomic_file.h"
+#include "encoding.h"
+#include "line_width_cache.h"
+#include "mapped_file.h"
+#include "offset_index.h"
+#include "parallel.h"
+#include "search.h"
+#include "syntax_lexer.h"
+#include "text_regex.h"
+#include "token_span_cache.h"
+#include "trigram_index.h"
 #include "utils.h"
 
+namespace
+  {
+  std::atomic<uint64_t> last_content_version(0);
+
+  uint64_t get_new_content_version()
+    {
+    return ++last_content_version;
+    }
+
+  const uint32_t max_logged_changes = 256;
+
+  /*
+  Logs that the edit that gave fb its content_version replaced the characters in [first, last) by txt. The log starts
+  over when it is full, but only between edits, as followers cannot use a part of the changes of one edit.
+  */
+  void log_change(file_buffer& fb, uint64_t previous_version, position first, position last, const std::wstring& txt)
+    {
+    auto c = std::make_shared<logged_change>();
+    c->previous_version = previous_version;
+    c->version = fb.content_version;
+    c->change.first = first;
+    c->change.last = last;
+    c->change.txt = txt;
+    c->untouched_rows_at_end = std::max<int64_t>((int64_t)fb.content.size() - 1 - std::max(first.row, last.row), 0);
+    if (fb.changes && (fb.changes->nr_of_changes < max_logged_changes || fb.changes->version == fb.content_version))
+      c->previous = fb.changes;
+    c->nr_of_changes = c->previous ? c->previous->nr_of_changes + 1 : 1;
+    fb.changes = c;
+    }
+  }
+
 file_buffer make_empty_buffer()
   {
   file_buffer fb;
@@ -14,8 +61,26 @@ file_buffer make_empty_buffer()
   fb.xpos = 0;
   fb.start_selection = std::nullopt;
   fb.modification_mask = 0;
-  fb.undo_redo_index = 0;
+  fb.generation = 0;
+  fb.parent_generation = 0;
+  fb.next_generation = 1;
+  fb.saved_generation = 0;
+  fb.history_bytes = 0;
   fb.rectangular_selection = false;
+  fb.last_edit_kind = edit_kind_other;
+  fb.last_edit_time = 0;
+  fb.content_version = get_new_content_version();
+  fb.trigram_request = 0;
+  fb.match_request = 0;
+  fb.lex_pending = false;
+  fb.lex_request = 0;
+  fb.lexed_rows = 0;
+  fb.unlexed_rows = 0;
+  fb.lexed_version = 0;
+  fb.load_request = 0;
+  fb.token_spans = std::make_shared<token_span_cache>();
+  fb.line_widths = std::make_shared<line_width_cache>();
+  fb.offsets = std::make_shared<offset_index_cache>();
   return fb;
   }
 
@@ -32,150 +97,234 @@ namespace
       }
     return has_quotes;
     }
-  }
 
-file_buffer read_from_file(std::string filename)
-  {
-  using namespace jtk;
-  local_remove_quotes(filename);
-  file_buffer fb = make_empty_buffer();
-  fb.name = filename;
-  if (file_exists(filename))
+  const uint64_t parallel_read_threshold = 4 * 1024 * 1024;
+  const uint64_t parallel_read_chunk_size = 1024 * 1024;
+
+  /*
+  Scans and decodes the bytes in [first, last) in a single pass over the bytes for scanning.
+  The encoding is chosen for this chunk only, so invalid utf8 somewhere in a file only affects the chunk it is in.
+  If is_last_chunk is false, then the chunk should end with '\n'.
+  */
+  text read_chunk_from_memory(const char* first, const char* last, bool is_last_chunk)
     {
+    std::vector<uint64_t> offsets;
+    offsets.push_back(0);
+    const e_encoding enc = scan_encoding(first, (uint64_t)(last - first), &offsets);
+    if (!is_last_chunk)
+      offsets.pop_back(); // the chunk ends with '\n', so the last offset is the start of the next chunk
+    auto trans_lines = text().transient();
+    std::wstring wline;
+    for (size_t row = 0; row < offsets.size(); ++row)
+      {
+      const bool has_newline = !is_last_chunk || row + 1 < offsets.size();
+      const char* line_first = first + offsets[row];
+      const char* line_last = (row + 1 < offsets.size()) ? first + offsets[row + 1] - 1 : (has_newline ? last - 1 : last);
 #ifdef _WIN32
-    std::wstring wfilename = convert_string_to_wstring(filename);
-#else
-    std::string wfilename(filename);
+      if (has_newline && line_last != line_first && *(line_last - 1) == '\r') // files were read in text mode before, so keep on dropping \r in \r\n
+        --line_last;
 #endif
-    auto f = std::ifstream{ wfilename };
-    auto trans_lines = fb.content.transient();
-    try
+      wline.clear();
+      decode(wline, line_first, line_last, enc);
+      if (has_newline)
+        wline.push_back(L'\n');
+      auto trans = line().transient();
+      for (auto ch : wline)
+        trans.push_back(ch);
+      trans_lines.push_back(trans.persistent());
+      }
+    return trans_lines.persistent();
+    }
+
+  /*
+  Splits the file in newline aligned chunks of about parallel_read_chunk_size bytes.
+  Each chunk is decoded on a worker into its own vector, afterwards the chunks are concatenated.
+  */
+  text read_text_from_memory(const char* data, uint64_t size, bool parallel)
+    {
+    if (!parallel || size < parallel_read_threshold)
+      return read_chunk_from_memory(data, data + size, true);
+
+    std::vector<uint64_t> chunk_offsets;
+    chunk_offsets.push_back(0);
+    for (uint64_t offset = parallel_read_chunk_size; offset < size; offset = chunk_offsets.back() + parallel_read_chunk_size)
+      {
+      const char* nl = (const char*)memchr(data + offset, '\n', (size_t)(size - offset));
+      if (!nl)
+        break;
+      chunk_offsets.push_back((uint64_t)(nl + 1 - data));
+      }
+    if (chunk_offsets.back() != size)
+      chunk_offsets.push_back(size);
+
+    std::vector<text> chunks(chunk_offsets.size() - 1);
+    parallel_for(chunks.size(), [&](uint64_t chunk)
+      {
+      chunks[chunk] = read_chunk_from_memory(data + chunk_offsets[chunk], data + chunk_offsets[chunk + 1], chunk + 1 == chunks.size());
+      });
+
+    text result = chunks.front();
+    for (size_t chunk = 1; chunk < chunks.size(); ++chunk)
+      result = result + chunks[chunk];
+    return result;
+    }
+
+  file_buffer read_from_file(std::string filename, bool parallel)
+    {
+    using namespace jtk;
+    local_remove_quotes(filename);
+    file_buffer fb = make_empty_buffer();
+    fb.name = filename;
+    if (file_exists(filename))
       {
-      while (!f.eof())
+      mapped_file f;
+      if (f.open(filename))
         {
-        std::string file_line;
-        std::getline(f, file_line);
-        auto trans = line().transient();
-        auto it = file_line.begin();
-        auto it_end = file_line.end();
-        utf8::utf8to16(it, it_end, std::back_inserter(trans));
-        if (!f.eof())
-          trans.push_back('\n');
-        trans_lines.push_back(trans.persistent());
+        fb.content = read_text_from_memory(f.data(), f.size(), parallel);
+        f.close();
+        }
+      else
+        {
+#ifdef _WIN32
+        std::wstring wfilename = convert_string_to_wstring(filename);
+#else
+        std::string wfilename(filename);
+#endif
+        auto fs = std::ifstream{ wfilename, std::ios::binary };
+        std::string content((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+        fb.content = read_text_from_memory(content.data(), content.size(), parallel);
+        fs.close();
         }
       }
-    catch (...)
+    else if (is_directory(filename))
       {
-      while (!trans_lines.empty())
-        trans_lines.pop_back();
-      f.seekg(0);
-      while (!f.eof())
+      std::wstring wfilename = convert_string_to_wstring(fb.name);
+      std::replace(wfilename.begin(), wfilename.end(), '\\', '/'); // replace all '\\' to '/'
+      if (wfilename.back() != L'/')
+        wfilename.push_back(L'/');
+      fb.name = convert_wstring_to_string(wfilename);
+      auto trans_lines = fb.content.transient();
+
+      line dots;
+      dots = dots.push_back(L'.');
+      dots = dots.push_back(L'.');
+      dots = dots.push_back(L'\n');
+      trans_lines.push_back(dots);
+
+      auto items = get_subdirectories_from_directory(filename, false);
+      std::sort(items.begin(), items.end(), [](const std::string& lhs, const std::string& rhs)
         {
-        std::string file_line;
-        std::getline(f, file_line);
-        auto trans = line().transient();
-        auto it = file_line.begin();
-        auto it_end = file_line.end();
-        for (; it != it_end; ++it)
-          {
-          trans.push_back(ascii_to_utf16(*it));
-          }
-        if (!f.eof())
-          trans.push_back('\n');
-        trans_lines.push_back(trans.persistent());
+        const auto result = std::mismatch(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(), [](const unsigned char lhs, const unsigned char rhs) {return tolower(lhs) == tolower(rhs); });
+        return result.second != rhs.cend() && (result.first == lhs.cend() || tolower(*result.first) < tolower(*result.second));
+        });
+      for (auto& item : items)
+        {
+        item = get_filename(item);
+        auto witem = convert_string_to_wstring(item);
+        line ln;
+        auto folder_content = ln.transient();
+        for (auto ch : witem)
+          folder_content.push_back(ch);
+        folder_content.push_back(L'/');
+        folder_content.push_back(L'\n');
+        trans_lines.push_back(folder_content.persistent());
+        }
+      items = get_files_from_directory(filename, false);
+      std::sort(items.begin(), items.end(), [](const std::string& lhs, const std::string& rhs)
+        {
+        const auto result = std::mismatch(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(), [](const unsigned char lhs, const unsigned char rhs) {return tolower(lhs) == tolower(rhs); });
+        return result.second != rhs.cend() && (result.first == lhs.cend() || tolower(*result.first) < tolower(*result.second));
+        });
+      for (auto& item : items)
+        {
+        item = get_filename(item);
+        auto witem = convert_string_to_wstring(item);
+        line ln;
+        auto folder_content = ln.transient();
+        for (auto ch : witem)
+          folder_content.push_back(ch);
+        folder_content.push_back(L'\n');
+        trans_lines.push_back(folder_content.persistent());
         }
+      fb.content = trans_lines.persistent();
       }
-    fb.content = trans_lines.persistent();
-    f.close();
+
+    return fb;
     }
-  else if (is_directory(filename))
-    {
-    std::wstring wfilename = convert_string_to_wstring(fb.name);
-    std::replace(wfilename.begin(), wfilename.end(), '\\', '/'); // replace all '\\' to '/'
-    if (wfilename.back() != L'/')
-      wfilename.push_back(L'/');
-    fb.name = convert_wstring_to_string(wfilename);
-    auto trans_lines = fb.content.transient();
+  }
 
-    line dots;
-    dots = dots.push_back(L'.');
-    dots = dots.push_back(L'.');
-    dots = dots.push_back(L'\n');
-    trans_lines.push_back(dots);
+file_buffer read_from_file(std::string filename)
+  {
+  return read_from_file(filename, true);
+  }
 
-    auto items = get_subdirectories_from_directory(filename, false);
-    std::sort(items.begin(), items.end(), [](const std::string& lhs, const std::string& rhs)
-      {
-      const auto result = std::mismatch(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(), [](const unsigned char lhs, const unsigned char rhs) {return tolower(lhs) == tolower(rhs); });
-      return result.second != rhs.cend() && (result.first == lhs.cend() || tolower(*result.first) < tolower(*result.second));
-      });
-    for (auto& item : items)
+std::vector<file_buffer> read_from_files(const std::vector<std::string>& filenames)
+  {
+  std::vector<file_buffer> buffers(filenames.size());
+  parallel_for(filenames.size(), [&](uint64_t i)
+    {
+    buffers[i] = read_from_file(filenames[i], false);
+    });
+  return buffers;
+  }
+
+bool write_to_file(text content, const std::string& filename)
+  {
+  atomic_file f;
+  if (!f.open(filename))
+    return false;
+  std::string block;
+  std::wstring wline;
+  for (const auto& ln : content)
+    {
+    wline.assign(ln.begin(), ln.end());
+    encode(block, wline.data(), wline.data() + wline.size());
+#ifdef _WIN32
+    if (!block.empty() && block.back() == '\n') // files were written in text mode before, so keep on writing \r\n
       {
-      item = get_filename(item);
-      auto witem = convert_string_to_wstring(item);
-      line ln;
-      auto folder_content = ln.transient();
-      for (auto ch : witem)
-        folder_content.push_back(ch);
-      folder_content.push_back(L'/');
-      folder_content.push_back(L'\n');
-      trans_lines.push_back(folder_content.persistent());
+      block.back() = '\r';
+      block.push_back('\n');
       }
-    items = get_files_from_directory(filename, false);
-    std::sort(items.begin(), items.end(), [](const std::string& lhs, const std::string& rhs)
-      {
-      const auto result = std::mismatch(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(), [](const unsigned char lhs, const unsigned char rhs) {return tolower(lhs) == tolower(rhs); });
-      return result.second != rhs.cend() && (result.first == lhs.cend() || tolower(*result.first) < tolower(*result.second));
-      });
-    for (auto& item : items)
+#endif
+    if (block.size() >= 1024 * 1024)
       {
-      item = get_filename(item);
-      auto witem = convert_string_to_wstring(item);
-      line ln;
-      auto folder_content = ln.transient();
-      for (auto ch : witem)
-        folder_content.push_back(ch);
-      folder_content.push_back(L'\n');
-      trans_lines.push_back(folder_content.persistent());
+      if (!f.write(block.data(), block.size()))
+        return false;
+      block.clear();
       }
-    fb.content = trans_lines.persistent();
     }
+  if (!f.write(block.data(), block.size()))
+    return false;
+  return f.commit();
+  }
+
+file_buffer mark_saved(file_buffer fb)
+  {
+  fb.modification_mask = 0;
+  fb.saved_generation = fb.generation;
+  fb.last_edit_kind = edit_kind_other; // the next keystroke starts a new undo group, so that undoing it returns to the saved text
+  return fb;
+  }
+
+file_buffer mark_modified(file_buffer fb)
+  {
+  fb.modification_mask |= 1;
+  fb.saved_generation = std::nullopt;
+  return fb;
+  }
 
+file_buffer set_text(file_buffer fb, text txt)
+  {
+  fb.content = txt;
+  fb.content_version = get_new_content_version();
   return fb;
   }
 
 file_buffer save_to_file(bool& success, file_buffer fb, const std::string& filename)
   {
-#ifdef _WIN32
-  std::wstring wfilename = jtk::convert_string_to_wstring(filename); // filenames are in utf8 encoding
-#else
-  std::string wfilename(filename);
-#endif
-  success = false;
-  auto f = std::ofstream{ wfilename };
-  if (f.is_open())
-    {
-    for (auto ln : fb.content)
-      {
-      std::string str;
-      auto it = ln.begin();
-      auto it_end = ln.end();
-      str.reserve(std::distance(it, it_end));
-      utf8::utf16to8(it, it_end, std::back_inserter(str));
-      f << str;
-      }
-    f.close();
-    success = true;
-    fb.modification_mask = 0;
-    auto thistory = fb.history.transient();
-    for (uint32_t idx = 0; idx < thistory.size(); ++idx)
-      {
-      auto h = thistory[idx];
-      h.modification_mask = 1;
-      thistory.set(idx, h);
-      }
-    fb.history = thistory.persistent();
-    }
+  success = write_to_file(fb.content, filename);
+  if (success)
+    fb = mark_saved(fb);
   return fb;
   }
 
@@ -233,31 +382,109 @@ uint32_t character_width(uint32_t character, int64_t x_pos, const env_settings&
 int64_t line_length_up_to_column(line ln, int64_t column, const env_settings& s)
   {
   int64_t length = 0;
-  int64_t col = 0;
-  for (int64_t i = 0; i <= column && i < ln.size(); ++i)
-    {
-    uint32_t w = character_width(ln[i], col, s);
-    length += w;
-    col += w;
-    }
+  const int64_t n = std::min<int64_t>(column + 1, ln.size());
+  auto it = ln.begin();
+  for (int64_t i = 0; i < n; ++i, ++it)
+    length += character_width(*it, length, s);
   return length;
   }
 
 int64_t get_col_from_line_length(line ln, int64_t length, const env_settings& s)
   {
   int64_t le = 0;
-  int64_t col = 0;
   int64_t out = 0;
-  for (int i = 0; le < length && i < ln.size(); ++i)
+  const int64_t size = ln.size();
+  for (auto it = ln.begin(); le < length && out < size; ++it)
     {
-    uint32_t w = character_width(ln[i], col, s);
-    le += w;
-    col += w;
+    le += character_width(*it, le, s);
     ++out;
     }
   return out;
   }
 
+int64_t line_length_up_to_column(const file_buffer& fb, int64_t row, int64_t column, const env_settings& s)
+  {
+  if (fb.line_widths)
+    return fb.line_widths->line_length_up_to_column(fb, row, column, s);
+  return line_length_up_to_column(fb.content[row], column, s);
+  }
+
+int64_t get_col_from_line_length(const file_buffer& fb, int64_t row, int64_t length, const env_settings& s)
+  {
+  if (fb.line_widths)
+    return fb.line_widths->get_col_from_line_length(fb, row, length, s);
+  return get_col_from_line_length(fb.content[row], length, s);
+  }
+
+size_t hash_line(const line& ln)
+  {
+  uint64_t h = 14695981039346656037ull;
+  for (wchar_t ch : ln)
+    {
+    h ^= (uint64_t)ch;
+    h *= 1099511628211ull;
+    }
+  return (size_t)h;
+  }
+
+line_width_index::line_width_index(line ln, const env_settings& s) : _ln(ln), _s(s), _plain_columns(0)
+  {
+  _checkpoints.push_back(0);
+  }
+
+void line_width_index::add_checkpoints(int64_t column)
+  {
+  const int64_t last = std::min<int64_t>(column, _ln.size()) / checkpoint_distance;
+  while ((int64_t)_checkpoints.size() <= last)
+    {
+    const int64_t first_col = ((int64_t)_checkpoints.size() - 1) * checkpoint_distance;
+    int64_t x = _checkpoints.back();
+    auto it = _ln.begin();
+    it += first_col;
+    for (int64_t col = first_col; col < first_col + checkpoint_distance; ++col, ++it)
+      {
+      const uint32_t w = character_width(*it, x, _s);
+      if (w == 1 && _plain_columns == col)
+        ++_plain_columns;
+      x += w;
+      }
+    _checkpoints.push_back(x);
+    }
+  }
+
+int64_t line_width_index::line_length_up_to_column(int64_t column)
+  {
+  const int64_t n = std::min<int64_t>(column + 1, _ln.size());
+  if (n <= _plain_columns)
+    return n < 0 ? 0 : n;
+  add_checkpoints(n);
+  int64_t col = (n / checkpoint_distance) * checkpoint_distance;
+  int64_t x = _checkpoints[n / checkpoint_distance];
+  auto it = _ln.begin();
+  it += col;
+  for (; col < n; ++col, ++it)
+    x += character_width(*it, x, _s);
+  return x;
+  }
+
+int64_t line_width_index::get_col_from_line_length(int64_t length)
+  {
+  if (length <= _plain_columns)
+    return length < 0 ? 0 : length;
+  const int64_t size = _ln.size();
+  while (_checkpoints.back() < length && (int64_t)_checkpoints.size() * checkpoint_distance <= size)
+    add_checkpoints((int64_t)_checkpoints.size() * checkpoint_distance);
+  // the x positions of the checkpoints are strictly increasing, find the last one before length
+  const int64_t j = (int64_t)(std::lower_bound(_checkpoints.begin(), _checkpoints.end(), length) - _checkpoints.begin()) - 1;
+  int64_t col = j * checkpoint_distance;
+  int64_t x = _checkpoints[j];
+  auto it = _ln.begin();
+  it += col;
+  for (; x < length && col < size; ++col, ++it)
+    x += character_width(*it, x, _s);
+  return col;
+  }
+
 bool in_selection(file_buffer fb, position current, position cursor, position buffer_pos, std::optional<position> start_selection, bool rectangular, const env_settings& s)
   {
   bool has_selection = start_selection != std::nullopt;
@@ -269,7 +496,7 @@ bool in_selection(file_buffer fb, position current, position cursor, position bu
     int64_t minx, maxx, minrow, maxrow;
     get_rectangular_selection(minrow, maxrow, minx, maxx, fb, *start_selection, buffer_pos, s);
 
-    int64_t xpos = line_length_up_to_column(fb.content[current.row], current.col - 1, s);
+    int64_t xpos = line_length_up_to_column(fb, current.row, current.col - 1, s);
 
     return (minrow <= current.row && current.row <= maxrow && minx <= xpos && xpos <= maxx);
     }
@@ -338,24 +565,154 @@ file_buffer clear_selection(file_buffer fb)
   return fb;
   }
 
+namespace
+  {
+  /*
+  A state is stored in the history the first time it is left, by an edit or by undo. Generations are handed out
+  when a state is entered, so the history is sorted by generation, and a state that is not stored yet is the newest one.
+  */
+  bool current_state_is_stored(const file_buffer& fb)
+    {
+    return !fb.history.empty() && fb.generation <= fb.history.back().generation;
+    }
+
+  /*
+  Returns the index in the history of the state with the given generation, or history.size() if it is not stored.
+  */
+  uint32_t find_state(const file_buffer& fb, uint64_t generation)
+    {
+    uint32_t first = 0;
+    uint32_t last = fb.history.size();
+    while (first < last)
+      {
+      const uint32_t mid = first + (last - first) / 2;
+      if (fb.history[mid].generation < generation)
+        first = mid + 1;
+      else
+        last = mid;
+      }
+    if (first < fb.history.size() && fb.history[first].generation == generation)
+      return first;
+    return fb.history.size();
+    }
+
+  /*
+  The text of a snapshot shares all its lines with the state it was derived from, except for the lines that the edits
+  in between changed. We count these lines, from the change log or else by comparing the rows with the parent state,
+  and the nodes of the rrb tree that were copied to change them. The root of the tree shares its lines with the file.
+  */
+  uint64_t estimate_unique_bytes(const file_buffer& fb)
+    {
+    int64_t first_row = 0;
+    int64_t last_row = 0;
+    const uint32_t parent = fb.parent_generation != fb.generation ? find_state(fb, fb.parent_generation) : (uint32_t)fb.history.size();
+    if (parent < fb.history.size())
+      {
+      const snapshot& ss = fb.history[parent];
+      int64_t equal_prefix, equal_suffix;
+      if (!get_equal_rows(equal_prefix, equal_suffix, fb, ss.content_version))
+        get_equal_rows(equal_prefix, equal_suffix, ss.content, fb.content);
+      const int64_t nr_of_rows = (int64_t)fb.content.size();
+      first_row = std::min(equal_prefix, nr_of_rows);
+      last_row = std::max(first_row, nr_of_rows - equal_suffix);
+      }
+    uint64_t bytes = sizeof(snapshot) + (4 + (last_row - first_row) / 32) * 32 * sizeof(void*);
+    for (int64_t r = first_row; r < last_row; ++r)
+      bytes += sizeof(line) + fb.content[r].size() * sizeof(wchar_t);
+    return bytes;
+    }
+
+  file_buffer store_current_state(file_buffer fb)
+    {
+    if (current_state_is_stored(fb))
+      return fb;
+    snapshot ss;
+    ss.content = fb.content;
+    ss.lex = fb.lex;
+    ss.lex_pending = fb.lex_pending;
+    ss.pos = fb.pos;
+    ss.start_selection = fb.start_selection;
+    ss.rectangular_selection = fb.rectangular_selection;
+    ss.generation = fb.generation;
+    ss.parent = fb.parent_generation;
+    ss.redo_child = fb.generation;
+    ss.bytes = estimate_unique_bytes(fb);
+    ss.content_version = fb.content_version;
+    fb.history = fb.history.push_back(ss);
+    fb.history_bytes += ss.bytes;
+    return fb;
+    }
+
+  file_buffer set_redo_child(file_buffer fb, uint64_t parent, uint64_t child)
+    {
+    const uint32_t idx = find_state(fb, parent);
+    if (idx < fb.history.size() && fb.history[idx].redo_child != child)
+      {
+      snapshot ss = fb.history[idx];
+      ss.redo_child = child;
+      fb.history = fb.history.set(idx, ss);
+      }
+    return fb;
+    }
+
+  file_buffer restore_state(file_buffer fb, uint32_t idx)
+    {
+    const snapshot ss = fb.history[idx];
+    fb.content = ss.content;
+    fb.lex = ss.lex;
+    fb.lex_pending = ss.lex_pending;
+    fb.pos = ss.pos;
+    fb.start_selection = ss.start_selection;
+    fb.rectangular_selection = ss.rectangular_selection;
+    fb.generation = ss.generation;
+    fb.parent_generation = ss.parent;
+    fb.modification_mask = (fb.saved_generation && *fb.saved_generation == ss.generation) ? 0 : 1;
+    fb.last_edit_kind = edit_kind_other;
+    fb.content_version = get_new_content_version();
+    return fb;
+    }
+  }
+
 file_buffer push_undo(file_buffer fb)
   {
-  snapshot ss;
-  ss.content = fb.content;
-  ss.lex = fb.lex;
-  ss.pos = fb.pos;
-  ss.start_selection = fb.start_selection;
-  ss.modification_mask = fb.modification_mask;
-  ss.rectangular_selection = fb.rectangular_selection;
-  fb.history = fb.history.push_back(ss);
-  fb.undo_redo_index = fb.history.size();
+  fb = store_current_state(fb);
+  fb.parent_generation = fb.generation;
+  fb.generation = fb.next_generation++;
+  fb = set_redo_child(fb, fb.parent_generation, fb.generation);
+  fb.last_edit_kind = edit_kind_other;
+  return fb;
+  }
+
+namespace
+  {
+  const int64_t undo_coalesce_time_window = 2000; // milliseconds
+
+  int64_t get_time_in_milliseconds()
+    {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+  }
+
+file_buffer push_undo(file_buffer fb, e_edit_kind kind, bool word_boundary)
+  {
+  const int64_t now = get_time_in_milliseconds();
+  const bool continuation = kind != edit_kind_other
+    && fb.last_edit_kind == kind
+    && !word_boundary
+    && !current_state_is_stored(fb)
+    && get_actual_position(fb) == fb.last_edit_pos
+    && now - fb.last_edit_time < undo_coalesce_time_window;
+  if (!continuation)
+    fb = push_undo(fb);
+  fb.last_edit_kind = (uint8_t)kind;
+  fb.last_edit_time = now;
   return fb;
   }
 
 void get_rectangular_selection(int64_t& min_row, int64_t& max_row, int64_t& min_x, int64_t& max_x, file_buffer fb, position p1, position p2, const env_settings& s)
   {
-  min_x = line_length_up_to_column(fb.content[p1.row], p1.col - 1, s);
-  max_x = line_length_up_to_column(fb.content[p2.row], p2.col - 1, s);
+  min_x = line_length_up_to_column(fb, p1.row, p1.col - 1, s);
+  max_x = line_length_up_to_column(fb, p2.row, p2.col - 1, s);
   //min_x = p1.col;
   //max_x = p2.col;
   min_row = p1.row;
@@ -389,19 +746,20 @@ namespace
       for (int64_t r = minrow; r <= maxrow; ++r)
         {
         auto ln = fb.content[r];
-        int64_t current_col = get_col_from_line_length(fb.content[r], minx, s);
-        int64_t len = line_length_up_to_column(fb.content[r], current_col - 1, s);
+        int64_t current_col = get_col_from_line_length(fb, r, minx, s);
+        int64_t len = line_length_up_to_column(fb, r, current_col - 1, s);
         if (len == minx)
           {
           ln = ln.take(current_col) + input + ln.drop(current_col);
           }
         fb.content = fb.content.set(r, ln);
         }
+      fb.content_version = get_new_content_version(); // after the rows are changed, as their widths were cached for the previous version
       fb.start_selection->row = minrow;
       fb.pos.row = maxrow;
 
-      fb.start_selection->col = get_col_from_line_length(fb.content[fb.start_selection->row], minx, s) + input.size();
-      fb.pos.col = get_col_from_line_length(fb.content[fb.pos.row], minx, s) + input.size();
+      fb.start_selection->col = get_col_from_line_length(fb, fb.start_selection->row, minx, s) + input.size();
+      fb.pos.col = get_col_from_line_length(fb, fb.pos.row, minx, s) + input.size();
 
       fb.rectangular_selection = true;
       }
@@ -429,8 +787,8 @@ namespace
 
         int64_t r = minrow + current_line;
         auto ln = fb.content[r];
-        int64_t current_col = get_col_from_line_length(fb.content[r], minx, s);
-        int64_t len = line_length_up_to_column(fb.content[r], current_col - 1, s);
+        int64_t current_col = get_col_from_line_length(fb, r, minx, s);
+        int64_t len = line_length_up_to_column(fb, r, current_col - 1, s);
         if (len == minx)
           {
           ln = ln.take(current_col) + input + ln.drop(current_col);
@@ -438,10 +796,11 @@ namespace
         fb.content = fb.content.set(r, ln);
         ++current_line;
         }
+      fb.content_version = get_new_content_version();
       fb.start_selection = std::nullopt;
       fb.rectangular_selection = false;
       fb.pos.row = minrow;
-      fb.pos.col = get_col_from_line_length(fb.content[fb.pos.row], minx, s);
+      fb.pos.col = get_col_from_line_length(fb, fb.pos.row, minx, s);
       }
     fb = update_lexer_status(fb, minrow, maxrow, s);
     return fb;
@@ -455,6 +814,7 @@ namespace
       return fb;
 
     fb.modification_mask = 1;
+    fb.content_version = get_new_content_version();
 
     int64_t minrow, maxrow, minx, maxx;
     get_rectangular_selection(minrow, maxrow, minx, maxx, fb, *fb.start_selection, fb.pos, s);
@@ -519,7 +879,7 @@ namespace
 
 int64_t get_x_position(file_buffer fb, const env_settings& s)
   {
-  return fb.content.empty() ? 0 : line_length_up_to_column(fb.content[fb.pos.row], fb.pos.col - 1, s);
+  return fb.content.empty() ? 0 : line_length_up_to_column(fb, fb.pos.row, fb.pos.col - 1, s);
   }
 
 file_buffer insert(file_buffer fb, std::wstring wtxt, const env_settings& s, bool save_undo)
@@ -527,7 +887,17 @@ file_buffer insert(file_buffer fb, std::wstring wtxt, const env_settings& s, boo
   if (wtxt.empty())
     return fb;
   if (save_undo)
-    fb = push_undo(fb);
+    {
+    if (wtxt.size() == 1 && wtxt[0] != L'\n' && !has_selection(fb))
+      {
+      position actual = get_actual_position(fb);
+      const bool word_boundary = iswspace(wtxt[0]) && actual.col > 0 && !iswspace(fb.content[actual.row][actual.col - 1]);
+      fb = push_undo(fb, edit_kind_typing, word_boundary);
+      fb.last_edit_pos = position(actual.row, actual.col + 1);
+      }
+    else
+      fb = push_undo(fb);
+    }
 
   if (has_nontrivial_selection(fb, s))
     fb = erase(fb, s, false);
@@ -538,8 +908,11 @@ file_buffer insert(file_buffer fb, std::wstring wtxt, const env_settings& s, boo
   fb.start_selection = std::nullopt;
 
   fb.modification_mask = 1;
+  const uint64_t previous_version = fb.content_version;
+  fb.content_version = get_new_content_version();
 
   auto pos = get_actual_position(fb);
+  log_change(fb, previous_version, pos, pos, wtxt);
   int nr_of_lines_inserted = 0;
   int64_t first_insertion_row = pos.row;
   while (!wtxt.empty())
@@ -597,7 +970,7 @@ file_buffer insert(file_buffer fb, std::wstring wtxt, const env_settings& s, boo
 
 file_buffer insert(file_buffer fb, const std::string& txt, const env_settings& s, bool save_undo)
   {
-  std::wstring wtxt = jtk::convert_string_to_wstring(txt);
+  std::wstring wtxt = decode(txt);
   return insert(fb, wtxt, s, save_undo);
   }
 
@@ -612,9 +985,20 @@ file_buffer erase(file_buffer fb, const env_settings& s, bool save_undo)
     return fb;
 
   if (save_undo)
-    fb = push_undo(fb);
+    {
+    position actual = get_actual_position(fb);
+    if (!has_selection(fb) && actual.col > 0)
+      {
+      fb = push_undo(fb, edit_kind_backspace, false);
+      fb.last_edit_pos = position(actual.row, actual.col - 1);
+      }
+    else
+      fb = push_undo(fb);
+    }
 
   fb.modification_mask = 1;
+  const uint64_t previous_version = fb.content_version;
+  fb.content_version = get_new_content_version();
 
   if (!has_selection(fb))
     {
@@ -623,6 +1007,7 @@ file_buffer erase(file_buffer fb, const env_settings& s, bool save_undo)
     fb.start_selection = std::nullopt;
     if (pos.col > 0)
       {
+      log_change(fb, previous_version, position(pos.row, pos.col - 1), pos, std::wstring());
       fb.content = fb.content.set(pos.row, fb.content[pos.row].erase(pos.col - 1));
       --fb.pos.col;
       fb = update_lexer_status(fb, pos.row, s);
@@ -630,6 +1015,7 @@ file_buffer erase(file_buffer fb, const env_settings& s, bool save_undo)
     else if (pos.row > 0)
       {
       fb.pos.col = (int64_t)fb.content[pos.row - 1].size() - 1;
+      log_change(fb, previous_version, position(pos.row - 1, fb.pos.col), pos, std::wstring());
       auto l = fb.content[pos.row - 1].pop_back() + fb.content[pos.row];
       fb.content = fb.content.erase(pos.row).set(pos.row - 1, l);
       fb.lex = fb.lex.erase(pos.row);
@@ -653,6 +1039,7 @@ file_buffer erase(file_buffer fb, const env_settings& s, bool save_undo)
       {
       fb.start_selection = std::nullopt;
       fb.rectangular_selection = false;
+      log_change(fb, previous_version, p1, position(p1.row, p2.col), std::wstring());
       auto new_line = fb.content[p1.row].erase(p1.col, p2.col);
       fb.content = fb.content.set(p1.row, new_line);
       fb.pos.col = p1.col;
@@ -684,6 +1071,11 @@ file_buffer erase(file_buffer fb, const env_settings& s, bool save_undo)
         int64_t tgt = p2.col + 1;
         if (tgt > fb.content[p2.row].size() - 1)
           remove_line = true;
+        // the newline of row p1 stays, so the text from p1 up to the remainder of row p2 becomes one newline
+        if (remove_line && p2.row + 1 < (int64_t)fb.content.size())
+          log_change(fb, previous_version, p1, position(p2.row + 1, 0), std::wstring(1, L'\n'));
+        else
+          log_change(fb, previous_version, p1, position(p2.row, tgt), std::wstring(1, L'\n'));
         fb.content = fb.content.set(p2.row, fb.content[p2.row].erase(0, tgt));
         fb.content = fb.content.erase(p1.row + 1, remove_line ? p2.row + 1 : p2.row);
         fb.lex = fb.lex.erase(p1.row + 1, remove_line ? p2.row + 1 : p2.row);
@@ -705,28 +1097,30 @@ file_buffer erase(file_buffer fb, const env_settings& s, bool save_undo)
             {
             for (int64_t r = minrow; r <= maxrow; ++r)
               {
-              int64_t current_col = get_col_from_line_length(fb.content[r], minx, s);
-              int64_t len = line_length_up_to_column(fb.content[r], current_col - 1, s);
+              int64_t current_col = get_col_from_line_length(fb, r, minx, s);
+              int64_t len = line_length_up_to_column(fb, r, current_col - 1, s);
               if (len == minx)
                 fb.content = fb.content.set(r, fb.content[r].take(current_col - 1) + fb.content[r].drop(current_col));
               }
-            fb.start_selection->col = get_col_from_line_length(fb.content[fb.start_selection->row], minx, s) - 1;
-            fb.pos.col = get_col_from_line_length(fb.content[fb.pos.row], minx, s) - 1;
+            fb.content_version = get_new_content_version();
+            fb.start_selection->col = get_col_from_line_length(fb, fb.start_selection->row, minx, s) - 1;
+            fb.pos.col = get_col_from_line_length(fb, fb.pos.row, minx, s) - 1;
             }
           }
         else
           {
           for (int64_t r = minrow; r <= maxrow; ++r)
             {
-            int64_t min_col = get_col_from_line_length(fb.content[r], minx, s);
-            int64_t max_col = get_col_from_line_length(fb.content[r], maxx, s);
-            int64_t len_min = line_length_up_to_column(fb.content[r], min_col - 1, s);
-            int64_t len_max = line_length_up_to_column(fb.content[r], max_col - 1, s);
+            int64_t min_col = get_col_from_line_length(fb, r, minx, s);
+            int64_t max_col = get_col_from_line_length(fb, r, maxx, s);
+            int64_t len_min = line_length_up_to_column(fb, r, min_col - 1, s);
+            int64_t len_max = line_length_up_to_column(fb, r, max_col - 1, s);
             if (len_min <= maxx && len_max >= minx)
               fb.content = fb.content.set(r, fb.content[r].take(min_col) + fb.content[r].drop(max_col + 1));
             }
-          fb.start_selection->col = get_col_from_line_length(fb.content[fb.start_selection->row], minx, s);
-          fb.pos.col = get_col_from_line_length(fb.content[fb.pos.row], minx, s);
+          fb.content_version = get_new_content_version();
+          fb.start_selection->col = get_col_from_line_length(fb, fb.start_selection->row, minx, s);
+          fb.pos.col = get_col_from_line_length(fb, fb.pos.row, minx, s);
           }
         fb = update_lexer_status(fb, minrow, maxrow, s);
         fb.xpos = get_x_position(fb, s);
@@ -739,12 +1133,22 @@ file_buffer erase(file_buffer fb, const env_settings& s, bool save_undo)
 file_buffer erase_right(file_buffer fb, const env_settings& s, bool save_undo)
   {
   if (save_undo)
-    fb = push_undo(fb);
+    {
+    if (!has_selection(fb) && !fb.content.empty())
+      {
+      fb = push_undo(fb, edit_kind_delete, false);
+      fb.last_edit_pos = get_actual_position(fb);
+      }
+    else
+      fb = push_undo(fb);
+    }
 
   fb.modification_mask = 1;
 
   if (!has_selection(fb))
     {
+    const uint64_t previous_version = fb.content_version;
+    fb.content_version = get_new_content_version();
     if (fb.content.empty())
       return fb;
     auto pos = get_actual_position(fb);
@@ -752,6 +1156,7 @@ file_buffer erase_right(file_buffer fb, const env_settings& s, bool save_undo)
     fb.start_selection = std::nullopt;
     if (pos.col < (int64_t)fb.content[pos.row].size() - 1)
       {
+      log_change(fb, previous_version, pos, position(pos.row, pos.col + 1), std::wstring());
       fb.content = fb.content.set(pos.row, fb.content[pos.row].erase(pos.col));
       fb = update_lexer_status(fb, pos.row, s);
       }
@@ -759,6 +1164,7 @@ file_buffer erase_right(file_buffer fb, const env_settings& s, bool save_undo)
       {
       if (pos.row != (int64_t)fb.content.size() - 1) // not last line
         {
+        log_change(fb, previous_version, pos, pos, std::wstring());
         fb.content = fb.content.erase(pos.row);
         fb.lex = fb.lex.erase(pos.row);
         fb = update_lexer_status(fb, pos.row, s);
@@ -766,6 +1172,7 @@ file_buffer erase_right(file_buffer fb, const env_settings& s, bool save_undo)
       }
     else if (pos.row < (int64_t)fb.content.size() - 1)
       {
+      log_change(fb, previous_version, pos, position(pos.row + 1, 0), std::wstring());
       auto l = fb.content[pos.row].pop_back() + fb.content[pos.row + 1];
       fb.content = fb.content.erase(pos.row + 1).set(pos.row, l);
       fb.lex = fb.lex.erase(pos.row + 1);
@@ -773,6 +1180,7 @@ file_buffer erase_right(file_buffer fb, const env_settings& s, bool save_undo)
       }
     else if (pos.col == (int64_t)fb.content[pos.row].size() - 1)// last line, last item
       {
+      log_change(fb, previous_version, pos, position(pos.row, pos.col + 1), std::wstring());
       fb.content = fb.content.set(pos.row, fb.content[pos.row].pop_back());
       }
     fb.xpos = get_x_position(fb, s);
@@ -788,14 +1196,15 @@ file_buffer erase_right(file_buffer fb, const env_settings& s, bool save_undo)
       get_rectangular_selection(minrow, maxrow, minx, maxx, fb, p1, p2, s);
       for (int64_t r = minrow; r <= maxrow; ++r)
         {
-        int64_t current_col = get_col_from_line_length(fb.content[r], minx, s);
-        int64_t len = line_length_up_to_column(fb.content[r], current_col - 1, s);
+        int64_t current_col = get_col_from_line_length(fb, r, minx, s);
+        int64_t len = line_length_up_to_column(fb, r, current_col - 1, s);
         if (len == minx && (current_col < fb.content[r].size() - 1 || (current_col == fb.content[r].size() - 1 && r == fb.content.size() - 1)))
           fb.content = fb.content.set(r, fb.content[r].take(current_col) + fb.content[r].drop(current_col + 1));
         }
+      fb.content_version = get_new_content_version();
       fb = update_lexer_status(fb, minrow, maxrow, s);
-      fb.start_selection->col = get_col_from_line_length(fb.content[fb.start_selection->row], minx, s);
-      fb.pos.col = get_col_from_line_length(fb.content[fb.pos.row], minx, s);
+      fb.start_selection->col = get_col_from_line_length(fb, fb.start_selection->row, minx, s);
+      fb.pos.col = get_col_from_line_length(fb, fb.pos.row, minx, s);
       fb.xpos = get_x_position(fb, s);
       return fb;
       }
@@ -865,42 +1274,81 @@ text get_selection(file_buffer fb, const env_settings& s)
 
 file_buffer undo(file_buffer fb, const env_settings& s)
   {
-  if (fb.undo_redo_index == fb.history.size()) // first time undo
-    {
-    fb = push_undo(fb);
-    --fb.undo_redo_index;
-    }
-  if (fb.undo_redo_index)
-    {
-    --fb.undo_redo_index;
-    snapshot ss = fb.history[(uint32_t)fb.undo_redo_index];
-    fb.content = ss.content;
-    fb.lex = ss.lex;
-    fb.pos = ss.pos;
-    fb.modification_mask = ss.modification_mask;
-    fb.start_selection = ss.start_selection;
-    fb.rectangular_selection = ss.rectangular_selection;
-    fb.history = fb.history.push_back(ss);
-    }
+  if (!can_undo(fb))
+    return fb;
+  fb = store_current_state(fb); // so that we can redo
+  fb = set_redo_child(fb, fb.parent_generation, fb.generation);
+  fb = restore_state(fb, find_state(fb, fb.parent_generation));
   fb.xpos = get_x_position(fb, s);
   return fb;
   }
 
 file_buffer redo(file_buffer fb, const env_settings& s)
   {
-  if (fb.undo_redo_index + 1 < fb.history.size())
+  if (!can_redo(fb))
+    return fb;
+  fb = restore_state(fb, find_state(fb, fb.history[find_state(fb, fb.generation)].redo_child));
+  fb.xpos = get_x_position(fb, s);
+  return fb;
+  }
+
+file_buffer undo_earlier(file_buffer fb, const env_settings& s)
+  {
+  fb = store_current_state(fb);
+  const uint32_t idx = find_state(fb, fb.generation);
+  if (idx == 0)
+    return fb;
+  const snapshot& target = fb.history[idx - 1];
+  fb = set_redo_child(fb, target.parent, target.generation); // redo follows the branch we moved to
+  fb = restore_state(fb, idx - 1);
+  fb.xpos = get_x_position(fb, s);
+  return fb;
+  }
+
+file_buffer redo_later(file_buffer fb, const env_settings& s)
+  {
+  const uint32_t idx = find_state(fb, fb.generation);
+  if (idx + 1 >= fb.history.size())
+    return fb;
+  const snapshot& target = fb.history[idx + 1];
+  fb = set_redo_child(fb, target.parent, target.generation);
+  fb = restore_state(fb, idx + 1);
+  fb.xpos = get_x_position(fb, s);
+  return fb;
+  }
+
+bool can_undo(file_buffer fb)
+  {
+  return fb.parent_generation != fb.generation && find_state(fb, fb.parent_generation) < fb.history.size();
+  }
+
+bool can_redo(file_buffer fb)
+  {
+  const uint32_t idx = find_state(fb, fb.generation);
+  if (idx == fb.history.size())
+    return false;
+  const uint64_t child = fb.history[idx].redo_child;
+  return child != fb.generation && find_state(fb, child) < fb.history.size();
+  }
+
+uint64_t history_memory_used(file_buffer fb)
+  {
+  return fb.history_bytes;
+  }
+
+file_buffer trim_history(file_buffer fb, uint64_t max_bytes)
+  {
+  if (fb.history_bytes <= max_bytes)
+    return fb;
+  // the current state and its parent are kept, so that the last change can always be undone
+  const uint32_t limit = std::min(find_state(fb, fb.generation), find_state(fb, fb.parent_generation));
+  uint32_t dropped = 0;
+  while (fb.history_bytes > max_bytes && dropped < limit)
     {
-    ++fb.undo_redo_index;
-    snapshot ss = fb.history[(uint32_t)fb.undo_redo_index];
-    fb.content = ss.content;
-    fb.lex = ss.lex;
-    fb.pos = ss.pos;
-    fb.modification_mask = ss.modification_mask;
-    fb.start_selection = ss.start_selection;
-    fb.rectangular_selection = ss.rectangular_selection;
-    fb.history = fb.history.push_back(ss);
+    fb.history_bytes -= fb.history[dropped].bytes;
+    ++dropped;
     }
-  fb.xpos = get_x_position(fb, s);
+  fb.history = fb.history.drop(dropped);
   return fb;
   }
 
@@ -963,7 +1411,7 @@ file_buffer move_up(file_buffer fb, const env_settings& s)
   if (fb.pos.row > 0)
     {
     --fb.pos.row;
-    int64_t new_col = get_col_from_line_length(fb.content[fb.pos.row], fb.xpos, s);
+    int64_t new_col = get_col_from_line_length(fb, fb.pos.row, fb.xpos, s);
     fb.pos.col = new_col;
     }
   return fb;
@@ -974,7 +1422,7 @@ file_buffer move_down(file_buffer fb, const env_settings& s)
   if ((fb.pos.row + 1) < fb.content.size())
     {
     ++fb.pos.row;
-    int64_t new_col = get_col_from_line_length(fb.content[fb.pos.row], fb.xpos, s);
+    int64_t new_col = get_col_from_line_length(fb, fb.pos.row, fb.xpos, s);
     fb.pos.col = new_col;
     }
   return fb;
@@ -985,7 +1433,7 @@ file_buffer move_page_up(file_buffer fb, int64_t rows, const env_settings& s)
   fb.pos.row -= rows;
   if (fb.pos.row < 0)
     fb.pos.row = 0;
-  int64_t new_col = get_col_from_line_length(fb.content[fb.pos.row], fb.xpos, s);
+  int64_t new_col = get_col_from_line_length(fb, fb.pos.row, fb.xpos, s);
   fb.pos.col = new_col;
   return fb;
   }
@@ -997,7 +1445,7 @@ file_buffer move_page_down(file_buffer fb, int64_t rows, const env_settings& s)
   fb.pos.row += rows;
   if (fb.pos.row >= fb.content.size())
     fb.pos.row = fb.content.size() - 1;
-  int64_t new_col = get_col_from_line_length(fb.content[fb.pos.row], fb.xpos, s);
+  int64_t new_col = get_col_from_line_length(fb, fb.pos.row, fb.xpos, s);
   fb.pos.col = new_col;
   return fb;
   }
@@ -1037,9 +1485,11 @@ file_buffer move_end(file_buffer fb, const env_settings& s)
 std::string to_string(text txt)
   {
   std::string out;
+  std::wstring wline;
   for (auto ln : txt)
     {
-    out.append(to_string(ln));
+    wline.assign(ln.begin(), ln.end());
+    encode(out, wline.data(), wline.data() + wline.size());
     }
   return out;
   }
@@ -1047,15 +1497,13 @@ std::string to_string(text txt)
 std::string to_string(line ln)
   {
   std::string str;
-  auto it = ln.begin();
-  auto it_end = ln.end();
-  str.reserve(std::distance(it, it_end));
-  utf8::utf16to8(it, it_end, std::back_inserter(str));
+  std::wstring wline(ln.begin(), ln.end());
+  encode(str, wline.data(), wline.data() + wline.size());
   return str;
   }
 
 std::string to_string(text txt, position from, position to) {
-  return jtk::convert_wstring_to_string(to_wstring(txt, from, to));
+  return encode(to_wstring(txt, from, to));
   }
 
 std::wstring to_wstring(text txt)
@@ -1084,9 +1532,26 @@ std::wstring to_wstring(text txt, position from, position to) {
   return out;
   }
 
-std::string buffer_to_string(file_buffer fb)
+void get_equal_rows(int64_t& equal_prefix, int64_t& equal_suffix, text previous, text txt)
   {
-  return to_string(fb.content);
+  auto rows_are_equal = [](const line& a, const line& b)
+    {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+    };
+  const int64_t old_rows = (int64_t)previous.size();
+  const int64_t new_rows = (int64_t)txt.size();
+  const int64_t min_rows = std::min(old_rows, new_rows);
+  equal_prefix = 0;
+  while (equal_prefix < min_rows && rows_are_equal(previous[equal_prefix], txt[equal_prefix]))
+    ++equal_prefix;
+  equal_suffix = 0;
+  while (equal_suffix < min_rows - equal_prefix && rows_are_equal(previous[old_rows - 1 - equal_suffix], txt[new_rows - 1 - equal_suffix]))
+    ++equal_suffix;
+  }
+
+std::string buffer_to_string(file_buffer fb)
+  {
+  return to_string(fb.content);
   }
 
 position get_last_position(text txt)
@@ -1138,7 +1603,7 @@ text to_text(std::wstring wtxt)
 
 text to_text(const std::string& txt)
   {
-  return to_text(jtk::convert_string_to_wstring(txt));
+  return to_text(decode(txt));
   }
 
 position get_next_position(text txt, position pos)
@@ -1183,54 +1648,184 @@ position get_previous_position(file_buffer fb, position pos)
   return get_previous_position(fb.content, pos);
   }
 
-position find_next_occurence_reverse(text txt, position starting_pos, const std::wstring& wtxt_to_find) {
-  position lastpos = get_last_position(txt);
-  position firstpos = position(0, 0);
-  position pos = starting_pos;
-  while (pos != firstpos) {
-    pos = get_previous_position(txt, pos);
-    bool found = true;
-    position tmp = pos;
-    for (int j = 0; j < wtxt_to_find.size(); ++j) {
-      if (tmp == lastpos) {
-        found = false;
-        break;
+namespace
+  {
+  const size_t search_window_size = 1 << 16;
+
+  /*
+  The number of characters of row that can be part of an occurrence. The last position of a text is never part of an occurrence,
+  so a newline that ends the last row is excluded.
+  */
+  int64_t searchable_row_size(const text& txt, int64_t row)
+    {
+    const int64_t sz = (int64_t)txt[row].size();
+    if (row + 1 == (int64_t)txt.size() && sz > 0 && txt[row].back() == L'\n')
+      return sz - 1;
+    return sz;
+    }
+
+  /*
+  A contiguous copy of a range of rows, so that the search kernels can run over it.
+  Only the first row can start at a column different from 0. If fold is true, the copy is case folded.
+  */
+  struct text_window
+    {
+    std::wstring chars;
+    std::vector<size_t> row_offsets;
+    int64_t first_row = 0;
+    int64_t first_col = 0;
+    bool fold = false;
+
+    void reset(int64_t row, int64_t col)
+      {
+      chars.clear();
+      row_offsets.clear();
+      first_row = row;
+      first_col = col;
+      }
+
+    void append(const line& ln, int64_t from_col, int64_t to_col)
+      {
+      row_offsets.push_back(chars.size());
+      auto it = ln.begin();
+      it += from_col;
+      auto it_end = ln.begin();
+      it_end += to_col;
+      chars.append(it, it_end);
+      if (fold && chars.size() > row_offsets.back())
+        fold_case(&chars[0] + row_offsets.back(), &chars[0] + chars.size());
+      }
+
+    position get_position(size_t offset) const
+      {
+      const size_t idx = (size_t)(std::upper_bound(row_offsets.begin(), row_offsets.end(), offset) - row_offsets.begin()) - 1;
+      const int64_t col = (int64_t)(offset - row_offsets[idx]);
+      return idx == 0 ? position(first_row, first_col + col) : position(first_row + (int64_t)idx, col);
+      }
+    };
+
+  /*
+  Finds the first occurrence of wtxt_to_find that starts at or after from, and that ends before row end_row. On success first and
+  last are set to the positions of the first and the last character of the occurrence.
+  */
+  bool search_text_forward(const text& txt, position from, int64_t end_row, std::wstring wtxt_to_find, bool case_sensitive, position& first, position& last)
+    {
+    const size_t m = wtxt_to_find.size();
+    const int64_t nr_of_rows = std::min<int64_t>(end_row, (int64_t)txt.size());
+    if (m == 0 || from.row < 0)
+      return false;
+    text_window w;
+    w.fold = !case_sensitive;
+    if (w.fold)
+      fold_case(&wtxt_to_find[0], &wtxt_to_find[0] + m);
+    int64_t row = from.row;
+    int64_t col = from.col;
+    while (row < nr_of_rows)
+      {
+      w.reset(row, col);
+      int64_t r = row;
+      for (; r < nr_of_rows && w.chars.size() < search_window_size + m; ++r)
+        {
+        const int64_t sz = searchable_row_size(txt, r);
+        w.append(txt[r], r == row ? std::min(col, sz) : 0, sz);
         }
-      const wchar_t current_char = txt[tmp.row][tmp.col];
-      if (current_char != wtxt_to_find[j]) {
-        found = false;
-        break;
+      const wchar_t* data = w.chars.data();
+      const wchar_t* found = search_forward(data, data + w.chars.size(), wtxt_to_find.data(), m);
+      if (found != data + w.chars.size())
+        {
+        first = w.get_position((size_t)(found - data));
+        last = w.get_position((size_t)(found - data) + m - 1);
+        return true;
         }
-      tmp = get_next_position(txt, tmp);
+      if (r >= nr_of_rows)
+        return false;
+      // the last m-1 characters of this window can still be the start of an occurrence
+      const position next = w.get_position(w.chars.size() - m + 1);
+      row = next.row;
+      col = next.col;
       }
-    if (found)
-      return pos;
+    return false;
     }
-  return position(-1, -1);
-  }
 
-position find_next_occurence(text txt, position starting_pos, const std::wstring& wtxt_to_find) {
-  position lastpos = get_last_position(txt);
-  position pos = starting_pos;
-  while (pos != lastpos) {
-    bool found = true;
-    position tmp = pos;
-    for (int j = 0; j < wtxt_to_find.size(); ++j) {
-      if (tmp == lastpos) {
-        found = false;
-        break;
+  bool search_text_forward(const text& txt, position from, const std::wstring& wtxt_to_find, bool case_sensitive, position& first, position& last)
+    {
+    return search_text_forward(txt, from, (int64_t)txt.size(), wtxt_to_find, case_sensitive, first, last);
+    }
+
+  /*
+  Same as search_text_forward, but only the row ranges [first, last) in candidate_rows are searched.
+  */
+  bool search_candidate_rows_forward(const text& txt, position from, const std::vector<std::pair<int64_t, int64_t>>& candidate_rows, const std::wstring& wtxt_to_find, bool case_sensitive, position& first, position& last)
+    {
+    for (const auto& rows : candidate_rows)
+      {
+      if (rows.second <= from.row)
+        continue;
+      const position start = rows.first > from.row ? position(rows.first, 0) : from;
+      if (search_text_forward(txt, start, rows.second, wtxt_to_find, case_sensitive, first, last))
+        return true;
+      }
+    return false;
+    }
+
+  /*
+  Finds the last occurrence of wtxt_to_find that starts before before. The occurrence may end after before.
+  */
+  bool search_text_backward(const text& txt, position before, const std::wstring& wtxt_to_find, position& first)
+    {
+    const size_t m = wtxt_to_find.size();
+    const int64_t nr_of_rows = (int64_t)txt.size();
+    if (m == 0 || before.row < 0 || nr_of_rows == 0)
+      return false;
+    if (before.row >= nr_of_rows)
+      before = position(nr_of_rows - 1, searchable_row_size(txt, nr_of_rows - 1));
+    text_window w;
+    position end = before; // occurrences should start before end
+    while (end.row > 0 || end.col > 0)
+      {
+      int64_t lo = end.row;
+      size_t nr_of_chars = (size_t)end.col;
+      while (lo > 0 && ((lo == end.row && end.col == 0) || nr_of_chars < search_window_size))
+        {
+        --lo;
+        nr_of_chars += (size_t)searchable_row_size(txt, lo);
         }
-      const wchar_t current_char = txt[tmp.row][tmp.col];
-      if (current_char != wtxt_to_find[j]) {
-        found = false;
-        break;
+      w.reset(lo, 0);
+      for (int64_t r = lo; r < end.row; ++r)
+        w.append(txt[r], 0, searchable_row_size(txt, r));
+      // append the m-1 characters following end, so that occurrences that start before end but end after end are found
+      int64_t r = end.row;
+      const size_t remaining = w.chars.size() + (size_t)end.col + m - 1;
+      for (; r < nr_of_rows && w.chars.size() < remaining; ++r)
+        {
+        const int64_t sz = searchable_row_size(txt, r);
+        const size_t needed = remaining - w.chars.size();
+        w.append(txt[r], 0, std::min<int64_t>(sz, (int64_t)needed));
+        }
+      const wchar_t* data = w.chars.data();
+      const wchar_t* found = search_backward(data, data + w.chars.size(), wtxt_to_find.data(), m);
+      if (found != data + w.chars.size())
+        {
+        first = w.get_position((size_t)(found - data));
+        return true;
         }
-      tmp = get_next_position(txt, tmp);
+      end = position(lo, 0);
       }
-    if (found)
-      return pos;
-    pos = get_next_position(txt, pos);
+    return false;
     }
+  }
+
+position find_next_occurence_reverse(text txt, position starting_pos, const std::wstring& wtxt_to_find) {
+  position first;
+  if (search_text_backward(txt, starting_pos, wtxt_to_find, first))
+    return first;
+  return position(-1, -1);
+  }
+
+position find_next_occurence(text txt, position starting_pos, const std::wstring& wtxt_to_find) {
+  position first, last;
+  if (search_text_forward(txt, starting_pos, wtxt_to_find, true, first, last))
+    return first;
   return position(-1, -1);
   }
 
@@ -1251,131 +1846,448 @@ position find_next_occurence(file_buffer fb, position starting_pos, wchar_t ch)
   return find_next_occurence(fb.content, starting_pos, ch);
   }
 
-file_buffer find_text(file_buffer fb, text txt)
+namespace
   {
-  if (txt.empty())
+  file_buffer _find_text(file_buffer fb, const std::wstring& wtxt, bool case_sensitive)
+    {
+    if (wtxt.empty())
+      return fb;
+    if (fb.content.empty())
+      return fb;
+    fb.rectangular_selection = false;
+    position lastpos = get_last_position(fb);
+    position pos = wtxt.size() == 1 ? get_next_position(fb, fb.pos) : fb.pos; // don't find the same character again
+    if (has_selection(fb) && fb.start_selection > pos)
+      pos = *fb.start_selection;
+    if (pos == lastpos)
+      pos.col = pos.row = 0;
+    pos = get_actual_position(fb, pos);
+    position first, last;
+    std::vector<std::pair<int64_t, int64_t>> candidate_rows;
+    const bool found = get_candidate_rows(candidate_rows, fb, wtxt) ?
+      search_candidate_rows_forward(fb.content, pos, candidate_rows, wtxt, case_sensitive, first, last) :
+      search_text_forward(fb.content, pos, wtxt, case_sensitive, first, last);
+    if (found)
+      {
+      fb.start_selection = first;
+      fb.pos = last;
+      return fb;
+      }
+    fb.pos = lastpos;
+    fb.start_selection = std::nullopt;
     return fb;
-  if (fb.content.empty())
+    }
+  }
+
+file_buffer find_text(file_buffer fb, text txt)
+  {
+  return _find_text(fb, to_wstring(txt), true);
+  }
+
+file_buffer find_text(file_buffer fb, const std::wstring& wtxt)
+  {
+  return _find_text(fb, wtxt, true);
+  }
+
+file_buffer find_text(file_buffer fb, const std::string& txt)
+  {
+  return find_text(fb, jtk::convert_string_to_wstring(txt));
+  }
+
+file_buffer find_text_case_insensitive(file_buffer fb, text txt)
+  {
+  return _find_text(fb, to_wstring(txt), false);
+  }
+
+file_buffer find_text_case_insensitive(file_buffer fb, const std::wstring& wtxt)
+  {
+  return _find_text(fb, wtxt, false);
+  }
+
+file_buffer find_text_case_insensitive(file_buffer fb, const std::string& txt)
+  {
+  return find_text_case_insensitive(fb, jtk::convert_string_to_wstring(txt));
+  }
+
+namespace
+  {
+  /*
+  Finds the first match in [first, last) that is not empty, as an empty match cannot be selected.
+  */
+  bool search_nonempty_match(regex_match& m, const text_regex& rx, text txt, position first, position last)
+    {
+    while (rx.search(m, txt, first, last))
+      {
+      if (m.begin != m.end)
+        return true;
+      const position next = get_next_position(txt, m.begin);
+      if (next == m.begin)
+        return false;
+      first = next;
+      }
+    return false;
+    }
+  }
+
+file_buffer find_regex(file_buffer fb, const std::wstring& pattern, bool case_sensitive)
+  {
+  if (pattern.empty() || fb.content.empty())
     return fb;
+  auto rx = get_regex(pattern, case_sensitive);
   fb.rectangular_selection = false;
-  position lastpos = get_last_position(fb);
   position pos = fb.pos;
-  position text_pos(0, 0);
-  position lasttext = get_last_position(txt);
-  position first_encounter;
-  if (has_selection(fb) && fb.start_selection > pos)
-    pos = *fb.start_selection;
-  if (pos == lastpos)
-    pos.col = pos.row = 0;
-  pos = get_actual_position(fb, pos);
-  wchar_t current_text_char = txt[text_pos.row][text_pos.col];
-  wchar_t first_text_char = txt[text_pos.row][text_pos.col];
-  while (pos != lastpos)
-    {
-    wchar_t current_char = fb.content[pos.row][pos.col];
-    if (current_char == current_text_char)
-      {
-      if (text_pos.col == 0 && text_pos.row == 0)
-        first_encounter = pos;
-      text_pos = get_next_position(txt, text_pos);
-      if (text_pos == lasttext)
+  if (fb.start_selection) // don't find the selected match again
+    pos = get_next_position(fb, *fb.start_selection < pos ? pos : *fb.start_selection);
+  const position end = get_end_position(fb.content);
+  regex_match m;
+  if (search_nonempty_match(m, *rx, fb.content, pos, end) || search_nonempty_match(m, *rx, fb.content, position(0, 0), end))
+    {
+    fb.start_selection = m.begin;
+    fb.pos = get_previous_position(fb, m.end);
+    return fb;
+    }
+  fb.pos = get_last_position(fb);
+  fb.start_selection = std::nullopt;
+  return fb;
+  }
+
+namespace
+  {
+  /*
+  A range of rows of the old text, and the lines that replace them.
+  */
+  struct replaced_rows
+    {
+    int64_t first_row;
+    int64_t last_row;
+    std::vector<line> lines;
+    position end_of_last_replacement; // relative to first_row
+    };
+
+  void append_lines(std::vector<line>& lines, const std::wstring& wtxt, bool contains_last_row_of_text)
+    {
+    size_t start = 0;
+    while (start < wtxt.size())
+      {
+      size_t end = wtxt.find(L'\n', start);
+      end = (end == std::wstring::npos) ? wtxt.size() : end + 1;
+      line ln;
+      auto trans = ln.transient();
+      for (size_t i = start; i < end; ++i)
+        trans.push_back(wtxt[i]);
+      lines.push_back(trans.persistent());
+      start = end;
+      }
+    // the last row of a text does not end with a newline, it is empty after a trailing newline
+    if (contains_last_row_of_text && (wtxt.empty() || wtxt.back() == L'\n'))
+      lines.push_back(line());
+    }
+
+  position get_relative_position(const std::wstring& wtxt, size_t offset)
+    {
+    position pos(0, 0);
+    for (size_t i = 0; i < offset; ++i)
+      {
+      if (wtxt[i] == L'\n')
         {
-        fb.start_selection = first_encounter;
-        fb.pos = pos;
-        return fb;
+        ++pos.row;
+        pos.col = 0;
         }
-      current_text_char = txt[text_pos.row][text_pos.col];
+      else
+        ++pos.col;
       }
-    else
+    return pos;
+    }
+
+  /*
+  Replaces the rows of the text by the given replacements, which are sorted and do not overlap, in one pass with
+  transients. The lexer status is updated once over the changed rows, and the cursor is put after the last replacement.
+  */
+  file_buffer replace_rows(file_buffer fb, const std::vector<replaced_rows>& replacements, const env_settings& s, bool save_undo)
+    {
+    if (replacements.empty())
+      return fb;
+    const int64_t nr_of_rows = (int64_t)fb.content.size();
+
+    if (save_undo)
+      fb = push_undo(fb);
+    fb.modification_mask = 1;
+    const uint64_t previous_version = fb.content_version;
+    fb.content_version = get_new_content_version();
+
+    // logged from the last replacement to the first, so that the positions of each change are still valid, and not
+    // logged at all if there are more replacements than fit in the log
+    std::wstring replaced_txt;
+    for (auto it = replacements.rbegin(); replacements.size() <= max_logged_changes && it != replacements.rend(); ++it)
+      {
+      replaced_txt.clear();
+      for (const auto& ln : it->lines)
+        replaced_txt.append(ln.begin(), ln.end());
+      const position last = it->last_row + 1 < nr_of_rows ? position(it->last_row + 1, 0) : position(it->last_row, (int64_t)fb.content[it->last_row].size());
+      log_change(fb, previous_version, position(it->first_row, 0), last, replaced_txt);
+      }
+
+    const int64_t first_changed_row = replacements.front().first_row;
+    auto content = fb.content.take((uint32_t)first_changed_row).transient();
+    auto lex = fb.lex.take((uint32_t)first_changed_row).transient();
+    int64_t row = first_changed_row;
+    for (const auto& rr : replacements)
+      {
+      for (; row < rr.first_row; ++row)
+        {
+        content.push_back(fb.content[row]);
+        lex.push_back(fb.lex[row]);
+        }
+      fb.pos = rr.end_of_last_replacement;
+      fb.pos.row += (int64_t)content.size();
+      for (const auto& ln : rr.lines)
+        {
+        content.push_back(ln);
+        lex.push_back(lexer_normal);
+        }
+      if (!rr.lines.empty())
+        lex.set(lex.size() - (uint32_t)rr.lines.size(), fb.lex[rr.first_row]);
+      row = rr.last_row + 1;
+      }
+    const int64_t last_changed_row = (int64_t)content.size() - 1;
+    for (; row < nr_of_rows; ++row)
+      {
+      content.push_back(fb.content[row]);
+      lex.push_back(fb.lex[row]);
+      }
+    fb.content = content.persistent();
+    fb.lex = lex.persistent();
+    if (fb.content.empty())
       {
-      current_text_char = first_text_char;
-      text_pos = position(0, 0);
+      fb.content = fb.content.push_back(line());
+      fb.lex = fb.lex.push_back(lexer_normal);
       }
-    pos = get_next_position(fb, pos);
+    fb.start_selection = std::nullopt;
+    fb.rectangular_selection = false;
+    fb = update_lexer_status(fb, first_changed_row, last_changed_row, s);
+    fb.xpos = get_x_position(fb, s);
+    return fb;
     }
-  fb.pos = lastpos;
-  fb.start_selection = std::nullopt;
-  return fb;
   }
 
-file_buffer find_text(file_buffer fb, const std::wstring& wtxt)
+file_buffer replace_text(file_buffer fb, const std::wstring& find, const std::wstring& replacement, bool case_sensitive, position first, position last, const env_settings& s)
   {
-  return find_text(fb, to_text(wtxt));
+  if (find.empty() || fb.content.empty())
+    return fb;
+  if (last < first)
+    std::swap(first, last);
+  const int64_t nr_of_rows = (int64_t)fb.content.size();
+  first.row = std::max<int64_t>(first.row, 0);
+  last.row = std::min<int64_t>(last.row, nr_of_rows - 1);
+
+  std::wstring pattern = find;
+  if (!case_sensitive)
+    fold_case(&pattern[0], &pattern[0] + pattern.size());
+
+  // A pattern without newlines is searched line by line. Otherwise the rows between first and last are searched
+  // together, with one extra row, so that the newline that ends the range is never part of a match.
+  const bool multiline_pattern = pattern.find(L'\n') != std::wstring::npos;
+
+  std::vector<replaced_rows> replacements;
+  std::wstring chunk, searched;
+  for (int64_t row = first.row; row <= last.row; ++row)
+    {
+    const int64_t chunk_last_row = multiline_pattern ? std::min<int64_t>(last.row + 1, nr_of_rows - 1) : row;
+    chunk.clear();
+    size_t lo = 0;
+    size_t hi = 0;
+    for (int64_t r = row; r <= chunk_last_row; ++r)
+      {
+      if (r == first.row)
+        lo = chunk.size() + (size_t)std::min<int64_t>(first.col, fb.content[r].size());
+      if (r == last.row)
+        hi = chunk.size() + (size_t)std::min<int64_t>(last.col + 1, fb.content[r].size());
+      else if (r < last.row)
+        hi = chunk.size() + fb.content[r].size();
+      chunk.append(fb.content[r].begin(), fb.content[r].end());
+      }
+    searched = chunk;
+    if (!case_sensitive && !searched.empty())
+      fold_case(&searched[0], &searched[0] + searched.size());
+
+    std::wstring result;
+    size_t copied = 0;
+    size_t end_of_last_replacement = 0;
+    const wchar_t* data = searched.data();
+    const wchar_t* data_end = data + std::max(hi, lo);
+    const wchar_t* match = search_forward(data + lo, data_end, pattern.data(), pattern.size());
+    while (match != data_end)
+      {
+      const size_t offset = (size_t)(match - data);
+      result.append(chunk, copied, offset - copied);
+      result.append(replacement);
+      end_of_last_replacement = result.size();
+      copied = offset + pattern.size();
+      match = search_forward(data + copied, data_end, pattern.data(), pattern.size());
+      }
+    if (copied > 0)
+      {
+      result.append(chunk, copied, std::wstring::npos);
+      replaced_rows rr;
+      rr.first_row = row;
+      rr.last_row = chunk_last_row;
+      append_lines(rr.lines, result, chunk_last_row == nr_of_rows - 1);
+      rr.end_of_last_replacement = get_relative_position(result, end_of_last_replacement);
+      replacements.push_back(rr);
+      }
+    row = chunk_last_row;
+    }
+
+  return replace_rows(fb, replacements, s, true);
   }
 
-file_buffer find_text(file_buffer fb, const std::string& txt)
+file_buffer replace_text(file_buffer fb, const std::wstring& find, const std::wstring& replacement, bool case_sensitive, const env_settings& s)
   {
-  return find_text(fb, jtk::convert_string_to_wstring(txt));
+  if (fb.content.empty())
+    return fb;
+  return replace_text(fb, find, replacement, case_sensitive, position(0, 0), get_last_position(fb), s);
   }
 
-file_buffer find_text_case_insensitive(file_buffer fb, text txt)
+namespace
   {
-  if (txt.empty())
-    return fb;
-  if (fb.content.empty())
+  /*
+  Moves a position after the newline of a row to the start of the next row.
+  */
+  position normalize_change_position(const text& txt, position pos)
+    {
+    const int64_t nr_of_rows = (int64_t)txt.size();
+    if (pos.row >= nr_of_rows)
+      return position(nr_of_rows - 1, (int64_t)txt.back().size());
+    if (pos.row < nr_of_rows - 1 && pos.col >= (int64_t)txt[pos.row].size())
+      return position(pos.row + 1, 0);
+    return pos;
+    }
+  }
+
+void append_text(std::wstring& wtxt, text txt, position from, position to)
+  {
+  for (int64_t row = from.row; row <= to.row && row < (int64_t)txt.size(); ++row)
+    {
+    const line& ln = txt[row];
+    const int64_t begin = row == from.row ? std::min<int64_t>(from.col, ln.size()) : 0;
+    const int64_t end = row == to.row ? std::min<int64_t>(to.col, ln.size()) : (int64_t)ln.size();
+    if (begin < end)
+      wtxt.append(ln.begin() + begin, ln.begin() + end);
+    }
+  }
+
+file_buffer apply_changes(file_buffer fb, const std::vector<text_change>& changes, const env_settings& s, bool save_undo)
+  {
+  if (changes.empty() || fb.content.empty())
     return fb;
-  fb.rectangular_selection = false;
-  position lastpos = get_last_position(fb);
-  position pos = txt[0].size() == 1 ? get_next_position(fb, fb.pos) : fb.pos;
-  position text_pos(0, 0);
-  position lasttext = get_last_position(txt);
-  position first_encounter;
-  if (has_selection(fb) && fb.start_selection > pos)
-    pos = *fb.start_selection;
-  if (pos == lastpos)
-    pos.col = pos.row = 0;
-  pos = get_actual_position(fb, pos);  
-  wchar_t first_text_char = tolower(txt[text_pos.row][text_pos.col]);
-  while (pos != lastpos)
-    {
-    wchar_t current_char = tolower(fb.content[pos.row][pos.col]);
-    if (current_char == first_text_char)
-      {
-      wchar_t current_text_char = first_text_char;
-      position pos2 = pos;
-      while (pos2 != lastpos)
+  const int64_t nr_of_rows = (int64_t)fb.content.size();
+  std::vector<replaced_rows> replacements;
+  std::wstring result;
+  size_t i = 0;
+  while (i < changes.size())
+    {
+    replaced_rows rr;
+    rr.first_row = normalize_change_position(fb.content, changes[i].first).row;
+    result.clear();
+    position copied(rr.first_row, 0);
+    size_t end_of_last_replacement = 0;
+    // changes that start in the row where the previous change ends are rebuilt together
+    do
+      {
+      append_text(result, fb.content, copied, normalize_change_position(fb.content, changes[i].first));
+      result.append(changes[i].txt);
+      end_of_last_replacement = result.size();
+      copied = std::max(copied, normalize_change_position(fb.content, changes[i].last));
+      ++i;
+      } while (i < changes.size() && normalize_change_position(fb.content, changes[i].first).row <= copied.row);
+    rr.last_row = copied.row;
+    append_text(result, fb.content, copied, position(rr.last_row, (int64_t)fb.content[rr.last_row].size()));
+    append_lines(rr.lines, result, rr.last_row == nr_of_rows - 1);
+    rr.end_of_last_replacement = get_relative_position(result, end_of_last_replacement);
+    replacements.push_back(rr);
+    }
+  return replace_rows(fb, replacements, s, save_undo);
+  }
+
+namespace
+  {
+  /*
+  Fills changes with the logged changes since version in the order in which they were made.
+  */
+  bool get_logged_changes_since(std::vector<const logged_change*>& changes, const file_buffer& fb, uint64_t version)
+    {
+    changes.clear();
+    if (version == fb.content_version)
+      return true;
+    // the log is walked back to the first change of the edit that followed version
+    std::vector<const logged_change*> log;
+    const logged_change* first = nullptr;
+    for (const logged_change* c = fb.changes.get(); c; c = c->previous.get())
+      {
+      log.push_back(c);
+      if (c->previous_version == version)
+        first = c;
+      else if (first)
+        break;
+      }
+    if (!first)
+      return false;
+    while (log.back() != first)
+      log.pop_back();
+    uint64_t previous_version = version;
+    uint64_t current_version = version;
+    for (auto it = log.rbegin(); it != log.rend(); ++it)
+      {
+      const logged_change& c = **it;
+      if (c.previous_version == current_version) // the first change of the next edit
         {
-        current_char = tolower(fb.content[pos2.row][pos2.col]);
-        if (current_char == current_text_char)
-          {
-          text_pos = get_next_position(txt, text_pos);
-          if (text_pos == lasttext)
-            {
-            fb.start_selection = pos;
-            fb.pos = pos2;
-            return fb;
-            }
-          current_text_char = tolower(txt[text_pos.row][text_pos.col]);
-          pos2 = get_next_position(fb, pos2);
-          }
-        else
-          {
-          text_pos = position(0, 0);
-          break;
-          }
+        previous_version = current_version;
+        current_version = c.version;
         }
+      else if (c.previous_version != previous_version || c.version != current_version) // an edit that was not logged came in between
+        return false;
+      changes.push_back(&c);
       }
-    pos = get_next_position(fb, pos);
+    return current_version == fb.content_version;
     }
-  fb.pos = lastpos;
-  fb.start_selection = std::nullopt;
-  return fb;
   }
 
-file_buffer find_text_case_insensitive(file_buffer fb, const std::wstring& wtxt)
+bool get_changes_since(std::vector<text_change>& changes, const file_buffer& fb, uint64_t version)
   {
-  return find_text_case_insensitive(fb, to_text(wtxt));
+  changes.clear();
+  std::vector<const logged_change*> log;
+  if (!get_logged_changes_since(log, fb, version))
+    return false;
+  for (const logged_change* c : log)
+    changes.push_back(c->change);
+  return true;
   }
 
-file_buffer find_text_case_insensitive(file_buffer fb, const std::string& txt)
+bool get_equal_rows(int64_t& equal_prefix, int64_t& equal_suffix, const file_buffer& fb, uint64_t version)
   {
-  return find_text_case_insensitive(fb, jtk::convert_string_to_wstring(txt));
+  std::vector<const logged_change*> log;
+  if (!get_logged_changes_since(log, fb, version))
+    return false;
+  // a change leaves the rows before its first row in place, and the rows after its last row at the end of the text
+  equal_prefix = (int64_t)fb.content.size();
+  equal_suffix = (int64_t)fb.content.size();
+  for (const logged_change* c : log)
+    {
+    equal_prefix = std::min(equal_prefix, c->change.first.row);
+    equal_suffix = std::min(equal_suffix, c->untouched_rows_at_end);
+    }
+  return true;
+  }
+
+bool is_word_separator(wchar_t ch)
+  {
+  return ch == L' ' || ch == L',' || ch == L'(' || ch == L'{' || ch == L')' || ch == L'}' || ch == L'[' || ch == L']' || ch == L'\n' || ch == L'\t' || ch == L'\r' || ch == L'<' || ch == L'>' || ch == L'&' || ch == L'*';
   }
 
 std::wstring read_next_word(line::const_iterator it, line::const_iterator it_end)
   {
   std::wstring out;
-  while (it != it_end && *it != L' ' && *it != L',' && *it != L'(' && *it != L'{' && *it != L')' && *it != L'}' && *it != L'[' && *it != L']' && *it != L'\n' && *it != L'\t' && *it != L'\r' && *it != L'<' && *it != L'>' && *it != L'&' && *it != L'*')
+  while (it != it_end && !is_word_separator(*it))
     {
     out.push_back(*it);
     ++it;
@@ -1386,87 +2298,106 @@ std::wstring read_next_word(line::const_iterator it, line::const_iterator it_end
 namespace
   {
 
-  bool _is_next_word(line::const_iterator it, line::const_iterator it_end, const std::string& word)
+  uint8_t _get_end_of_line_lexer_status(const file_buffer& fb, int64_t row, uint8_t status_at_begin_of_line)
     {
-    if (word.empty())
-      return false;
-    if (*it == (wchar_t)word[0])
-      {
-      ++it;
-      int i = 1;
-      while (i < word.length() && (it != it_end) && (*it == (wchar_t)word[i]))
-        {
-        ++it; ++i;
-        }
-      return (i == word.length());
-      }
-    return false;
+    if (!fb.syntax.should_highlight || !fb.syntax.lexer)
+      return lexer_normal;
+    return fb.syntax.lexer->lex(fb.content[row], status_at_begin_of_line);
     }
 
-  uint8_t _get_end_of_line_lexer_status(file_buffer fb, int64_t row, uint8_t status_at_begin_of_line)
+  uint8_t _number_of_lexer_statuses(const file_buffer& fb)
     {
-    if (!fb.syntax.should_highlight)
-      return lexer_normal;
-    uint8_t current_status = status_at_begin_of_line;
-    line ln = fb.content[row];
-    auto it = ln.begin();
-    auto prev_it = it;
-    auto prevprev_it = prev_it;
-    auto it_end = ln.end();
-    bool inside_single_line_comment = false;
-    bool inside_single_line_string = false;
-    bool inside_quotes = false;
-    for (; it != it_end; ++it)
+    if (!fb.syntax.should_highlight || !fb.syntax.lexer)
+      return 1;
+    return fb.syntax.lexer->number_of_statuses();
+    }
+
+  const int64_t lexer_rows_per_task = 16384;
+
+  /*
+  A task lexes its rows from each status at its begin for this many rows at most. Languages with nested comments have
+  a status per comment depth, and these rarely agree with each other, so lexing each row once per status would multiply
+  the work by the number of statuses.
+  */
+  const int64_t lexer_speculation_rows = 512;
+
+  /*
+  The lexer status at the begin of each row of a range of rows, for each of the statuses that the range can begin
+  with. status[lexer_normal] holds all rows. The other statuses hold the rows until they agree with lexer_normal, as the
+  later rows are the same.
+  */
+  struct lexer_task
+    {
+    std::vector<std::vector<uint8_t>> status;
+    std::vector<bool> lexed; // false for the statuses at the begin that are only lexed if the range begins with them
+    std::vector<uint8_t> end; // the status after the last row, for each lexed status at the begin
+    };
+
+  bool _all_equal(const std::vector<uint8_t>& status)
+    {
+    return std::adjacent_find(status.begin(), status.end(), std::not_equal_to<uint8_t>()) == status.end();
+    }
+
+  void lex_task(lexer_task& task, const file_buffer& fb, int64_t first_row, int64_t last_row, uint8_t nr_of_statuses)
+    {
+    std::vector<uint8_t> current_status(nr_of_statuses);
+    for (uint8_t i = 0; i < nr_of_statuses; ++i)
+      current_status[i] = i;
+    task.status.resize(nr_of_statuses);
+    // several statuses at the begin can have led to the same status, a row is lexed only once per distinct status
+    std::vector<int> end_of_row(nr_of_statuses);
+    int64_t row = first_row;
+    const int64_t last_speculated_row = std::min(last_row, first_row + lexer_speculation_rows);
+    for (; row < last_speculated_row && !_all_equal(current_status); ++row)
       {
-      if (inside_single_line_comment)
-        break;
-      if (current_status == lexer_normal)
+      std::fill(end_of_row.begin(), end_of_row.end(), -1);
+      for (uint8_t i = 0; i < nr_of_statuses; ++i)
         {
-        if (!inside_single_line_string && !inside_quotes && _is_next_word(it, it_end, fb.syntax.multiline_begin))
-          {
-          current_status = lexer_inside_multiline_comment;
-          it += fb.syntax.multiline_begin.length() - 1;
-          }
-        else if (!inside_single_line_string && !inside_quotes && _is_next_word(it, it_end, fb.syntax.multistring_begin))
-          {
-          current_status = lexer_inside_multiline_string;
-          it += fb.syntax.multistring_begin.length() - 1;
-          }
-        else if (!inside_single_line_string && !inside_quotes && _is_next_word(it, it_end, fb.syntax.single_line))
-          {
-          inside_single_line_comment = true;
-          }
-        else if (!inside_quotes && *it == L'"' && (*prev_it != L'\\' || *prevprev_it == L'\\'))
-          {
-          inside_single_line_string = !inside_single_line_string;
-          }
-        else if (fb.syntax.uses_quotes_for_chars && !inside_single_line_string && *it == L'\'' && (*prev_it != L'\\' || *prevprev_it == L'\\'))
-          {
-          inside_quotes = !inside_quotes;
-          }
+        task.status[i].push_back(current_status[i]);
+        int& eol = end_of_row[current_status[i]];
+        if (eol < 0)
+          eol = _get_end_of_line_lexer_status(fb, row, current_status[i]);
+        current_status[i] = (uint8_t)eol;
         }
-      else if (current_status == lexer_inside_multiline_comment)
+      }
+    task.lexed.assign(nr_of_statuses, true);
+    const bool all_rows_lexed = row == last_row;
+    for (uint8_t i = 1; i < nr_of_statuses; ++i)
+      {
+      if (!all_rows_lexed && current_status[i] != current_status[0])
         {
-        if (_is_next_word(it, it_end, fb.syntax.multiline_end))
-          {
-          current_status = lexer_normal;
-          it += fb.syntax.multiline_end.length() - 1;
-          }
+        task.lexed[i] = false;
+        task.status[i].clear();
         }
-      else if (current_status == lexer_inside_multiline_string)
-        {
-        if (_is_next_word(it, it_end, fb.syntax.multistring_end))
-          {
-          current_status = lexer_normal;
-          it += fb.syntax.multistring_end.length() - 1;
-          }
-        }
-      prevprev_it = prev_it;
-      prev_it = it;
       }
-    return current_status;
+    for (; row < last_row; ++row)
+      {
+      task.status[0].push_back(current_status[0]);
+      current_status[0] = _get_end_of_line_lexer_status(fb, row, current_status[0]);
+      }
+    if (!all_rows_lexed)
+      std::fill(current_status.begin(), current_status.end(), current_status[0]);
+    task.end = current_status;
     }
 
+  /*
+  Lexes the rows of a task from a status at its begin that lex_task did not finish, until they agree with the rows that
+  were lexed from lexer_normal.
+  */
+  void lex_task_from(lexer_task& task, const file_buffer& fb, int64_t first_row, int64_t last_row, uint8_t status_at_first_row)
+    {
+    std::vector<uint8_t>& status = task.status[status_at_first_row];
+    status.clear();
+    uint8_t current_status = status_at_first_row;
+    int64_t row = first_row;
+    for (; row < last_row && current_status != task.status[0][row - first_row]; ++row)
+      {
+      status.push_back(current_status);
+      current_status = _get_end_of_line_lexer_status(fb, row, current_status);
+      }
+    task.end[status_at_first_row] = row < last_row ? task.end[lexer_normal] : current_status;
+    task.lexed[status_at_first_row] = true;
+    }
   }
 
 uint8_t get_end_of_line_lexer_status(file_buffer fb, int64_t row)
@@ -1476,29 +2407,109 @@ uint8_t get_end_of_line_lexer_status(file_buffer fb, int64_t row)
 
 file_buffer init_lexer_status(file_buffer fb, const env_settings& s)
   {
+  fb.lex_pending = false;
   if (!s.perform_syntax_highlighting)
     return fb;
   if (fb.content.empty())
     return fb;
+  std::vector<uint8_t> status;
+  lex_rows(status, fb, 0, (int64_t)fb.content.size(), lexer_normal);
   lexer_status ls;
   auto trans = ls.transient();
+  for (uint8_t st : status)
+    trans.push_back(st);
+  fb.lex = trans.persistent();
+  return fb;
+  }
 
-  trans.push_back(lexer_normal);
-  for (int64_t row = 1; row < fb.content.size(); ++row)
-    {
-    trans.push_back(_get_end_of_line_lexer_status(fb, row - 1, trans.back()));
-    }
-
+file_buffer init_lexer_status(file_buffer fb, int64_t last_row, const env_settings& s)
+  {
+  if (!s.perform_syntax_highlighting || !fb.syntax.should_highlight || last_row + 1 >= (int64_t)fb.content.size())
+    return init_lexer_status(fb, s);
+  std::vector<uint8_t> status;
+  const uint8_t status_at_last_row = lex_rows(status, fb, 0, last_row, lexer_normal);
+  lexer_status ls;
+  auto trans = ls.transient();
+  for (uint8_t st : status)
+    trans.push_back(st);
+  trans.push_back(status_at_last_row);
+  for (int64_t row = last_row + 1; row < (int64_t)fb.content.size(); ++row)
+    trans.push_back(lexer_normal);
   fb.lex = trans.persistent();
+  fb.lex_pending = true;
+  fb.lexed_rows = last_row + 1;
+  fb.unlexed_rows = (int64_t)fb.content.size() - fb.lexed_rows;
+  fb.lexed_version = fb.content_version;
   return fb;
   }
 
+int64_t get_lexed_rows(const file_buffer& fb)
+  {
+  const int64_t nr_of_rows = (int64_t)fb.content.size();
+  if (fb.lexed_version == fb.content_version)
+    return std::min(fb.lexed_rows, nr_of_rows);
+  int64_t equal_prefix, equal_suffix;
+  if (!get_equal_rows(equal_prefix, equal_suffix, fb, fb.lexed_version))
+    return 0;
+  if (equal_suffix >= fb.unlexed_rows)
+    return std::max<int64_t>(nr_of_rows - fb.unlexed_rows, 0);
+  return std::min(std::min(fb.lexed_rows, equal_prefix + 1), nr_of_rows);
+  }
+
+uint8_t lex_rows(std::vector<uint8_t>& status, const file_buffer& fb, int64_t first_row, int64_t last_row, uint8_t status_at_first_row)
+  {
+  status.clear();
+  const uint8_t nr_of_statuses = _number_of_lexer_statuses(fb);
+  uint8_t current_status = status_at_first_row < nr_of_statuses ? status_at_first_row : (uint8_t)lexer_normal;
+  if (last_row - first_row < 2 * lexer_rows_per_task)
+    {
+    for (int64_t row = first_row; row < last_row; ++row)
+      {
+      status.push_back(current_status);
+      current_status = _get_end_of_line_lexer_status(fb, row, current_status);
+      }
+    return current_status;
+    }
+  // each task maps the status at its begin to the status at its end, as there are only a few statuses. These maps are
+  // composed in order to find the status at the begin of each task, and the rows of the task are then known as well.
+  // A task that begins with a status that it did not lex far enough is finished during the composition.
+  const uint64_t nr_of_tasks = (uint64_t)((last_row - first_row + lexer_rows_per_task - 1) / lexer_rows_per_task);
+  std::vector<lexer_task> tasks(nr_of_tasks);
+  parallel_for(nr_of_tasks, [&](uint64_t t)
+    {
+    const int64_t task_begin = first_row + (int64_t)t * lexer_rows_per_task;
+    const int64_t task_end = std::min<int64_t>(task_begin + lexer_rows_per_task, last_row);
+    lex_task(tasks[t], fb, task_begin, task_end, nr_of_statuses);
+    });
+  std::vector<uint8_t> status_at_task_begin(nr_of_tasks);
+  for (uint64_t t = 0; t < nr_of_tasks; ++t)
+    {
+    status_at_task_begin[t] = current_status;
+    if (!tasks[t].lexed[current_status])
+      {
+      const int64_t task_begin = first_row + (int64_t)t * lexer_rows_per_task;
+      lex_task_from(tasks[t], fb, task_begin, std::min<int64_t>(task_begin + lexer_rows_per_task, last_row), current_status);
+      }
+    current_status = tasks[t].end[current_status];
+    }
+  status.resize((size_t)(last_row - first_row));
+  parallel_for(nr_of_tasks, [&](uint64_t t)
+    {
+    const lexer_task& task = tasks[t];
+    const std::vector<uint8_t>& begin_status = task.status[status_at_task_begin[t]];
+    auto out = status.begin() + (int64_t)t * lexer_rows_per_task;
+    out = std::copy(begin_status.begin(), begin_status.end(), out);
+    std::copy(task.status[0].begin() + begin_status.size(), task.status[0].end(), out);
+    });
+  return current_status;
+  }
+
 file_buffer update_lexer_status(file_buffer fb, int64_t row, const env_settings& s)
   {
   assert(!fb.content.empty());
   if (!s.perform_syntax_highlighting)
     return fb;
-  if (fb.syntax.single_line.empty() && fb.syntax.multiline_begin.empty() && fb.syntax.multistring_begin.empty())
+  if (!fb.syntax.should_highlight || !fb.syntax.lexer)
     return fb;
 
   auto trans = fb.lex.transient();
@@ -1528,7 +2539,7 @@ file_buffer update_lexer_status(file_buffer fb, int64_t from_row, int64_t to_row
   assert(!fb.content.empty());
   if (!s.perform_syntax_highlighting)
     return fb;
-  if (fb.syntax.single_line.empty() && fb.syntax.multiline_begin.empty() && fb.syntax.multistring_begin.empty())
+  if (!fb.syntax.should_highlight || !fb.syntax.lexer)
     return fb;
 
   auto trans = fb.lex.transient();
@@ -1543,10 +2554,15 @@ file_buffer update_lexer_status(file_buffer fb, int64_t from_row, int64_t to_row
     --to_row;
 
   int64_t r = from_row;
-  for (; r <= to_row; ++r)
+  if (to_row >= from_row)
     {
-    uint8_t eol = _get_end_of_line_lexer_status(fb, r, trans[r]);
-    trans.set(r + 1, eol);
+    // large ranges, as after a big paste or a replace all, are lexed in parallel
+    std::vector<uint8_t> status;
+    const uint8_t eol = lex_rows(status, fb, from_row, to_row + 1, trans[from_row]);
+    for (size_t i = 1; i < status.size(); ++i)
+      trans.set(from_row + (int64_t)i, status[i]);
+    trans.set(to_row + 1, eol);
+    r = to_row + 1;
     }
   for (; r < fb.content.size() - 1; ++r)
     {
@@ -1567,96 +2583,13 @@ std::vector<std::pair<int64_t, text_type>> get_text_type(file_buffer fb, int64_t
     out.emplace_back((int64_t)0, tt_normal);
     return out;
     }
-
-  out.emplace_back((int64_t)0, (text_type)fb.lex[row]);
-  //if (fb.syntax.single_line.empty() && fb.syntax.multiline_begin.empty() && fb.syntax.multistring_begin.empty())
-  //  return out;
-  if (!fb.syntax.should_highlight)
-    return out;
-
-  uint8_t current_status = fb.lex[row];
-  line ln = fb.content[row];
-  auto it = ln.begin();
-  auto prev_it = it;
-  auto prevprev_it = prev_it;
-  auto it_end = ln.end();
-  bool inside_single_line_comment = false;
-  bool inside_single_line_string = false;
-  bool inside_quotes = false;
-  int64_t col = 0;
-  for (; it != it_end; ++it, ++col)
+  if (!fb.syntax.should_highlight || !fb.syntax.lexer)
     {
-    if (inside_single_line_comment)
-      break;
-    if (current_status == lexer_normal)
-      {
-      if (!inside_single_line_string && !inside_quotes && _is_next_word(it, it_end, fb.syntax.multiline_begin))
-        {
-        out.emplace_back((int64_t)col, tt_comment);
-        current_status = lexer_inside_multiline_comment;
-        it += fb.syntax.multiline_begin.length() - 1;
-        col += fb.syntax.multiline_begin.length() - 1;
-        }
-      else if (!inside_single_line_string && !inside_quotes && _is_next_word(it, it_end, fb.syntax.multistring_begin))
-        {
-        out.emplace_back((int64_t)col, tt_string);
-        current_status = lexer_inside_multiline_string;
-        it += fb.syntax.multistring_begin.length() - 1;
-        col += fb.syntax.multistring_begin.length() - 1;
-        }
-      else if (!inside_single_line_string && !inside_quotes && _is_next_word(it, it_end, fb.syntax.single_line))
-        {
-        inside_single_line_comment = true;
-        out.emplace_back((int64_t)col, tt_comment);
-        }
-      else if (!inside_quotes && *it == L'"' && (*prev_it != L'\\' || *prevprev_it == L'\\'))
-        {
-        inside_single_line_string = !inside_single_line_string;
-        if (inside_single_line_string)
-          out.emplace_back((int64_t)col, tt_string);
-        else
-          out.emplace_back((int64_t)col + 1, tt_normal);
-        }
-      else if (fb.syntax.uses_quotes_for_chars && !inside_single_line_string && *it == L'\'' && (*prev_it != L'\\' || *prevprev_it == L'\\'))
-        {
-        inside_quotes = !inside_quotes;
-        if (inside_quotes)
-          out.emplace_back((int64_t)col, tt_string);
-        else
-          out.emplace_back((int64_t)col + 1, tt_normal);
-        }
-      }
-    else if (current_status == lexer_inside_multiline_comment)
-      {
-      if (_is_next_word(it, it_end, fb.syntax.multiline_end))
-        {
-        current_status = lexer_normal;
-        it += fb.syntax.multiline_end.length() - 1;
-        col += fb.syntax.multiline_end.length() - 1;
-        out.emplace_back((int64_t)col + 1, tt_normal);
-        }
-      }
-    else if (current_status == lexer_inside_multiline_string)
-      {
-      if (_is_next_word(it, it_end, fb.syntax.multistring_end))
-        {
-        current_status = lexer_normal;
-        it += fb.syntax.multistring_end.length() - 1;
-        col += fb.syntax.multistring_end.length() - 1;
-        out.emplace_back((int64_t)col + 1, tt_normal);
-        }
-      }
-    prevprev_it = prev_it;
-    prev_it = it;
+    out.emplace_back((int64_t)0, (text_type)fb.lex[row]);
+    return out;
     }
-
+  fb.syntax.lexer->lex(fb.content[row], fb.lex[row], &out);
   std::reverse(out.begin(), out.end());
-  out.erase(std::unique(out.begin(), out.end(), [](const std::pair<int64_t, text_type>& left, const std::pair<int64_t, text_type>& right)
-    {
-    return left.first == right.first;
-    })
-    , out.end());
-
   return out;
   }
 
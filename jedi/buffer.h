@@ -2,14 +2,16 @@
 #include <stdexcept>
 #include <immutable/vector.h>
 #include <vector>
+#include <memory>
 #include <string>
 #include <optional>
 #include <stdint.h>
 
 
-typedef immutable::vector<wchar_t, false, 5> line;
-typedef immutable::vector<immutable::vector<wchar_t, false, 5>, false, 5> text;
-typedef immutable::vector<uint8_t, false, 5> lexer_status;
+// atomic reference counting, so that snapshots of the text can be read on background threads
+typedef immutable::vector<wchar_t, true, 5> line;
+typedef immutable::vector<immutable::vector<wchar_t, true, 5>, true, 5> text;
+typedef immutable::vector<uint8_t, true, 5> lexer_status;
 
 #define lexer_normal 0
 #define lexer_inside_multiline_comment 1
@@ -57,18 +59,63 @@ struct snapshot
   {
   text content;
   lexer_status lex;
+  bool lex_pending; // some rows had a provisional lexer status when the state was stored
   position pos;
   std::optional<position> start_selection;
-  uint8_t modification_mask;
   bool rectangular_selection;
+  uint64_t generation; // identifies this state of the text
+  uint64_t parent; // generation of the state this state was derived from, equal to generation for the root of the undo tree
+  uint64_t redo_child; // generation of the child that redo moves to, equal to generation if redo is not possible
+  uint64_t bytes; // estimate of the memory this state keeps alive next to the memory it shares with its neighbours
+  uint64_t content_version; // of the text when the state was stored
   };
 
+struct keyword_data;
+class syntax_lexer;
+
 struct syntax_settings
   {
-  syntax_settings() : uses_quotes_for_chars(false), should_highlight(false) {}
-  std::string multiline_begin, multiline_end, single_line, multistring_begin, multistring_end;
-  bool uses_quotes_for_chars;
+  syntax_settings() : should_highlight(false), keywords(nullptr) {}
+  std::shared_ptr<const syntax_lexer> lexer; // compiled from jedi_syntax.json once per language, shared by all buffers of the language
   bool should_highlight;
+  const keyword_data* keywords; // resolved from the name of the buffer once, or nullptr if the buffer has no keywords
+  };
+
+class line_width_cache;
+class match_set;
+class offset_index_cache;
+class token_span_cache;
+class trigram_index;
+
+enum e_edit_kind
+  {
+  edit_kind_other,
+  edit_kind_typing,
+  edit_kind_backspace,
+  edit_kind_delete
+  };
+
+/*
+A change of the text: the characters in [first, last) are replaced by txt.
+*/
+struct text_change
+  {
+  position first, last;
+  std::wstring txt;
+  };
+
+/*
+A change that an edit made, kept so that a copy of the text elsewhere, as in a language server, can follow the edits
+without taking the whole text again. See get_changes_since.
+*/
+struct logged_change
+  {
+  uint64_t previous_version; // the content_version before the edit
+  uint64_t version; // the content_version after the edit, one edit can log several changes
+  text_change change; // positions refer to the text after the changes that were logged before
+  int64_t untouched_rows_at_end; // the rows after the last row of the change, which the change does not move from the end
+  std::shared_ptr<const logged_change> previous; // the change that was logged before, shared by the copies of the buffer
+  uint32_t nr_of_changes; // the length of the log up to and including this change
   };
 
 struct file_buffer
@@ -81,9 +128,31 @@ struct file_buffer
   position pos;
   int64_t xpos;
   std::optional<position> start_selection;  
-  uint64_t undo_redo_index;
+  uint64_t generation;
+  uint64_t parent_generation;
+  uint64_t next_generation;
+  std::optional<uint64_t> saved_generation;
+  uint64_t history_bytes;
   uint8_t modification_mask;
   bool rectangular_selection;
+  uint8_t last_edit_kind; // consecutive typing, backspace or delete edits are coalesced into one undo snapshot
+  position last_edit_pos;
+  int64_t last_edit_time;
+  uint64_t content_version; // unique over all buffers, changes with each edit of content
+  std::shared_ptr<const trigram_index> trigrams; // can belong to an older content_version, in which case it is not used for searching
+  uint64_t trigram_request; // content_version for which a trigram index is being built, or 0
+  std::shared_ptr<const match_set> matches; // occurrences of the last find, can belong to an older content_version
+  uint64_t match_request; // identifies the match set that is being built, or 0
+  bool lex_pending; // some rows have a provisional lexer status, until the rows are lexed in the background
+  uint64_t lex_request; // content_version for which the rows are being lexed in the background, or 0
+  int64_t lexed_rows; // the rows at the top that had their final lexer status in content_version lexed_version
+  int64_t unlexed_rows; // the rows after these in content_version lexed_version
+  uint64_t lexed_version;
+  uint64_t load_request; // content_version of the empty buffer that is filled when its file is read in the background, or 0
+  std::shared_ptr<token_span_cache> token_spans; // the token spans of the rows that were drawn, shared by the copies of the buffer
+  std::shared_ptr<line_width_cache> line_widths; // the display widths of the long rows that were measured, shared by the copies of the buffer
+  std::shared_ptr<offset_index_cache> offsets; // the offset_index of the last content_version that needed one, shared by the copies of the buffer
+  std::shared_ptr<const logged_change> changes; // the last edits of content, newest first, cleared when there are too many
   };
 
 struct env_settings
@@ -99,6 +168,39 @@ int64_t line_length_up_to_column(line ln, int64_t column, const env_settings& s)
 
 int64_t get_col_from_line_length(line ln, int64_t length, const env_settings& s);
 
+int64_t line_length_up_to_column(const file_buffer& fb, int64_t row, int64_t column, const env_settings& s); // same result for fb.content[row], through fb.line_widths
+
+int64_t get_col_from_line_length(const file_buffer& fb, int64_t row, int64_t length, const env_settings& s); // same result for fb.content[row], through fb.line_widths
+
+size_t hash_line(const line& ln); // of the characters of ln, for the caches that are keyed on the content of a row
+
+/*
+Index of the display widths of one line, for code that converts between columns and x positions of the same line
+many times, like draw_line or the rectangular selection code. The x position at every checkpoint_distance-th column
+is remembered when it is first needed, so a conversion costs O(log n) plus a scan of at most checkpoint_distance
+characters. Leading characters of width 1 (no tabs, and no newlines when all characters are shown) are converted in O(1).
+Tab widths depend on env_settings::tab_space, so an index must not outlive a change of the settings it was made with.
+*/
+class line_width_index
+  {
+  public:
+    line_width_index(line ln, const env_settings& s);
+
+    int64_t line_length_up_to_column(int64_t column); // same result as the free function with the same name
+
+    int64_t get_col_from_line_length(int64_t length); // same result as the free function with the same name
+
+  private:
+    void add_checkpoints(int64_t column);
+
+  private:
+    enum { checkpoint_distance = 64 };
+    line _ln;
+    env_settings _s;
+    std::vector<int64_t> _checkpoints; // _checkpoints[i] is the x position of column i*checkpoint_distance
+    int64_t _plain_columns; // the first _plain_columns characters have width 1
+  };
+
 int64_t get_x_position(file_buffer fb, const env_settings& s);
 
 bool in_selection(file_buffer fb, position current, position cursor, position buffer_pos, std::optional<position> start_selection, bool rectangular, const env_settings& s);
@@ -123,8 +225,18 @@ file_buffer make_empty_buffer();
 
 file_buffer read_from_file(std::string filename);
 
+std::vector<file_buffer> read_from_files(const std::vector<std::string>& filenames); // reads the files in parallel
+
 file_buffer save_to_file(bool& success, file_buffer fb, const std::string& filename);
 
+bool write_to_file(text content, const std::string& filename); // atomic, can be called from any thread
+
+file_buffer mark_saved(file_buffer fb);
+
+file_buffer mark_modified(file_buffer fb);
+
+file_buffer set_text(file_buffer fb, text txt); // replaces the content without undo, as for the command windows
+
 file_buffer start_selection(file_buffer fb);
 
 file_buffer clear_selection(file_buffer fb);
@@ -139,7 +251,9 @@ file_buffer erase(file_buffer fb, const env_settings& s, bool save_undo = true);
 
 file_buffer erase_right(file_buffer fb, const env_settings& s, bool save_undo = true);
 
-file_buffer push_undo(file_buffer fb);
+file_buffer push_undo(file_buffer fb); // starts a new undo group
+
+file_buffer push_undo(file_buffer fb, e_edit_kind kind, bool word_boundary); // joins the current undo group if it is a continuation of the last edit
 
 text get_selection(file_buffer fb, const env_settings& s);
 
@@ -147,6 +261,24 @@ file_buffer undo(file_buffer fb, const env_settings& s);
 
 file_buffer redo(file_buffer fb, const env_settings& s);
 
+file_buffer undo_earlier(file_buffer fb, const env_settings& s); // moves to the previous state in time, crossing over to abandoned branches of the undo tree
+
+file_buffer redo_later(file_buffer fb, const env_settings& s); // moves to the next state in time
+
+bool can_undo(file_buffer fb);
+
+bool can_redo(file_buffer fb);
+
+/*
+The history is an undo tree: undo moves to the parent state, redo to the child that was visited last, and editing
+after undo starts a new branch instead of dropping the redo states.
+history_memory_used returns an estimate of the memory held by the history on top of the memory of the current text.
+trim_history drops the oldest states until this estimate is below max_bytes. The current state is never dropped.
+*/
+uint64_t history_memory_used(file_buffer fb);
+
+file_buffer trim_history(file_buffer fb, uint64_t max_bytes);
+
 file_buffer select_all(file_buffer fb, const env_settings& s);
 
 file_buffer move_left(file_buffer fb, const env_settings& s);
@@ -187,6 +319,20 @@ std::wstring to_wstring(text txt);
 
 std::wstring to_wstring(text txt, position from, position to);
 
+/*
+Sets equal_prefix and equal_suffix to the number of rows at the start and at the end that are equal in both texts,
+so that rows [equal_prefix, previous.size() - equal_suffix) of previous became rows [equal_prefix, txt.size() - equal_suffix) of txt.
+*/
+void get_equal_rows(int64_t& equal_prefix, int64_t& equal_suffix, text previous, text txt);
+
+/*
+Sets equal_prefix and equal_suffix as above for the text with content_version version and the text of fb, from the
+change log of fb instead of by comparing rows. The rows that an edit touched count as changed. Returns false if the
+changes since version are not known, and then the rows have to be compared. equal_prefix and equal_suffix can exceed
+the number of rows that both texts have.
+*/
+bool get_equal_rows(int64_t& equal_prefix, int64_t& equal_suffix, const file_buffer& fb, uint64_t version);
+
 position find_next_occurence_reverse(text txt, position starting_pos, const std::wstring& wtxt_to_find);
 
 position find_next_occurence(text txt, position starting_pos, const std::wstring& wtxt_to_find);
@@ -203,6 +349,39 @@ file_buffer find_text_case_insensitive(file_buffer fb, const std::wstring& wtxt)
 
 file_buffer find_text_case_insensitive(file_buffer fb, const std::string& txt);
 
+/*
+Selects the next match of the regular expression pattern after the cursor, and wraps around at the end of the text.
+Throws text_regex_error if pattern is not a valid regular expression.
+*/
+file_buffer find_regex(file_buffer fb, const std::wstring& pattern, bool case_sensitive);
+
+/*
+Replaces all occurrences of find that lie between first and last (both inclusive) by replacement, in one pass over the text.
+Only the lines that contain an occurrence are rebuilt, and the lexer status is updated once over the changed rows.
+If anything is replaced, one undo snapshot is pushed, and the cursor is put after the last replacement.
+*/
+file_buffer replace_text(file_buffer fb, const std::wstring& find, const std::wstring& replacement, bool case_sensitive, position first, position last, const env_settings& s);
+
+file_buffer replace_text(file_buffer fb, const std::wstring& find, const std::wstring& replacement, bool case_sensitive, const env_settings& s); // the whole text
+
+/*
+Appends the characters of txt in [from, to) to wtxt.
+*/
+void append_text(std::wstring& wtxt, text txt, position from, position to);
+
+/*
+Applies changes that are sorted and do not overlap, and whose positions all refer to the text before any change, in one
+pass over the text as replace_text does. If anything changes and save_undo is true, one undo snapshot is pushed.
+*/
+file_buffer apply_changes(file_buffer fb, const std::vector<text_change>& changes, const env_settings& s, bool save_undo = true);
+
+/*
+Fills changes with the changes that turn the text with content_version version into the text of fb, to be applied one
+after the other. Returns false if they are not known, as after an undo, a rectangular edit or very many edits, and then
+the whole text has to be taken again.
+*/
+bool get_changes_since(std::vector<text_change>& changes, const file_buffer& fb, uint64_t version);
+
 position find_next_occurence(text txt, position starting_pos, wchar_t ch);
 
 position find_next_occurence(file_buffer fb, position starting_pos, wchar_t ch);
@@ -223,6 +402,27 @@ uint8_t get_end_of_line_lexer_status(file_buffer fb, int64_t row);
 
 file_buffer init_lexer_status(file_buffer fb, const env_settings& s);
 
+/*
+Lexes the rows up to last_row only, and gives the other rows the provisional status lexer_normal, so that a large file
+can be shown before it is lexed completely. fb.lex_pending is set if rows are left, they can be lexed with lex_rows.
+*/
+file_buffer init_lexer_status(file_buffer fb, int64_t last_row, const env_settings& s);
+
+/*
+Returns the number of rows at the top of fb whose lexer status is final while fb.lex_pending is set. These are the rows
+that were lexed from the top in content_version fb.lexed_version, up to the first row that was edited since, or
+shifted by the rows that were inserted or erased if all edits were made in these rows, as an edit updates the statuses
+of the rows after it until they agree with the statuses from before.
+*/
+int64_t get_lexed_rows(const file_buffer& fb);
+
+/*
+Fills status with the lexer status at the begin of the rows [first_row, last_row), when first_row begins with
+status_at_first_row, and returns the status at the begin of last_row. Only reads fb, so it can run on a copy of fb
+on a background thread. Large ranges are split over the hardware threads.
+*/
+uint8_t lex_rows(std::vector<uint8_t>& status, const file_buffer& fb, int64_t first_row, int64_t last_row, uint8_t status_at_first_row);
+
 file_buffer update_lexer_status(file_buffer fb, int64_t row, const env_settings& s);
 
 file_buffer update_lexer_status(file_buffer fb, int64_t from_row, int64_t to_row, const env_settings& s);
@@ -231,7 +431,11 @@ enum text_type
   {
   tt_normal,
   tt_comment,
-  tt_string
+  tt_string,
+  tt_keyword_1,
+  tt_keyword_2,
+  tt_number,
+  tt_preprocessor
   };
 
 /*
@@ -246,6 +450,11 @@ This method looks for corresponding tokens, inside the range (minrow, maxrow).
 */
 position find_corresponding_token(file_buffer fb, position tokenpos, int64_t minrow, int64_t maxrow);
 
+/*
+Returns true if ch ends the word that read_next_word reads.
+*/
+bool is_word_separator(wchar_t ch);
+
 std::wstring read_next_word(line::const_iterator it, line::const_iterator it_end);
 
 position get_indentation_at_row(file_buffer fb, int64_t row);
@@ -4,6 +4,30 @@
 #include "jtk/file_utils.h"
 #include "draw.h" // for getting the syntax highlighter
 
+#include <algorithm>
+
+namespace
+  {
+  /*
+  The completions of the language server that start with prefix come first, followed by the other suggestions.
+  */
+  std::vector<std::wstring> merge_suggestions(const std::wstring& prefix, const std::vector<std::wstring>& server_suggestions, const std::vector<std::wstring>& suggestions)
+    {
+    std::vector<std::wstring> merged;
+    for (const auto& w : server_suggestions)
+      {
+      if (w.compare(0, prefix.size(), prefix) == 0 && std::find(merged.begin(), merged.end(), w) == merged.end())
+        merged.push_back(w);
+      }
+    for (const auto& w : suggestions)
+      {
+      if (std::find(merged.begin(), merged.end(), w) == merged.end())
+        merged.push_back(w);
+      }
+    return merged;
+    }
+  }
+
 bool valid_word_for_tree(const std::wstring& w)
   {
   return w.size() > 2;
@@ -80,6 +104,14 @@ std::wstring code_completion(const std::wstring& prefix, buffer_data& d)
     {
     if (prefix == d.code_completion.last_suggestions[d.code_completion.last_suggestion_index])
       {
+      if (!d.code_completion.server_suggestions.empty())
+        {
+        // the language server answered after the last suggestion was shown, its completions are shown first now
+        d.code_completion.last_suggestions = merge_suggestions(d.code_completion.last_prefix, d.code_completion.server_suggestions, d.code_completion.last_suggestions);
+        d.code_completion.server_suggestions.clear();
+        d.code_completion.last_suggestion_index = (d.code_completion.last_suggestions.size() > 1 && d.code_completion.last_suggestions.front() == prefix) ? 1 : 0;
+        return d.code_completion.last_suggestions[d.code_completion.last_suggestion_index];
+        }
       ++d.code_completion.last_suggestion_index;
       if (d.code_completion.last_suggestion_index >= d.code_completion.last_suggestions.size())
         d.code_completion.last_suggestion_index = 0;
@@ -88,8 +120,11 @@ std::wstring code_completion(const std::wstring& prefix, buffer_data& d)
     }
   add_syntax_to_trie(d.code_completion.t, d.buffer.name);
   add_buffer_to_trie(d.code_completion.t, d.buffer);
+  if (prefix != d.code_completion.last_prefix)
+    d.code_completion.server_suggestions.clear();
   d.code_completion.last_prefix = prefix;
-  d.code_completion.last_suggestions = d.code_completion.t.predict(prefix, 10);
+  d.code_completion.last_suggestions = merge_suggestions(prefix, d.code_completion.server_suggestions, d.code_completion.t.predict(prefix, 10));
+  d.code_completion.server_suggestions.clear();
   d.code_completion.last_suggestion_index = 0;
   if (d.code_completion.last_suggestions.empty())
     return std::wstring();
@@ -12,6 +12,7 @@ struct code_completion_data
   std::wstring last_prefix;
   uint32_t last_suggestion_index;
   std::vector<std::wstring> last_suggestions;
+  std::vector<std::wstring> server_suggestions; // completions of the language server for last_prefix, merged in at the next completion
   };
 
 void add_buffer_to_trie(trie& t, const file_buffer& b);
@@ -70,6 +70,8 @@ void init_colors(const settings& s)
 
   init_pair(scroll_bar_b_editor, jedi_scrollbar_background, jedi_editor_bg);
   init_pair(scroll_bar_f_editor, jedi_scrollbar, jedi_editor_bg);
+  init_pair(scroll_bar_match_editor, jedi_editor_tag, jedi_editor_bg);
+  init_pair(match_editor, jedi_editor_text, jedi_command_bg);
   
   init_pair(command_plus, jedi_plus, jedi_command_bg);
   init_pair(column_command_plus, jedi_plus, jedi_column_command_bg);
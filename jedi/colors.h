@@ -29,7 +29,9 @@ enum e_color
   topline_command_icon,
   topline_command_icon_modified,
   editor_icon,
-  editor_icon_modified
+  editor_icon_modified,
+  match_editor,
+  scroll_bar_match_editor
   };
   
 enum jedi_colors
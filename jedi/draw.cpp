@@ -1,7 +1,9 @@
 #include "draw.h"
 #include "pdcex.h"
 #include "colors.h"
+#include "match_set.h"
 #include "syntax_highlight.h"
+#include "token_span_cache.h"
 #include "utils.h"
 #include <SDL.h>
 #include <SDL_syswm.h>
@@ -25,6 +27,43 @@ extern "C"
 #define COLUMN_COMMAND_COLOR (A_NORMAL | COLOR_PAIR(column_command_color))
 
 
+namespace
+  {
+  /*
+  Returns the occurrences of the last find in the buffer of window w, or nullptr if they should not be shown, or if
+  they are still being computed for the current content or find.
+  */
+  const match_set* get_shown_match_set(const window& w, const buffer_data& bd, const settings& s)
+    {
+    if (!s.highlight_matches || w.wt != e_window_type::wt_normal)
+      return nullptr;
+    const match_set* matches = get_match_set(bd.buffer);
+    if (!matches || matches->size() == 0 || matches->case_sensitive() != s.case_sensitive || matches->pattern() != jtk::convert_string_to_wstring(s.last_find))
+      return nullptr;
+    return matches;
+    }
+
+  /*
+  Returns "n of m" for the hit of an incremental search in fb, or "n of ..." while the occurrences are being counted.
+  */
+  std::string get_match_count_text(const file_buffer& fb, const settings& s)
+    {
+    const std::wstring pattern = jtk::convert_string_to_wstring(s.last_find);
+    if (pattern.empty())
+      return std::string();
+    const match_set* matches = get_match_set(fb);
+    const bool counted = matches && matches->pattern() == pattern && matches->case_sensitive() == s.case_sensitive;
+    if (counted && matches->size() == 0)
+      return std::string("no matches");
+    if (fb.start_selection == std::nullopt)
+      return counted ? std::to_string(matches->size()) + " matches" : std::string();
+    const position hit = *fb.start_selection < fb.pos ? *fb.start_selection : fb.pos;
+    std::string total = counted ? std::to_string(matches->size()) : std::string("...");
+    std::string nr = counted ? std::to_string(matches->count_before(hit) + 1) : std::string("?");
+    return nr + " of " + total;
+    }
+  }
+
 const syntax_highlighter& get_syntax_highlighter()
   {
   static syntax_highlighter s;
@@ -39,43 +78,36 @@ file_buffer set_multiline_comments(file_buffer fb)
   std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (unsigned char)std::tolower(c); });
   std::transform(filename.begin(), filename.end(), filename.begin(), [](unsigned char c) { return (unsigned char)std::tolower(c); });
   const syntax_highlighter& shl = get_syntax_highlighter();
-  comment_data cd;
   fb.syntax.should_highlight = false;
+  fb.syntax.lexer.reset();
   if (shl.extension_or_filename_has_syntax_highlighter(ext))
     {
-    cd = shl.get_syntax_highlighter(ext);
+    fb.syntax.lexer = shl.get_syntax_highlighter(ext);
     fb.syntax.should_highlight = true;
     }
   else if (shl.extension_or_filename_has_syntax_highlighter(filename))
     {
-    cd = shl.get_syntax_highlighter(filename);
+    fb.syntax.lexer = shl.get_syntax_highlighter(filename);
     fb.syntax.should_highlight = true;
     }
-  fb.syntax.multiline_begin = cd.multiline_begin;
-  fb.syntax.multiline_end = cd.multiline_end;
-  fb.syntax.multistring_begin = cd.multistring_begin;
-  fb.syntax.multistring_end = cd.multistring_end;
-  fb.syntax.single_line = cd.single_line;
-  fb.syntax.uses_quotes_for_chars = cd.uses_quotes_for_chars;
+  fb.syntax.keywords = nullptr;
+  if (shl.extension_or_filename_has_keywords(ext))
+    fb.syntax.keywords = &shl.get_keywords(ext);
+  else if (shl.extension_or_filename_has_keywords(filename))
+    fb.syntax.keywords = &shl.get_keywords(filename);
   return fb;
   }
 
 
-const keyword_data& get_keywords(const std::string& name, const env_settings& senv)
+/*
+Returns the keywords that set_multiline_comments resolved for fb, so that the name is not looked up on every draw.
+*/
+const keyword_data& get_keywords(const file_buffer& fb, const env_settings& senv)
   {
   static keyword_data empty;
-  if (!senv.perform_syntax_highlighting)
+  if (!senv.perform_syntax_highlighting || !fb.syntax.keywords)
     return empty;
-  auto ext = jtk::get_extension(name);
-  auto filename = jtk::get_filename(name);
-  std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (unsigned char)std::tolower(c); });
-  std::transform(filename.begin(), filename.end(), filename.begin(), [](unsigned char c) { return (unsigned char)std::tolower(c); });
-  const syntax_highlighter& shl = get_syntax_highlighter();
-  if (shl.extension_or_filename_has_keywords(ext))
-    return shl.get_keywords(ext);
-  if (shl.extension_or_filename_has_keywords(filename))
-    return shl.get_keywords(filename);
-  return empty;
+  return *fb.syntax.keywords;
   }
 
 uint16_t character_to_pdc_char(uint32_t character, uint32_t char_id, const settings& s)
@@ -178,10 +210,13 @@ Returns an x offset (let's call it multiline_offset_x) such that
 equals the x position in the screen of where the next character should come.
 This makes it possible to further fill the line with spaces after calling "draw_line".
  */
-int draw_line(int& wide_characters_offset, file_buffer fb, uint32_t buffer_id, position& current, position cursor, position buffer_pos, position underline, chtype base_color, int& r, int yoffset, int xoffset, int maxcol, int maxrow, std::optional<position> start_selection, bool rectangular, int active, screen_ex_type set_type, e_window_type wt, const keyword_data& kd, bool wrap, const settings& s, const env_settings& senv, int wx, int wy)
+int draw_line(int& wide_characters_offset, file_buffer fb, uint32_t buffer_id, position& current, position cursor, position buffer_pos, position underline, chtype base_color, int& r, int yoffset, int xoffset, int maxcol, int maxrow, std::optional<position> start_selection, bool rectangular, int active, screen_ex_type set_type, e_window_type wt, const keyword_data& kd, const match_set* matches, bool wrap, const settings& s, const env_settings& senv, int wx, int wy)
   {
   int MULTILINEOFFSET = 10;
-  auto tt = get_text_type(fb, current.row, senv);
+  token_spans uncached_spans;
+  if (!fb.token_spans)
+    get_token_spans(uncached_spans, fb, current.row, kd.matcher, senv);
+  const token_spans& spans = fb.token_spans ? fb.token_spans->get(fb, current.row, kd.matcher, senv) : uncached_spans;
 
   line ln = fb.content[current.row];
   int multiline_tag = (int)multiline_tag_editor;
@@ -195,7 +230,7 @@ int draw_line(int& wide_characters_offset, file_buffer fb, uint32_t buffer_id, p
   wide_characters_offset = 0;
   bool has_selection = (start_selection != std::nullopt) && (cursor.row >= 0) && (cursor.col >= 0);
 
-  int64_t len = line_length_up_to_column(ln, maxcol - 1, senv);
+  int64_t len = line_length_up_to_column(fb, current.row, maxcol - 1, senv);
   
   if (wrap && (len >= (maxcol - 1)))
     {
@@ -262,7 +297,7 @@ int draw_line(int& wide_characters_offset, file_buffer fb, uint32_t buffer_id, p
     }
     if (pagewidth <= 0)
       return xoffset;
-    int64_t len_to_cursor = line_length_up_to_column(ln, multiline_ref_col - 1, senv);
+    int64_t len_to_cursor = line_length_up_to_column(fb, current.row, multiline_ref_col - 1, senv);
     page = len_to_cursor / pagewidth;
     if (page != 0)
       {
@@ -276,8 +311,8 @@ int draw_line(int& wide_characters_offset, file_buffer fb, uint32_t buffer_id, p
       else
         {
         int offset = page * pagewidth - MULTILINEOFFSET / 2;
-        current.col = get_col_from_line_length(ln, offset, senv);
-        int64_t length_done = line_length_up_to_column(ln, current.col - 1, senv);
+        current.col = get_col_from_line_length(fb, current.row, offset, senv);
+        int64_t length_done = line_length_up_to_column(fb, current.row, current.col - 1, senv);
         it += current.col;
         wide_characters_offset = length_done - (current.col - 1);
         xoffset -= current.col + wide_characters_offset;
@@ -293,62 +328,56 @@ int draw_line(int& wide_characters_offset, file_buffer fb, uint32_t buffer_id, p
     --maxcol;
     }
 
-  int drawn = 0;
-  auto current_tt = tt.back();
-  assert(current_tt.first == 0);
-  tt.pop_back();
+  // the bounds of a rectangular selection are computed once per line instead of once per character
+  int64_t rect_min_row = 0, rect_max_row = -1, rect_min_x = 0, rect_max_x = 0;
+  if (start_selection && rectangular)
+    get_rectangular_selection(rect_min_row, rect_max_row, rect_min_x, rect_max_x, fb, *start_selection, buffer_pos, senv);
+  auto is_selected = [&](position p)
+    {
+    if (!rectangular)
+      return in_selection(fb, p, cursor, buffer_pos, start_selection, rectangular, senv);
+    if (p.row < rect_min_row || p.row > rect_max_row)
+      return false;
+    int64_t xpos = line_length_up_to_column(fb, current.row, p.col - 1, senv);
+    return rect_min_x <= xpos && xpos <= rect_max_x;
+    };
+
+  std::vector<int64_t> match_columns;
+  if (matches)
+    matches->get_matches(match_columns, current.row);
+  auto in_match = [&](int64_t col)
+    {
+    auto m = std::upper_bound(match_columns.begin(), match_columns.end(), col);
+    return m != match_columns.begin() && *(m - 1) + (int64_t)matches->pattern().size() > col;
+    };
 
-  int next_word_read_length_remaining = 0;
-  bool keyword_type_1 = false;
-  bool keyword_type_2 = false;
+  int drawn = 0;
+  assert(spans.front().first == 0);
+  size_t current_span = 0;
 
   for (; it != it_end; ++it)
     {
-    if (next_word_read_length_remaining > 0)
-      --next_word_read_length_remaining;
     if (!wrap && drawn >= maxcol)
       break;
 
-    while (!tt.empty() && tt.back().first <= current.col)
-      {
-      current_tt = tt.back();
-      tt.pop_back();
-      }
-
-    if (!(kd.keywords_1.empty() && kd.keywords_2.empty()) && current_tt.second == tt_normal && next_word_read_length_remaining == 0)
-      {
-      keyword_type_1 = false;
-      keyword_type_2 = false;
-      std::wstring next_word = read_next_word(it, it_end);
-      next_word_read_length_remaining = next_word.length();
-      auto it = std::lower_bound(kd.keywords_1.begin(), kd.keywords_1.end(), next_word);
-      if (it != kd.keywords_1.end() && *it == next_word)
-        keyword_type_1 = true;
-      else
-        {
-        it = std::lower_bound(kd.keywords_2.begin(), kd.keywords_2.end(), next_word);
-        if (it != kd.keywords_2.end() && *it == next_word)
-          keyword_type_2 = true;
-        }
-      }
+    while (current_span + 1 < spans.size() && spans[current_span + 1].first <= current.col)
+      ++current_span;
 
-    switch (current_tt.second)
+    switch (spans[current_span].second)
       {
-      case tt_normal:
-      {
-      if (keyword_type_1)
-        attron(COLOR_PAIR(keyword_color));
-      else if (keyword_type_2)
-        attron(COLOR_PAIR(keyword_2_color));
-      else
-        attron(base_color);
-      break;
-      }
+      case tt_normal: attron(base_color); break;
+      case tt_keyword_1: attron(COLOR_PAIR(keyword_color)); break;
+      case tt_keyword_2: attron(COLOR_PAIR(keyword_2_color)); break;
       case tt_string: attron(COLOR_PAIR(string_color)); break;
       case tt_comment: attron(COLOR_PAIR(comment_color)); break;
+      case tt_number: attron(COLOR_PAIR(string_color)); break;
+      case tt_preprocessor: attron(COLOR_PAIR(keyword_2_color)); break;
       }
 
-    if (active && in_selection(fb, current, cursor, buffer_pos, start_selection, rectangular, senv))
+    if (!match_columns.empty() && in_match(current.col))
+      attron(COLOR_PAIR(match_editor));
+
+    if (active && is_selected(current))
       attron(A_REVERSE);
     else
       attroff(A_REVERSE);
@@ -401,7 +430,7 @@ int draw_line(int& wide_characters_offset, file_buffer fb, uint32_t buffer_id, p
     }
   attroff(A_UNDERLINE | A_ITALIC);
 
-  if (!in_selection(fb, current, cursor, buffer_pos, start_selection, rectangular, senv))
+  if (!is_selected(current))
     attroff(A_REVERSE);
 
   if (multiline && (it != it_end))
@@ -419,6 +448,7 @@ int draw_line(int& wide_characters_offset, file_buffer fb, uint32_t buffer_id, p
   
 void draw_scroll_bars(const window& w, const buffer_data& bd, const settings& s, const env_settings& senv, int active) {
   const unsigned char scrollbar_ascii_sign = 219;
+  const unsigned char match_density_signs[4] = { 176, 177, 178, 219 };
   int maxrow = w.rows;
   int maxcol = w.cols;
   int scroll1 = 0;
@@ -435,6 +465,25 @@ void draw_scroll_bars(const window& w, const buffer_data& bd, const settings& s,
     scroll2 = maxrow - 1;
 
 
+  // the number of occurrences of the last find in the rows that each row of the scroll bar covers
+  std::vector<uint64_t> match_density;
+  uint64_t max_match_density = 0;
+  if (const match_set* matches = get_shown_match_set(w, bd, s))
+    {
+    match_density.resize(maxrow);
+    const int64_t nr_of_rows = (int64_t)bd.buffer.content.size();
+    for (int r = 0; r < maxrow; ++r)
+      {
+      const int64_t first_row = (int64_t)((double)r*(double)nr_of_rows / (double)maxrow);
+      int64_t last_row = (int64_t)((double)(r + 1)*(double)nr_of_rows / (double)maxrow);
+      if (last_row <= first_row)
+        last_row = first_row + 1;
+      match_density[r] = matches->count(first_row, last_row);
+      if (match_density[r] > max_match_density)
+        max_match_density = match_density[r];
+      }
+    }
+
   attron(COLOR_PAIR(scroll_bar_b_editor));
 
   for (int r = 0; r < maxrow; ++r)
@@ -455,7 +504,15 @@ void draw_scroll_bars(const window& w, const buffer_data& bd, const settings& s,
       }
 
     add_ex(position(rowpos, 0), bd.buffer_id, SET_SCROLLBAR_EDITOR);
-    addch(ascii_to_utf16(scrollbar_ascii_sign));
+    if (!match_density.empty() && match_density[r] > 0)
+      {
+      const uint64_t level = (4 * match_density[r] + max_match_density - 1) / max_match_density;
+      attron(COLOR_PAIR(scroll_bar_match_editor));
+      addch(ascii_to_utf16(match_density_signs[level - 1]));
+      attron(COLOR_PAIR((r >= scroll1 && r <= scroll2) ? scroll_bar_f_editor : scroll_bar_b_editor));
+      }
+    else
+      addch(ascii_to_utf16(scrollbar_ascii_sign));
 
     move(r + w.y, 1+w.x);
     add_ex(position(rowpos, 0), bd.buffer_id, SET_SCROLLBAR_EDITOR);
@@ -506,7 +563,10 @@ void draw_window(const app_state& state, const window& w, const buffer_data& bd,
     underline = find_corresponding_token(bd.buffer, cursor, current.row, current.row + maxrow - 1);
     }
 
-  const keyword_data& kd = get_keywords(bd.buffer.name, senv);
+  // a command window shows the keywords of its editor window
+  const bool command = w.wt == e_window_type::wt_command && w.buffer_id + 1 < (uint32_t)state.buffers.size();
+  const keyword_data& kd = get_keywords(command ? state.buffers[w.buffer_id + 1].buffer : bd.buffer, senv);
+  const match_set* matches = get_shown_match_set(w, bd, s);
   
   screen_ex_type set_type = SET_TEXT_EDITOR;
   if (is_command_window(w.wt))
@@ -607,7 +667,7 @@ void draw_window(const app_state& state, const window& w, const buffer_data& bd,
     int wide_characters_offset = 0;
     int multiline_offset_x = draw_line(wide_characters_offset, bd.buffer, bd.buffer_id, current, cursor, bd.buffer.pos, underline,
     main_color, r, offset_y, offset_x, maxcol, maxrow, bd.buffer.start_selection,
-    bd.buffer.rectangular_selection, active, set_type, w.wt, kd, s.wrap, s, senv, w.x, w.y);
+    bd.buffer.rectangular_selection, active, set_type, w.wt, kd, matches, s.wrap, s, senv, w.x, w.y);
 
     int x = (int)current.col + multiline_offset_x + wide_characters_offset;
     if (!has_nontrivial_selection && (current == cursor))
@@ -658,12 +718,12 @@ void draw_window(const app_state& state, const window& w, const buffer_data& bd,
 }
 
 
-std::string get_operation_text(e_operation op)
+std::string get_operation_text(e_operation op, const settings& s)
   {
   switch (op)
     {
     case op_edit: return std::string("Edit: ");
-    case op_find: return std::string("Find: ");
+    case op_find: return std::string(s.regex_find ? "Find regex: " : "Find: ");
     case op_incremental_search: return std::string("Incremental search: ");
     case op_replace: return std::string("Replace: ");
     case op_replace_find: return std::string("Find:  ");
@@ -768,7 +828,7 @@ void draw_operation_buffer(const app_state& state, const settings& s) {
     position current;
     current.col = 0;
     current.row = 0;
-    std::string txt = get_operation_text(state.operation);
+    std::string txt = get_operation_text(state.operation, s);
     move((int)rows - 2, 0);
     attrset(DEFAULT_COLOR);
     for (auto ch : txt)
@@ -779,7 +839,7 @@ void draw_operation_buffer(const app_state& state, const settings& s) {
     int cols_available = cols - txt.length();
     int wide_characters_offset = 0;
     int multiline_offset_x = txt.length();
-    keyword_data kd;
+    static const keyword_data kd;
     if (!state.operation_buffer.content.empty())
     /*
       int multiline_offset_x = draw_line(wide_characters_offset, bd.buffer, bd.buffer_id, current, cursor, bd.buffer.pos, underline,
@@ -787,7 +847,7 @@ void draw_operation_buffer(const app_state& state, const settings& s) {
     bd.buffer.rectangular_selection, active, set_type, kd, s.wrap, s, senv, w.x, w.y);
 
      */
-      multiline_offset_x = draw_line(wide_characters_offset, state.operation_buffer, buffer_id, current, cursor, state.operation_buffer.pos, position(-1, -1), DEFAULT_COLOR, rows, - 2, multiline_offset_x, cols_available, 1, state.operation_buffer.start_selection, state.operation_buffer.rectangular_selection, true, SET_TEXT_OPERATION, e_window_type::wt_normal, kd, 0, s, convert(s), 0, 0);
+      multiline_offset_x = draw_line(wide_characters_offset, state.operation_buffer, buffer_id, current, cursor, state.operation_buffer.pos, position(-1, -1), DEFAULT_COLOR, rows, - 2, multiline_offset_x, cols_available, 1, state.operation_buffer.start_selection, state.operation_buffer.rectangular_selection, true, SET_TEXT_OPERATION, e_window_type::wt_normal, kd, nullptr, 0, s, convert(s), 0, 0);
     int x = (int)current.col + multiline_offset_x + wide_characters_offset;
     if ((current == cursor))
       {
@@ -807,6 +867,22 @@ void draw_operation_buffer(const app_state& state, const settings& s) {
       ++current.col;
       ++x;
       }
+    if (state.operation == op_incremental_search)
+      {
+      std::string count = get_match_count_text(state.buffers[buffer_id].buffer, s);
+      int count_x = cols - (int)count.length() - 1;
+      int pattern_end = (int)txt.length() + (state.operation_buffer.content.empty() ? 0 : (int)state.operation_buffer.content[0].size()) + 1;
+      if (count_x > pattern_end)
+        {
+        attrset(DEFAULT_COLOR);
+        for (auto ch : count)
+          {
+          move((int)rows - 2, count_x++);
+          add_ex(position(), buffer_id, SET_NONE);
+          addch(ch);
+          }
+        }
+      }
     }
   else
     {
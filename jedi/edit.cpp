@@ -1,10 +1,15 @@
 #include "edit.h"
+#include "encoding.h"
+#include "offset_index.h"
+#include "parallel.h"
+#include "text_regex.h"
+#include "trigram_index.h"
 
+#include <algorithm>
 #include <functional>
 #include <inttypes.h>
 #include <stdio.h>
 #include <sstream>
-#include <regex>
 #include <iterator>
 
 void throw_error(error_type t, std::string extra)
@@ -33,6 +38,9 @@ void throw_error(error_type t, std::string extra)
     case pipe_error:
       str << "Pipe error";
       break;
+    case changes_not_in_sequence:
+      str << "Changes not in sequence";
+      break;
     case invalid_address:
       str << "Invalid address";
       break;
@@ -97,6 +105,16 @@ std::string _treat_escape_characters(std::string s)
   return str.str();
 }
 
+/*
+Returns true if tokens[i] is the s command, or the number that follows it.
+*/
+bool is_substitute(const std::vector<token>& tokens, size_t i)
+{
+  if (tokens[i].type == token::T_NUMBER && i > 0)
+    --i;
+  return tokens[i].type == token::T_COMMAND && tokens[i].value == "s";
+}
+
 void _treat_number(std::string& number, std::vector<token>& tokens)
 {
   if (!number.empty())
@@ -243,8 +261,9 @@ std::vector<token> tokenize(const std::string& str)
         break;
       case '/':
         bool expect_two_delimiting_texts = false;
-        if (!tokens.empty() && tokens.back().type == token::T_COMMAND && tokens.back().value == "s")
+        if (!tokens.empty() && is_substitute(tokens, tokens.size() - 1))
           expect_two_delimiting_texts = true;
+        const bool substitute_text = tokens.size() >= 3 && tokens.back().type == token::T_TEXT && is_substitute(tokens, tokens.size() - 3);
         tokens.emplace_back(token::T_DELIMITER_SLASH, "/");
         const char* t = s;
         const char* prev_t = s;
@@ -281,6 +300,11 @@ std::vector<token> tokenize(const std::string& str)
               {
                 tokens.emplace_back(token::T_DELIMITER_SLASH, "/");
                 ++s;
+                if (substitute_text && *s == 'g' && (s + 1 == s_end || ignore_character(*(s + 1))))
+                {
+                  tokens.emplace_back(token::T_FLAG, "g");
+                  ++s;
+                }
               }
             }
           }
@@ -527,6 +551,15 @@ Command make_command(std::vector<token>& tokens)
     case 's':
     {
       Cmd_s cmd;
+      cmd.nth = 1;
+      cmd.global = false;
+      if (current_type(tokens) == token::T_NUMBER)
+      {
+        cmd.nth = s64(current(tokens).c_str());
+        tokens.pop_back();
+        if (cmd.nth < 1)
+          throw_error(bad_syntax, "s0");
+      }
       require_type(tokens, token::T_DELIMITER_SLASH, "/");
       cmd.regexp.regexp = current(tokens);
       require_type(tokens, token::T_TEXT, "regexp");
@@ -534,6 +567,11 @@ Command make_command(std::vector<token>& tokens)
       cmd.txt.text = current(tokens);
       require_type(tokens, token::T_TEXT, "text");
       require_type(tokens, token::T_DELIMITER_SLASH, "/");
+      if (current_type(tokens) == token::T_FLAG)
+      {
+        cmd.global = true;
+        tokens.pop_back();
+      }
       return cmd;
     }
     case 't':
@@ -590,6 +628,9 @@ Command make_command(std::vector<token>& tokens)
     cmd.cmd.push_back(make_command(tokens));
     return cmd;
     }
+    case 'X':
+    case 'Y':
+      throw_error(bad_syntax, "X and Y can only start a command line");
   }
   throw_error(command_expected);
   return Cmd_null();
@@ -627,6 +668,116 @@ struct address {
   bool null_selection;
 };
 
+/*
+Returns the longest ascii text that every match of the regular expression re contains, or an empty string if there is
+no such text or if it cannot be found cheaply, as is the case for alternations. Text inside groups and character classes,
+and characters followed by a quantifier that allows zero repetitions, are not required.
+*/
+std::wstring get_required_literal(const std::string& re)
+{
+  if (re.find('|') != std::string::npos)
+    return std::wstring();
+  std::string best, current;
+  auto flush = [&]() {
+    if (current.size() > best.size())
+      best = current;
+    current.clear();
+  };
+  int depth = 0;
+  for (size_t i = 0; i < re.size(); ++i) {
+    const char c = re[i];
+    switch (c) {
+      case '\\':
+        if (i + 1 < re.size() && ispunct((unsigned char)re[i + 1]) && depth == 0) {
+          current.push_back(re[++i]);
+        } else {
+          flush();
+          ++i;
+        }
+        break;
+      case '[':
+        flush();
+        ++i;
+        if (i < re.size() && re[i] == '^')
+          ++i;
+        if (i < re.size() && re[i] == ']')
+          ++i;
+        while (i < re.size() && re[i] != ']') {
+          if (re[i] == '\\')
+            ++i;
+          ++i;
+        }
+        break;
+      case '(': flush(); ++depth; break;
+      case ')': flush(); --depth; break;
+      case '*':
+      case '?':
+      case '{':
+        if (!current.empty())
+          current.pop_back();
+        flush();
+        if (c == '{') {
+          while (i < re.size() && re[i] != '}')
+            ++i;
+        }
+        break;
+      case '+':
+      case '.':
+      case '^':
+      case '$':
+        flush();
+        break;
+      default:
+        if ((unsigned char)c < 0x80 && depth == 0)
+          current.push_back(c);
+        else
+          flush();
+        break;
+    }
+  }
+  flush();
+  if (best.size() < 3)
+    return std::wstring();
+  return std::wstring(best.begin(), best.end());
+}
+
+/*
+Returns the first row >= row that can contain a match, or nr_of_rows if there is none.
+*/
+int64_t get_next_candidate_row(const std::vector<std::pair<int64_t, int64_t>>& candidate_rows, int64_t row, int64_t nr_of_rows)
+{
+  auto it = std::upper_bound(candidate_rows.begin(), candidate_rows.end(), row, [](int64_t r, const std::pair<int64_t, int64_t>& rows) { return r < rows.second; });
+  if (it == candidate_rows.end())
+    return nr_of_rows;
+  return std::max(row, it->first);
+}
+
+/*
+Returns the last row <= row that can contain a match, or -1 if there is none.
+*/
+int64_t get_previous_candidate_row(const std::vector<std::pair<int64_t, int64_t>>& candidate_rows, int64_t row)
+{
+  auto it = std::upper_bound(candidate_rows.begin(), candidate_rows.end(), row, [](int64_t r, const std::pair<int64_t, int64_t>& rows) { return r < rows.first; });
+  if (it == candidate_rows.begin())
+    return -1;
+  --it;
+  return std::min(row, it->second - 1);
+}
+
+/*
+Returns the compiled regular expression re, or throws an invalid_regex error.
+*/
+std::shared_ptr<const text_regex> get_compiled_regex(const std::string& re)
+{
+  try {
+    return get_regex(decode(re));
+  }
+  catch (text_regex_error& e) {
+    throw_error(invalid_regex, e.what());
+  }
+  return nullptr;
+}
+
 address find_regex_range(std::string re, file_buffer fb, bool reverse, position starting_pos)
 {
   address r;
@@ -637,31 +788,23 @@ address find_regex_range(std::string re, file_buffer fb, bool reverse, position
     return r;
   }
   
+  auto reg = get_compiled_regex(re);
+  
+  // rows that cannot contain the literal text that every match needs, are skipped, unless a match can span rows
+  std::vector<std::pair<int64_t, int64_t>> candidate_rows;
+  const bool use_candidate_rows = !reg->can_match_newline() && get_candidate_rows(candidate_rows, fb, get_required_literal(re));
+  
+  regex_match m;
+  bool found = false;
   if (reverse)
   {
     r.p1 = r.p2 = position(0, 0);
-    std::regex reg(re);
-    for (int64_t row = starting_pos.row; row >= 0; --row) {
-      std::string line = to_string(fb.content[row]);
-      std::smatch sm;
-      if (std::regex_search(line, sm, reg)) {
-        for (int i = (int)sm.size()-1; i >= 0; --i) {
-          int64_t p1 = sm.position(i);
-          int64_t p2 = p1 + sm.length(i);
-          if (row == starting_pos.row && p2 > starting_pos.col)
-            continue;
-          r.p1.row = row;
-          r.p1.col = p1;
-          r.p2.row = row;
-          r.p2.col = p2-1;
-          if (sm.length(i)==0) {
-            r.p2.col = p2;
-            r.null_selection = true;
-          } else
-            r.null_selection = false;
-          return r;
-        }
-      }
+    if (!use_candidate_rows)
+      found = reg->search_backward(m, fb.content, position(0, 0), starting_pos);
+    for (int64_t row = starting_pos.row; use_candidate_rows && !found && row >= 0; --row) {
+      if ((row = get_previous_candidate_row(candidate_rows, row)) < 0)
+        break;
+      found = reg->search_backward(m, fb.content, position(row, 0), std::min(starting_pos, position(row + 1, 0)));
     }
   } else
   {
@@ -670,30 +813,20 @@ address find_regex_range(std::string re, file_buffer fb, bool reverse, position
       r.p1.col = fb.content[r.p1.row].size()-1;
       r.p2.col = fb.content[r.p1.row].size()-1;
     }
-    std::regex reg(re);
-    for (int64_t row = starting_pos.row; row < fb.content.size(); ++row) {
-      std::string line = to_string(fb.content[row]);
-      std::smatch sm;
-      if (std::regex_search(line, sm, reg)) {
-        for (int i = 0; i < (int)sm.size(); ++i) {
-          int64_t p1 = sm.position(i);
-          int64_t p2 = p1 + sm.length(i);
-          if (row == starting_pos.row && p1 < starting_pos.col)
-            continue;
-          r.p1.row = row;
-          r.p1.col = p1;
-          r.p2.row = row;
-          r.p2.col = p2-1;
-          if (sm.length(i)==0) {
-            r.p2.col = p2;
-            r.null_selection = true;
-          } else
-            r.null_selection = false;
-          return r;
-        }
-      }
+    const position end = get_end_position(fb.content);
+    if (!use_candidate_rows)
+      found = reg->search(m, fb.content, starting_pos, end);
+    for (int64_t row = starting_pos.row; use_candidate_rows && !found && row < fb.content.size(); ++row) {
+      if ((row = get_next_candidate_row(candidate_rows, row, fb.content.size())) >= fb.content.size())
+        break;
+      found = reg->search(m, fb.content, std::max(starting_pos, position(row, 0)), std::min(end, position(row + 1, 0)));
     }
-  }  
+  }
+  if (found) {
+    r.p1 = m.begin;
+    r.null_selection = m.begin == m.end;
+    r.p2 = r.null_selection ? m.begin : get_previous_position(fb, m.end);
+  }
   return r;
 }
 
@@ -768,7 +901,7 @@ struct simple_address_handler
   
   address operator()(const CharacterNumber& cn)
   {
-    int64_t v = (int64_t)cn.value;
+    const int64_t v = (int64_t)cn.value;
     address r;
     r.null_selection = true;
     position pos = starting_pos;
@@ -777,40 +910,17 @@ struct simple_address_handler
       check_range(r);
       return r;
     }
-    if (reverse)
-    {
-      while ((pos.row > 0 || pos.col > 0) && v>0) {
-        if (v >= pos.col) {
-          v -= pos.col;
-          pos.col = 0;
-          if (pos.row) {
-            --pos.row;
-            pos.col = f.content[pos.row].size();
-          }
-        } else {
-          pos.col -= v;
-          v = 0;
-        }
-      }
+    if (v <= max_walked_characters) {
+      if (!move_over_characters(pos, f.content, v, reverse))
+        throw_error(invalid_address);
     }
-    else
-    {
-      while ((pos.row < (f.content.size()-1) || (pos.col) < f.content[pos.row].size()) && v>0) {
-        if (v > f.content[pos.row].size()) {
-          v -= (f.content[pos.row].size()-pos.col);
-          pos.col = 0;
-          ++pos.row;
-          if (pos.row >= f.content.size())
-            throw_error(invalid_address);
-        }
-        else {
-          pos.col += v;
-          v = 0;
-        }
-      }
+    else {
+      const auto index = get_offset_index(f); // built once per version of the text
+      const int64_t offset = index->get_offset(pos) + (reverse ? -v : v);
+      if (offset < 0 || offset > index->size())
+        throw_error(invalid_address);
+      pos = index->get_position(offset);
     }
-    if (v > 0)
-      throw_error(invalid_address);
     r.p1 = pos;
     r.p2 = pos;
     check_range(r);
@@ -865,14 +975,7 @@ struct simple_address_handler
     address ret;
     ret.p1 = ret.p2 = starting_pos;
     ret.null_selection = true;
-    try
-    {
-      ret = find_regex_range(re.regexp, f, reverse, starting_pos);
-    }
-    catch (std::regex_error e)
-    {
-      throw_error(invalid_regex, e.what());
-    }
+    ret = find_regex_range(re.regexp, f, reverse, starting_pos);
     return ret;
   }
   
@@ -949,6 +1052,189 @@ address interpret_address_range(const AddressRange& addr, file_buffer f)
   return out;
 }
 
+/*
+A piece of the replacement text of s: literal text, or the text of a group of the match if group is not negative.
+*/
+struct replacement_piece
+{
+  std::wstring txt;
+  int group;
+};
+
+std::vector<replacement_piece> parse_replacement(const std::string& replacement)
+{
+  std::vector<replacement_piece> pieces;
+  std::string literal;
+  for (size_t i = 0; i < replacement.size(); ++i) {
+    if (replacement[i] == '\\' && i + 1 < replacement.size() && isdigit((unsigned char)replacement[i + 1])) {
+      if (!literal.empty())
+        pieces.push_back(replacement_piece{decode(literal), -1});
+      literal.clear();
+      pieces.push_back(replacement_piece{std::wstring(), replacement[i + 1] - '0'});
+      ++i;
+    }
+    else if (replacement[i] == '\\' && i + 1 < replacement.size()) {
+      literal.append(_treat_escape_characters(replacement.substr(i, 2)));
+      ++i;
+    }
+    else
+      literal.push_back(replacement[i]);
+  }
+  if (!literal.empty())
+    pieces.push_back(replacement_piece{decode(literal), -1});
+  return pieces;
+}
+
+std::wstring expand_replacement(const std::vector<replacement_piece>& pieces, const regex_match& m, const text& txt)
+{
+  std::wstring result;
+  for (const auto& piece : pieces) {
+    if (piece.group < 0) {
+      result.append(piece.txt);
+      continue;
+    }
+    if ((size_t)piece.group >= m.groups.size())
+      throw_error(invalid_regex, "there is no group " + std::to_string(piece.group));
+    const auto& group = m.groups[piece.group];
+    if (group.first.row >= 0)
+      append_text(result, txt, group.first, group.second);
+  }
+  return result;
+}
+
+/*
+Adds the changes of s in dot [first, last) to changes: the n-th match is replaced, or with the g flag every match from
+the n-th on. All matches are found on the unchanged text, so that they can be replaced in one pass.
+*/
+void collect_substitutions(std::vector<text_change>& changes, text txt, const Cmd_s& cmd, position first, position last)
+{
+  auto reg = get_compiled_regex(cmd.regexp.regexp);
+  const auto pieces = parse_replacement(cmd.txt.text);
+  int64_t nr_of_matches = 0;
+  reg->search_all(txt, first, last, [&](const regex_match& m) {
+    if (++nr_of_matches < cmd.nth)
+      return true;
+    changes.push_back(text_change{m.begin, m.end, expand_replacement(pieces, m, txt)});
+    return cmd.global;
+  });
+}
+
+/*
+Collects the changes that a command makes to dot [first, last) as in sam: all positions refer to the text before the
+x or y loop that runs the command, so that the loop can apply all its changes in one pass. The commands that read or
+move text elsewhere (e, m, r, t, u, w) cannot be collected, then false is returned.
+*/
+struct change_collector
+{
+  const file_buffer& fb;
+  std::vector<text_change>& changes;
+  position first, last;
+
+  bool run(const Command& cmd, position dot_first, position dot_last) {
+    change_collector inner{fb, changes, dot_first, dot_last};
+    return std::visit(inner, cmd);
+  }
+
+  bool operator() (const Cmd_a& cmd) {
+    changes.push_back(text_change{last, last, decode(_treat_escape_characters(cmd.txt.text))});
+    return true;
+  }
+
+  bool operator() (const Cmd_c& cmd) {
+    changes.push_back(text_change{first, last, decode(_treat_escape_characters(cmd.txt.text))});
+    return true;
+  }
+
+  bool operator() (const Cmd_d&) {
+    changes.push_back(text_change{first, last, std::wstring()});
+    return true;
+  }
+
+  bool operator() (const Cmd_i& cmd) {
+    changes.push_back(text_change{first, first, decode(_treat_escape_characters(cmd.txt.text))});
+    return true;
+  }
+
+  bool operator() (const Cmd_s& cmd) {
+    collect_substitutions(changes, fb.content, cmd, first, last);
+    return true;
+  }
+
+  bool operator() (const Cmd_g& cmd) {
+    auto reg = get_compiled_regex(cmd.regexp.regexp);
+    regex_match m;
+    if (first < last && reg->search(m, fb.content, first, last))
+      return run(cmd.cmd.front(), first, last);
+    return true;
+  }
+
+  bool operator() (const Cmd_v& cmd) {
+    auto reg = get_compiled_regex(cmd.regexp.regexp);
+    regex_match m;
+    if (first < last && reg->search(m, fb.content, first, last))
+      return true;
+    return run(cmd.cmd.front(), first, last);
+  }
+
+  bool operator() (const Cmd_x& cmd) {
+    auto reg = get_compiled_regex(cmd.regexp.regexp);
+    regex_match m;
+    position p = first;
+    while (reg->search(m, fb.content, p, last)) {
+      if (!run(cmd.cmd.front(), m.begin, m.end))
+        return false;
+      p = m.end;
+      if (m.begin == m.end) {
+        const position next = get_next_position(fb.content, p);
+        if (next == p)
+          break;
+        p = next;
+      }
+    }
+    return true;
+  }
+
+  bool operator() (const Cmd_y& cmd) {
+    auto reg = get_compiled_regex(cmd.regexp.regexp);
+    regex_match m;
+    position p = first;
+    position piece = first;
+    while (reg->search(m, fb.content, p, last)) {
+      if (!run(cmd.cmd.front(), piece, m.begin))
+        return false;
+      piece = m.end;
+      p = m.end;
+      if (m.begin == m.end) {
+        const position next = get_next_position(fb.content, p);
+        if (next == p)
+          break;
+        p = next;
+      }
+    }
+    return run(cmd.cmd.front(), piece, last);
+  }
+
+  bool operator() (const Cmd_null&) {
+    return true;
+  }
+
+  template <class TCommand>
+  bool operator() (const TCommand&) {
+    return false;
+  }
+};
+
+/*
+Throws if the changes are not sorted or overlap, as can happen when a loop changes the same text twice.
+*/
+void check_sequence(const std::vector<text_change>& changes)
+{
+  for (size_t i = 1; i < changes.size(); ++i) {
+    if (changes[i].first < changes[i - 1].last || changes[i].first < changes[i - 1].first)
+      throw_error(changes_not_in_sequence);
+  }
+}
+
 struct command_handler
 {
   file_buffer fb;
@@ -957,6 +1243,23 @@ struct command_handler
   
   command_handler(file_buffer i_fb, const env_settings& i_s) : fb(i_fb), s(i_s), save_undo(true) {}
   
+  /*
+  Runs an x or y loop by collecting the changes of all its iterations on the unchanged text, and applying them in one
+  pass with one undo snapshot and one lexer update, so that a loop over many matches stays linear. Returns false if
+  the loop contains a command that cannot be collected, then the loop has to change the text match by match.
+  */
+  template <class TCommand>
+  bool apply_collected_changes(file_buffer& changed, const TCommand& cmd) {
+    auto dot = get_dot();
+    std::vector<text_change> changes;
+    change_collector collector{fb, changes, dot.first, dot.second};
+    if (!collector(cmd))
+      return false;
+    check_sequence(changes);
+    changed = apply_changes(fb, changes, s, save_undo);
+    return true;
+  }
+
   std::pair<position, position> get_dot() const {
     position p1 = fb.pos;
     position p2 = p1;
@@ -1015,31 +1318,11 @@ struct command_handler
   }
   
   file_buffer operator() (const Cmd_g& cmd) {
-    std::regex reg(cmd.regexp.regexp);
+    auto reg = get_compiled_regex(cmd.regexp.regexp);
     auto dot = get_dot();
-        
-    for (int64_t row = dot.first.row; row <= dot.second.row; ++row) {
-      if (row >= fb.content.size())
-        break;
-      std::string line = to_string(fb.content[row]);
-      int64_t offset = 0;
-      if (row == dot.first.row) {
-        line = line.substr(dot.first.col);
-        offset = dot.first.col;
-        }
-      if (row == dot.second.row) {
-        const int64_t sz = dot.second.col - offset;
-        if (sz <= 0)
-          continue;
-        line = line.substr(0, sz);
-      }
-      std::smatch sm;
-      if (std::regex_search(line, sm, reg)) {
-        fb = std::visit(*this, cmd.cmd.front());
-        return fb;
-      }
-    }
-  
+    regex_match m;
+    if (dot.first < dot.second && reg->search(m, fb.content, dot.first, dot.second))
+      fb = std::visit(*this, cmd.cmd.front());
     return fb;
   }
   
@@ -1116,47 +1399,15 @@ struct command_handler
   }
   
   file_buffer operator() (const Cmd_s& cmd) {
-    std::regex reg(cmd.regexp.regexp);
     auto dot = get_dot();
-        
-    for (int64_t row = dot.first.row; row <= dot.second.row; ++row) {
-      if (row >= fb.content.size())
-        break;
-      std::string line = to_string(fb.content[row]);
-      int64_t offset = 0;
-      if (row == dot.first.row) {
-        line = line.substr(dot.first.col);
-        offset = dot.first.col;
-        }
-      else if (row == dot.second.row) {
-        const int64_t sz = dot.second.col - offset;
-        if (sz <= 0)
-          continue;
-        line = line.substr(0, sz);
-      }
-      std::smatch sm;
-      if (std::regex_search(line, sm, reg)) {
-
-        int64_t pos1 = sm.position(0);
-        int64_t pos2 = pos1 + sm.length(0);
-        if (pos2 > pos1)
-          pos2 -= 1;
-        fb.start_selection = position(row, pos1+offset);
-        fb.pos = position(row, pos2+offset);
-        auto init_pos = *fb.start_selection;
-        if (sm.length(0) == 1) {
-          fb = erase_right(fb, s, save_undo);
-          fb = insert(fb, cmd.txt.text, s, false);
-        } else {
-          fb = insert(fb, cmd.txt.text, s, save_undo);
-        }
-        fb.start_selection = init_pos;
-        fb.pos = get_previous_position(fb, fb.pos);
-        return fb;
-        
-      }
-    }
-  
+    std::vector<text_change> changes;
+    collect_substitutions(changes, fb.content, cmd, dot.first, dot.second);
+    if (changes.empty())
+      return fb;
+    auto init_pos = changes.front().first;
+    fb = apply_changes(fb, changes, s, save_undo);
+    fb.start_selection = init_pos;
+    fb.pos = get_previous_position(fb, fb.pos);
     return fb;
   }
   
@@ -1177,29 +1428,11 @@ struct command_handler
   }
   
   file_buffer operator() (const Cmd_v& cmd) {
-    std::regex reg(cmd.regexp.regexp);
+    auto reg = get_compiled_regex(cmd.regexp.regexp);
     auto dot = get_dot();
-        
-    for (int64_t row = dot.first.row; row <= dot.second.row; ++row) {
-      if (row >= fb.content.size())
-        break;
-      std::string line = to_string(fb.content[row]);
-      int64_t offset = 0;
-      if (row == dot.first.row) {
-        line = line.substr(dot.first.col);
-        offset = dot.first.col;
-        }
-      if (row == dot.second.row) {
-        const int64_t sz = dot.second.col - offset;
-        if (sz <= 0)
-          continue;
-        line = line.substr(0, sz);
-      }
-      std::smatch sm;
-      if (std::regex_search(line, sm, reg)) {
-        return fb;
-      }
-    }
+    regex_match m;
+    if (dot.first < dot.second && reg->search(m, fb.content, dot.first, dot.second))
+      return fb;
     fb = std::visit(*this, cmd.cmd.front());
     return fb;
   }
@@ -1211,6 +1444,9 @@ struct command_handler
   }
   
   file_buffer operator() (const Cmd_x& cmd) {
+    file_buffer changed;
+    if (apply_collected_changes(changed, cmd))
+      return changed;
   
     if (save_undo)
       fb = push_undo(fb);
@@ -1218,54 +1454,37 @@ struct command_handler
     bool save_undo_backup = save_undo;
     save_undo = false;
     
-    std::regex reg(cmd.regexp.regexp);
+    auto reg = get_compiled_regex(cmd.regexp.regexp);
     auto dot = get_dot();
-        
-        
-    for (int64_t row = dot.first.row; row <= dot.second.row; ++row) {
-      if (row >= fb.content.size())
-        break;
-      std::string line = to_string(fb.content[row]);
-      int64_t offset = 0;
-      if (row == dot.first.row) {
-        line = line.substr(dot.first.col);
-        offset = dot.first.col;
-        }
-      if (row == dot.second.row) {
-        const int64_t sz = dot.second.col - offset;
-        if (sz < 0)
-          continue;
-        line = line.substr(0, sz);
-      }
-      std::smatch sm;
-      if (std::regex_search(line, sm, reg)) {
-        int64_t pos1 = sm.position(0);
-        int64_t pos2 = pos1 + sm.length(0);
-        if (pos2 > pos1)
-          pos2 -= 1;
-        fb.start_selection = position(row, pos1+offset);
-        fb.pos = position(row, pos2+offset);
-        auto init_pos = *fb.start_selection;
-        if (sm.length(0) == 0)
-          fb.start_selection = std::nullopt;
-        
-        fb = std::visit(*this, cmd.cmd.front());
-
-        position new_p1 = fb.pos;
-        position new_p2 = fb.pos;
-        if (fb.start_selection)
-          new_p2 = *fb.start_selection;
-        if (new_p2 < new_p1)
-          std::swap(new_p1, new_p2);
-        position end = recompute_position_after_dot_change(fb, dot.second, position(row, pos1+offset), position(row, pos2+offset), new_p1, new_p2);
-        
-        dot.first = fb.pos;
-        dot.second = end;
-        
-        if (sm.length(0)==0)
-          dot.first = get_next_position(fb, dot.first);
-        
-        row = dot.first.row-1;
+    
+    regex_match m;
+    while (reg->search(m, fb.content, dot.first, dot.second)) {
+      const position match_p1 = m.begin;
+      const position match_p2 = m.begin == m.end ? m.begin : get_previous_position(fb, m.end);
+      fb.start_selection = match_p1;
+      fb.pos = match_p2;
+      if (m.begin == m.end)
+        fb.start_selection = std::nullopt;
+      
+      fb = std::visit(*this, cmd.cmd.front());
+
+      position new_p1 = fb.pos;
+      position new_p2 = fb.pos;
+      if (fb.start_selection)
+        new_p2 = *fb.start_selection;
+      if (new_p2 < new_p1)
+        std::swap(new_p1, new_p2);
+      position end = recompute_position_after_dot_change(fb, dot.second, match_p1, match_p2, new_p1, new_p2);
+      
+      dot.first = fb.pos;
+      dot.second = end;
+      
+      if (m.begin == m.end) {
+        // an empty match at the end of the text cannot be followed by another match
+        const position next = get_next_position(fb, dot.first);
+        if (next == dot.first)
+          break;
+        dot.first = next;
       }
     }
     
@@ -1274,6 +1493,9 @@ struct command_handler
   }
 
   file_buffer operator() (const Cmd_y& cmd) {
+    file_buffer changed;
+    if (apply_collected_changes(changed, cmd))
+      return changed;
 
     if (save_undo)
       fb = push_undo(fb);
@@ -1281,68 +1503,44 @@ struct command_handler
     bool save_undo_backup = save_undo;
     save_undo = false;
 
-    std::regex reg(cmd.regexp.regexp);
+    auto reg = get_compiled_regex(cmd.regexp.regexp);
     auto dot = get_dot();
 
-    position prev_dot_end = position(0, 0);
+    position prev_dot_end = dot.first;
 
-    for (int64_t row = dot.first.row; row <= dot.second.row; ++row) {
-      if (row >= fb.content.size())
-        break;
-      std::string line = to_string(fb.content[row]);
-      int64_t offset = 0;
-      if (row == dot.first.row) {
-        line = line.substr(dot.first.col);
-        offset = dot.first.col;
+    regex_match m;
+    while (reg->search(m, fb.content, dot.first, dot.second)) {
+      if (m.begin == prev_dot_end) {
+        fb.start_selection = std::nullopt;
+        fb.pos = prev_dot_end;
         }
-      if (row == dot.second.row) {
-        const int64_t sz = dot.second.col - offset;
-        if (sz < 0)
-          continue;
-        line = line.substr(0, sz);
+      else {
+        fb.start_selection = prev_dot_end;
+        fb.pos = get_previous_position(fb, m.begin);
         }
-      std::smatch sm;
-      if (std::regex_search(line, sm, reg)) {
-        int64_t pos1 = sm.position(0);
-        int64_t pos2 = pos1 + sm.length(0);
-        if (pos2 > pos1)
-          pos2 -= 1;
-        
-        
-        auto regex_start = position(row, pos1 + offset);
-        auto regex_end = position(row, pos2 + offset);
-
-        if (regex_start == prev_dot_end) {
-          fb.start_selection = std::nullopt;
-          fb.pos = prev_dot_end;
-          }
-        else {
-          fb.start_selection = prev_dot_end;
-          fb.pos = get_previous_position(fb, regex_start);
-          }
-        auto old_dot_p1 = fb.start_selection == std::nullopt ? fb.pos : *fb.start_selection;
-        auto old_dot_p2 = fb.pos;
-
-        fb = std::visit(*this, cmd.cmd.front());
+      auto old_dot_p1 = fb.start_selection == std::nullopt ? fb.pos : *fb.start_selection;
+      auto old_dot_p2 = fb.pos;
 
-        position new_p1 = fb.pos;
-        position new_p2 = fb.pos;
-        if (fb.start_selection)
-          new_p2 = *fb.start_selection;
-        if (new_p2 < new_p1)
-          std::swap(new_p1, new_p2);
-        //prev_dot_end = new_p2;        
-        //prev_dot_end.col += sm.length(0);
-        position end = recompute_position_after_dot_change(fb, dot.second, old_dot_p1, old_dot_p2, new_p1, new_p2);
-        prev_dot_end = recompute_position_after_dot_change(fb, position(row, pos1 + sm.length(0)+offset), old_dot_p1, old_dot_p2, new_p1, new_p2);
+      fb = std::visit(*this, cmd.cmd.front());
 
-        dot.first = prev_dot_end;
-        dot.second = end;
+      position new_p1 = fb.pos;
+      position new_p2 = fb.pos;
+      if (fb.start_selection)
+        new_p2 = *fb.start_selection;
+      if (new_p2 < new_p1)
+        std::swap(new_p1, new_p2);
+      position end = recompute_position_after_dot_change(fb, dot.second, old_dot_p1, old_dot_p2, new_p1, new_p2);
+      prev_dot_end = recompute_position_after_dot_change(fb, m.end, old_dot_p1, old_dot_p2, new_p1, new_p2);
 
+      dot.first = prev_dot_end;
+      dot.second = end;
 
-        row = dot.first.row - 1;
+      if (m.begin == m.end) {
+        const position next = get_next_position(fb, dot.first);
+        if (next == dot.first)
+          break;
+        dot.first = next;
         }
-
       }
 
     if (dot.second == prev_dot_end) {
@@ -1369,7 +1567,8 @@ struct expression_handler
 {
   file_buffer fb;
   env_settings s;
-  expression_handler(file_buffer i_fb, const env_settings& i_s) : fb(i_fb), s(i_s) {}
+  bool save_undo;
+  expression_handler(file_buffer i_fb, const env_settings& i_s, bool i_save_undo) : fb(i_fb), s(i_s), save_undo(i_save_undo) {}
   
   file_buffer operator() (const AddressRange& addr)
   {
@@ -1387,19 +1586,99 @@ struct expression_handler
   file_buffer operator() (const Command& cmd)
   {
     command_handler ch(fb, s);
+    ch.save_undo = save_undo;
     return std::visit(ch, cmd);
   }
 };
 
 }
 
+namespace {
+
+bool modifies_text(const Expression& expr) {
+  if (!std::holds_alternative<Command>(expr))
+    return false;
+  const Command& cmd = std::get<Command>(expr);
+  return !(std::holds_alternative<Cmd_null>(cmd) || std::holds_alternative<Cmd_u>(cmd) || std::holds_alternative<Cmd_w>(cmd));
+}
+
+bool contains_undo(const Expression& expr) {
+  return std::holds_alternative<Command>(expr) && std::holds_alternative<Cmd_u>(std::get<Command>(expr));
+}
+
+}
+
 file_buffer handle_command(file_buffer fb, std::string command, const env_settings& s) {
   auto tokens = tokenize(command);
   auto cmds = parse(tokens);
+  // As in sam, all changes made by one command line form one undo group
+  const bool single_undo_group = std::any_of(cmds.begin(), cmds.end(), modifies_text) && std::none_of(cmds.begin(), cmds.end(), contains_undo);
+  if (single_undo_group)
+    fb = push_undo(fb);
   for (const auto& cmd : cmds)
   {
-    expression_handler eh(fb, s);
+    expression_handler eh(fb, s, !single_undo_group);
     fb = std::visit(eh, cmd);
   }
   return fb;
 }
+
+namespace {
+
+/*
+Splits X/regexp/ command in its kind, regexp and command. A / in regexp is escaped as \/, as in the other commands.
+*/
+bool split_file_command(char& kind, std::string& regexp, std::string& command, const std::string& file_command)
+{
+  size_t i = 0;
+  while (i < file_command.size() && ignore_character(file_command[i]))
+    ++i;
+  if (i + 1 >= file_command.size() || (file_command[i] != 'X' && file_command[i] != 'Y') || file_command[i + 1] != '/')
+    return false;
+  kind = file_command[i];
+  regexp.clear();
+  for (i += 2; i < file_command.size() && file_command[i] != '/'; ++i) {
+    if (file_command[i] == '\\' && i + 1 < file_command.size()) {
+      if (file_command[i + 1] != '/')
+        regexp.push_back('\\');
+      regexp.push_back(file_command[++i]);
+    }
+    else
+      regexp.push_back(file_command[i]);
+  }
+  command = i < file_command.size() ? file_command.substr(i + 1) : std::string();
+  return true;
+}
+
+}
+
+bool is_file_command(const std::string& command) {
+  char kind;
+  std::string regexp, rest;
+  return split_file_command(kind, regexp, rest, command);
+}
+
+std::vector<file_command_result> handle_file_command(const std::vector<file_buffer>& files, const std::string& command, const env_settings& s) {
+  char kind;
+  std::string regexp, rest;
+  if (!split_file_command(kind, regexp, rest, command))
+    throw_error(command_expected);
+  auto reg = get_compiled_regex(regexp);
+  std::vector<file_command_result> results(files.size());
+  parallel_for(files.size(), [&](uint64_t i) {
+    file_command_result& result = results[i];
+    result.buffer = files[i];
+    const text name = to_text(decode(files[i].name));
+    regex_match m;
+    result.selected = reg->search(m, name, position(0, 0), get_end_position(name)) == (kind == 'X');
+    if (!result.selected)
+      return;
+    try {
+      result.buffer = handle_command(files[i], rest, s);
+    }
+    catch (std::runtime_error& e) {
+      result.error = e.what();
+    }
+  });
+  return results;
+}
@@ -16,6 +16,7 @@ enum error_type
   invalid_address,
   invalid_regex,
   pipe_error,
+  changes_not_in_sequence,
   not_implemented
 };
 
@@ -37,7 +38,8 @@ struct token
     T_COMMA,
     T_HASHTAG,
     T_TEXT,
-    T_EXTERNAL_COMMAND
+    T_EXTERNAL_COMMAND,
+    T_FLAG
   };
   
   e_type type;
@@ -109,10 +111,12 @@ struct Cmd_d // Delete text in dot
 {
 };
 
-struct Cmd_s // Substitute text for match of regular expression in dot
+struct Cmd_s // Substitute text for the n-th (default 1) match of regular expression in dot, or with flag g for all matches from the n-th on
 {
-  Text txt;
+  Text txt; // \1 to \9 refer to the groups of the match, \0 to the whole match
   RegExp regexp;
+  int64_t nth;
+  bool global;
 };
 
 struct Cmd_m // Move text in dot after address
@@ -190,3 +194,23 @@ std::vector<Expression> parse(std::vector<token> tokens);
 
 
 file_buffer handle_command(file_buffer fb, std::string command, const env_settings& s);
+
+/*
+Returns true if command starts with sam's X/regexp/ or Y/regexp/, which run the rest of the command on every file
+whose name contains, or for Y does not contain, a match of regexp.
+*/
+bool is_file_command(const std::string& command);
+
+struct file_command_result
+{
+  file_buffer buffer; // the file after the command, or the unchanged file if the command failed or did not run
+  std::string error; // empty if the command succeeded
+  bool selected; // the command ran on this file
+};
+
+/*
+Runs an X or Y command on the files in parallel, as the files are independent values. Each file either gets the result
+of the whole command, or keeps its content when the command fails on it, so that one failing file does not stop the others.
+Throws if the command itself is not valid.
+*/
+std::vector<file_command_result> handle_file_command(const std::vector<file_buffer>& files, const std::string& command, const env_settings& s);
@@ -0,0 +1,371 @@
+#include "encoding.h"
+#include "utils.h"
+
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define JEDI_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JEDI_SSE2
+#endif
+
+namespace
+  {
+  /*
+  Returns the length of the valid utf8 sequence starting at p, or 0 if the sequence is invalid.
+  Overlong encodings, surrogates and code points above 0x10FFFF are invalid.
+  */
+  inline int valid_sequence_length(const unsigned char* p, const unsigned char* p_end)
+    {
+    const unsigned char c = p[0];
+    if (c < 0x80)
+      return 1;
+    int length;
+    unsigned char lo = 0x80, hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF)
+      length = 2;
+    else if (c >= 0xE0 && c <= 0xEF)
+      {
+      length = 3;
+      if (c == 0xE0)
+        lo = 0xA0;
+      else if (c == 0xED)
+        hi = 0x9F;
+      }
+    else if (c >= 0xF0 && c <= 0xF4)
+      {
+      length = 4;
+      if (c == 0xF0)
+        lo = 0x90;
+      else if (c == 0xF4)
+        hi = 0x8F;
+      }
+    else
+      return 0;
+    if (p_end - p < length)
+      return 0;
+    if (p[1] < lo || p[1] > hi)
+      return 0;
+    for (int i = 2; i < length; ++i)
+      {
+      if ((p[i] & 0xC0) != 0x80)
+        return 0;
+      }
+    return length;
+    }
+
+  inline void add_line_offsets(std::vector<uint64_t>* line_offsets, uint32_t newline_mask, uint64_t offset)
+    {
+    while (newline_mask)
+      {
+#if defined(_MSC_VER)
+      unsigned long bit;
+      _BitScanForward(&bit, newline_mask);
+#else
+      const uint32_t bit = (uint32_t)__builtin_ctz(newline_mask);
+#endif
+      line_offsets->push_back(offset + bit + 1);
+      newline_mask &= newline_mask - 1;
+      }
+    }
+
+  struct scan_state
+    {
+    bool ascii = true;
+    bool valid = true;
+    uint64_t validated_up_to = 0;
+    };
+
+  /*
+  Validates the bytes from max(first, validated_up_to) up to last. A sequence that starts before last
+  may extend beyond last, validated_up_to is set to the end of the last sequence.
+  */
+  inline void validate(scan_state& state, const unsigned char* data, uint64_t first, uint64_t last, uint64_t size)
+    {
+    uint64_t i = first < state.validated_up_to ? state.validated_up_to : first;
+    while (i < last)
+      {
+      if (data[i] >= 0x80)
+        {
+        state.ascii = false;
+        const int length = valid_sequence_length(data + i, data + size);
+        if (length == 0)
+          {
+          state.valid = false;
+          return;
+          }
+        i += length;
+        }
+      else
+        ++i;
+      }
+    if (i > state.validated_up_to)
+      state.validated_up_to = i;
+    }
+
+  inline void append_utf8(std::string& out, uint32_t cp)
+    {
+    if (cp < 0x80)
+      out.push_back((char)cp);
+    else if (cp < 0x800)
+      {
+      out.push_back((char)(0xC0 | (cp >> 6)));
+      out.push_back((char)(0x80 | (cp & 0x3F)));
+      }
+    else if (cp < 0x10000)
+      {
+      out.push_back((char)(0xE0 | (cp >> 12)));
+      out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+      out.push_back((char)(0x80 | (cp & 0x3F)));
+      }
+    else
+      {
+      out.push_back((char)(0xF0 | (cp >> 18)));
+      out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+      out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+      out.push_back((char)(0x80 | (cp & 0x3F)));
+      }
+    }
+
+#ifdef JEDI_SSE2
+  /*
+  Widens 16 ascii bytes at p to 16 wchar_t's at out.
+  */
+  inline void widen_16(wchar_t* out, const char* p)
+    {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v = _mm_loadu_si128((const __m128i*)p);
+    const __m128i lo = _mm_unpacklo_epi8(v, zero);
+    const __m128i hi = _mm_unpackhi_epi8(v, zero);
+    if (sizeof(wchar_t) == 2)
+      {
+      _mm_storeu_si128((__m128i*)out, lo);
+      _mm_storeu_si128((__m128i*)(out + 8), hi);
+      }
+    else
+      {
+      _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi16(lo, zero));
+      _mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi16(lo, zero));
+      _mm_storeu_si128((__m128i*)(out + 8), _mm_unpacklo_epi16(hi, zero));
+      _mm_storeu_si128((__m128i*)(out + 12), _mm_unpackhi_epi16(hi, zero));
+      }
+    }
+
+  /*
+  Narrows 8 wchar_t's at p to 8 bytes at out if they are all ascii, and returns true. Returns false otherwise.
+  */
+  inline bool narrow_8(char* out, const wchar_t* p)
+    {
+    __m128i v;
+    if (sizeof(wchar_t) == 2)
+      {
+      v = _mm_loadu_si128((const __m128i*)p);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128())) != 0xFFFF)
+        return false;
+      }
+    else
+      {
+      const __m128i v0 = _mm_loadu_si128((const __m128i*)p);
+      const __m128i v1 = _mm_loadu_si128((const __m128i*)(p + 4));
+      const __m128i mask = _mm_set1_epi32((int)0xFFFFFF80);
+      const __m128i high = _mm_or_si128(_mm_and_si128(v0, mask), _mm_and_si128(v1, mask));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xFFFF)
+        return false;
+      v = _mm_packs_epi32(v0, v1);
+      }
+    _mm_storel_epi64((__m128i*)out, _mm_packus_epi16(v, v));
+    return true;
+    }
+#endif
+  }
+
+e_encoding scan_encoding(const char* data, uint64_t size, std::vector<uint64_t>* line_offsets)
+  {
+  const unsigned char* udata = (const unsigned char*)data;
+  scan_state state;
+  uint64_t i = 0;
+#if defined(JEDI_AVX2)
+  const __m256i newline_32 = _mm256_set1_epi8('\n');
+  for (; i + 32 <= size; i += 32)
+    {
+    const __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+    if (line_offsets)
+      add_line_offsets(line_offsets, (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline_32)), i);
+    if (state.valid && (_mm256_movemask_epi8(v) != 0 || state.validated_up_to > i))
+      validate(state, udata, i, i + 32, size);
+    }
+#endif
+#if defined(JEDI_SSE2)
+  const __m128i newline_16 = _mm_set1_epi8('\n');
+  for (; i + 16 <= size; i += 16)
+    {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    if (line_offsets)
+      add_line_offsets(line_offsets, (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline_16)), i);
+    if (state.valid && (_mm_movemask_epi8(v) != 0 || state.validated_up_to > i))
+      validate(state, udata, i, i + 16, size);
+    }
+#endif
+  if (line_offsets)
+    {
+    for (uint64_t j = i; j < size; ++j)
+      {
+      if (data[j] == '\n')
+        line_offsets->push_back(j + 1);
+      }
+    }
+  if (state.valid)
+    validate(state, udata, i, size, size);
+  if (!state.valid)
+    return enc_ansi;
+  return state.ascii ? enc_ascii : enc_utf8;
+  }
+
+bool is_ascii(const char* data, uint64_t size)
+  {
+  uint64_t i = 0;
+#if defined(JEDI_AVX2)
+  for (; i + 32 <= size; i += 32)
+    {
+    if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(data + i))) != 0)
+      return false;
+    }
+#endif
+#if defined(JEDI_SSE2)
+  for (; i + 16 <= size; i += 16)
+    {
+    if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(data + i))) != 0)
+      return false;
+    }
+#endif
+  for (; i < size; ++i)
+    {
+    if ((unsigned char)data[i] >= 0x80)
+      return false;
+    }
+  return true;
+  }
+
+bool is_valid_utf8(const char* data, uint64_t size)
+  {
+  return scan_encoding(data, size) != enc_ansi;
+  }
+
+void decode(std::wstring& out, const char* first, const char* last, e_encoding enc)
+  {
+  const uint64_t size = (uint64_t)(last - first);
+  if (enc == enc_ansi)
+    {
+    out.reserve(out.size() + size);
+    for (; first != last; ++first)
+      out.push_back((wchar_t)ascii_to_utf16((unsigned char)*first));
+    return;
+    }
+  const size_t start = out.size();
+  out.resize(start + size); // the number of utf16 code units never exceeds the number of utf8 bytes
+  wchar_t* dst = &out[0] + start;
+  const unsigned char* p = (const unsigned char*)first;
+  const unsigned char* p_end = (const unsigned char*)last;
+  while (p < p_end)
+    {
+#if defined(JEDI_SSE2)
+    if (p_end - p >= 16 && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p)) == 0)
+      {
+      widen_16(dst, (const char*)p);
+      dst += 16;
+      p += 16;
+      continue;
+      }
+#endif
+    const unsigned char c = *p;
+    if (c < 0x80)
+      {
+      *dst++ = (wchar_t)c;
+      ++p;
+      }
+    else
+      {
+      uint32_t cp;
+      if (c < 0xE0)
+        {
+        cp = ((c & 0x1F) << 6) | (p[1] & 0x3F);
+        p += 2;
+        }
+      else if (c < 0xF0)
+        {
+        cp = ((c & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+        p += 3;
+        }
+      else
+        {
+        cp = ((c & 0x07) << 18) | ((p[1] & 0x3F) << 12) | ((p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+        p += 4;
+        }
+      if (cp >= 0x10000)
+        {
+        cp -= 0x10000;
+        *dst++ = (wchar_t)(0xD800 + (cp >> 10));
+        *dst++ = (wchar_t)(0xDC00 + (cp & 0x3FF));
+        }
+      else
+        *dst++ = (wchar_t)cp;
+      }
+    }
+  out.resize((size_t)(dst - &out[0]));
+  }
+
+std::wstring decode(const std::string& str)
+  {
+  std::wstring out;
+  decode(out, str.data(), str.data() + str.size(), scan_encoding(str.data(), str.size()));
+  return out;
+  }
+
+void encode(std::string& out, const wchar_t* first, const wchar_t* last)
+  {
+  out.reserve(out.size() + (size_t)(last - first));
+  while (first < last)
+    {
+#if defined(JEDI_SSE2)
+    if (last - first >= 8)
+      {
+      char ascii[8];
+      if (narrow_8(ascii, first))
+        {
+        out.append(ascii, 8);
+        first += 8;
+        continue;
+        }
+      }
+#endif
+    uint32_t cp = (uint32_t)*first++;
+    if (cp >= 0xD800 && cp <= 0xDBFF)
+      {
+      if (first < last && (uint32_t)*first >= 0xDC00 && (uint32_t)*first <= 0xDFFF)
+        {
+        cp = 0x10000 + ((cp - 0xD800) << 10) + ((uint32_t)*first - 0xDC00);
+        ++first;
+        }
+      else
+        cp = 0xFFFD;
+      }
+    else if ((cp >= 0xDC00 && cp <= 0xDFFF) || cp > 0x10FFFF)
+      cp = 0xFFFD;
+    append_utf8(out, cp);
+    }
+  }
+
+std::string encode(const std::wstring& wstr)
+  {
+  std::string out;
+  encode(out, wstr.data(), wstr.data() + wstr.size());
+  return out;
+  }
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+enum e_encoding
+  {
+  enc_ascii,
+  enc_utf8,
+  enc_ansi // the bytes are not valid utf8, each byte is mapped with ascii_to_utf16
+  };
+
+/*
+Scans [data, data+size) in one pass, and returns the encoding that should be used to decode these bytes.
+If line_offsets is not null, the offset (relative to data) of the character following each '\n' is appended to line_offsets.
+*/
+e_encoding scan_encoding(const char* data, uint64_t size, std::vector<uint64_t>* line_offsets = nullptr);
+
+bool is_ascii(const char* data, uint64_t size);
+
+bool is_valid_utf8(const char* data, uint64_t size);
+
+/*
+Appends the utf16 code units of [first, last) to out.
+[first, last) should have been scanned with scan_encoding before, as enc_ascii and enc_utf8 do not check the input.
+*/
+void decode(std::wstring& out, const char* first, const char* last, e_encoding enc);
+
+/*
+Scans and decodes str. Invalid utf8 falls back to enc_ansi, so this method never throws.
+*/
+std::wstring decode(const std::string& str);
+
+/*
+Appends the utf8 encoding of the utf16 code units in [first, last) to out.
+Unpaired surrogates are written as U+FFFD.
+*/
+void encode(std::string& out, const wchar_t* first, const wchar_t* last);
+
+std::string encode(const std::wstring& wstr);
@@ -3,6 +3,7 @@
 #include "colors.h"
 #include "keyboard.h"
 #include "mouse.h"
+#include "offset_index.h"
 #include "pdcex.h"
 #include "syntax_highlight.h"
 #include "utils.h"
@@ -12,11 +13,20 @@
 #include "hex.h"
 #include "edit.h"
 #include "mario.h"
+#include "background_tasks.h"
+#include "look.h"
+#include "lsp.h"
+#include "mapped_file.h"
+#include "match_set.h"
+#include "text_regex.h"
+#include "trigram_index.h"
 
 #include <jtk/file_utils.h>
 #include <jtk/pipe.h>
 
 #include <map>
+#include <mutex>
+#include <set>
 #include <functional>
 #include <sstream>
 #include <cctype>
@@ -44,6 +54,562 @@ extern "C"
 namespace
   {
   int font_width, font_height;
+
+  async_messages* p_async_messages = nullptr;
+  uint32_t async_message_event = 0xffffffff;
+
+  std::mutex save_mutex;
+  std::map<std::string, std::pair<uint64_t, std::shared_ptr<std::mutex>>> save_generations;
+
+  background_tasks& get_background_tasks()
+    {
+    static background_tasks tasks;
+    return tasks;
+    }
+
+  // can be called from any thread, wakes up process_input so that the engine handles the message
+  void post_async_message(const async_message& m)
+    {
+    p_async_messages->push(m);
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = async_message_event;
+    SDL_PushEvent(&event);
+    }
+
+  /*
+  Saves content on a background thread. Saves of the same file are serialized, and a save
+  that is overtaken by a newer save of the same file is skipped without a message, as the newer save reports.
+  */
+  void save_in_background(text content, const std::string& filename)
+    {
+    uint64_t generation;
+    std::shared_ptr<std::mutex> file_mutex;
+      {
+      std::scoped_lock lock(save_mutex);
+      auto& entry = save_generations[filename];
+      if (!entry.second)
+        entry.second = std::make_shared<std::mutex>();
+      generation = ++entry.first;
+      file_mutex = entry.second;
+      }
+    get_background_tasks().run([content, filename, generation, file_mutex]()
+      {
+      async_message m;
+      m.m = ASYNC_MESSAGE_SAVED;
+      m.str = filename;
+      std::scoped_lock file_lock(*file_mutex);
+      bool overtaken = false;
+        {
+        std::scoped_lock lock(save_mutex);
+        overtaken = save_generations[filename].first != generation;
+        }
+      if (overtaken)
+        return;
+      if (!write_to_file(content, filename))
+        m.m = ASYNC_MESSAGE_SAVE_FAILED;
+      post_async_message(m);
+      });
+    }
+
+  const int64_t search_index_min_rows = 100000; // smaller buffers are searched fast enough without index
+
+  std::mutex search_index_mutex;
+  std::vector<std::shared_ptr<const trigram_index>> finished_search_indices;
+
+  bool needs_search_index_update(const buffer_data& bd, uint64_t max_bytes)
+    {
+    const file_buffer& fb = bd.buffer;
+    if (max_bytes == 0 || bd.bt != bt_normal || fb.content.size() < search_index_min_rows)
+      return false;
+    const bool busy = fb.trigram_request != 0 && (!fb.trigrams || fb.trigrams->content_version() != fb.trigram_request);
+    return !busy && (!fb.trigrams || fb.trigrams->content_version() != fb.content_version);
+    }
+
+  /*
+  Builds the trigram index of the content of fb on a background thread, starting from the index of an older version if
+  there is one. The result is given to the buffer by attach_search_indices.
+  */
+  file_buffer update_search_index_in_background(file_buffer fb, uint64_t max_bytes)
+    {
+    fb.trigram_request = fb.content_version;
+    text content = fb.content;
+    uint64_t content_version = fb.content_version;
+    std::shared_ptr<const trigram_index> previous = fb.trigrams;
+    // the edited rows are taken from the change log if it goes back far enough, so that the texts need not be compared
+    int64_t equal_prefix = 0, equal_suffix = 0;
+    const bool logged = previous && get_equal_rows(equal_prefix, equal_suffix, fb, previous->content_version());
+    get_background_tasks().run([content, content_version, previous, max_bytes, logged, equal_prefix, equal_suffix]()
+      {
+      std::shared_ptr<const trigram_index> index = logged ?
+        std::make_shared<const trigram_index>(*previous, content, content_version, max_bytes, equal_prefix, equal_suffix) : previous ?
+        std::make_shared<const trigram_index>(*previous, content, content_version, max_bytes) :
+        std::make_shared<const trigram_index>(content, content_version, max_bytes);
+        {
+        std::scoped_lock lock(search_index_mutex);
+        finished_search_indices.push_back(index);
+        }
+      async_message m;
+      m.m = ASYNC_MESSAGE_SEARCH_INDEX;
+      post_async_message(m);
+      });
+    return fb;
+    }
+
+  void attach_search_indices(app_state& state)
+    {
+    std::vector<std::shared_ptr<const trigram_index>> indices;
+      {
+      std::scoped_lock lock(search_index_mutex);
+      indices.swap(finished_search_indices);
+      }
+    for (const auto& index : indices)
+      {
+      for (auto& b : state.buffers)
+        {
+        if (b.buffer.trigram_request == index->content_version())
+          b.buffer.trigrams = index;
+        }
+      }
+    }
+
+  uint64_t last_look_request = 0; // results of older requests are dropped
+
+  std::mutex look_mutex;
+  std::vector<std::pair<uint64_t, std::string>> finished_look_results;
+
+  /*
+  Searches pattern in the snapshots on a background thread. The lines with a hit are given to the +Look window by
+  attach_look_results as soon as a snapshot is searched, followed by a summary when all snapshots are searched.
+  */
+  void look_in_background(std::vector<look_snapshot> snapshots, const std::wstring& pattern, bool case_sensitive)
+    {
+    uint64_t request = ++last_look_request;
+    get_background_tasks().run([request, snapshots, pattern, case_sensitive]()
+      {
+      std::atomic<uint64_t> nr_of_lines(0), nr_of_files(0);
+      auto post = [request](const std::string& results)
+        {
+          {
+          std::scoped_lock lock(look_mutex);
+          finished_look_results.emplace_back(request, results);
+          }
+        async_message m;
+        m.m = ASYNC_MESSAGE_LOOK;
+        post_async_message(m);
+        };
+      look(snapshots, pattern, case_sensitive, [&](size_t, const std::string& lines, uint64_t nr)
+        {
+        if (nr == 0)
+          return;
+        nr_of_lines += nr;
+        ++nr_of_files;
+        post(lines);
+        });
+      std::stringstream str;
+      str << nr_of_lines << " line(s) found in " << nr_of_files << " of " << snapshots.size() << " file(s)\n";
+      post(str.str());
+      });
+    }
+
+  /*
+  Returns the id of the buffer with this name that is shown in an editor window, or 0xffffffff if there is none.
+  */
+  uint32_t find_editor_buffer(const app_state& state, const std::string& name)
+    {
+    for (const auto& w : state.windows)
+      {
+      if (w.wt == wt_normal && state.buffers[w.buffer_id].buffer.name == name)
+        return w.buffer_id;
+      }
+    return 0xffffffff;
+    }
+
+  void attach_look_results(app_state& state, const settings& s)
+    {
+    std::vector<std::pair<uint64_t, std::string>> results;
+      {
+      std::scoped_lock lock(look_mutex);
+      results.swap(finished_look_results);
+      }
+    uint32_t buffer_id = find_editor_buffer(state, "+Look");
+    if (buffer_id == 0xffffffff)
+      return;
+    file_buffer& fb = state.buffers[buffer_id].buffer;
+    const position pos = fb.pos;
+    const std::optional<position> start_selection = fb.start_selection;
+    for (const auto& r : results)
+      {
+      if (r.first != last_look_request)
+        continue;
+      fb.pos = get_last_position(fb);
+      fb.start_selection = std::nullopt;
+      fb = insert(fb, r.second, convert(s), false);
+      }
+    fb.pos = pos;
+    fb.start_selection = start_selection;
+    }
+
+  uint64_t last_match_request = 0;
+  uint64_t last_finished_match_request = 0;
+
+  std::mutex match_set_mutex;
+  std::vector<std::pair<uint64_t, std::shared_ptr<const match_set>>> finished_match_sets;
+
+  bool needs_match_set_update(const buffer_data& bd, const std::wstring& pattern, bool case_sensitive)
+    {
+    const file_buffer& fb = bd.buffer;
+    if (bd.bt != bt_normal || pattern.empty())
+      return false;
+    const bool busy = fb.match_request > last_finished_match_request;
+    return !busy && (!fb.matches || fb.matches->content_version() != fb.content_version || fb.matches->pattern() != pattern || fb.matches->case_sensitive() != case_sensitive);
+    }
+
+  /*
+  Finds all occurrences of pattern in the content of fb on a background thread. If fb has a match set for the same
+  pattern, only the rows that were edited since are searched again. The result is given to the buffer by attach_match_sets.
+  */
+  file_buffer update_match_set_in_background(file_buffer fb, const std::wstring& pattern, bool case_sensitive)
+    {
+    fb.match_request = ++last_match_request;
+    uint64_t request = fb.match_request;
+    text content = fb.content;
+    uint64_t content_version = fb.content_version;
+    std::shared_ptr<const match_set> previous = fb.matches;
+    if (previous && previous->case_sensitive() != case_sensitive)
+      previous.reset();
+    // a longer pattern, as typed during an incremental search, only needs the occurrences of its prefix to be checked
+    const bool narrow = previous && previous->content_version() == content_version && previous->pattern().size() < pattern.size() &&
+      pattern.compare(0, previous->pattern().size(), previous->pattern()) == 0;
+    if (previous && !narrow && previous->pattern() != pattern)
+      previous.reset();
+    int64_t equal_prefix = 0, equal_suffix = 0;
+    const bool logged = previous && !narrow && get_equal_rows(equal_prefix, equal_suffix, fb, previous->content_version());
+    get_background_tasks().run([request, content, content_version, previous, narrow, logged, equal_prefix, equal_suffix, pattern, case_sensitive]()
+      {
+      std::shared_ptr<const match_set> matches = narrow ?
+        std::make_shared<const match_set>(*previous, pattern) : logged ?
+        std::make_shared<const match_set>(*previous, content, content_version, equal_prefix, equal_suffix) : previous ?
+        std::make_shared<const match_set>(*previous, content, content_version) :
+        std::make_shared<const match_set>(content, content_version, pattern, case_sensitive);
+        {
+        std::scoped_lock lock(match_set_mutex);
+        finished_match_sets.emplace_back(request, matches);
+        }
+      async_message m;
+      m.m = ASYNC_MESSAGE_MATCH_SET;
+      post_async_message(m);
+      });
+    return fb;
+    }
+
+  void attach_match_sets(app_state& state)
+    {
+    std::vector<std::pair<uint64_t, std::shared_ptr<const match_set>>> sets;
+      {
+      std::scoped_lock lock(match_set_mutex);
+      sets.swap(finished_match_sets);
+      }
+    for (const auto& request_and_set : sets)
+      {
+      if (request_and_set.first > last_finished_match_request)
+        last_finished_match_request = request_and_set.first;
+      for (auto& b : state.buffers)
+        {
+        if (b.buffer.match_request == request_and_set.first)
+          b.buffer.matches = request_and_set.second;
+        }
+      }
+    }
+
+  const int64_t rows_lexed_before_first_frame = 4096; // the other rows of a loaded file are lexed in the background
+  const int64_t lexer_rows_per_chunk = 16384; // rows that are lexed in the background before they are repainted
+
+  struct lexer_chunk
+    {
+    uint64_t request;
+    int64_t first_row;
+    std::vector<uint8_t> status;
+    bool exact; // the rows were lexed from a row with a final status
+    bool last;
+    };
+
+  std::mutex lexer_mutex;
+  std::set<uint64_t> running_lexer_requests; // a job stops at its next chunk when its request is removed
+  std::vector<lexer_chunk> finished_lexer_chunks;
+
+  bool needs_lexer_update(const buffer_data& bd)
+    {
+    return bd.buffer.lex_pending && bd.buffer.lex_request != bd.buffer.content_version;
+    }
+
+  /*
+  Lexes the rows of fb on a background thread, the visible rows [first_visible_row, last_visible_row) first, starting
+  from their provisional status, and then all rows after the rows that are already lexed (get_lexed_rows) in chunks.
+  Each chunk is given to the buffer by attach_lexer_results, so that the rows are repainted as soon as they are lexed.
+  An edit cancels the job, and a new job is started for the new content by the engine loop, which resumes after the
+  rows that the edit left lexed.
+  */
+  file_buffer lex_in_background(file_buffer fb, int64_t first_visible_row, int64_t last_visible_row)
+    {
+    const int64_t lexed_rows = get_lexed_rows(fb);
+    fb.lexed_rows = lexed_rows;
+    fb.unlexed_rows = (int64_t)fb.content.size() - lexed_rows;
+    fb.lexed_version = fb.content_version;
+    fb.lex_request = fb.content_version;
+    const uint64_t request = fb.lex_request;
+      {
+      std::scoped_lock lock(lexer_mutex);
+      running_lexer_requests.insert(request);
+      }
+    get_background_tasks().run([fb, request, lexed_rows, first_visible_row, last_visible_row]()
+      {
+      auto post = [request](int64_t first_row, const std::vector<uint8_t>& status, bool exact, bool last)
+        {
+          {
+          std::scoped_lock lock(lexer_mutex);
+          if (running_lexer_requests.find(request) == running_lexer_requests.end())
+            return false;
+          if (last)
+            running_lexer_requests.erase(request);
+          finished_lexer_chunks.push_back(lexer_chunk{ request, first_row, status, exact, last });
+          }
+        async_message m;
+        m.m = ASYNC_MESSAGE_LEXER;
+        post_async_message(m);
+        return true;
+        };
+      const int64_t nr_of_rows = (int64_t)fb.content.size();
+      std::vector<uint8_t> status;
+      if (first_visible_row > lexed_rows && first_visible_row < nr_of_rows)
+        {
+        lex_rows(status, fb, first_visible_row, last_visible_row < nr_of_rows ? last_visible_row : nr_of_rows, fb.lex[first_visible_row]);
+        if (!post(first_visible_row, status, false, false))
+          return;
+        }
+      int64_t row = lexed_rows > 0 ? lexed_rows - 1 : 0; // the status at the begin of the last lexed row is final
+      uint8_t current_status = lexed_rows > 0 ? fb.lex[row] : lexer_normal;
+      do
+        {
+        const int64_t last_row = row + lexer_rows_per_chunk < nr_of_rows ? row + lexer_rows_per_chunk : nr_of_rows;
+        current_status = lex_rows(status, fb, row, last_row, current_status);
+        if (!post(row, status, true, last_row == nr_of_rows))
+          return;
+        row = last_row;
+        } while (row < nr_of_rows);
+      });
+    return fb;
+    }
+
+  /*
+  Removes the requests of the jobs that lex a content_version that is no longer shown, so that these jobs stop.
+  */
+  void cancel_lexer_jobs(const app_state& state)
+    {
+    std::scoped_lock lock(lexer_mutex);
+    auto it = running_lexer_requests.begin();
+    while (it != running_lexer_requests.end())
+      {
+      bool wanted = false;
+      for (const auto& b : state.buffers)
+        {
+        if (b.buffer.lex_pending && b.buffer.lex_request == *it && b.buffer.content_version == *it)
+          wanted = true;
+        }
+      if (wanted)
+        ++it;
+      else
+        it = running_lexer_requests.erase(it);
+      }
+    }
+
+  void attach_lexer_results(app_state& state)
+    {
+    std::vector<lexer_chunk> chunks;
+      {
+      std::scoped_lock lock(lexer_mutex);
+      chunks.swap(finished_lexer_chunks);
+      }
+    for (const auto& chunk : chunks)
+      {
+      for (auto& b : state.buffers)
+        {
+        file_buffer& fb = b.buffer;
+        if (!fb.lex_pending || fb.lex_request != chunk.request || fb.content_version != chunk.request)
+          continue;
+        auto trans = fb.lex.transient();
+        for (size_t i = 0; i < chunk.status.size(); ++i)
+          trans.set(chunk.first_row + (int64_t)i, chunk.status[i]);
+        fb.lex = trans.persistent();
+        if (chunk.exact && chunk.first_row <= fb.lexed_rows)
+          {
+          const int64_t last_row = chunk.first_row + (int64_t)chunk.status.size();
+          if (last_row > fb.lexed_rows)
+            fb.lexed_rows = last_row;
+          fb.unlexed_rows = (int64_t)fb.content.size() - fb.lexed_rows;
+          }
+        if (chunk.last)
+          {
+          fb.lex_pending = false;
+          fb.lex_request = 0;
+          }
+        }
+      }
+    }
+
+  /*
+  A language server that runs as a child process, and that reads from its stdin and writes to its stdout.
+  */
+  class process_transport : public lsp_transport
+    {
+    public:
+      process_transport() : _running(false)
+        {
+#ifdef _WIN32
+        _process = nullptr;
+#else
+        _process[0] = _process[1] = _process[2] = -1;
+#endif
+        }
+
+      ~process_transport()
+        {
+        if (_running)
+          jtk::destroy_pipe(_process, 9);
+        }
+
+      bool start(const std::string& file_path, std::vector<std::string> arguments, const std::string& folder)
+        {
+        jtk::active_folder af(folder.c_str());
+        arguments.insert(arguments.begin(), file_path);
+        std::vector<char*> argv;
+        for (auto& argument : arguments)
+          argv.push_back(&argument[0]);
+        argv.push_back(nullptr);
+#ifdef _WIN32
+        _running = jtk::create_pipe(file_path.c_str(), argv.data(), nullptr, &_process) == 0;
+#else
+        _running = jtk::create_pipe(file_path.c_str(), argv.data(), nullptr, _process) == 0;
+#endif
+        return _running;
+        }
+
+      virtual bool write(const std::string& data) override
+        {
+        return jtk::send_to_pipe(_process, data.c_str()) == 0;
+        }
+
+      virtual std::string read(int timeout_ms) override
+        {
+        return jtk::read_from_pipe(_process, timeout_ms);
+        }
+
+    private:
+#ifdef _WIN32
+      void* _process;
+#else
+      int _process[3];
+#endif
+      bool _running;
+    };
+
+  std::map<std::string, std::unique_ptr<lsp_client>> lsp_clients; // by executable, started when the first file of their language is shown
+  std::set<std::string> failed_lsp_servers; // are not started again
+  std::map<uint32_t, std::pair<lsp_client*, uint64_t>> lsp_completion_requests; // the last completion request of each buffer
+  std::pair<lsp_client*, uint64_t> lsp_definition_request(nullptr, 0);
+  uint32_t lsp_definition_buffer = 0xffffffff;
+  std::map<std::string, std::string> lsp_diagnostics_text; // the diagnostics of each file as they were last written to +Errors
+
+  const lsp_config& get_lsp_config()
+    {
+    static lsp_config config;
+    return config;
+    }
+
+  /*
+  Returns the client of the language server of the file, which is started the first time, or nullptr if no server is
+  configured for the file or if it could not be started.
+  */
+  lsp_client* get_lsp_client(app_state& state, const std::string& filename, settings& s)
+    {
+    const lsp_server* server = get_lsp_config().get_server_from_extension(filename);
+    if (!server || failed_lsp_servers.find(server->executable) != failed_lsp_servers.end())
+      return nullptr;
+    auto it = lsp_clients.find(server->executable);
+    if (it != lsp_clients.end())
+      return it->second.get();
+    const std::string folder = jtk::get_folder(filename);
+    const std::string file_path = get_file_path(server->executable, "");
+    auto transport = std::make_unique<process_transport>();
+    if (file_path.empty() || !transport->start(file_path, server->arguments, folder))
+      {
+      failed_lsp_servers.insert(server->executable);
+      state = add_error_text(state, "Could not start language server " + server->executable + "\n", s);
+      return nullptr;
+      }
+    auto client = std::make_unique<lsp_client>(std::move(transport), folder, server->language_id, []()
+      {
+      async_message m;
+      m.m = ASYNC_MESSAGE_LSP;
+      post_async_message(m);
+      });
+    lsp_client* result = client.get();
+    lsp_clients[server->executable] = std::move(client);
+    return result;
+    }
+
+  bool is_lsp_document(const app_state& state, uint32_t buffer_id)
+    {
+    const buffer_data& bd = state.buffers[buffer_id];
+    return bd.bt == bt_normal && !bd.buffer.name.empty() && bd.buffer.name.front() != '+' && bd.buffer.load_request == 0 && state.windows[state.buffer_id_to_window_id[buffer_id]].wt == wt_normal;
+    }
+
+  /*
+  Keeps the language servers in sync with the files in the editor windows: a file is opened at its server when it is
+  shown, its edits are sent as they are made, and it is closed when it is no longer shown.
+  */
+  void sync_lsp_documents(app_state& state, settings& s)
+    {
+    std::map<lsp_client*, std::set<std::string>> shown;
+    for (size_t i = 0; i < state.windows.size(); ++i)
+      {
+      const uint32_t buffer_id = state.windows[i].buffer_id;
+      if (state.windows[i].wt != wt_normal || !is_lsp_document(state, buffer_id))
+        continue;
+      const std::string filename = state.buffers[buffer_id].buffer.name;
+      lsp_client* client = get_lsp_client(state, filename, s);
+      if (!client)
+        continue;
+      client->sync(state.buffers[buffer_id].buffer);
+      shown[client].insert(filename);
+      }
+    for (auto& c : lsp_clients)
+      {
+      const auto& filenames = shown[c.second.get()];
+      for (const auto& filename : c.second->get_open_documents())
+        {
+        if (filenames.find(filename) == filenames.end())
+          c.second->close(filename);
+        }
+      }
+    }
+
+  /*
+  Asks the language server of the buffer for the completions at its cursor. The answer is merged in the suggestions of
+  code_completion by attach_lsp_results.
+  */
+  void request_lsp_completion(app_state& state, uint32_t buffer_id, settings& s)
+    {
+    if (!is_lsp_document(state, buffer_id))
+      return;
+    lsp_client* client = get_lsp_client(state, state.buffers[buffer_id].buffer.name, s);
+    if (!client)
+      return;
+    const file_buffer& fb = state.buffers[buffer_id].buffer;
+    const uint64_t request = client->request_completion(fb, get_actual_position(fb));
+    if (request != 0)
+      lsp_completion_requests[buffer_id] = std::make_pair(client, request);
+    }
   }
 
 const plumber& get_plumber()
@@ -78,7 +644,7 @@ buffer_data make_empty_buffer_data() {
 bool can_be_saved(const std::string& name) {
   if (name.empty())
     return true;
-  if (name == std::string("+Errors") || name.front() == '=')
+  if (name == std::string("+Errors") || name == std::string("+Look") || name.front() == '=')
     return false;
   return true;
   }
@@ -298,8 +864,8 @@ std::string get_command_text(const app_state& state, uint32_t buffer_id, const s
   auto& textf = state.buffers[buffer_id + 1].buffer;
 
   bool put = textf.modification_mask != 0 && can_be_saved(f.name);
-  bool undo = !textf.history.empty() && textf.undo_redo_index > 0;
-  bool redo = !textf.history.empty() && textf.undo_redo_index < textf.history.size();
+  bool undo = can_undo(textf);
+  bool redo = can_redo(textf);
 
   bool get = true;//jtk::is_directory(f.name);
   std::stringstream str;
@@ -465,17 +1031,22 @@ app_state set_filename(app_state state, uint32_t buffer_id, const settings& s) {
   return state;
   }
 
-app_state add_error_window(app_state state, settings& s)
+app_state add_named_window(app_state state, const std::string& name, settings& s)
   {
   state = *command_new_window(state, 0xffffffff, s);
   uint32_t buffer_id = state.buffers.size() - 1;
   uint32_t command_id = state.buffers.size() - 2;
-  state.buffers[buffer_id].buffer.name = "+Errors";
-  state.buffers[command_id].buffer.name = "+Errors";
-  state.buffers[command_id].buffer.content = to_text(make_command_text(state, command_id, s));
+  state.buffers[buffer_id].buffer.name = name;
+  state.buffers[command_id].buffer.name = name;
+  state.buffers[command_id].buffer = set_text(state.buffers[command_id].buffer, to_text(make_command_text(state, command_id, s)));
   return state;
   }
 
+app_state add_error_window(app_state state, settings& s)
+  {
+  return add_named_window(state, "+Errors", s);
+  }
+
 app_state add_error_text(app_state state, const std::string& errortext, settings& s)
   {
   std::string error_filename("+Errors");
@@ -1093,7 +1664,7 @@ app_state check_operation_scroll_position(app_state state, const settings& s)
 app_state check_operation_buffer(app_state state)
   {
   if (state.operation_buffer.content.size() > 1)
-    state.operation_buffer.content = state.operation_buffer.content.take(1);
+    state.operation_buffer = set_text(state.operation_buffer, state.operation_buffer.content.take(1));
   state.operation_buffer.pos.row = 0;
   return state;
   }
@@ -1325,21 +1896,51 @@ app_state text_input_standard(app_state state, const char* txt, const settings&
   return check_scroll_position(state, s);
   }
 
+/*
+Searches the pattern in the operation buffer after it was edited. If the pattern extends the pattern of the last step,
+the search resumes at the last hit, as the first occurrence of the longer pattern cannot come before it. If the pattern
+equals the pattern of an earlier step, that step is restored. Otherwise the search starts again from where it began.
+*/
+app_state incremental_search(app_state state, settings& s)
+  {
+  file_buffer& fb = get_active_buffer(state);
+  std::wstring pattern = to_wstring(state.operation_buffer.content);
+  auto& steps = state.incremental_search_steps;
+  if (steps.empty())
+    steps.push_back(incremental_search_step{ std::wstring(), fb.pos, fb.start_selection, fb.matches });
+  for (auto& step : steps)
+    {
+    if (fb.matches && fb.matches->pattern() == step.pattern)
+      step.matches = fb.matches; // the match set of this step was computed in the meantime
+    }
+  auto restore = [&](const incremental_search_step& step)
+    {
+    fb.pos = step.pos;
+    fb.start_selection = step.start_selection;
+    if (step.matches && step.matches->content_version() == fb.content_version)
+      fb.matches = step.matches;
+    };
+  while (steps.size() > 1 && pattern.compare(0, steps.back().pattern.size(), steps.back().pattern) != 0)
+    steps.pop_back();
+  restore(steps.back());
+  if (steps.back().pattern != pattern)
+    {
+    if (fb.start_selection != std::nullopt && *fb.start_selection < fb.pos)
+      fb.pos = *fb.start_selection;
+    fb.start_selection = std::nullopt;
+    fb = s.case_sensitive ? find_text(fb, pattern) : find_text_case_insensitive(fb, pattern);
+    steps.push_back(incremental_search_step{ pattern, fb.pos, fb.start_selection, nullptr });
+    }
+  s.last_find = jtk::convert_wstring_to_string(pattern);
+  return check_scroll_position(state, s);
+  }
+
 app_state text_input_operation(app_state state, const char* txt, settings& s)
   {
   std::string t(txt);
   state.operation_buffer = insert(state.operation_buffer, t, convert(s));
   if (state.operation == op_incremental_search)
-    {
-    if (get_active_buffer(state).start_selection != std::nullopt && *get_active_buffer(state).start_selection < get_active_buffer(state).pos)
-      {
-      get_active_buffer(state).pos = *get_active_buffer(state).start_selection;
-      }
-    get_active_buffer(state).start_selection = std::nullopt;
-    get_active_buffer(state) = s.case_sensitive ? find_text(get_active_buffer(state), state.operation_buffer.content) : find_text_case_insensitive(get_active_buffer(state), state.operation_buffer.content);
-    s.last_find = to_string(state.operation_buffer.content);
-    state = check_scroll_position(state, s);
-    }
+    state = incremental_search(state, s);
   return check_operation_buffer(state);
   }
 
@@ -1357,13 +1958,15 @@ app_state backspace_editor(app_state state, const settings& s)
   return check_scroll_position(state, s);
   }
 
-app_state backspace_operation(app_state state, const settings& s)
+app_state backspace_operation(app_state state, settings& s)
   {
   state.operation_buffer = erase(state.operation_buffer, convert(s));
+  if (state.operation == op_incremental_search)
+    state = incremental_search(state, s);
   return check_operation_buffer(state);
   }
 
-app_state backspace(app_state state, const settings& s)
+app_state backspace(app_state state, settings& s)
   {
   if (state.operation == op_editing)
     return backspace_editor(state, s);
@@ -1726,10 +2329,13 @@ app_state ret_editor(app_state state, settings& s)
 
 app_state clear_operation_buffer(app_state state)
   {
-  state.operation_buffer.content = text();
+  state.operation_buffer = set_text(state.operation_buffer, text());
   state.operation_buffer.lex = lexer_status();
   state.operation_buffer.history = immutable::vector<snapshot, false>();
-  state.operation_buffer.undo_redo_index = 0;
+  state.operation_buffer.history_bytes = 0;
+  state.operation_buffer.generation = 0;
+  state.operation_buffer.parent_generation = 0;
+  state.operation_buffer.next_generation = 1;
   state.operation_buffer.start_selection = std::nullopt;
   state.operation_buffer.rectangular_selection = false;
   state.operation_buffer.pos.row = 0;
@@ -1738,12 +2344,78 @@ app_state clear_operation_buffer(app_state state)
   return state;
   }
 
+/*
+Runs sam's X or Y command on the open files. The files are edited in parallel, and each file either gets the result of
+the whole command or stays as it was. A summary line for each file that the command ran on is written to +Errors.
+*/
+app_state edit_files(app_state state, const std::string& edit_command, settings& s)
+  {
+  std::vector<uint32_t> buffer_ids;
+  std::vector<file_buffer> files;
+  for (const auto& w : state.windows)
+    {
+    const buffer_data& bd = state.buffers[w.buffer_id];
+    if (w.wt != wt_normal || bd.bt != bt_normal || bd.buffer.name.empty() || bd.buffer.name.front() == '+' || jtk::is_directory(bd.buffer.name))
+      continue;
+    if (std::find(buffer_ids.begin(), buffer_ids.end(), w.buffer_id) != buffer_ids.end())
+      continue;
+    buffer_ids.push_back(w.buffer_id);
+    files.push_back(bd.buffer);
+    }
+  std::vector<file_command_result> results;
+  try {
+    results = handle_file_command(files, edit_command, convert(s));
+    }
+  catch (std::runtime_error e) {
+    return add_error_text(state, e.what(), s);
+    }
+  std::stringstream str;
+  uint64_t nr_of_files = 0;
+  uint64_t nr_of_changed_files = 0;
+  for (size_t i = 0; i < results.size(); ++i)
+    {
+    const file_command_result& result = results[i];
+    if (!result.selected)
+      continue;
+    ++nr_of_files;
+    const file_buffer& old_buffer = state.buffers[buffer_ids[i]].buffer;
+    str << old_buffer.name << ": ";
+    if (!result.error.empty())
+      {
+      str << result.error << "\n";
+      continue;
+      }
+    if (result.buffer.content_version == old_buffer.content_version)
+      str << "no changes\n";
+    else
+      {
+      int64_t equal_prefix, equal_suffix;
+      get_equal_rows(equal_prefix, equal_suffix, old_buffer.content, result.buffer.content);
+      int64_t changed_rows = (int64_t)result.buffer.content.size() - equal_prefix - equal_suffix;
+      if (changed_rows < (int64_t)old_buffer.content.size() - equal_prefix - equal_suffix)
+        changed_rows = (int64_t)old_buffer.content.size() - equal_prefix - equal_suffix;
+      str << changed_rows << " line(s) changed\n";
+      ++nr_of_changed_files;
+      }
+    state.buffers[buffer_ids[i]].buffer = result.buffer;
+    state = check_scroll_position(state, buffer_ids[i], s);
+    }
+  str << nr_of_changed_files << " of " << nr_of_files << " file(s) changed\n";
+  return add_error_text(state, str.str(), s);
+  }
+
 app_state edit(app_state state, settings& s)
   {
   uint32_t buffer_id = state.active_buffer;
   std::string edit_command;
   if (!state.operation_buffer.content.empty())
     edit_command = jtk::convert_wstring_to_string(std::wstring(state.operation_buffer.content[0].begin(), state.operation_buffer.content[0].end()));
+  if (is_file_command(edit_command))
+    {
+    state = edit_files(state, edit_command, s);
+    state.operation = op_editing;
+    return state;
+    }
   try {
     state.buffers[buffer_id].buffer = handle_command(state.buffers[buffer_id].buffer, edit_command, convert(s));
     }
@@ -1754,6 +2426,27 @@ app_state edit(app_state state, settings& s)
   return check_scroll_position(state, buffer_id, s);
   }
 
+/*
+Finds the next occurrence of pattern in the buffer, as a regular expression if regex_find is set.
+*/
+app_state find_next_occurrence(app_state state, uint32_t buffer_id, const std::wstring& pattern, settings& s)
+  {
+  if (!s.regex_find)
+    {
+    state.buffers[buffer_id].buffer = s.case_sensitive ? find_text(state.buffers[buffer_id].buffer, pattern) : find_text_case_insensitive(state.buffers[buffer_id].buffer, pattern);
+    return state;
+    }
+  try
+    {
+    state.buffers[buffer_id].buffer = find_regex(state.buffers[buffer_id].buffer, pattern, s.case_sensitive);
+    }
+  catch (text_regex_error& e)
+    {
+    state = add_error_text(state, std::string("Invalid regular expression: ") + e.what(), s);
+    }
+  return state;
+  }
+
 app_state find(app_state state, settings& s)
   {
   uint32_t buffer_id = state.active_buffer;
@@ -1762,7 +2455,7 @@ app_state find(app_state state, settings& s)
   if (!state.operation_buffer.content.empty())
     search_string = std::wstring(state.operation_buffer.content[0].begin(), state.operation_buffer.content[0].end());
   s.last_find = jtk::convert_wstring_to_string(search_string);
-  state.buffers[buffer_id].buffer = s.case_sensitive ? find_text(state.buffers[buffer_id].buffer, search_string) : find_text_case_insensitive(state.buffers[buffer_id].buffer, search_string);
+  state = find_next_occurrence(state, buffer_id, search_string, s);
   state.operation = op_editing;
   return check_scroll_position(state, s);
   }
@@ -1794,20 +2487,7 @@ app_state replace_all(app_state state, settings& s)
     replace_string = std::wstring(state.operation_buffer.content[0].begin(), state.operation_buffer.content[0].end());
   s.last_replace = jtk::convert_wstring_to_string(replace_string);
   std::wstring find_string = jtk::convert_string_to_wstring(s.last_find);
-  state.buffers[buffer_id].buffer.pos = position(0, 0); // go to start
-  state.buffers[buffer_id].buffer.start_selection = std::nullopt;
-  state.buffers[buffer_id].buffer.rectangular_selection = false;
-  state.buffers[buffer_id].buffer = s.case_sensitive ? find_text(state.buffers[buffer_id].buffer, find_string) : find_text_case_insensitive(state.buffers[buffer_id].buffer, find_string);
-  if (state.buffers[buffer_id].buffer.pos == get_last_position(state.buffers[buffer_id].buffer))
-    return state;
-  state.buffers[buffer_id].buffer = push_undo(state.buffers[buffer_id].buffer);
-  auto senv = convert(s);
-  while (state.buffers[buffer_id].buffer.pos != get_last_position(state.buffers[buffer_id].buffer))
-    {
-    state.buffers[buffer_id].buffer = erase_right(state.buffers[buffer_id].buffer, senv, false);
-    state.buffers[buffer_id].buffer = insert(state.buffers[buffer_id].buffer, replace_string, senv, false);
-    state.buffers[buffer_id].buffer = s.case_sensitive ? find_text(state.buffers[buffer_id].buffer, find_string) : find_text_case_insensitive(state.buffers[buffer_id].buffer, find_string);
-    }
+  state.buffers[buffer_id].buffer = replace_text(state.buffers[buffer_id].buffer, find_string, replace_string, s.case_sensitive, convert(s));
   return check_scroll_position(state, buffer_id, s);
   }
 
@@ -1830,19 +2510,7 @@ app_state replace_selection(app_state state, settings& s)
   if (end_pos < start_pos)
     std::swap(start_pos, end_pos);
 
-  state.buffers[buffer_id].buffer.pos = start_pos;
-  state.buffers[buffer_id].buffer = s.case_sensitive ? find_text(state.buffers[buffer_id].buffer, find_string) : find_text_case_insensitive(state.buffers[buffer_id].buffer, find_string);
-  if (state.buffers[buffer_id].buffer.pos == get_last_position(state.buffers[buffer_id].buffer))
-    return state;
-  state.buffers[buffer_id].buffer = push_undo(state.buffers[buffer_id].buffer);
-  auto senv = convert(s);
-
-  while (state.buffers[buffer_id].buffer.pos <= end_pos)
-    {
-    state.buffers[buffer_id].buffer = erase_right(state.buffers[buffer_id].buffer, senv, false);
-    state.buffers[buffer_id].buffer = insert(state.buffers[buffer_id].buffer, replace_string, senv, false);
-    state.buffers[buffer_id].buffer = s.case_sensitive ? find_text(state.buffers[buffer_id].buffer, find_string) : find_text_case_insensitive(state.buffers[buffer_id].buffer, find_string);
-    }
+  state.buffers[buffer_id].buffer = replace_text(state.buffers[buffer_id].buffer, find_string, replace_string, s.case_sensitive, start_pos, end_pos, convert(s));
   return check_scroll_position(state, buffer_id, s);
   }
 
@@ -1869,7 +2537,7 @@ std::optional<app_state> command_find_next(app_state state, uint32_t buffer_id,
   {
   //state.message = string_to_line("[Find next]");
   state.operation = op_editing;
-  state.buffers[buffer_id].buffer = s.case_sensitive ? find_text(state.buffers[buffer_id].buffer, s.last_find) : find_text_case_insensitive(state.buffers[buffer_id].buffer, s.last_find);
+  state = find_next_occurrence(state, buffer_id, jtk::convert_string_to_wstring(s.last_find), s);
   return check_scroll_position(state, buffer_id, s);
   }
 
@@ -1883,6 +2551,28 @@ app_state gotoline(app_state state, const settings& s)
     {
     int64_t r = -1;
     std::wstring line_nr = std::wstring(state.operation_buffer.content[0].begin(), state.operation_buffer.content[0].end());
+    if (!line_nr.empty() && line_nr[0] == L'#') // character offset, as in sam, or utf8 byte offset with #b
+      {
+      const bool bytes = line_nr.size() > 1 && line_nr[1] == L'b';
+      int64_t offset = -1;
+      std::wstringstream str;
+      str << line_nr.substr(bytes ? 2 : 1);
+      str >> offset;
+      if (offset >= 0)
+        {
+        auto& fb = state.buffers[buffer_id].buffer;
+        fb = clear_selection(fb);
+        position pos(0, 0);
+        if (bytes)
+          pos = get_offset_index(fb)->get_position_from_byte_offset(offset);
+        else if (offset <= max_walked_characters)
+          move_over_characters(pos, fb.content, offset, false); // an offset past the end gives the last position, as the index does
+        else
+          pos = get_offset_index(fb)->get_position(offset);
+        fb = update_position(fb, pos, convert(s));
+        }
+      return check_scroll_position(state, buffer_id, s);
+      }
     std::wstringstream str;
     str << line_nr;
     str >> r;
@@ -2231,35 +2921,138 @@ app_state optimize_column(app_state state, uint32_t buffer_id, settings& s)
   return resize_windows(state, s);
   }
 
-std::optional<app_state> load_file(app_state state, uint32_t buffer_id, const std::string& filename, settings& s)
+namespace
   {
-  if (jtk::is_directory(filename)) {
-    state = *command_new_window(state, 0xffffffff, s);
-    get_active_buffer(state) = read_from_file(filename);
-    int64_t command_id = state.active_buffer - 1;
-    state.buffers[command_id].buffer.name = get_active_buffer(state).name;
-    get_active_buffer(state) = set_multiline_comments(get_active_buffer(state));
-    get_active_buffer(state) = init_lexer_status(get_active_buffer(state), convert(s));
-    state.buffers[command_id].buffer.content = to_text(make_command_text(state, command_id, s));
-    return check_scroll_position(state, s);
+  const uint64_t background_read_bytes = 16 << 20; // larger files are read on a background thread, after their window is shown
+
+  std::mutex file_read_mutex;
+  std::vector<file_buffer> finished_file_reads;
+
+  bool should_be_read_in_background(const std::string& filename)
+    {
+    mapped_file f;
+    return !jtk::is_directory(filename) && f.open(filename) && f.size() >= background_read_bytes;
+    }
+
+  /*
+  Returns an empty buffer for filename, and reads the file on a background thread. The text is given to the buffer by
+  attach_file_reads, so that the window of a large file is shown before its text is built.
+  */
+  file_buffer read_from_file_in_background(const std::string& filename)
+    {
+    file_buffer fb = make_empty_buffer();
+    fb.name = filename;
+    fb.load_request = fb.content_version;
+    const uint64_t request = fb.load_request;
+    get_background_tasks().run([filename, request]()
+      {
+      file_buffer read = read_from_file(filename);
+      read.load_request = request;
+        {
+        std::scoped_lock lock(file_read_mutex);
+        finished_file_reads.push_back(read);
+        }
+      async_message m;
+      m.m = ASYNC_MESSAGE_FILE_READ;
+      post_async_message(m);
+      });
+    return fb;
+    }
+
+  /*
+  Replaces the empty buffers of the files that were read in the background by their text. The empty buffers cannot be
+  edited, see reject_edits_while_reading, or saved, so that neither the edits nor the file on disk get lost.
+  */
+  void attach_file_reads(app_state& state, settings& s)
+    {
+    std::vector<file_buffer> reads;
+      {
+      std::scoped_lock lock(file_read_mutex);
+      reads.swap(finished_file_reads);
+      }
+    for (const auto& read : reads)
+      {
+      for (uint32_t buffer_id = 1; buffer_id < (uint32_t)state.buffers.size(); ++buffer_id)
+        {
+        if (state.buffers[buffer_id].buffer.load_request != read.load_request)
+          continue;
+        file_buffer fb = read;
+        fb.load_request = 0;
+        fb = set_multiline_comments(fb);
+        fb = init_lexer_status(fb, rows_lexed_before_first_frame, convert(s));
+        state.buffers[buffer_id].buffer = fb;
+        state.buffers[buffer_id].scroll_row = 0;
+        const uint32_t command_id = buffer_id - 1;
+        state.buffers[command_id].buffer = set_text(state.buffers[command_id].buffer, to_text(make_command_text(state, command_id, s)));
+        }
+      }
+    }
+
+  /*
+  Undoes the edits of new_state to the empty buffers of files that are still being read, as their text would be
+  replaced by the file. These buffers are restored from state, which was shown when the edit was made.
+  */
+  app_state reject_edits_while_reading(const app_state& state, app_state new_state, settings& s)
+    {
+    std::vector<std::string> rejected;
+    for (auto& b : new_state.buffers)
+      {
+      if (b.buffer.load_request == 0 || b.buffer.content_version == b.buffer.load_request)
+        continue;
+      for (const auto& old : state.buffers)
+        {
+        if (old.buffer.load_request == b.buffer.load_request)
+          {
+          b.buffer = old.buffer;
+          rejected.push_back(b.buffer.name);
+          break;
+          }
+        }
+      }
+    for (const auto& name : rejected)
+      new_state = add_error_text(new_state, "Error editing " + name + ", the file is still loading\n", s);
+    return new_state;
     }
-  else if (jtk::file_exists(filename))
+
+  std::optional<app_state> load_file(app_state state, uint32_t buffer_id, const std::string& filename, file_buffer fb, settings& s)
     {
-    state = *command_new_window(state, state.active_buffer, s);
-    get_active_buffer(state) = read_from_file(filename);
+    if (jtk::is_directory(filename)) {
+      state = *command_new_window(state, 0xffffffff, s);
+      }
+    else if (jtk::file_exists(filename))
+      {
+      state = *command_new_window(state, state.active_buffer, s);
+      }
+    else
+      {
+      std::stringstream str;
+      str << "File " << filename << " does not exist\n";
+      return add_error_text(state, str.str(), s);
+      }
+    get_active_buffer(state) = fb;
     int64_t command_id = state.active_buffer - 1;
     state.buffers[command_id].buffer.name = get_active_buffer(state).name;
     get_active_buffer(state) = set_multiline_comments(get_active_buffer(state));
-    get_active_buffer(state) = init_lexer_status(get_active_buffer(state), convert(s));
-    state.buffers[command_id].buffer.content = to_text(make_command_text(state, command_id, s));
+    get_active_buffer(state) = init_lexer_status(get_active_buffer(state), rows_lexed_before_first_frame, convert(s));
+    state.buffers[command_id].buffer = set_text(state.buffers[command_id].buffer, to_text(make_command_text(state, command_id, s)));
     return check_scroll_position(state, s);
     }
-  else
-    {
-    std::stringstream str;
-    str << "File " << filename << " does not exist\n";
-    return add_error_text(state, str.str(), s);
-    }
+  }
+
+std::optional<app_state> load_file(app_state state, uint32_t buffer_id, const std::string& filename, settings& s)
+  {
+  if (jtk::is_directory(filename) || jtk::file_exists(filename))
+    return load_file(state, buffer_id, filename, should_be_read_in_background(filename) ? read_from_file_in_background(filename) : read_from_file(filename), s);
+  std::stringstream str;
+  str << "File " << filename << " does not exist\n";
+  return add_error_text(state, str.str(), s);
+  }
+
+std::optional<app_state> load_files(app_state state, uint32_t buffer_id, const std::vector<std::string>& filenames, settings& s)
+  {
+  std::vector<file_buffer> buffers = read_from_files(filenames);
+  for (size_t i = 0; i < filenames.size(); ++i)
+    state = *load_file(state, buffer_id, filenames[i], buffers[i], s);
   return state;
   }
 
@@ -2341,7 +3134,7 @@ std::optional<app_state> load_folder(app_state state, uint32_t buffer_id, const
     int64_t command_id = buffer_id - 1;
     state.buffers[buffer_id].buffer = read_from_file(simplified_folder_name);
     state.buffers[buffer_id].buffer = set_multiline_comments(state.buffers[buffer_id].buffer);
-    state.buffers[buffer_id].buffer = init_lexer_status(state.buffers[buffer_id].buffer, convert(s));
+    state.buffers[buffer_id].buffer = init_lexer_status(state.buffers[buffer_id].buffer, rows_lexed_before_first_frame, convert(s));
     state.buffers[buffer_id].buffer.pos = position(0, 0);
     state.buffers[buffer_id].scroll_row = 0;
     auto original_position = state.buffers[command_id].buffer.pos;
@@ -2350,7 +3143,7 @@ std::optional<app_state> load_folder(app_state state, uint32_t buffer_id, const
     std::string user_command_text = get_user_command_text(state, command_id);
     std::string command_text = get_command_text(state, command_id, s);
     std::string total_line = simplified_folder_name + command_text + user_command_text;
-    state.buffers[command_id].buffer.content = to_text(total_line);
+    state.buffers[command_id].buffer = set_text(state.buffers[command_id].buffer, to_text(total_line));
     set_updated_command_text_position(state.buffers[command_id].buffer, original_position, original_start_selection, original_first_row_length, false);
     return check_scroll_position(state, buffer_id, s);
     }
@@ -2371,6 +3164,50 @@ std::optional<app_state> find_text(app_state state, uint32_t buffer_id, const st
   return state;
   }
 
+/*
+Splits "file:line" or "file:line:", as written by Lookall or by compilers, in the file and the line number.
+Returns false if cmd does not end in a line number.
+*/
+bool split_line_number(std::string& filename, int64_t& line_nr, std::string cmd)
+  {
+  if (!cmd.empty() && cmd.back() == ':')
+    cmd.pop_back();
+  auto colon = cmd.find_last_of(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == cmd.size() || cmd.size() - colon > 10)
+    return false;
+  for (size_t i = colon + 1; i < cmd.size(); ++i)
+    {
+    if (!std::isdigit((unsigned char)cmd[i]))
+      return false;
+    }
+  filename = cmd.substr(0, colon);
+  line_nr = std::stoll(cmd.substr(colon + 1));
+  return true;
+  }
+
+/*
+Moves the cursor to line line_nr of the file, in the window that shows the file, or in a new window if the file is not open.
+*/
+std::optional<app_state> load_file_at_line(app_state state, uint32_t buffer_id, const std::string& filename, int64_t line_nr, settings& s)
+  {
+  uint32_t file_id = find_editor_buffer(state, filename);
+  if (file_id == 0xffffffff)
+    {
+    state = *load_file(state, buffer_id, filename, read_from_file(filename), s); // the line must be there to move to
+    if (get_active_buffer(state).name != filename)
+      return state;
+    file_id = state.active_buffer;
+    }
+  file_buffer& fb = state.buffers[file_id].buffer;
+  fb = clear_selection(fb);
+  int64_t row = line_nr > 0 ? line_nr - 1 : 0;
+  if (row > get_last_position(fb).row)
+    row = get_last_position(fb).row;
+  fb = update_position(fb, position(row, 0), convert(s));
+  state.active_buffer = file_id;
+  return check_scroll_position(state, file_id, s);
+  }
+
 std::optional<app_state> load(app_state state, uint32_t buffer_id, const std::wstring& command, settings& s)
   {
   if (command.empty())
@@ -2394,6 +3231,18 @@ std::optional<app_state> load(app_state state, uint32_t buffer_id, const std::ws
     cmd.pop_back();
   std::string newfilename = folder + cmd;
 
+  std::string line_filename;
+  int64_t line_nr;
+  if (split_line_number(line_filename, line_nr, jtk::convert_wstring_to_string(command)))
+    {
+    std::string stripped_line_filename;
+    split_line_number(stripped_line_filename, line_nr, cmd);
+    if (!jtk::file_exists(line_filename) && jtk::file_exists(folder + stripped_line_filename))
+      line_filename = folder + stripped_line_filename;
+    if (jtk::file_exists(line_filename) || find_editor_buffer(state, line_filename) != 0xffffffff)
+      return load_file_at_line(state, buffer_id, line_filename, line_nr, s);
+    }
+
   if (jtk::file_exists(newfilename))
     {
     if (!ctrl_pressed()) {
@@ -3407,6 +4256,12 @@ std::optional<app_state> command_line_numbers(app_state state, uint32_t, setting
   return state;
   }
 
+std::optional<app_state> command_matches(app_state state, uint32_t, settings& s)
+  {
+  s.highlight_matches = !s.highlight_matches;
+  return state;
+  }
+
 std::optional<app_state> command_wrap(app_state state, uint32_t, settings& s)
   {
   s.wrap = !s.wrap;
@@ -3419,6 +4274,12 @@ std::optional<app_state> command_case_sensitive(app_state state, uint32_t, setti
   return state;
   }
 
+std::optional<app_state> command_regex(app_state state, uint32_t, settings& s)
+  {
+  s.regex_find = !s.regex_find;
+  return state;
+  }
+
 std::optional<app_state> command_syntax_highlighting(app_state state, uint32_t buffer_id, settings& s)
   {
   /*
@@ -3452,10 +4313,12 @@ std::optional<app_state> command_syntax_highlighting(app_state state, uint32_t b
 
 std::optional<app_state> command_edit_with_parameters(app_state state, uint32_t buffer_id, std::wstring& sz, settings& s)
   {
+  std::string edit_command = jtk::convert_wstring_to_string(sz);
+  if (is_file_command(edit_command))
+    return edit_files(state, edit_command, s);
   buffer_id = get_editor_buffer_id(state, buffer_id);
   if (buffer_id == 0xffffffff)
     return state;
-  std::string edit_command = jtk::convert_wstring_to_string(sz);
   try {
     state.buffers[buffer_id].buffer = handle_command(state.buffers[buffer_id].buffer, edit_command, convert(s));
     }
@@ -3521,19 +4384,13 @@ std::optional<app_state> command_put(app_state state, uint32_t buffer_id, settin
     std::string error_message = "The name " + state.buffers[buffer_id].buffer.name + " is invalid for saving\n";
     return add_error_text(state, error_message, s);
     }
-  bool success = false;
-  state.buffers[buffer_id].buffer = save_to_file(success, state.buffers[buffer_id].buffer, state.buffers[buffer_id].buffer.name);
-  if (success)
-    {
-    std::string message = "Saved file " + state.buffers[buffer_id].buffer.name;
-    //state.message = string_to_line(message);
-    state = add_error_text(state, message, s);
-    }
-  else
+  if (state.buffers[buffer_id].buffer.load_request != 0)
     {
-    std::string error_message = "Error saving file " + state.buffers[buffer_id].buffer.name + "\n";
+    std::string error_message = "Error saving " + state.buffers[buffer_id].buffer.name + ", the file is still being read\n";
     return add_error_text(state, error_message, s);
     }
+  save_in_background(state.buffers[buffer_id].buffer.content, state.buffers[buffer_id].buffer.name);
+  state.buffers[buffer_id].buffer = mark_saved(state.buffers[buffer_id].buffer); // if saving fails, the buffer is marked as modified again when the message arrives
   return state;
   }
 
@@ -3566,6 +4423,7 @@ std::optional<app_state> command_open(app_state state, uint32_t buffer_id, setti
 std::optional<app_state> command_incremental_search(app_state state, uint32_t buffer_id, settings& s)
   {
   state.operation = op_incremental_search;
+  state.incremental_search_steps.clear();
   state = clear_operation_buffer(state);
   return state;
   }
@@ -3605,12 +4463,56 @@ std::optional<app_state> command_hex(app_state state, uint32_t buffer_id, std::w
   auto file_path = get_file_path(jtk::convert_wstring_to_string(parameters), state.buffers[active_buffer].buffer.name);
   if (!file_path.empty())
     parameters = jtk::convert_string_to_wstring(file_path);
-  state.buffers[buffer_id].buffer.content = to_text(to_hex(jtk::convert_wstring_to_string(parameters)));//read_from_file(jtk::convert_wstring_to_string(parameters));
+  state.buffers[buffer_id].buffer = set_text(state.buffers[buffer_id].buffer, to_text(to_hex(jtk::convert_wstring_to_string(parameters))));//read_from_file(jtk::convert_wstring_to_string(parameters));
   state.buffers[buffer_id].buffer = set_multiline_comments(state.buffers[buffer_id].buffer);
   state.buffers[buffer_id].buffer = init_lexer_status(state.buffers[buffer_id].buffer, convert(s));
   int64_t command_id = state.active_buffer - 1;
   //state.buffers[command_id].buffer.name = state.buffers[buffer_id].buffer.name;
-  state.buffers[command_id].buffer.content = to_text(make_command_text(state, command_id, s));
+  state.buffers[command_id].buffer = set_text(state.buffers[command_id].buffer, to_text(make_command_text(state, command_id, s)));
+  return state;
+  }
+
+std::optional<app_state> command_look_all(app_state state, uint32_t buffer_id, std::wstring& parameters, settings& s)
+  {
+  std::wstring pattern = clean_command(parameters);
+  if (pattern.empty() && state.last_active_editor_buffer != 0xffffffff)
+    pattern = to_wstring(get_selection(state.buffers[state.last_active_editor_buffer].buffer, convert(s)));
+  if (pattern.empty())
+    pattern = jtk::convert_string_to_wstring(s.last_find);
+  if (pattern.empty() || pattern.find(L'\n') != std::wstring::npos)
+    return add_error_text(state, "Lookall needs a text of one line to look for\n", s);
+  s.last_find = jtk::convert_wstring_to_string(pattern);
+
+  std::vector<uint32_t> buffer_ids;
+  std::vector<look_snapshot> snapshots;
+  for (const auto& w : state.windows)
+    {
+    const buffer_data& bd = state.buffers[w.buffer_id];
+    if (w.wt != wt_normal || bd.bt != bt_normal || bd.buffer.name.empty() || bd.buffer.name.front() == '+' || jtk::is_directory(bd.buffer.name))
+      continue;
+    if (std::find(buffer_ids.begin(), buffer_ids.end(), w.buffer_id) != buffer_ids.end())
+      continue;
+    buffer_ids.push_back(w.buffer_id);
+    snapshots.push_back(look_snapshot{ bd.buffer.name, bd.buffer.content });
+    }
+
+  uint32_t look_id = find_editor_buffer(state, "+Look");
+  if (look_id == 0xffffffff)
+    {
+    auto active = state.active_buffer;
+    state = add_named_window(state, "+Look", s);
+    look_id = state.buffers.size() - 1;
+    state.active_buffer = active;
+    }
+  file_buffer& fb = state.buffers[look_id].buffer;
+  fb = select_all(fb, convert(s));
+  fb = erase(fb, convert(s), false);
+  std::stringstream str;
+  str << "Looking for " << s.last_find << " in " << snapshots.size() << " file(s)\n";
+  fb = insert(fb, str.str(), convert(s), false);
+  fb.pos = position(0, 0);
+  state.buffers[look_id].scroll_row = 0;
+  look_in_background(snapshots, pattern, s.case_sensitive);
   return state;
   }
 
@@ -3637,20 +4539,27 @@ app_state load_dump(app_state last_state, std::istream& str, settings& s) {
     }
   uint32_t sz = (uint32_t)state.windows.size();
   auto active_buffer = state.active_buffer;
+  std::vector<uint32_t> buffers_to_read;
+  std::vector<std::string> files_to_read;
   for (uint32_t j = 0; j < sz; ++j) {
     if (state.windows[j].wt == e_window_type::wt_normal && state.buffers[state.windows[j].buffer_id].bt != e_buffer_type::bt_piped) {
       uint32_t buffer_id = state.windows[j].buffer_id;
       std::string filename = state.buffers[buffer_id].buffer.name;
-      if (jtk::file_exists(filename)) {
-        state.buffers[buffer_id].buffer = read_from_file(filename);
-        state.buffers[buffer_id].buffer = set_multiline_comments(state.buffers[buffer_id].buffer);
-        state.buffers[buffer_id].buffer = init_lexer_status(state.buffers[buffer_id].buffer, convert(s));
-        }
-      else if (jtk::is_directory(filename)) {
-        state.buffers[buffer_id].buffer = read_from_file(filename);
-        state.buffers[buffer_id].buffer = set_multiline_comments(state.buffers[buffer_id].buffer);
-        state.buffers[buffer_id].buffer = init_lexer_status(state.buffers[buffer_id].buffer, convert(s));
+      if (jtk::file_exists(filename) || jtk::is_directory(filename)) {
+        buffers_to_read.push_back(buffer_id);
+        files_to_read.push_back(filename);
         }
+      }
+    }
+  std::vector<file_buffer> files_read = read_from_files(files_to_read);
+  for (size_t i = 0; i < buffers_to_read.size(); ++i) {
+    uint32_t buffer_id = buffers_to_read[i];
+    state.buffers[buffer_id].buffer = set_multiline_comments(files_read[i]);
+    state.buffers[buffer_id].buffer = init_lexer_status(state.buffers[buffer_id].buffer, convert(s));
+    }
+  for (uint32_t j = 0; j < sz; ++j) {
+    if (state.windows[j].wt == e_window_type::wt_normal && state.buffers[state.windows[j].buffer_id].bt != e_buffer_type::bt_piped) {
+      uint32_t buffer_id = state.windows[j].buffer_id;
       if (state.buffers[buffer_id].scroll_row > get_last_position(state.buffers[buffer_id].buffer).row)
         state.buffers[buffer_id].scroll_row = get_last_position(state.buffers[buffer_id].buffer).row;
       }
@@ -3716,7 +4625,13 @@ std::optional<app_state> command_complete(app_state state, uint32_t buffer_id, s
     command_begin_pos.col -= (int64_t)(command.length() - 1);
     std::string suggestion = complete_file_path(jtk::convert_wstring_to_string(command), state.buffers[buffer_id].buffer.name);
     if (suggestion.empty())
+      {
+      const code_completion_data& cc = state.buffers[buffer_id].code_completion;
+      const bool cycling = !cc.last_suggestions.empty() && command == cc.last_suggestions[cc.last_suggestion_index];
+      if (!cycling)
+        request_lsp_completion(state, buffer_id, s);
       suggestion = jtk::convert_wstring_to_string(code_completion(command, state.buffers[buffer_id]));
+      }
     if (!suggestion.empty()) {
       state.buffers[buffer_id].buffer.start_selection = command_begin_pos;
       state.buffers[buffer_id].buffer.pos = command_end_pos;
@@ -3735,6 +4650,129 @@ std::optional<app_state> command_complete(app_state state, uint32_t buffer_id, s
   return state;
   }
 
+std::optional<app_state> command_definition(app_state state, uint32_t buffer_id, settings& s)
+  {
+  buffer_id = get_editor_buffer_id(state, buffer_id);
+  if (buffer_id == 0xffffffff || !is_lsp_document(state, buffer_id))
+    return state;
+  lsp_client* client = get_lsp_client(state, state.buffers[buffer_id].buffer.name, s);
+  if (!client)
+    return add_error_text(state, "No language server for " + state.buffers[buffer_id].buffer.name + "\n", s);
+  const file_buffer& fb = state.buffers[buffer_id].buffer;
+  const uint64_t request = client->request_definition(fb, get_actual_position(fb));
+  if (request == 0)
+    return add_error_text(state, "The language server is not ready yet\n", s);
+  lsp_definition_request = std::make_pair(client, request);
+  lsp_definition_buffer = buffer_id;
+  return state;
+  }
+
+namespace
+  {
+  const char* diagnostic_severity(int severity)
+    {
+    switch (severity)
+      {
+      case 2: return "warning";
+      case 3: return "information";
+      case 4: return "hint";
+      default: return "error";
+      }
+    }
+
+  /*
+  Replaces the rows old_text in the +Errors window by new_text, or adds new_text if these rows are not found, so that
+  the diagnostics of a file are shown once while they change.
+  */
+  app_state replace_error_text(app_state state, const std::string& old_text, const std::string& new_text, settings& s)
+    {
+    const text old_rows = to_text(old_text);
+    for (const auto& w : state.windows)
+      {
+      if (old_rows.empty() || w.wt != wt_normal || state.buffers[w.buffer_id].buffer.name != "+Errors")
+        continue;
+      file_buffer& fb = state.buffers[w.buffer_id].buffer;
+      const int64_t nr_of_rows = (int64_t)old_rows.size();
+      for (int64_t row = 0; row + nr_of_rows <= (int64_t)fb.content.size(); ++row)
+        {
+        bool found = true;
+        for (int64_t i = 0; found && i < nr_of_rows; ++i)
+          {
+          const line& ln = fb.content[row + i];
+          const line& old_ln = old_rows[i];
+          found = ln.size() == old_ln.size() && std::equal(ln.begin(), ln.end(), old_ln.begin());
+          }
+        if (!found)
+          continue;
+        const position last = row + nr_of_rows < (int64_t)fb.content.size() ? position(row + nr_of_rows, 0) : get_last_position(fb);
+        fb = apply_changes(fb, std::vector<text_change>{ text_change{ position(row, 0), last, jtk::convert_string_to_wstring(new_text) } }, convert(s));
+        return state;
+        }
+      }
+    return add_error_text(state, new_text, s);
+    }
+
+  /*
+  Gives the answers of the language servers to the editor: completions to the code_completion of their buffer, the
+  definition by moving the cursor to it, and diagnostics to the +Errors window, as lines that can be right clicked.
+  */
+  void attach_lsp_results(app_state& state, settings& s)
+    {
+    for (auto& c : lsp_clients)
+      {
+      lsp_client* client = c.second.get();
+      for (const auto& r : client->take_results())
+        {
+        if (r.type == lsp_completion)
+          {
+          for (const auto& request : lsp_completion_requests)
+            {
+            if (request.second.first == client && request.second.second == r.request && request.first < state.buffers.size())
+              state.buffers[request.first].code_completion.server_suggestions = r.completions;
+            }
+          }
+        else if (r.type == lsp_definition)
+          {
+          if (lsp_definition_request != std::make_pair(client, r.request))
+            continue;
+          lsp_definition_request = std::make_pair(nullptr, 0);
+          if (r.locations.empty())
+            {
+            state = add_error_text(state, "No definition found\n", s);
+            continue;
+            }
+          const std::string filename = r.locations.front().first;
+          const position pos = r.locations.front().second;
+          const uint32_t buffer_id = lsp_definition_buffer < state.buffers.size() ? lsp_definition_buffer : state.active_buffer;
+          state = *load_file_at_line(state, buffer_id, filename, pos.row + 1, s);
+          file_buffer& fb = get_active_buffer(state);
+          if (fb.name == filename && pos.row < (int64_t)fb.content.size())
+            {
+            const int64_t col = utf16_to_column(fb.content[pos.row], pos.col);
+            fb = update_position(fb, position(pos.row, col < (int64_t)fb.content[pos.row].size() ? col : 0), convert(s));
+            }
+          }
+        else
+          {
+          std::stringstream str;
+          for (const auto& d : r.diagnostics)
+            {
+            std::string message = jtk::convert_wstring_to_string(d.message);
+            std::replace(message.begin(), message.end(), '\n', ' ');
+            str << r.filename << ":" << d.first.row + 1 << ": " << diagnostic_severity(d.severity) << ": " << message << "\n";
+            }
+          const std::string new_text = str.str().empty() ? r.filename + ": no problems\n" : str.str();
+          std::string& last_text = lsp_diagnostics_text[r.filename];
+          if (new_text == last_text || (last_text.empty() && r.diagnostics.empty()))
+            continue;
+          state = replace_error_text(state, last_text, new_text, s);
+          last_text = new_text;
+          }
+        }
+      }
+    }
+  }
+
 std::optional<app_state> command_undo_mouseclick(app_state state, uint32_t buffer_id, settings& s)
   {
   buffer_id = get_editor_buffer_id(state, buffer_id);
@@ -3747,6 +4785,47 @@ std::optional<app_state> command_redo_mouseclick(app_state state, uint32_t buffe
   return command_redo(state, buffer_id, s);
   }
 
+std::optional<app_state> command_earlier(app_state state, uint32_t buffer_id, settings& s)
+  {
+  buffer_id = get_editor_buffer_id(state, buffer_id);
+  state.buffers[buffer_id].buffer = undo_earlier(state.buffers[buffer_id].buffer, convert(s));
+  return check_scroll_position(state, buffer_id, s);
+  }
+
+std::optional<app_state> command_later(app_state state, uint32_t buffer_id, settings& s)
+  {
+  buffer_id = get_editor_buffer_id(state, buffer_id);
+  state.buffers[buffer_id].buffer = redo_later(state.buffers[buffer_id].buffer, convert(s));
+  return check_scroll_position(state, buffer_id, s);
+  }
+
+std::optional<app_state> command_history(app_state state, uint32_t buffer_id, settings& s)
+  {
+  buffer_id = get_editor_buffer_id(state, buffer_id);
+  const file_buffer& fb = state.buffers[buffer_id].buffer;
+  std::stringstream str;
+  str << fb.name << ": " << fb.history.size() << " undo states using about " << (history_memory_used(fb) >> 10) << " kB, the budget is " << s.undo_memory_budget << " MB\n";
+  return add_error_text(state, str.str(), s);
+  }
+
+std::optional<app_state> command_index(app_state state, uint32_t buffer_id, settings& s)
+  {
+  buffer_id = get_editor_buffer_id(state, buffer_id);
+  const file_buffer& fb = state.buffers[buffer_id].buffer;
+  std::stringstream str;
+  str << fb.name << ": ";
+  if (!fb.trigrams)
+    str << "no search index, buffers with at least " << search_index_min_rows << " lines are indexed";
+  else
+    {
+    str << "search index with " << fb.trigrams->rows_per_group() << " line(s) per group using about " << (fb.trigrams->memory_used() >> 10) << " kB, the budget is " << s.search_index_budget << " MB";
+    if (fb.trigrams->content_version() != fb.content_version)
+      str << ", being updated";
+    }
+  str << "\n";
+  return add_error_text(state, str.str(), s);
+  }
+
 const auto executable_commands = std::map<std::wstring, std::function<std::optional<app_state>(app_state, uint32_t, settings&)>>
   {
     {L"AcmeTheme", command_acme_theme},
@@ -3763,11 +4842,13 @@ const auto executable_commands = std::map<std::wstring, std::function<std::optio
     {L"DarkTheme", command_dark_theme},
     {L"DejaVu", command_dejavusansmono},
     {L"Delcol", command_delete_column},
+    {L"Definition", command_definition},
     {L"Del", command_delete_window},
     {L"DosTheme", command_dos_theme},
     {L"DarkDraculaTheme", command_dark_dracula_theme},
     {L"DraculaTheme", command_dracula_theme},
     {L"Dump", command_dump},
+    {L"Earlier", command_earlier},
     {L"Edit", command_edit},
     {L"Execute", command_run},
     {L"Exit", command_exit},
@@ -3781,13 +4862,17 @@ const auto executable_commands = std::map<std::wstring, std::function<std::optio
     {L"GruvboxLight", command_gruvbox_light_theme},
     {L"Hack", command_hack},
     {L"Help", command_help},
+    {L"History", command_history},
     {L"Inconsolata", command_inconsolata},
     {L"Incr", command_incremental_search},
+    {L"Index", command_index},
     {L"Kill", command_kill},
+    {L"Later", command_later},
     {L"LightTheme", command_light_theme},
     {L"LineNumbers", command_line_numbers},
     {L"Load", command_load},
     {L"Mario", command_mario},
+    {L"Matches", command_matches},
     {L"MatrixTheme", command_matrix_theme},
     {L"Menlo", command_menlo},
     {L"MidnightTheme", command_midnight_theme},
@@ -3800,6 +4885,7 @@ const auto executable_commands = std::map<std::wstring, std::function<std::optio
     {L"Put", command_put},
     {L"Putall", command_putall},
     {L"Redo", command_redo_mouseclick},
+    {L"Regex", command_regex},
     {L"Replace", command_replace},
     {L"Select", command_select},
     {L"Sel/all", command_select_all},
@@ -3820,7 +4906,8 @@ const auto executable_commands_with_parameters = std::map<std::wstring, std::fun
     {L"Edit", command_edit_with_parameters},
     {L"Tab", command_tab},
     {L"Win", command_piped_win},
-    {L"Hex", command_hex}
+    {L"Hex", command_hex},
+    {L"Lookall", command_look_all}
   };
 
 
@@ -5141,15 +6228,11 @@ std::string pbpaste()
   FILE* pipe = popen("xclip -o", "r");
 #endif
   if (!pipe) return "ERROR";
-  char buffer[128];
+  char buffer[4096];
   std::string result = "";
-  while (!feof(pipe))
-    {
-    if (fgets(buffer, 128, pipe) != NULL)
-      {
-      result += buffer;
-      }
-    }
+  size_t bytes_read;
+  while ((bytes_read = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+    result.append(buffer, bytes_read);
   pclose(pipe);
   return result;
   }
@@ -5163,8 +6246,7 @@ std::optional<app_state> command_copy_to_snarf_buffer(app_state state, uint32_t,
     state.snarf_buffer = get_selection(state.operation_buffer, convert(s));
   //state.message = string_to_line("[Copy]");
 #ifdef _WIN32
-  std::wstring txt = to_wstring(state.snarf_buffer);
-  copy_to_windows_clipboard(jtk::convert_wstring_to_string(txt));
+  copy_to_windows_clipboard(to_string(state.snarf_buffer));
 #else
   std::string txt = to_string(state.snarf_buffer);
   int pipefd[3];
@@ -5374,6 +6456,8 @@ std::optional<app_state> process_input(app_state state, uint32_t buffer_id, sett
     {
     while (SDL_PollEvent(&event))
       {
+      if (event.type == async_message_event)
+        return state; // return so that we can process the messages queue
       keyb.handle_event(event);
       switch (event.type)
         {
@@ -5395,9 +6479,16 @@ std::optional<app_state> process_input(app_state state, uint32_t buffer_id, sett
         x /= font_width;
         y /= font_height;
         auto p = find_mouse_text_pick(x, y);
-        std::string path(dropped_filedir);
+        std::vector<std::string> paths;
+        paths.emplace_back(dropped_filedir);
         SDL_free(dropped_filedir);    // Free dropped_filedir memory
-        return load_file(state, p.buffer_id, path, s);
+        SDL_Event next_drop;
+        while (SDL_PeepEvents(&next_drop, 1, SDL_GETEVENT, SDL_DROPFILE, SDL_DROPFILE) > 0) // collect all files of this drop so that they are read in parallel
+          {
+          paths.emplace_back(next_drop.drop.file);
+          SDL_free(next_drop.drop.file);
+          }
+        return load_files(state, p.buffer_id, paths, s);
         break;
         }
         case SDL_WINDOWEVENT:
@@ -5873,6 +6964,9 @@ bool file_already_opened(const app_state& state, const std::string& filename)
 
 engine::engine(int argc, char** argv, const settings& input_settings) : s(input_settings)
   {
+  p_async_messages = &messages;
+  async_message_event = SDL_RegisterEvents(1);
+
   set_font(s.font_size, s);
 
   state.w = s.w * font_width;
@@ -5920,6 +7014,20 @@ engine::engine(int argc, char** argv, const settings& input_settings) : s(input_
   state.active_buffer = 0;
   // put active buffer to 0 so that new folders are added at the top left
 
+  // read all files given as argument in parallel first
+  std::vector<std::string> files_to_read;
+  for (int j = 1; j < argc; ++j) {
+    std::string input(argv[j]);
+    if (input[0] == '=') // the remaining arguments are a piped command
+      break;
+    if (input[0] == '-') // options
+      continue;
+    remove_quotes(input);
+    if (!jtk::is_directory(input) && jtk::file_exists(input) && !file_already_opened(state, input))
+      files_to_read.push_back(input);
+    }
+  std::vector<file_buffer> files_read = read_from_files(files_to_read);
+
   for (int j = 1; j < argc; ++j) {
     std::string input(argv[j]);
     bool piped = input[0] == '=';
@@ -5965,7 +7073,10 @@ engine::engine(int argc, char** argv, const settings& input_settings) : s(input_
       else {
         if (!file_already_opened(state, input))
           {
-          if (jtk::file_exists(input))
+          auto it = std::find(files_to_read.begin(), files_to_read.end(), input);
+          if (it != files_to_read.end())
+            state = *load_file(state, 0, input, files_read[std::distance(files_to_read.begin(), it)], s);
+          else if (jtk::file_exists(input))
             state = *load_file(state, 0, input, s);
           else
             {
@@ -5976,7 +7087,7 @@ engine::engine(int argc, char** argv, const settings& input_settings) : s(input_
             state.buffers[command_id].buffer.name = get_active_buffer(state).name;
             get_active_buffer(state) = set_multiline_comments(get_active_buffer(state));
             get_active_buffer(state) = init_lexer_status(get_active_buffer(state), convert(s));
-            state.buffers[command_id].buffer.content = to_text(make_command_text(state, command_id, s));
+            state.buffers[command_id].buffer = set_text(state.buffers[command_id].buffer, to_text(make_command_text(state, command_id, s)));
             }
           }
         }
@@ -5990,6 +7101,12 @@ engine::engine(int argc, char** argv, const settings& input_settings) : s(input_
 
 engine::~engine()
   {
+    {
+    std::scoped_lock lock(lexer_mutex);
+    running_lexer_requests.clear();
+    }
+  lsp_clients.clear();
+  get_background_tasks().wait();
   save_to_file(get_file_in_executable_path("temp.json"), state);
   for (uint32_t buffer_id = 0; buffer_id < (uint32_t)state.buffers.size(); ++buffer_id)
     kill(state, buffer_id);
@@ -6004,6 +7121,7 @@ void engine::run()
 
   while (auto new_state = process_input(state, state.active_buffer, s))
     {
+    new_state = reject_edits_while_reading(state, *new_state, s);
     while (!messages.empty())
       {
       auto m = messages.pop();
@@ -6011,8 +7129,77 @@ void engine::run()
         {
         new_state = load_file(*new_state, new_state->active_buffer, m.str, s);
         }
+      else if (m.m == ASYNC_MESSAGE_SAVED)
+        {
+        new_state = add_error_text(*new_state, "Saved file " + m.str, s);
+        }
+      else if (m.m == ASYNC_MESSAGE_SAVE_FAILED)
+        {
+        for (auto& b : new_state->buffers)
+          {
+          if (b.buffer.name == m.str)
+            b.buffer = mark_modified(b.buffer);
+          }
+        new_state = add_error_text(*new_state, "Error saving file " + m.str + "\n", s);
+        }
+      else if (m.m == ASYNC_MESSAGE_SEARCH_INDEX)
+        {
+        attach_search_indices(*new_state);
+        }
+      else if (m.m == ASYNC_MESSAGE_MATCH_SET)
+        {
+        attach_match_sets(*new_state);
+        }
+      else if (m.m == ASYNC_MESSAGE_LOOK)
+        {
+        attach_look_results(*new_state, s);
+        }
+      else if (m.m == ASYNC_MESSAGE_LEXER)
+        {
+        attach_lexer_results(*new_state);
+        }
+      else if (m.m == ASYNC_MESSAGE_LSP)
+        {
+        attach_lsp_results(*new_state, s);
+        }
+      else if (m.m == ASYNC_MESSAGE_FILE_READ)
+        {
+        attach_file_reads(*new_state, s);
+        }
       }
     state = check_update_active_command_text(*new_state, s);
+    const uint64_t undo_memory_budget = (uint64_t)s.undo_memory_budget << 20;
+    for (auto& b : state.buffers)
+      {
+      if (b.buffer.history_bytes > undo_memory_budget)
+        b.buffer = trim_history(b.buffer, undo_memory_budget);
+      }
+    const uint64_t search_index_budget = s.search_index_budget > 0 ? (uint64_t)s.search_index_budget << 20 : 0;
+    for (auto& b : state.buffers)
+      {
+      if (needs_search_index_update(b, search_index_budget))
+        b.buffer = update_search_index_in_background(b.buffer, search_index_budget);
+      }
+    const bool needs_matches = (s.highlight_matches && !s.regex_find) || state.operation == op_incremental_search;
+    const std::wstring match_pattern = needs_matches ? jtk::convert_string_to_wstring(s.last_find) : std::wstring();
+    for (auto& b : state.buffers)
+      {
+      if (match_pattern.empty())
+        b.buffer.matches.reset();
+      else if (needs_match_set_update(b, match_pattern, s.case_sensitive))
+        b.buffer = update_match_set_in_background(b.buffer, match_pattern, s.case_sensitive);
+      }
+    cancel_lexer_jobs(state);
+    for (uint32_t buffer_id = 0; buffer_id < (uint32_t)state.buffers.size(); ++buffer_id)
+      {
+      auto& b = state.buffers[buffer_id];
+      if (needs_lexer_update(b))
+        {
+        const int64_t visible_rows = buffer_id < state.buffer_id_to_window_id.size() ? state.windows[state.buffer_id_to_window_id[buffer_id]].rows : 0;
+        b.buffer = lex_in_background(b.buffer, b.scroll_row, b.scroll_row + visible_rows);
+        }
+      }
+    sync_lsp_documents(state, s);
     if (!mouse.rearranging_windows)
       draw(state, s);
     if (s.mario)
@@ -47,6 +47,18 @@ struct buffer_data {
   code_completion_data code_completion;
 };
 
+/*
+The state of the editor buffer after an incremental search for pattern, so that removing characters from the
+pattern returns to an earlier result without searching again.
+*/
+struct incremental_search_step
+  {
+  std::wstring pattern;
+  position pos;
+  std::optional<position> start_selection;
+  std::shared_ptr<const match_set> matches;
+  };
+
 struct app_state
   {
   std::vector<buffer_data> buffers;
@@ -61,6 +73,7 @@ struct app_state
   uint32_t mouse_pointing_buffer;
   e_operation operation;
   std::vector<e_operation> operation_stack;
+  std::vector<incremental_search_step> incremental_search_steps; // the first step is the state before the search started
   file_buffer operation_buffer;
   int64_t operation_scroll_row;
   };
@@ -81,6 +94,7 @@ std::optional<app_state> command_select_all(app_state state, uint32_t buffer_id,
 std::optional<app_state> command_run(app_state state, uint32_t buffer_id, settings& s);
 std::optional<app_state> command_edit(app_state state, uint32_t buffer_id, settings& s);
 std::optional<app_state> load_file(app_state state, uint32_t buffer_id, const std::string& filename, settings& s);
+std::optional<app_state> load_files(app_state state, uint32_t buffer_id, const std::vector<std::string>& filenames, settings& s);
 std::wstring find_command(file_buffer fb, position pos, const settings& s);
 app_state add_error_text(app_state state, const std::string& errortext, settings& s);
 app_state replace_all(app_state state, settings& s);
@@ -0,0 +1,76 @@
+#include "keyword_matcher.h"
+
+#include <algorithm>
+
+keyword_matcher::keyword_matcher() : _nr_of_classes(1), _next(2, 0), _type(2, 0)
+  {
+  std::fill(_ascii_class, _ascii_class + 128, 0);
+  }
+
+keyword_matcher::keyword_matcher(const std::vector<std::wstring>& keywords_1, const std::vector<std::wstring>& keywords_2) : _nr_of_classes(1)
+  {
+  std::fill(_ascii_class, _ascii_class + 128, 0);
+  std::vector<wchar_t> characters;
+  for (const auto& keyword : keywords_1)
+    characters.insert(characters.end(), keyword.begin(), keyword.end());
+  for (const auto& keyword : keywords_2)
+    characters.insert(characters.end(), keyword.begin(), keyword.end());
+  std::sort(characters.begin(), characters.end());
+  characters.erase(std::unique(characters.begin(), characters.end()), characters.end());
+  for (wchar_t ch : characters)
+    {
+    if ((uint32_t)ch < 128)
+      _ascii_class[ch] = _nr_of_classes++;
+    else
+      _other_classes.emplace_back(ch, _nr_of_classes++);
+    }
+  _next.assign(2 * _nr_of_classes, 0);
+  _type.assign(2, 0);
+  // keywords_1 is added last, so that it wins for words that are in both lists
+  for (const auto& keyword : keywords_2)
+    _add(keyword, 2);
+  for (const auto& keyword : keywords_1)
+    _add(keyword, 1);
+  }
+
+void keyword_matcher::_add(const std::wstring& keyword, uint8_t type)
+  {
+  if (keyword.empty())
+    return;
+  uint32_t state = 1;
+  for (wchar_t ch : keyword)
+    {
+    const size_t index = (size_t)state * _nr_of_classes + _class(ch);
+    if (_next[index] == 0)
+      {
+      _next[index] = (uint32_t)_type.size();
+      _type.push_back(0);
+      _next.resize(_next.size() + _nr_of_classes, 0);
+      }
+    state = _next[index];
+    }
+  _type[state] = type;
+  }
+
+uint32_t keyword_matcher::_class(wchar_t ch) const
+  {
+  if ((uint32_t)ch < 128)
+    return _ascii_class[ch];
+  auto it = std::lower_bound(_other_classes.begin(), _other_classes.end(), std::pair<wchar_t, uint32_t>(ch, 0));
+  return (it != _other_classes.end() && it->first == ch) ? it->second : 0;
+  }
+
+bool keyword_matcher::empty() const
+  {
+  return _type.size() <= 2;
+  }
+
+int64_t keyword_matcher::match(uint8_t& type, line::const_iterator it, line::const_iterator it_end) const
+  {
+  uint32_t state = 1;
+  int64_t length = 0;
+  for (; it != it_end && !is_word_separator(*it); ++it, ++length)
+    state = _next[(size_t)state * _nr_of_classes + _class(*it)];
+  type = _type[state];
+  return length;
+  }
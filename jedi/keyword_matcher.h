@@ -0,0 +1,38 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+The keywords of a syntax, compiled once to a deterministic automaton over the characters that occur in the keywords.
+A word in a line is classified while it is read, without building a string or searching the keyword lists.
+*/
+class keyword_matcher
+  {
+  public:
+    keyword_matcher();
+    keyword_matcher(const std::vector<std::wstring>& keywords_1, const std::vector<std::wstring>& keywords_2);
+
+    bool empty() const;
+
+    /*
+    Reads the word that starts at it, the characters up to the first one for which is_word_separator holds, and
+    returns its length. type is set to 1 if the word is in keywords_1, to 2 if it is only in keywords_2, and to 0 otherwise.
+    */
+    int64_t match(uint8_t& type, line::const_iterator it, line::const_iterator it_end) const;
+
+  private:
+    void _add(const std::wstring& keyword, uint8_t type);
+
+    uint32_t _class(wchar_t ch) const;
+
+  private:
+    uint32_t _nr_of_classes; // class 0 holds the characters that occur in no keyword
+    uint32_t _ascii_class[128];
+    std::vector<std::pair<wchar_t, uint32_t>> _other_classes; // sorted
+    std::vector<uint32_t> _next; // _next[state * _nr_of_classes + class], state 0 matches nothing, state 1 is the start
+    std::vector<uint8_t> _type; // the keyword type that ends in each state
+  };
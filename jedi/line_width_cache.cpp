@@ -0,0 +1,81 @@
+#include "line_width_cache.h"
+
+#include <algorithm>
+
+line_width_cache::line_width_cache(size_t max_rows) : _content_version(0), _max_rows(max_rows)
+  {
+  }
+
+int64_t line_width_cache::line_length_up_to_column(const file_buffer& fb, int64_t row, int64_t column, const env_settings& s)
+  {
+  if ((int64_t)fb.content[row].size() < min_row_length)
+    return ::line_length_up_to_column(fb.content[row], column, s);
+  std::scoped_lock lock(_mutex);
+  return _get(fb, row, s).line_length_up_to_column(column);
+  }
+
+int64_t line_width_cache::get_col_from_line_length(const file_buffer& fb, int64_t row, int64_t length, const env_settings& s)
+  {
+  if ((int64_t)fb.content[row].size() < min_row_length)
+    return ::get_col_from_line_length(fb.content[row], length, s);
+  std::scoped_lock lock(_mutex);
+  return _get(fb, row, s).get_col_from_line_length(length);
+  }
+
+size_t line_width_cache::size() const
+  {
+  std::scoped_lock lock(_mutex);
+  return _rows.size();
+  }
+
+line_width_index& line_width_cache::_get(const file_buffer& fb, int64_t row, const env_settings& s)
+  {
+  if (_content_version != fb.content_version)
+    {
+    _by_row.clear();
+    _content_version = fb.content_version;
+    }
+  auto found_row = _by_row.find(row);
+  if (found_row != _by_row.end() && found_row->second->tab_space == s.tab_space && found_row->second->show_all_characters == s.show_all_characters)
+    {
+    _rows.splice(_rows.begin(), _rows, found_row->second);
+    return _rows.front().widths;
+    }
+  const line ln = fb.content[row];
+  const size_t hash = hash_line(ln) ^ ((size_t)s.tab_space << 1) ^ (size_t)s.show_all_characters;
+  auto range = _by_hash.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it)
+    {
+    const entry& e = *it->second;
+    if (e.tab_space == s.tab_space && e.show_all_characters == s.show_all_characters && e.ln.size() == ln.size() && std::equal(ln.begin(), ln.end(), e.ln.begin()))
+      {
+      _rows.splice(_rows.begin(), _rows, it->second);
+      _by_row[row] = _rows.begin();
+      return _rows.front().widths;
+      }
+    }
+  _rows.push_front(entry{ ln, s.tab_space, s.show_all_characters, hash, line_width_index(ln, s) });
+  _by_hash.emplace(hash, _rows.begin());
+  _by_row[row] = _rows.begin();
+  // the new entry is the first one, so it is not dropped
+  while (_rows.size() > _max_rows)
+    _evict();
+  return _rows.front().widths;
+  }
+
+void line_width_cache::_evict()
+  {
+  auto last = std::prev(_rows.end());
+  auto range = _by_hash.equal_range(last->hash);
+  for (auto it = range.first; it != range.second; ++it)
+    {
+    if (it->second == last)
+      {
+      _by_hash.erase(it);
+      break;
+      }
+    }
+  _rows.pop_back();
+  // rows can share an entry, so the rows that point to the dropped entry are not known
+  _by_row.clear();
+  }
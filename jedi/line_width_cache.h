@@ -0,0 +1,50 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+/*
+A bounded cache of the line_width_index of the long rows of a buffer, keyed on the content of a row and the settings
+that its widths depend on (tab_space and show_all_characters), so that draw_line, the cursor movements and the
+rectangular selection do not measure a long row again each time, also after other rows were edited. The least
+recently used rows are dropped first. Rows shorter than min_row_length are measured directly.
+The cache can be used by several threads, as the copies of a buffer share it.
+*/
+class line_width_cache
+  {
+  public:
+    enum { min_row_length = 256 };
+
+    explicit line_width_cache(size_t max_rows = 256);
+
+    int64_t line_length_up_to_column(const file_buffer& fb, int64_t row, int64_t column, const env_settings& s); // same result as the free function with the same name for fb.content[row]
+
+    int64_t get_col_from_line_length(const file_buffer& fb, int64_t row, int64_t length, const env_settings& s); // same result as the free function with the same name for fb.content[row]
+
+    size_t size() const;
+
+  private:
+    struct entry
+      {
+      line ln;
+      int tab_space;
+      bool show_all_characters;
+      size_t hash;
+      line_width_index widths;
+      };
+
+    line_width_index& _get(const file_buffer& fb, int64_t row, const env_settings& s);
+
+    void _evict();
+
+  private:
+    mutable std::mutex _mutex;
+    std::list<entry> _rows; // the most recently used first
+    std::unordered_multimap<size_t, std::list<entry>::iterator> _by_hash;
+    std::unordered_map<int64_t, std::list<entry>::iterator> _by_row; // rows of _content_version that were found before, cleared when an entry is dropped
+    uint64_t _content_version;
+    size_t _max_rows;
+  };
@@ -0,0 +1,99 @@
+#include "look.h"
+#include "encoding.h"
+#include "parallel.h"
+#include "search.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace
+  {
+  const int64_t rows_per_task = 16384;
+  const size_t max_text_length = 256; // longer rows are cut, so that minified files do not flood the results
+
+  struct task
+    {
+    size_t snapshot;
+    int64_t first_row, last_row;
+    std::string lines;
+    uint64_t nr_of_lines;
+    };
+  }
+
+void look(const std::vector<look_snapshot>& snapshots, const std::wstring& pattern, bool case_sensitive, const std::function<void(size_t, const std::string&, uint64_t)>& found)
+  {
+  std::wstring folded_pattern(pattern);
+  if (!case_sensitive && !folded_pattern.empty())
+    fold_case(&folded_pattern[0], &folded_pattern[0] + folded_pattern.size());
+  const bool searchable = !folded_pattern.empty() && folded_pattern.find(L'\n') == std::wstring::npos;
+
+  std::vector<task> tasks;
+  std::vector<size_t> first_task(snapshots.size() + 1);
+  for (size_t i = 0; i < snapshots.size(); ++i)
+    {
+    first_task[i] = tasks.size();
+    const int64_t nr_of_rows = (int64_t)snapshots[i].content.size();
+    int64_t row = 0;
+    do
+      {
+      task t;
+      t.snapshot = i;
+      t.first_row = row;
+      t.last_row = std::min<int64_t>(row + rows_per_task, nr_of_rows);
+      t.nr_of_lines = 0;
+      tasks.push_back(t);
+      row = t.last_row;
+      } while (row < nr_of_rows);
+    }
+  first_task[snapshots.size()] = tasks.size();
+
+  // the worker that finishes the last task of a snapshot reports the snapshot
+  std::unique_ptr<std::atomic<size_t>[]> tasks_remaining(new std::atomic<size_t>[snapshots.size()]);
+  for (size_t i = 0; i < snapshots.size(); ++i)
+    tasks_remaining[i] = first_task[i + 1] - first_task[i];
+
+  parallel_for(tasks.size(), [&](uint64_t index)
+    {
+    task& t = tasks[index];
+    const look_snapshot& snapshot = snapshots[t.snapshot];
+    std::wstring row;
+    for (int64_t r = t.first_row; searchable && r < t.last_row; ++r)
+      {
+      const line& ln = snapshot.content[r];
+      if (ln.size() < folded_pattern.size())
+        continue;
+      row.assign(ln.begin(), ln.end());
+      if (!case_sensitive)
+        fold_case(&row[0], &row[0] + row.size());
+      const wchar_t* first = row.data();
+      const wchar_t* last = first + row.size();
+      if (search_forward(first, last, folded_pattern.data(), folded_pattern.size()) == last)
+        continue;
+      size_t length = ln.size();
+      while (length > 0 && (ln[length - 1] == L'\n' || ln[length - 1] == L'\r'))
+        --length;
+      if (length > max_text_length)
+        length = max_text_length;
+      row.assign(ln.begin(), ln.begin() + length);
+      t.lines.append(snapshot.name);
+      t.lines.push_back(':');
+      t.lines.append(std::to_string(r + 1));
+      t.lines.append(": ");
+      encode(t.lines, row.data(), row.data() + row.size());
+      t.lines.push_back('\n');
+      ++t.nr_of_lines;
+      }
+    if (--tasks_remaining[t.snapshot] == 0)
+      {
+      std::string lines;
+      uint64_t nr_of_lines = 0;
+      for (size_t i = first_task[t.snapshot]; i < first_task[t.snapshot + 1]; ++i)
+        {
+        lines.append(tasks[i].lines);
+        nr_of_lines += tasks[i].nr_of_lines;
+        }
+      found(t.snapshot, lines, nr_of_lines);
+      }
+    });
+  }
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+struct look_snapshot
+  {
+  std::string name;
+  text content;
+  };
+
+/*
+Searches pattern in all snapshots in parallel, large texts are split over several workers. As soon as all rows of a
+snapshot are searched, found(index, lines, nr_of_lines) is called from the worker that finished it, with a
+"name:line: text" line for each row that contains pattern. Returns when all snapshots are searched.
+Patterns that are empty or contain a newline are not found.
+*/
+void look(const std::vector<look_snapshot>& snapshots, const std::wstring& pattern, bool case_sensitive, const std::function<void(size_t, const std::string&, uint64_t)>& found);
@@ -0,0 +1,680 @@
+#include "lsp.h"
+
+#include "encoding.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cwctype>
+#include <fstream>
+#include <json.hpp>
+
+#include <jtk/file_utils.h>
+
+namespace
+  {
+  const uint64_t initialize_request = 1;
+
+  const int64_t shutdown_timeout_ms = 1000; // a server that does not answer the shutdown request in time is left behind
+
+  void read_lsp_config_from_json(std::vector<lsp_server>& servers, std::map<std::wstring, size_t>& extension_to_server, const std::string& filename)
+    {
+    nlohmann::json j;
+    std::ifstream i(filename);
+    if (!i.is_open())
+      return;
+    try
+      {
+      i >> j;
+      for (auto server_it = j.begin(); server_it != j.end(); ++server_it)
+        {
+        auto element = *server_it;
+        if (!element.is_object())
+          continue;
+        lsp_server server;
+        server.executable = server_it.key();
+        std::vector<std::wstring> extensions;
+        for (auto it = element.begin(); it != element.end(); ++it)
+          {
+          if (!it.value().is_string())
+            continue;
+          if (it.key() == "extensions")
+            extensions = break_string(it.value().get<std::string>());
+          else if (it.key() == "arguments")
+            {
+            for (const auto& argument : break_string(it.value().get<std::string>()))
+              {
+              if (!argument.empty())
+                server.arguments.push_back(encode(argument));
+              }
+            }
+          else if (it.key() == "language_id")
+            server.language_id = it.value().get<std::string>();
+          }
+        for (const auto& e : extensions)
+          extension_to_server[e] = servers.size();
+        servers.push_back(server);
+        }
+      }
+    catch (nlohmann::detail::exception&)
+      {
+      }
+    i.close();
+    }
+
+  std::string dump(const nlohmann::json& j)
+    {
+    return j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    }
+
+  std::string make_notification(const std::string& method, const nlohmann::json& params)
+    {
+    nlohmann::json j;
+    j["jsonrpc"] = "2.0";
+    j["method"] = method;
+    j["params"] = params;
+    return dump(j);
+    }
+
+  std::string make_request(uint64_t id, const std::string& method, const nlohmann::json& params)
+    {
+    nlohmann::json j;
+    j["jsonrpc"] = "2.0";
+    j["id"] = id;
+    j["method"] = method;
+    j["params"] = params;
+    return dump(j);
+    }
+
+  std::string filename_to_uri(const std::string& filename)
+    {
+    static const char hex_digits[] = "0123456789ABCDEF";
+    std::string uri("file://");
+    if (filename.empty() || (filename[0] != '/' && filename[0] != '\\'))
+      uri.push_back('/'); // a windows path starts with its drive letter
+    for (unsigned char ch : filename)
+      {
+      if (ch == '\\')
+        uri.push_back('/');
+      else if (std::isalnum(ch) || ch == '/' || ch == '-' || ch == '_' || ch == '.' || ch == '~' || ch == ':')
+        uri.push_back((char)ch);
+      else
+        {
+        uri.push_back('%');
+        uri.push_back(hex_digits[ch >> 4]);
+        uri.push_back(hex_digits[ch & 15]);
+        }
+      }
+    return uri;
+    }
+
+  std::string uri_to_filename(const std::string& uri)
+    {
+    std::string path = uri.compare(0, 7, "file://") == 0 ? uri.substr(7) : uri;
+    std::string filename;
+    for (size_t i = 0; i < path.size(); ++i)
+      {
+      if (path[i] == '%' && i + 2 < path.size() && std::isxdigit((unsigned char)path[i + 1]) && std::isxdigit((unsigned char)path[i + 2]))
+        {
+        filename.push_back((char)std::stoi(path.substr(i + 1, 2), nullptr, 16));
+        i += 2;
+        }
+      else
+        filename.push_back(path[i]);
+      }
+#ifdef _WIN32
+    if (filename.size() > 2 && filename[0] == '/' && filename[2] == ':')
+      filename.erase(filename.begin());
+    std::replace(filename.begin(), filename.end(), '/', '\\');
+#endif
+    return filename;
+    }
+
+  std::string text_to_utf8(text txt)
+    {
+    std::wstring wtxt;
+    for (const auto& ln : txt)
+      wtxt.append(ln.begin(), ln.end());
+    return encode(wtxt);
+    }
+
+  line to_line(const std::wstring& wtxt, size_t first, size_t last)
+    {
+    line ln;
+    auto trans = ln.transient();
+    for (size_t i = first; i < last; ++i)
+      trans.push_back(wtxt[i]);
+    return trans.persistent();
+    }
+
+  /*
+  Replaces [c.first, c.last) of txt by c.txt, as the server does with a change that it is sent.
+  */
+  text apply_change(text txt, const text_change& c)
+    {
+    const int64_t nr_of_rows = (int64_t)txt.size();
+    const line first_row = c.first.row < nr_of_rows ? txt[c.first.row] : line();
+    const line last_row = c.last.row < nr_of_rows ? txt[c.last.row] : line();
+    text rows;
+    line ln = first_row.take((uint32_t)c.first.col);
+    size_t begin = 0;
+    size_t end = c.txt.find(L'\n');
+    while (end != std::wstring::npos)
+      {
+      rows = rows.push_back(ln + to_line(c.txt, begin, end + 1));
+      ln = line();
+      begin = end + 1;
+      end = c.txt.find(L'\n', begin);
+      }
+    ln = ln + to_line(c.txt, begin, c.txt.size()) + last_row.drop((uint32_t)c.last.col);
+    if (!ln.empty())
+      rows = rows.push_back(ln);
+    const int64_t first_row_index = std::min(c.first.row, nr_of_rows);
+    txt = txt.erase((uint32_t)first_row_index, (uint32_t)std::min(c.last.row + 1, nr_of_rows));
+    return txt.insert((uint32_t)first_row_index, rows);
+    }
+
+  nlohmann::json make_position(const text& txt, position pos)
+    {
+    nlohmann::json j;
+    j["line"] = pos.row;
+    j["character"] = pos.row >= 0 && pos.row < (int64_t)txt.size() ? column_to_utf16(txt[pos.row], pos.col) : pos.col;
+    return j;
+    }
+
+  nlohmann::json make_range(const text& txt, position first, position last)
+    {
+    nlohmann::json j;
+    j["start"] = make_position(txt, first);
+    j["end"] = make_position(txt, last);
+    return j;
+    }
+
+  position read_position(const nlohmann::json& j)
+    {
+    position pos(0, 0);
+    if (j.is_object())
+      {
+      auto line = j.find("line");
+      auto character = j.find("character");
+      if (line != j.end() && line->is_number())
+        pos.row = line->get<int64_t>();
+      if (character != j.end() && character->is_number())
+        pos.col = character->get<int64_t>();
+      }
+    return pos;
+    }
+
+  std::string read_string(const nlohmann::json& j, const char* key)
+    {
+    if (!j.is_object())
+      return std::string();
+    auto it = j.find(key);
+    if (it == j.end() || !it->is_string())
+      return std::string();
+    return it->get<std::string>();
+    }
+
+  /*
+  The answer to textDocument/completion is a list of completion items or an object with such a list. The text that a
+  completion inserts is its insertText, the newText of its textEdit, or else its label.
+  */
+  std::vector<std::wstring> read_completions(const nlohmann::json& j)
+    {
+    std::vector<std::wstring> completions;
+    const nlohmann::json* items = &j;
+    if (j.is_object())
+      {
+      auto it = j.find("items");
+      if (it == j.end())
+        return completions;
+      items = &(*it);
+      }
+    if (!items->is_array())
+      return completions;
+    for (const auto& item : *items)
+      {
+      std::string txt = read_string(item, "insertText");
+      if (txt.empty() && item.is_object() && item.find("textEdit") != item.end())
+        txt = read_string(item["textEdit"], "newText");
+      if (txt.empty())
+        txt = read_string(item, "label");
+      std::wstring completion = decode(txt);
+      remove_whitespace(completion);
+      if (!completion.empty() && std::find(completions.begin(), completions.end(), completion) == completions.end())
+        completions.push_back(completion);
+      }
+    return completions;
+    }
+
+  /*
+  The answer to textDocument/definition is a location, a list of locations, or a list of location links.
+  */
+  std::vector<std::pair<std::string, position>> read_locations(const nlohmann::json& j)
+    {
+    std::vector<std::pair<std::string, position>> locations;
+    std::vector<nlohmann::json> items;
+    if (j.is_array())
+      items.assign(j.begin(), j.end());
+    else if (j.is_object())
+      items.push_back(j);
+    for (const auto& item : items)
+      {
+      if (!item.is_object())
+        continue;
+      std::string uri = read_string(item, "uri");
+      const char* range = "range";
+      if (uri.empty())
+        {
+        uri = read_string(item, "targetUri");
+        range = "targetSelectionRange";
+        }
+      if (uri.empty())
+        continue;
+      position pos(0, 0);
+      auto it = item.find(range);
+      if (it != item.end() && it->is_object() && it->find("start") != it->end())
+        pos = read_position((*it)["start"]);
+      locations.emplace_back(uri_to_filename(uri), pos);
+      }
+    return locations;
+    }
+
+  std::vector<lsp_diagnostic> read_diagnostics(const nlohmann::json& j)
+    {
+    std::vector<lsp_diagnostic> diagnostics;
+    if (!j.is_array())
+      return diagnostics;
+    for (const auto& item : j)
+      {
+      if (!item.is_object())
+        continue;
+      lsp_diagnostic d;
+      d.first = d.last = position(0, 0);
+      auto range = item.find("range");
+      if (range != item.end() && range->is_object())
+        {
+        if (range->find("start") != range->end())
+          d.first = read_position((*range)["start"]);
+        if (range->find("end") != range->end())
+          d.last = read_position((*range)["end"]);
+        }
+      auto severity = item.find("severity");
+      d.severity = (severity != item.end() && severity->is_number()) ? severity->get<int>() : 1;
+      d.message = decode(read_string(item, "message"));
+      diagnostics.push_back(d);
+      }
+    return diagnostics;
+    }
+
+  /*
+  The server tells in its capabilities whether it wants the changes of a document (textDocumentSync 2) or the whole
+  text after each change.
+  */
+  bool read_incremental_sync(const nlohmann::json& result)
+    {
+    if (!result.is_object() || result.find("capabilities") == result.end())
+      return false;
+    const auto& capabilities = result["capabilities"];
+    if (!capabilities.is_object() || capabilities.find("textDocumentSync") == capabilities.end())
+      return false;
+    const auto& sync = capabilities["textDocumentSync"];
+    if (sync.is_number())
+      return sync.get<int>() == 2;
+    if (sync.is_object() && sync.find("change") != sync.end() && sync["change"].is_number())
+      return sync["change"].get<int>() == 2;
+    return false;
+    }
+  }
+
+lsp_config::lsp_config()
+  {
+  read_lsp_config_from_json(_servers, _extension_to_server, get_file_in_executable_path("lsp.json"));
+  }
+
+lsp_config::lsp_config(const std::string& filename)
+  {
+  read_lsp_config_from_json(_servers, _extension_to_server, filename);
+  }
+
+const lsp_server* lsp_config::get_server_from_extension(const std::string& filename) const
+  {
+  std::wstring ext = jtk::convert_string_to_wstring(jtk::get_extension(filename));
+  std::transform(ext.begin(), ext.end(), ext.begin(), [](wchar_t ch) { return (wchar_t)towlower(ch); });
+  auto it = _extension_to_server.find(ext);
+  if (it == _extension_to_server.end())
+    return nullptr;
+  return &_servers[it->second];
+  }
+
+int64_t column_to_utf16(const line& ln, int64_t col)
+  {
+  if (sizeof(wchar_t) == 2)
+    return col;
+  int64_t utf16_col = col;
+  int64_t current_col = 0;
+  for (auto it = ln.begin(); it != ln.end() && current_col < col; ++it, ++current_col)
+    {
+    if ((uint32_t)*it >= 0x10000)
+      ++utf16_col;
+    }
+  return utf16_col;
+  }
+
+int64_t utf16_to_column(const line& ln, int64_t utf16_col)
+  {
+  if (sizeof(wchar_t) == 2)
+    return utf16_col;
+  int64_t col = 0;
+  int64_t current_utf16_col = 0;
+  for (auto it = ln.begin(); it != ln.end() && current_utf16_col < utf16_col; ++it, ++col)
+    current_utf16_col += (uint32_t)*it >= 0x10000 ? 2 : 1;
+  return col + (utf16_col > current_utf16_col ? utf16_col - current_utf16_col : 0);
+  }
+
+std::string make_lsp_message(const std::string& content)
+  {
+  return "Content-Length: " + std::to_string(content.size()) + "\r\n\r\n" + content;
+  }
+
+void lsp_message_reader::append(const std::string& data)
+  {
+  _data.append(data);
+  }
+
+bool lsp_message_reader::next(std::string& content)
+  {
+  const auto end_of_header = _data.find("\r\n\r\n");
+  if (end_of_header == std::string::npos)
+    return false;
+  size_t length = 0;
+  size_t line_begin = 0;
+  while (line_begin < end_of_header)
+    {
+    size_t line_end = _data.find("\r\n", line_begin);
+    const std::string field("Content-Length:");
+    if (_data.compare(line_begin, field.size(), field) == 0)
+      length = (size_t)std::strtoull(_data.c_str() + line_begin + field.size(), nullptr, 10);
+    line_begin = line_end + 2;
+    }
+  const size_t begin_of_content = end_of_header + 4;
+  if (_data.size() < begin_of_content + length)
+    return false;
+  content = _data.substr(begin_of_content, length);
+  _data.erase(0, begin_of_content + length);
+  return true;
+  }
+
+lsp_client::lsp_client(std::unique_ptr<lsp_transport> transport, const std::string& root_folder, const std::string& language_id, std::function<void()> notify) :
+  _transport(std::move(transport)), _root_folder(root_folder), _language_id(language_id), _notify(notify),
+  _last_request(initialize_request), _initialized(false), _incremental_sync(false), _shutdown_request(0),
+  _shutdown_answered(false), _notify_pending(false)
+  {
+  _thread = std::thread([this]() { _run(); });
+  }
+
+lsp_client::~lsp_client()
+  {
+  const uint64_t id = ++_last_request;
+  _shutdown_request = id; // before the request is posted, so that its answer is recognized
+  _post(make_request(id, "shutdown", nullptr));
+  _thread.join();
+  }
+
+bool lsp_client::is_initialized() const
+  {
+  return _initialized;
+  }
+
+void lsp_client::sync(const file_buffer& fb)
+  {
+  if (!_initialized || fb.name.empty())
+    return;
+  const std::string filename = fb.name;
+  const text content = fb.content;
+  auto it = _documents.find(filename);
+  if (it == _documents.end())
+    {
+    _post([this, filename, content]()
+      {
+      _texts[filename] = content;
+      nlohmann::json params;
+      params["textDocument"]["uri"] = filename_to_uri(filename);
+      params["textDocument"]["languageId"] = _language_id;
+      params["textDocument"]["version"] = 1;
+      params["textDocument"]["text"] = text_to_utf8(content);
+      return make_notification("textDocument/didOpen", params);
+      });
+    _documents[filename] = document{ 1, fb.content_version };
+    return;
+    }
+  if (it->second.content_version == fb.content_version)
+    return;
+  std::vector<text_change> changes;
+  const bool incremental = _incremental_sync && get_changes_since(changes, fb, it->second.content_version);
+  const int64_t version = ++it->second.version;
+  it->second.content_version = fb.content_version;
+  _post([this, filename, content, changes, incremental, version]()
+    {
+    nlohmann::json content_changes = nlohmann::json::array();
+    if (incremental)
+      {
+      text& server_text = _texts[filename];
+      for (const auto& c : changes)
+        {
+        nlohmann::json change;
+        change["range"] = make_range(server_text, c.first, c.last);
+        change["text"] = encode(c.txt);
+        content_changes.push_back(change);
+        if (sizeof(wchar_t) != 2) // the columns of the next change refer to the text after this change
+          server_text = apply_change(server_text, c);
+        }
+      }
+    else
+      {
+      nlohmann::json change;
+      change["text"] = text_to_utf8(content);
+      content_changes.push_back(change);
+      }
+    _texts[filename] = content;
+    nlohmann::json params;
+    params["textDocument"]["uri"] = filename_to_uri(filename);
+    params["textDocument"]["version"] = version;
+    params["contentChanges"] = content_changes;
+    return make_notification("textDocument/didChange", params);
+    });
+  }
+
+void lsp_client::close(const std::string& filename)
+  {
+  auto it = _documents.find(filename);
+  if (it == _documents.end())
+    return;
+  _documents.erase(it);
+  _post([this, filename]()
+    {
+    _texts.erase(filename);
+    nlohmann::json params;
+    params["textDocument"]["uri"] = filename_to_uri(filename);
+    return make_notification("textDocument/didClose", params);
+    });
+  }
+
+std::vector<std::string> lsp_client::get_open_documents() const
+  {
+  std::vector<std::string> filenames;
+  for (const auto& d : _documents)
+    filenames.push_back(d.first);
+  return filenames;
+  }
+
+uint64_t lsp_client::request_completion(const file_buffer& fb, position pos)
+  {
+  return _request(fb, pos, "textDocument/completion", lsp_completion);
+  }
+
+uint64_t lsp_client::request_definition(const file_buffer& fb, position pos)
+  {
+  return _request(fb, pos, "textDocument/definition", lsp_definition);
+  }
+
+std::vector<lsp_result> lsp_client::take_results()
+  {
+  std::vector<lsp_result> results;
+  std::scoped_lock lock(_mutex);
+  results.swap(_results);
+  return results;
+  }
+
+uint64_t lsp_client::_request(const file_buffer& fb, position pos, const std::string& method, e_lsp_result type)
+  {
+  sync(fb);
+  if (_documents.find(fb.name) == _documents.end())
+    return 0;
+  const uint64_t id = ++_last_request;
+  const std::string filename = fb.name;
+  std::scoped_lock lock(_mutex);
+  _pending[id] = type;
+  _outgoing.push_back([this, id, filename, pos, method]()
+    {
+    nlohmann::json params;
+    params["textDocument"]["uri"] = filename_to_uri(filename);
+    params["position"] = make_position(_texts[filename], pos);
+    return make_request(id, method, params);
+    });
+  return id;
+  }
+
+void lsp_client::_post(const std::string& content)
+  {
+  _post([content]() { return content; });
+  }
+
+void lsp_client::_post(std::function<std::string()> make_content)
+  {
+  std::scoped_lock lock(_mutex);
+  _outgoing.push_back(make_content);
+  }
+
+void lsp_client::_run()
+  {
+  nlohmann::json params;
+  params["processId"] = nullptr;
+  params["rootUri"] = _root_folder.empty() ? nlohmann::json(nullptr) : nlohmann::json(filename_to_uri(_root_folder));
+  params["capabilities"]["textDocument"]["synchronization"]["didSave"] = false;
+  params["capabilities"]["textDocument"]["completion"]["completionItem"]["snippetSupport"] = false;
+  params["capabilities"]["textDocument"]["definition"]["linkSupport"] = true;
+  params["capabilities"]["textDocument"]["publishDiagnostics"]["relatedInformation"] = false;
+  params["capabilities"]["general"]["positionEncodings"] = nlohmann::json::array({ "utf-16" });
+  _transport->write(make_lsp_message(make_request(initialize_request, "initialize", params)));
+
+  lsp_message_reader reader;
+  std::string content;
+  auto shutdown_time = std::chrono::steady_clock::now();
+  bool shutting_down = false;
+  for (;;)
+    {
+    std::vector<std::function<std::string()>> outgoing;
+    if (_initialized)
+      {
+      std::scoped_lock lock(_mutex);
+      outgoing.swap(_outgoing);
+      }
+    for (const auto& make_content : outgoing)
+      _transport->write(make_lsp_message(make_content()));
+    if (_shutdown_request != 0 && !shutting_down)
+      {
+      shutting_down = true;
+      shutdown_time = std::chrono::steady_clock::now();
+      }
+    if (shutting_down && (!_initialized || _shutdown_answered || std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - shutdown_time).count() > shutdown_timeout_ms))
+      break;
+    reader.append(_transport->read(10));
+    while (reader.next(content))
+      _handle(content);
+    if (_notify_pending)
+      {
+      _notify_pending = false;
+      if (!shutting_down)
+        _notify();
+      }
+    }
+  _transport->write(make_lsp_message(make_notification("exit", nullptr)));
+  }
+
+void lsp_client::_handle(const std::string& content)
+  {
+  nlohmann::json j;
+  try
+    {
+    j = nlohmann::json::parse(content);
+    }
+  catch (nlohmann::detail::exception&)
+    {
+    return;
+    }
+  if (!j.is_object())
+    return;
+  auto method = j.find("method");
+  auto id = j.find("id");
+  if (method != j.end() && id != j.end()) // a request of the server, which gets an empty answer
+    {
+    nlohmann::json answer;
+    answer["jsonrpc"] = "2.0";
+    answer["id"] = *id;
+    answer["result"] = nullptr;
+    if (*method == "workspace/configuration" && j.find("params") != j.end() && j["params"].is_object() && j["params"].find("items") != j["params"].end() && j["params"]["items"].is_array())
+      answer["result"] = std::vector<nlohmann::json>(j["params"]["items"].size(), nullptr);
+    _transport->write(make_lsp_message(dump(answer)));
+    return;
+    }
+  if (method != j.end())
+    {
+    if (*method == "textDocument/publishDiagnostics" && j.find("params") != j.end())
+      {
+      const auto& params = j["params"];
+      lsp_result r;
+      r.type = lsp_diagnostics;
+      r.request = 0;
+      r.filename = uri_to_filename(read_string(params, "uri"));
+      if (params.is_object() && params.find("diagnostics") != params.end())
+        r.diagnostics = read_diagnostics(params["diagnostics"]);
+      std::scoped_lock lock(_mutex);
+      _results.push_back(r);
+      _notify_pending = true;
+      }
+    return;
+    }
+  if (id == j.end() || !id->is_number_unsigned())
+    return;
+  const uint64_t request = id->get<uint64_t>();
+  const nlohmann::json result = j.find("result") != j.end() ? j["result"] : nlohmann::json(nullptr);
+  if (request == initialize_request)
+    {
+    _incremental_sync = read_incremental_sync(result);
+    _transport->write(make_lsp_message(make_notification("initialized", nlohmann::json::object())));
+    _initialized = true;
+    _notify_pending = true; // so that the open documents are synced
+    return;
+    }
+  if (request == _shutdown_request)
+    {
+    _shutdown_answered = true;
+    return;
+    }
+  std::scoped_lock lock(_mutex);
+  auto it = _pending.find(request);
+  if (it == _pending.end())
+    return;
+  lsp_result r;
+  r.type = it->second;
+  r.request = request;
+  _pending.erase(it);
+  if (r.type == lsp_completion)
+    r.completions = read_completions(result);
+  else if (r.type == lsp_definition)
+    r.locations = read_locations(result);
+  _results.push_back(r);
+  _notify_pending = true;
+  }
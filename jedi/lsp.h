@@ -0,0 +1,165 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+A language server as configured in lsp.json: the executable, its arguments, and the languageId of its documents.
+*/
+struct lsp_server
+  {
+  std::string executable;
+  std::vector<std::string> arguments;
+  std::string language_id;
+  };
+
+class lsp_config
+  {
+  public:
+    lsp_config(); // reads lsp.json in the folder of the executable
+    explicit lsp_config(const std::string& filename);
+
+    // returns nullptr if no server is configured for the extension of filename
+    const lsp_server* get_server_from_extension(const std::string& filename) const;
+
+  private:
+    std::vector<lsp_server> _servers;
+    std::map<std::wstring, size_t> _extension_to_server;
+  };
+
+/*
+The language server protocol counts columns in utf16 code units. A column of jedi counts wchar_t's, which are utf16 code
+units where wchar_t has 2 bytes, but where wchar_t has 4 bytes a character outside the basic multilingual plane can
+take one wchar_t instead of the two code units of its surrogate pair.
+*/
+int64_t column_to_utf16(const line& ln, int64_t col);
+int64_t utf16_to_column(const line& ln, int64_t utf16_col);
+
+/*
+The base protocol of the language server protocol: content preceded by a Content-Length header.
+*/
+std::string make_lsp_message(const std::string& content);
+
+/*
+Splits the bytes that a language server writes in the contents of its messages.
+*/
+class lsp_message_reader
+  {
+  public:
+    void append(const std::string& data);
+
+    // returns false if no complete message was read yet
+    bool next(std::string& content);
+
+  private:
+    std::string _data;
+  };
+
+/*
+The connection with a language server, normally the stdin and stdout of its process. Only the I/O thread of the
+lsp_client uses it.
+*/
+class lsp_transport
+  {
+  public:
+    virtual ~lsp_transport() {}
+
+    // returns false if the server cannot be reached
+    virtual bool write(const std::string& data) = 0;
+
+    // returns what the server wrote, or an empty string if it wrote nothing within timeout_ms milliseconds
+    virtual std::string read(int timeout_ms) = 0;
+  };
+
+enum e_lsp_result
+  {
+  lsp_completion,
+  lsp_definition,
+  lsp_diagnostics
+  };
+
+struct lsp_diagnostic
+  {
+  position first, last; // columns in utf16 code units
+  int severity; // 1 error, 2 warning, 3 information, 4 hint
+  std::wstring message;
+  };
+
+struct lsp_result
+  {
+  e_lsp_result type;
+  uint64_t request; // the id that request_completion or request_definition returned, 0 for diagnostics
+  std::string filename; // the file of the diagnostics
+  std::vector<std::wstring> completions;
+  std::vector<std::pair<std::string, position>> locations; // the definitions, as filename and position with its column in utf16 code units
+  std::vector<lsp_diagnostic> diagnostics;
+  };
+
+/*
+A client of one language server. All communication with the server happens on an I/O thread, so that a slow server
+never blocks the editor: the methods only queue snapshots of the text, which are encoded on the I/O thread, and the
+answers are collected as lsp_results, after which notify is called from the I/O thread. Documents are kept in sync with
+incremental changes, taken from the change log of the file_buffer.
+*/
+class lsp_client
+  {
+  public:
+    lsp_client(std::unique_ptr<lsp_transport> transport, const std::string& root_folder, const std::string& language_id, std::function<void()> notify);
+    ~lsp_client(); // asks the server to shut down and exit
+
+    bool is_initialized() const;
+
+    /*
+    Tells the server about the text of fb: the whole text the first time, and the changes since the last sync after
+    that. Does nothing before the server is initialized, as the server cannot be told anything yet.
+    */
+    void sync(const file_buffer& fb);
+
+    void close(const std::string& filename);
+
+    std::vector<std::string> get_open_documents() const;
+
+    // both return the id of the request, or 0 if the server is not initialized yet
+    uint64_t request_completion(const file_buffer& fb, position pos);
+    uint64_t request_definition(const file_buffer& fb, position pos);
+
+    std::vector<lsp_result> take_results();
+
+  private:
+    uint64_t _request(const file_buffer& fb, position pos, const std::string& method, e_lsp_result type);
+    void _post(const std::string& content);
+    void _post(std::function<std::string()> make_content);
+    void _run();
+    void _handle(const std::string& content); // on the I/O thread
+
+  private:
+    struct document
+      {
+      int64_t version;
+      uint64_t content_version;
+      };
+
+    std::unique_ptr<lsp_transport> _transport;
+    std::string _root_folder, _language_id;
+    std::function<void()> _notify;
+    std::map<std::string, document> _documents; // only used by the thread that owns the client
+    std::map<std::string, text> _texts; // the text that the server has of each open document, only used by the I/O thread
+    uint64_t _last_request;
+    std::atomic<bool> _initialized;
+    std::atomic<bool> _incremental_sync; // false if the server wants the whole text after each change
+    std::atomic<uint64_t> _shutdown_request; // 0 until the client is destroyed
+    bool _shutdown_answered, _notify_pending; // only used by the I/O thread
+    std::mutex _mutex; // guards the members below
+    std::vector<std::function<std::string()>> _outgoing; // make the contents of the messages on the I/O thread
+    std::map<uint64_t, e_lsp_result> _pending;
+    std::vector<lsp_result> _results;
+    std::thread _thread;
+  };
@@ -0,0 +1,120 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include "jtk/file_utils.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mapped_file::mapped_file() : _data(nullptr), _size(0)
+#ifdef _WIN32
+  , _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+#else
+  , _fd(-1)
+#endif
+  {
+  }
+
+mapped_file::~mapped_file()
+  {
+  close();
+  }
+
+bool mapped_file::open(const std::string& filename)
+  {
+  close();
+#ifdef _WIN32
+  std::wstring wfilename = jtk::convert_string_to_wstring(filename); // filenames are in utf8 encoding
+  _file = CreateFileW(wfilename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (_file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx((HANDLE)_file, &file_size))
+    {
+    close();
+    return false;
+    }
+  _size = (uint64_t)file_size.QuadPart;
+  if (_size == 0)
+    return true;
+  _mapping = CreateFileMappingW((HANDLE)_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (_mapping == nullptr)
+    {
+    close();
+    return false;
+    }
+  _data = (const char*)MapViewOfFile((HANDLE)_mapping, FILE_MAP_READ, 0, 0, 0);
+  if (_data == nullptr)
+    {
+    close();
+    return false;
+    }
+#else
+  _fd = ::open(filename.c_str(), O_RDONLY);
+  if (_fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(_fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+    close();
+    return false;
+    }
+  _size = (uint64_t)st.st_size;
+  if (_size == 0)
+    return true;
+  void* p = mmap(nullptr, (size_t)_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+  if (p == MAP_FAILED)
+    {
+    close();
+    return false;
+    }
+  madvise(p, (size_t)_size, MADV_SEQUENTIAL);
+  _data = (const char*)p;
+#endif
+  return true;
+  }
+
+void mapped_file::close()
+  {
+#ifdef _WIN32
+  if (_data)
+    UnmapViewOfFile(_data);
+  if (_mapping)
+    CloseHandle((HANDLE)_mapping);
+  if (_file != INVALID_HANDLE_VALUE)
+    CloseHandle((HANDLE)_file);
+  _mapping = nullptr;
+  _file = INVALID_HANDLE_VALUE;
+#else
+  if (_data)
+    munmap((void*)_data, (size_t)_size);
+  if (_fd >= 0)
+    ::close(_fd);
+  _fd = -1;
+#endif
+  _data = nullptr;
+  _size = 0;
+  }
+
+bool mapped_file::is_open() const
+  {
+#ifdef _WIN32
+  return _file != INVALID_HANDLE_VALUE;
+#else
+  return _fd >= 0;
+#endif
+  }
+
+const char* mapped_file::data() const
+  {
+  return _data;
+  }
+
+uint64_t mapped_file::size() const
+  {
+  return _size;
+  }
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+
+/*
+Read-only memory mapping of a file on disk.
+The mapping is released when the object is destroyed or when close() is called.
+*/
+class mapped_file
+  {
+  public:
+    mapped_file();
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator = (const mapped_file&) = delete;
+
+    bool open(const std::string& filename);
+
+    void close();
+
+    bool is_open() const;
+
+    const char* data() const;
+
+    uint64_t size() const;
+
+  private:
+    const char* _data;
+    uint64_t _size;
+#ifdef _WIN32
+    void* _file;
+    void* _mapping;
+#else
+    int _fd;
+#endif
+  };
+
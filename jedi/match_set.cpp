@@ -0,0 +1,174 @@
+#include "match_set.h"
+#include "parallel.h"
+#include "search.h"
+
+#include <algorithm>
+
+namespace
+  {
+  const int64_t rows_per_task = 4096;
+
+  /*
+  Returns true if a proper prefix of pattern equals a suffix of pattern, so that two occurrences of pattern can overlap.
+  */
+  bool can_overlap(const std::wstring& pattern)
+    {
+    for (size_t length = 1; length < pattern.size(); ++length)
+      {
+      if (std::equal(pattern.begin(), pattern.begin() + length, pattern.end() - length))
+        return true;
+      }
+    return false;
+    }
+  }
+
+match_set::match_set(text txt, uint64_t content_version, const std::wstring& pattern, bool case_sensitive) : _txt(txt), _content_version(content_version),
+  _pattern(pattern), _folded_pattern(pattern), _case_sensitive(case_sensitive)
+  {
+  if (!_case_sensitive && !_folded_pattern.empty())
+    fold_case(&_folded_pattern[0], &_folded_pattern[0] + _folded_pattern.size());
+  _find(_matches, 0, (int64_t)_txt.size());
+  }
+
+match_set::match_set(const match_set& previous, text txt, uint64_t content_version) : _txt(txt), _content_version(content_version),
+  _pattern(previous._pattern), _folded_pattern(previous._folded_pattern), _case_sensitive(previous._case_sensitive)
+  {
+  int64_t equal_prefix, equal_suffix;
+  get_equal_rows(equal_prefix, equal_suffix, previous._txt, _txt);
+  _update(previous, equal_prefix, equal_suffix);
+  }
+
+match_set::match_set(const match_set& previous, text txt, uint64_t content_version, int64_t equal_prefix, int64_t equal_suffix) : _txt(txt), _content_version(content_version),
+  _pattern(previous._pattern), _folded_pattern(previous._folded_pattern), _case_sensitive(previous._case_sensitive)
+  {
+  _update(previous, equal_prefix, equal_suffix);
+  }
+
+void match_set::_update(const match_set& previous, int64_t equal_prefix, int64_t equal_suffix)
+  {
+  const int64_t old_rows = (int64_t)previous._txt.size();
+  const int64_t new_rows = (int64_t)_txt.size();
+  const int64_t delta = new_rows - old_rows;
+  equal_prefix = std::min(equal_prefix, std::min(old_rows, new_rows));
+  equal_suffix = std::min(equal_suffix, std::min(old_rows, new_rows) - equal_prefix);
+
+  auto first_changed = std::lower_bound(previous._matches.begin(), previous._matches.end(), position(equal_prefix, 0));
+  auto first_after = std::lower_bound(first_changed, previous._matches.end(), position(old_rows - equal_suffix, 0));
+  _matches.assign(previous._matches.begin(), first_changed);
+  _find(_matches, equal_prefix, new_rows - equal_suffix);
+  _matches.reserve(_matches.size() + (previous._matches.end() - first_after));
+  for (auto it = first_after; it != previous._matches.end(); ++it)
+    _matches.emplace_back(it->row + delta, it->col);
+  }
+
+match_set::match_set(const match_set& prefix, const std::wstring& pattern) : _txt(prefix._txt), _content_version(prefix._content_version),
+  _pattern(pattern), _folded_pattern(pattern), _case_sensitive(prefix._case_sensitive)
+  {
+  if (!_case_sensitive && !_folded_pattern.empty())
+    fold_case(&_folded_pattern[0], &_folded_pattern[0] + _folded_pattern.size());
+  // occurrences of a prefix that can overlap are not all in the set of the prefix, so then the text is searched again
+  if (prefix._pattern.empty() || _pattern.compare(0, prefix._pattern.size(), prefix._pattern) != 0 || can_overlap(prefix._folded_pattern))
+    {
+    _find(_matches, 0, (int64_t)_txt.size());
+    return;
+    }
+  if (_folded_pattern.find(L'\n') != std::wstring::npos)
+    return;
+  const int64_t pattern_size = (int64_t)_folded_pattern.size();
+  for (const auto& m : prefix._matches)
+    {
+    if (!_matches.empty() && _matches.back().row == m.row && _matches.back().col + pattern_size > m.col)
+      continue;
+    const line& ln = _txt[m.row];
+    if (m.col + pattern_size > (int64_t)ln.size())
+      continue;
+    int64_t i = (int64_t)prefix._folded_pattern.size();
+    while (i < pattern_size && (_case_sensitive ? ln[m.col + i] : fold_case(ln[m.col + i])) == _folded_pattern[i])
+      ++i;
+    if (i == pattern_size)
+      _matches.push_back(m);
+    }
+  }
+
+void match_set::_find(std::vector<position>& matches, int64_t first_row, int64_t last_row) const
+  {
+  if (last_row <= first_row || _folded_pattern.empty() || _folded_pattern.find(L'\n') != std::wstring::npos)
+    return;
+  const uint64_t nr_of_tasks = (uint64_t)((last_row - first_row + rows_per_task - 1) / rows_per_task);
+  std::vector<std::vector<position>> found(nr_of_tasks);
+  parallel_for(nr_of_tasks, [&](uint64_t t)
+    {
+    const int64_t task_begin = first_row + (int64_t)t * rows_per_task;
+    const int64_t task_end = std::min<int64_t>(task_begin + rows_per_task, last_row);
+    const wchar_t* pattern = _folded_pattern.data();
+    const size_t pattern_size = _folded_pattern.size();
+    std::wstring row;
+    for (int64_t r = task_begin; r < task_end; ++r)
+      {
+      if (_txt[r].size() < pattern_size)
+        continue;
+      row.assign(_txt[r].begin(), _txt[r].end());
+      const wchar_t* first = row.data();
+      const wchar_t* last = first + row.size();
+      if (!_case_sensitive)
+        fold_case(&row[0], &row[0] + row.size());
+      const wchar_t* p = search_forward(first, last, pattern, pattern_size);
+      while (p != last)
+        {
+        found[t].emplace_back(r, (int64_t)(p - first));
+        p = search_forward(p + pattern_size, last, pattern, pattern_size);
+        }
+      }
+    });
+  for (const auto& f : found)
+    matches.insert(matches.end(), f.begin(), f.end());
+  }
+
+uint64_t match_set::content_version() const
+  {
+  return _content_version;
+  }
+
+const std::wstring& match_set::pattern() const
+  {
+  return _pattern;
+  }
+
+bool match_set::case_sensitive() const
+  {
+  return _case_sensitive;
+  }
+
+uint64_t match_set::size() const
+  {
+  return _matches.size();
+  }
+
+uint64_t match_set::count(int64_t first_row, int64_t last_row) const
+  {
+  if (last_row <= first_row)
+    return 0;
+  auto first = std::lower_bound(_matches.begin(), _matches.end(), position(first_row, 0));
+  auto last = std::lower_bound(first, _matches.end(), position(last_row, 0));
+  return (uint64_t)(last - first);
+  }
+
+uint64_t match_set::count_before(position pos) const
+  {
+  return (uint64_t)(std::lower_bound(_matches.begin(), _matches.end(), pos) - _matches.begin());
+  }
+
+void match_set::get_matches(std::vector<int64_t>& columns, int64_t row) const
+  {
+  columns.clear();
+  auto it = std::lower_bound(_matches.begin(), _matches.end(), position(row, 0));
+  for (; it != _matches.end() && it->row == row; ++it)
+    columns.push_back(it->col);
+  }
+
+const match_set* get_match_set(const file_buffer& fb)
+  {
+  if (!fb.matches || fb.matches->content_version() != fb.content_version)
+    return nullptr;
+  return fb.matches.get();
+  }
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <string>
+#include <vector>
+
+/*
+All occurrences of a pattern in one content_version of a file_buffer, sorted by position. Occurrences do not overlap.
+A set for a newer version can be made from a set of an older version, in which case only the rows that differ
+between both versions are searched again. These rows are found by comparing both texts, unless they are given as by
+get_equal_rows. A set for a longer pattern can be made from the set of its prefix, in which
+case only the occurrences of the prefix are checked. Patterns that are empty or contain a newline have no occurrences.
+Building a set can take long for large texts, so it should be done on a background thread.
+*/
+class match_set
+  {
+  public:
+    match_set(text txt, uint64_t content_version, const std::wstring& pattern, bool case_sensitive);
+    match_set(const match_set& previous, text txt, uint64_t content_version);
+    match_set(const match_set& previous, text txt, uint64_t content_version, int64_t equal_prefix, int64_t equal_suffix);
+    match_set(const match_set& prefix, const std::wstring& pattern); // pattern should start with the pattern of prefix
+
+    uint64_t content_version() const;
+
+    const std::wstring& pattern() const;
+
+    bool case_sensitive() const;
+
+    uint64_t size() const;
+
+    /*
+    Returns the number of occurrences that start in rows [first_row, last_row).
+    */
+    uint64_t count(int64_t first_row, int64_t last_row) const;
+
+    /*
+    Returns the number of occurrences that start before pos.
+    */
+    uint64_t count_before(position pos) const;
+
+    /*
+    Sets columns to the sorted columns at which an occurrence starts in row.
+    */
+    void get_matches(std::vector<int64_t>& columns, int64_t row) const;
+
+  private:
+    void _find(std::vector<position>& matches, int64_t first_row, int64_t last_row) const;
+    void _update(const match_set& previous, int64_t equal_prefix, int64_t equal_suffix);
+
+  private:
+    text _txt;
+    uint64_t _content_version;
+    std::wstring _pattern;
+    std::wstring _folded_pattern; // equal to _pattern if the search is case sensitive
+    bool _case_sensitive;
+    std::vector<position> _matches;
+  };
+
+/*
+Returns the match set of fb if it belongs to the current content_version of fb, and nullptr otherwise.
+*/
+const match_set* get_match_set(const file_buffer& fb);
@@ -0,0 +1,205 @@
+#include "offset_index.h"
+
+#include <algorithm>
+
+namespace
+  {
+  inline int64_t utf8_length(wchar_t ch)
+    {
+    const uint32_t cp = (uint32_t)ch;
+    if (cp < 0x80)
+      return 1;
+    if (cp < 0x800)
+      return 2;
+    if (cp >= 0xD800 && cp <= 0xDFFF) // one half of a surrogate pair, the pair takes 4 bytes
+      return 2;
+    if (cp < 0x10000)
+      return 3;
+    return 4;
+    }
+
+  int64_t utf8_length(line ln, int64_t first, int64_t last)
+    {
+    int64_t length = 0;
+    auto it = ln.begin();
+    it += first;
+    for (int64_t i = first; i < last; ++i, ++it)
+      length += utf8_length(*it);
+    return length;
+    }
+
+  /*
+  Turns the values in tree[1..n] into a Fenwick tree in O(n).
+  */
+  void make_fenwick_tree(std::vector<int64_t>& tree)
+    {
+    const int64_t n = (int64_t)tree.size() - 1;
+    for (int64_t i = 1; i <= n; ++i)
+      {
+      const int64_t parent = i + (i & -i);
+      if (parent <= n)
+        tree[parent] += tree[i];
+      }
+    }
+  }
+
+offset_index::offset_index() : _chars(1, 0), _bytes(1, 0)
+  {
+  }
+
+offset_index::offset_index(text txt) : _txt(txt)
+  {
+  _chars.resize(txt.size() + 1, 0);
+  _bytes.resize(txt.size() + 1, 0);
+  int64_t row = 1;
+  for (auto it = txt.begin(); it != txt.end(); ++it, ++row)
+    {
+    _chars[row] = (int64_t)it->size();
+    _bytes[row] = utf8_length(*it, 0, (int64_t)it->size());
+    }
+  make_fenwick_tree(_chars);
+  make_fenwick_tree(_bytes);
+  }
+
+int64_t offset_index::prefix(const std::vector<int64_t>& tree, int64_t row) const
+  {
+  int64_t sum = 0;
+  for (int64_t i = row; i > 0; i -= (i & -i))
+    sum += tree[i];
+  return sum;
+  }
+
+/*
+Returns the number of rows whose total length is at most offset, and subtracts that total length from offset.
+*/
+int64_t offset_index::find_row(const std::vector<int64_t>& tree, int64_t& offset) const
+  {
+  const int64_t n = (int64_t)tree.size() - 1;
+  int64_t step = 1;
+  while (step * 2 <= n)
+    step *= 2;
+  int64_t row = 0;
+  for (; step > 0; step /= 2)
+    {
+    if (row + step <= n && tree[row + step] <= offset)
+      {
+      row += step;
+      offset -= tree[row];
+      }
+    }
+  return row;
+  }
+
+int64_t offset_index::size() const
+  {
+  return prefix(_chars, (int64_t)_chars.size() - 1);
+  }
+
+int64_t offset_index::byte_size() const
+  {
+  return prefix(_bytes, (int64_t)_bytes.size() - 1);
+  }
+
+int64_t offset_index::get_offset(position pos) const
+  {
+  if (pos.row >= (int64_t)_txt.size())
+    return size();
+  return prefix(_chars, pos.row) + pos.col;
+  }
+
+position offset_index::get_position(int64_t offset) const
+  {
+  if (offset <= 0)
+    return position(0, 0);
+  const int64_t row = find_row(_chars, offset);
+  if (row >= (int64_t)_txt.size())
+    return get_last_position(_txt);
+  return position(row, offset);
+  }
+
+int64_t offset_index::get_byte_offset(position pos) const
+  {
+  if (pos.row >= (int64_t)_txt.size())
+    return byte_size();
+  line ln = _txt[pos.row];
+  return prefix(_bytes, pos.row) + utf8_length(ln, 0, std::min<int64_t>(pos.col, ln.size()));
+  }
+
+position offset_index::get_position_from_byte_offset(int64_t offset) const
+  {
+  if (offset <= 0)
+    return position(0, 0);
+  const int64_t row = find_row(_bytes, offset);
+  if (row >= (int64_t)_txt.size())
+    return get_last_position(_txt);
+  line ln = _txt[row];
+  int64_t col = 0;
+  for (auto it = ln.begin(); it != ln.end(); ++it, ++col)
+    {
+    const int64_t length = utf8_length(*it);
+    if (offset < length)
+      break;
+    offset -= length;
+    }
+  return position(row, col);
+  }
+
+offset_index_cache::offset_index_cache() : _content_version(0)
+  {
+  }
+
+std::shared_ptr<const offset_index> offset_index_cache::get(const file_buffer& fb)
+  {
+  std::scoped_lock lock(_mutex);
+  if (!_index || _content_version != fb.content_version)
+    {
+    _index = std::make_shared<const offset_index>(fb.content);
+    _content_version = fb.content_version;
+    }
+  return _index;
+  }
+
+std::shared_ptr<const offset_index> get_offset_index(const file_buffer& fb)
+  {
+  if (fb.offsets)
+    return fb.offsets->get(fb);
+  return std::make_shared<const offset_index>(fb.content);
+  }
+
+bool move_over_characters(position& pos, text txt, int64_t distance, bool reverse)
+  {
+  if (txt.empty())
+    return distance == 0;
+  if (reverse)
+    {
+    // the character before the begin of a row is the newline at the end of the previous row
+    while (distance > pos.col)
+      {
+      if (pos.row == 0)
+        return false;
+      distance -= pos.col + 1;
+      --pos.row;
+      pos.col = (int64_t)txt[pos.row].size() - 1;
+      }
+    pos.col -= distance;
+    return true;
+    }
+  while (distance > 0)
+    {
+    const int64_t rest = (int64_t)txt[pos.row].size() - pos.col;
+    if (distance < rest)
+      {
+      pos.col += distance;
+      return true;
+      }
+    distance -= rest;
+    if (pos.row + 1 >= (int64_t)txt.size())
+      {
+      pos = get_last_position(txt);
+      return distance == 0;
+      }
+    ++pos.row;
+    pos.col = 0;
+    }
+  return true;
+  }
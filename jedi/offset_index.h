@@ -0,0 +1,69 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+/*
+Prefix sums of the line lengths of a text, counted in characters and in utf8 bytes, stored as Fenwick trees.
+Building the index costs O(n) in the number of lines, afterwards a conversion between a position and an
+absolute offset costs O(log n). The index belongs to one version of the text, see offset_index_cache.
+*/
+class offset_index
+  {
+  public:
+    offset_index();
+    explicit offset_index(text txt);
+
+    int64_t size() const; // the number of characters in the text
+
+    int64_t byte_size() const; // the number of bytes in the utf8 encoding of the text
+
+    int64_t get_offset(position pos) const;
+
+    position get_position(int64_t offset) const; // offsets at or past the end of the text give get_last_position
+
+    int64_t get_byte_offset(position pos) const;
+
+    position get_position_from_byte_offset(int64_t offset) const; // an offset inside a multibyte character gives the position of that character
+
+  private:
+    int64_t prefix(const std::vector<int64_t>& tree, int64_t row) const;
+    int64_t find_row(const std::vector<int64_t>& tree, int64_t& offset) const;
+
+  private:
+    text _txt;
+    std::vector<int64_t> _chars; // 1-based Fenwick trees over the rows
+    std::vector<int64_t> _bytes;
+  };
+
+/*
+The offset_index of the last content_version of a buffer that asked for one, so that Goto and the #n addresses
+build the index once per version of the text instead of once per use.
+The cache can be used by several threads, as the copies of a buffer share it.
+*/
+class offset_index_cache
+  {
+  public:
+    offset_index_cache();
+
+    std::shared_ptr<const offset_index> get(const file_buffer& fb);
+
+  private:
+    std::mutex _mutex;
+    std::shared_ptr<const offset_index> _index;
+    uint64_t _content_version;
+  };
+
+std::shared_ptr<const offset_index> get_offset_index(const file_buffer& fb); // through fb.offsets, or a new index if the buffer has no cache
+
+const int64_t max_walked_characters = 1 << 16; // larger distances are resolved with an offset_index
+
+/*
+Moves pos forward, or backward if reverse, over distance characters of txt by walking the rows, which costs
+O(rows passed) and gives the same position as an offset_index. Returns false if the text ends first.
+*/
+bool move_over_characters(position& pos, text txt, int64_t distance, bool reverse);
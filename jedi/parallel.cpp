@@ -0,0 +1,55 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+uint32_t get_number_of_workers()
+  {
+  uint32_t n = std::thread::hardware_concurrency();
+  return n == 0 ? 1 : n;
+  }
+
+void parallel_for(uint64_t number_of_items, const std::function<void(uint64_t)>& fun)
+  {
+  if (number_of_items == 0)
+    return;
+  const uint64_t number_of_threads = std::min<uint64_t>(get_number_of_workers(), number_of_items);
+  if (number_of_threads == 1)
+    {
+    for (uint64_t i = 0; i < number_of_items; ++i)
+      fun(i);
+    return;
+    }
+  std::atomic<uint64_t> next_item(0);
+  std::exception_ptr first_exception;
+  std::mutex exception_mutex;
+  auto work = [&]()
+    {
+    for (uint64_t i = next_item++; i < number_of_items; i = next_item++)
+      {
+      try
+        {
+        fun(i);
+        }
+      catch (...)
+        {
+        std::scoped_lock lock(exception_mutex);
+        if (!first_exception)
+          first_exception = std::current_exception();
+        }
+      }
+    };
+  std::vector<std::thread> threads;
+  threads.reserve(number_of_threads - 1);
+  for (uint64_t t = 1; t < number_of_threads; ++t)
+    threads.emplace_back(work);
+  work();
+  for (auto& t : threads)
+    t.join();
+  if (first_exception)
+    std::rethrow_exception(first_exception);
+  }
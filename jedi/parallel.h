@@ -0,0 +1,13 @@
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+
+uint32_t get_number_of_workers();
+
+/*
+Calls fun(i) for i in [0, number_of_items) spread over the available hardware threads.
+The calling thread takes part in the work. The first exception thrown by fun is rethrown
+after all workers have finished.
+*/
+void parallel_for(uint64_t number_of_items, const std::function<void(uint64_t)>& fun);
@@ -1,11 +1,12 @@
 #include "plumber.h"
 
+#include "encoding.h"
+#include "text_regex.h"
 #include "utils.h"
 
 #include <cassert>
 #include <fstream>
 #include <json.hpp>
-#include <regex>
 
 #include <jtk/file_utils.h>
 
@@ -80,9 +81,15 @@ std::string plumber::get_executable_from_extension(const std::string& filename)
 
 std::string plumber::get_executable_from_regex(const std::string& expression) const {
   std::string exe;
+  const std::wstring wexpression = decode(expression);
   for (const auto& pr : regex_to_executable) {
-    if (std::regex_match(expression, std::regex(pr.first)))
-      return pr.second;
+    try {
+      if (get_regex(decode(pr.first))->match(wexpression))
+        return pr.second;
+    }
+    catch (text_regex_error&) {
+      // an invalid expression in plumber.json never matches
+    }
   }  
   return exe;
 }
@@ -0,0 +1,270 @@
+#include "search.h"
+
+#include <cstring>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JEDI_SSE2
+#endif
+
+namespace
+  {
+  /*
+  Two level table: the high byte of a character selects a page of 256 deltas, the low byte selects the delta within the page.
+  Pages without mappings share page 0, which contains only zeros.
+  */
+  class case_folding_table
+    {
+    public:
+      case_folding_table() : _deltas(256, 0)
+        {
+        memset(_page, 0, sizeof(_page));
+        set_range(0x41, 0x5A, 32);
+        set_range(0xC0, 0xD6, 32);
+        set_range(0xD8, 0xDE, 32);
+        set_pairs(0x100, 0x12F);
+        set_pairs(0x132, 0x137);
+        set_pairs(0x139, 0x148);
+        set_pairs(0x14A, 0x177);
+        set(0x178, 0xFF);
+        set_pairs(0x179, 0x17E);
+        set_pairs(0x1CD, 0x1DC);
+        set_pairs(0x1DE, 0x1EF);
+        set_pairs(0x1F8, 0x21F);
+        set_pairs(0x222, 0x233);
+        set_pairs(0x246, 0x24F);
+        set(0x386, 0x3AC);
+        set_range(0x388, 0x38A, 37);
+        set(0x38C, 0x3CC);
+        set_range(0x38E, 0x38F, 63);
+        set_range(0x391, 0x3A1, 32);
+        set_range(0x3A3, 0x3AB, 32);
+        set(0x3C2, 0x3C3); // final sigma
+        set_range(0x400, 0x40F, 80);
+        set_range(0x410, 0x42F, 32);
+        set_pairs(0x460, 0x481);
+        set_pairs(0x48A, 0x4BF);
+        set(0x4C0, 0x4CF);
+        set_pairs(0x4C1, 0x4CE);
+        set_pairs(0x4D0, 0x52F);
+        set_range(0x531, 0x556, 48);
+        set_range(0x10A0, 0x10C5, 7264);
+        set_pairs(0x1E00, 0x1E95);
+        set_pairs(0x1EA0, 0x1EFF);
+        set_range(0x2160, 0x216F, 16);
+        set_range(0x24B6, 0x24CF, 26);
+        set_range(0xFF21, 0xFF3A, 32);
+        }
+
+      wchar_t fold(wchar_t ch) const
+        {
+        const uint32_t c = (uint32_t)ch;
+        if (c > 0xFFFF)
+          return ch;
+        return (wchar_t)(c + _deltas[((size_t)_page[c >> 8] << 8) | (c & 0xFF)]);
+        }
+
+    private:
+      void set(uint32_t upper, uint32_t lower)
+        {
+        if (_page[upper >> 8] == 0)
+          {
+          _page[upper >> 8] = (uint8_t)(_deltas.size() >> 8);
+          _deltas.resize(_deltas.size() + 256, 0);
+          }
+        _deltas[((size_t)_page[upper >> 8] << 8) | (upper & 0xFF)] = (int16_t)((int32_t)lower - (int32_t)upper);
+        }
+
+      void set_range(uint32_t first, uint32_t last, int32_t delta)
+        {
+        for (uint32_t c = first; c <= last; ++c)
+          set(c, (uint32_t)((int32_t)c + delta));
+        }
+
+      // upper case and lower case alternate, starting with upper case at first
+      void set_pairs(uint32_t first, uint32_t last)
+        {
+        for (uint32_t c = first; c < last; c += 2)
+          set(c, c + 1);
+        }
+
+      uint8_t _page[256];
+      std::vector<int16_t> _deltas;
+    };
+
+  const case_folding_table& get_case_folding_table()
+    {
+    static const case_folding_table table;
+    return table;
+    }
+
+  inline bool matches(const wchar_t* p, const wchar_t* pattern, size_t pattern_size)
+    {
+    return p[0] == pattern[0] && p[pattern_size - 1] == pattern[pattern_size - 1] && memcmp(p + 1, pattern + 1, (pattern_size - 1) * sizeof(wchar_t)) == 0;
+    }
+
+#ifdef JEDI_SSE2
+  const size_t chars_per_block = 16 / sizeof(wchar_t);
+  const uint32_t char_bits = sizeof(wchar_t) == 2 ? 3 : 15; // the movemask bits that belong to one character
+
+  inline __m128i broadcast(wchar_t ch)
+    {
+    if (sizeof(wchar_t) == 2)
+      return _mm_set1_epi16((short)ch);
+    return _mm_set1_epi32((int)ch);
+    }
+
+  /*
+  Returns the movemask of the characters p[i] for which p[i] == first and p[i+pattern_size-1] == last, for i in [0, chars_per_block).
+  */
+  inline uint32_t candidates(const wchar_t* p, size_t pattern_size, __m128i first, __m128i last)
+    {
+    const __m128i v_first = _mm_loadu_si128((const __m128i*)p);
+    const __m128i v_last = _mm_loadu_si128((const __m128i*)(p + pattern_size - 1));
+    __m128i eq;
+    if (sizeof(wchar_t) == 2)
+      eq = _mm_and_si128(_mm_cmpeq_epi16(v_first, first), _mm_cmpeq_epi16(v_last, last));
+    else
+      eq = _mm_and_si128(_mm_cmpeq_epi32(v_first, first), _mm_cmpeq_epi32(v_last, last));
+    return (uint32_t)_mm_movemask_epi8(eq);
+    }
+
+  /*
+  Folds chars_per_block characters at p if they are all ascii, and returns true. Returns false otherwise.
+  */
+  inline bool fold_ascii_block(wchar_t* p)
+    {
+    const __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i upper;
+    if (sizeof(wchar_t) == 2)
+      {
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128())) != 0xFFFF)
+        return false;
+      upper = _mm_and_si128(_mm_cmpgt_epi16(v, _mm_set1_epi16('A' - 1)), _mm_cmplt_epi16(v, _mm_set1_epi16('Z' + 1)));
+      }
+    else
+      {
+      if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, _mm_set1_epi32((int)0xFFFFFF80)), _mm_setzero_si128())) != 0xFFFF)
+        return false;
+      upper = _mm_and_si128(_mm_cmpgt_epi32(v, _mm_set1_epi32('A' - 1)), _mm_cmplt_epi32(v, _mm_set1_epi32('Z' + 1)));
+      }
+    _mm_storeu_si128((__m128i*)p, _mm_or_si128(v, _mm_and_si128(upper, broadcast((wchar_t)0x20))));
+    return true;
+    }
+
+  inline uint32_t lowest_bit(uint32_t mask)
+    {
+#if defined(_MSC_VER)
+    unsigned long bit;
+    _BitScanForward(&bit, mask);
+    return (uint32_t)bit;
+#else
+    return (uint32_t)__builtin_ctz(mask);
+#endif
+    }
+
+  inline uint32_t highest_bit(uint32_t mask)
+    {
+#if defined(_MSC_VER)
+    unsigned long bit;
+    _BitScanReverse(&bit, mask);
+    return (uint32_t)bit;
+#else
+    return 31 - (uint32_t)__builtin_clz(mask);
+#endif
+    }
+#endif
+  }
+
+const wchar_t* search_forward(const wchar_t* first, const wchar_t* last, const wchar_t* pattern, size_t pattern_size)
+  {
+  if (pattern_size == 0)
+    return first;
+  if ((size_t)(last - first) < pattern_size)
+    return last;
+  const wchar_t* last_start = last - pattern_size; // the last position where an occurrence can start
+  const wchar_t* p = first;
+#if defined(JEDI_SSE2)
+  const __m128i first_char = broadcast(pattern[0]);
+  const __m128i last_char = broadcast(pattern[pattern_size - 1]);
+  for (; p + chars_per_block <= last_start + 1; p += chars_per_block)
+    {
+    uint32_t mask = candidates(p, pattern_size, first_char, last_char);
+    while (mask)
+      {
+      const uint32_t bit = lowest_bit(mask);
+      const wchar_t* candidate = p + bit / sizeof(wchar_t);
+      if (memcmp(candidate + 1, pattern + 1, (pattern_size - 1) * sizeof(wchar_t)) == 0)
+        return candidate;
+      mask &= ~(char_bits << bit);
+      }
+    }
+#endif
+  for (; p <= last_start; ++p)
+    {
+    if (matches(p, pattern, pattern_size))
+      return p;
+    }
+  return last;
+  }
+
+const wchar_t* search_backward(const wchar_t* first, const wchar_t* last, const wchar_t* pattern, size_t pattern_size)
+  {
+  if (pattern_size == 0)
+    return last;
+  if ((size_t)(last - first) < pattern_size)
+    return last;
+  const wchar_t* end = last - pattern_size + 1; // candidates are in [first, end)
+#if defined(JEDI_SSE2)
+  const __m128i first_char = broadcast(pattern[0]);
+  const __m128i last_char = broadcast(pattern[pattern_size - 1]);
+  while ((size_t)(end - first) >= chars_per_block)
+    {
+    const wchar_t* p = end - chars_per_block;
+    uint32_t mask = candidates(p, pattern_size, first_char, last_char);
+    while (mask)
+      {
+      const uint32_t bit = highest_bit(mask) & ~(uint32_t)(sizeof(wchar_t) - 1);
+      const wchar_t* candidate = p + bit / sizeof(wchar_t);
+      if (memcmp(candidate + 1, pattern + 1, (pattern_size - 1) * sizeof(wchar_t)) == 0)
+        return candidate;
+      mask &= ~(char_bits << bit);
+      }
+    end = p;
+    }
+#endif
+  while (end > first)
+    {
+    --end;
+    if (matches(end, pattern, pattern_size))
+      return end;
+    }
+  return last;
+  }
+
+wchar_t fold_case(wchar_t ch)
+  {
+  return get_case_folding_table().fold(ch);
+  }
+
+void fold_case(wchar_t* first, wchar_t* last)
+  {
+  const case_folding_table& table = get_case_folding_table();
+  while (first < last)
+    {
+#if defined(JEDI_SSE2)
+    if ((size_t)(last - first) >= chars_per_block && fold_ascii_block(first))
+      {
+      first += chars_per_block;
+      continue;
+      }
+#endif
+    *first = table.fold(*first);
+    ++first;
+    }
+  }
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Returns a pointer to the first occurrence of [pattern, pattern+pattern_size) in [first, last), or last if there is none.
+Candidates are filtered on their first and last character 8 or 4 characters at a time, and confirmed with memcmp.
+*/
+const wchar_t* search_forward(const wchar_t* first, const wchar_t* last, const wchar_t* pattern, size_t pattern_size);
+
+/*
+Returns a pointer to the last occurrence of [pattern, pattern+pattern_size) in [first, last), or last if there is none.
+*/
+const wchar_t* search_backward(const wchar_t* first, const wchar_t* last, const wchar_t* pattern, size_t pattern_size);
+
+/*
+Simple case folding of the characters in the basic multilingual plane: Latin, Greek, Cyrillic, Armenian, Georgian and fullwidth letters.
+Characters outside the table, and characters outside the basic multilingual plane, fold to themselves.
+*/
+wchar_t fold_case(wchar_t ch);
+
+/*
+Folds [first, last) in place. Blocks of ascii characters are folded 8 or 4 characters at a time.
+*/
+void fold_case(wchar_t* first, wchar_t* last);
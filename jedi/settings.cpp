@@ -10,9 +10,11 @@ settings::settings()
   tab_space = 2;
   use_spaces_for_tab = true;
   show_line_numbers = true;
+  highlight_matches = true;
   wrap = false;
   syntax = true;
   case_sensitive = false;
+  regex_find = false;
   mario = true;
   w = 80;
   h = 25;
@@ -21,6 +23,8 @@ settings::settings()
   font_size = 17;
   font = jtk::get_folder(jtk::get_executable_path()) + "fonts/FiraCode-Regular.ttf";
   mouse_scroll_steps = 3;
+  undo_memory_budget = 256;
+  search_index_budget = 64;
 
   color_editor_text = 0xfff2f8f8;
   color_editor_background = 0xff362a28;
@@ -67,6 +71,8 @@ void update_settings_if_different(settings& s, const settings& new_settings, con
     
   if (new_settings.case_sensitive != old_settings.case_sensitive)
     s.case_sensitive = new_settings.case_sensitive;
+  if (new_settings.regex_find != old_settings.regex_find)
+    s.regex_find = new_settings.regex_find;
 
   if (new_settings.w != old_settings.w)
     s.w = new_settings.w;
@@ -76,6 +82,8 @@ void update_settings_if_different(settings& s, const settings& new_settings, con
 
   if (new_settings.show_line_numbers != old_settings.show_line_numbers)
     s.show_line_numbers = new_settings.show_line_numbers;
+  if (new_settings.highlight_matches != old_settings.highlight_matches)
+    s.highlight_matches = new_settings.highlight_matches;
 
   if (new_settings.wrap != old_settings.wrap)
     s.wrap = new_settings.wrap;
@@ -98,6 +106,12 @@ void update_settings_if_different(settings& s, const settings& new_settings, con
   if (new_settings.mouse_scroll_steps != old_settings.mouse_scroll_steps)
     s.mouse_scroll_steps = new_settings.mouse_scroll_steps;
 
+  if (new_settings.undo_memory_budget != old_settings.undo_memory_budget)
+    s.undo_memory_budget = new_settings.undo_memory_budget;
+
+  if (new_settings.search_index_budget != old_settings.search_index_budget)
+    s.search_index_budget = new_settings.search_index_budget;
+
   if (new_settings.last_find != old_settings.last_find)
     s.last_find = new_settings.last_find;
 
@@ -185,12 +199,16 @@ void update_settings(settings& s, const char* filename)
   f["font_size"] >> s.font_size;
   f["font"] >> s.font;
   f["mouse_scroll_steps"] >> s.mouse_scroll_steps;
+  f["undo_memory_budget"] >> s.undo_memory_budget;
+  f["search_index_budget"] >> s.search_index_budget;
   f["last_find"] >> s.last_find;
   f["last_replace"] >> s.last_replace;
   f["show_line_numbers"] >> s.show_line_numbers;
+  f["highlight_matches"] >> s.highlight_matches;
   f["wrap"] >> s.wrap;
   f["syntax"] >> s.syntax;
   f["case_sensitive"] >> s.case_sensitive;
+  f["regex_find"] >> s.regex_find;
 
   f["color_editor_text"] >> s.color_editor_text;
   f["color_editor_background"] >> s.color_editor_background;
@@ -239,12 +257,16 @@ void write_settings(const settings& s, const char* filename)
   f << "font_size" << s.font_size;
   f << "font" << s.font;  
   f << "mouse_scroll_steps" << s.mouse_scroll_steps;
+  f << "undo_memory_budget" << s.undo_memory_budget;
+  f << "search_index_budget" << s.search_index_budget;
   f << "last_find" << s.last_find;
   f << "last_replace" << s.last_replace;
   f << "show_line_numbers" << s.show_line_numbers;
+  f << "highlight_matches" << s.highlight_matches;
   f << "wrap" << s.wrap;
   f << "syntax" << s.syntax;
   f << "case_sensitive" << s.case_sensitive;
+  f << "regex_find" << s.regex_find;
 
   f << "color_editor_text" << s.color_editor_text;
   f << "color_editor_background" << s.color_editor_background;
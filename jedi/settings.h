@@ -11,7 +11,9 @@ struct settings
   int tab_space;
   bool show_all_characters;
   bool show_line_numbers;
+  bool highlight_matches; // highlight all occurrences of the last find, and show them in the scroll bar
   bool case_sensitive;
+  bool regex_find; // Find and Find next search for a regular expression instead of literal text
   bool wrap;
   bool syntax;
   bool mario;
@@ -19,6 +21,8 @@ struct settings
   int font_size;
   std::string font;
   int mouse_scroll_steps;
+  int undo_memory_budget; // in megabytes, per buffer
+  int search_index_budget; // in megabytes, per buffer, 0 turns the trigram search index off
   std::string last_find, last_replace;
 
   uint32_t color_editor_text;
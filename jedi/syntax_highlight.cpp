@@ -102,110 +102,121 @@ namespace
     return kd;
     }
 
-  comment_data make_comment_data_for_cpp()
+  syntax_definition make_syntax_definition_for_cpp()
     {
-    comment_data cd;
-    cd.multiline_begin = "/*";
-    cd.multiline_end = "*/";
-    cd.multistring_begin = "R\"(";
-    cd.multistring_end = ")\"";
-    cd.single_line = "//";
-    cd.uses_quotes_for_chars = true;
-    return cd;
+    syntax_definition sd;
+    sd.multiline_comment_begin.push_back(L"/*");
+    sd.multiline_comment_end.push_back(L"*/");
+    sd.multiline_string_begin.push_back(L"R\"(");
+    sd.multiline_string_end.push_back(L")\"");
+    sd.single_line_comment.push_back(L"//");
+    sd.preprocessor = L"#";
+    sd.uses_quotes_for_chars = true;
+    sd.numbers = true;
+    return sd;
     }
 
-  comment_data make_comment_data_for_swift()
+  syntax_definition make_syntax_definition_for_swift()
     {
-    comment_data cd;
-    cd.multiline_begin = "/*";
-    cd.multiline_end = "*/";
-    cd.multistring_begin = "\"\"\"";
-    cd.multistring_end = "\"\"\"";
-    cd.single_line = "//";
-    cd.uses_quotes_for_chars = true;
-    return cd;
+    syntax_definition sd;
+    sd.multiline_comment_begin.push_back(L"/*");
+    sd.multiline_comment_end.push_back(L"*/");
+    sd.multiline_string_begin.push_back(L"\"\"\"");
+    sd.multiline_string_end.push_back(L"\"\"\"");
+    sd.single_line_comment.push_back(L"//");
+    sd.uses_quotes_for_chars = true;
+    sd.nested_comments = true;
+    sd.numbers = true;
+    return sd;
     }
 
-  comment_data make_comment_data_for_objective_c()
+  syntax_definition make_syntax_definition_for_objective_c()
     {
-    comment_data cd;
-    cd.multiline_begin = "/*";
-    cd.multiline_end = "*/";
-    cd.single_line = "//";
-    cd.uses_quotes_for_chars = true;
-    return cd;
+    syntax_definition sd;
+    sd.multiline_comment_begin.push_back(L"/*");
+    sd.multiline_comment_end.push_back(L"*/");
+    sd.single_line_comment.push_back(L"//");
+    sd.preprocessor = L"#";
+    sd.uses_quotes_for_chars = true;
+    sd.numbers = true;
+    return sd;
     }
 
-  comment_data make_comment_data_for_assembly()
+  syntax_definition make_syntax_definition_for_assembly()
     {
-    comment_data cd;
-    cd.single_line = ";";
-    return cd;
+    syntax_definition sd;
+    sd.single_line_comment.push_back(L";");
+    return sd;
     }
 
-  comment_data make_comment_data_for_scheme()
+  syntax_definition make_syntax_definition_for_scheme()
     {
-    comment_data cd;
-    cd.multiline_begin = "#|";
-    cd.multiline_end = "|#";
-    cd.single_line = ";";
-    return cd;
+    syntax_definition sd;
+    sd.multiline_comment_begin.push_back(L"#|");
+    sd.multiline_comment_end.push_back(L"|#");
+    sd.single_line_comment.push_back(L";");
+    sd.nested_comments = true;
+    return sd;
     }
 
-  comment_data make_comment_data_for_python_and_cmake()
+  syntax_definition make_syntax_definition_for_python_and_cmake()
     {
-    comment_data cd;
-    cd.single_line = "#";
-    cd.uses_quotes_for_chars = true;
-    return cd;
+    syntax_definition sd;
+    sd.single_line_comment.push_back(L"#");
+    sd.uses_quotes_for_chars = true;
+    return sd;
     }
 
-  comment_data make_comment_data_for_xml()
+  syntax_definition make_syntax_definition_for_xml()
     {
-    comment_data cd;
-    cd.multiline_begin = "<!--";
-    cd.multiline_end = "-->";
-    return cd;
+    syntax_definition sd;
+    sd.multiline_comment_begin.push_back(L"<!--");
+    sd.multiline_comment_end.push_back(L"-->");
+    return sd;
     }
 
-  comment_data make_comment_data_for_forth()
+  syntax_definition make_syntax_definition_for_forth()
     {
-    comment_data cd;
-    cd.multiline_begin = "(";
-    cd.multiline_end = ")";
-    cd.single_line = "\\\\";
-    return cd;
+    syntax_definition sd;
+    sd.multiline_comment_begin.push_back(L"(");
+    sd.multiline_comment_end.push_back(L")");
+    sd.single_line_comment.push_back(L"\\\\");
+    return sd;
     }
 
-  std::map<std::string, comment_data> build_comment_data_hardcoded()
+  std::map<std::string, std::shared_ptr<const syntax_lexer>> build_syntax_data_hardcoded()
     {
-    std::map<std::string, comment_data> m;
+    std::map<std::string, std::shared_ptr<const syntax_lexer>> m;
     /*
-    m["c"] = make_comment_data_for_cpp();
-    m["cc"] = make_comment_data_for_cpp();
-    m["cpp"] = make_comment_data_for_cpp();
-    m["h"] = make_comment_data_for_cpp();
-    m["hpp"] = make_comment_data_for_cpp();
+    auto cpp = std::make_shared<const syntax_lexer>(make_syntax_definition_for_cpp());
+    m["c"] = cpp;
+    m["cc"] = cpp;
+    m["cpp"] = cpp;
+    m["h"] = cpp;
+    m["hpp"] = cpp;
 
-    m["scm"] = make_comment_data_for_scheme();
+    m["scm"] = std::make_shared<const syntax_lexer>(make_syntax_definition_for_scheme());
 
-    m["py"] = make_comment_data_for_python_and_cmake();
-    m["cmake"] = make_comment_data_for_python_and_cmake();
+    auto python_and_cmake = std::make_shared<const syntax_lexer>(make_syntax_definition_for_python_and_cmake());
+    m["py"] = python_and_cmake;
+    m["cmake"] = python_and_cmake;
+    m["cmakelists.txt"] = python_and_cmake;
 
-    m["cmakelists.txt"] = make_comment_data_for_python_and_cmake();
+    auto xml = std::make_shared<const syntax_lexer>(make_syntax_definition_for_xml());
+    m["xml"] = xml;
+    m["html"] = xml;
 
-    m["xml"] = make_comment_data_for_xml();
-    m["html"] = make_comment_data_for_xml();
+    auto assembly = std::make_shared<const syntax_lexer>(make_syntax_definition_for_assembly());
+    m["s"] = assembly;
+    m["asm"] = assembly;
 
-    m["s"] = make_comment_data_for_assembly();
-    m["asm"] = make_comment_data_for_assembly();
+    m["4th"] = std::make_shared<const syntax_lexer>(make_syntax_definition_for_forth());
 
-    m["4th"] = make_comment_data_for_forth();
+    m["swift"] = std::make_shared<const syntax_lexer>(make_syntax_definition_for_swift());
 
-    m["swift"] = make_comment_data_for_swift();
-
-    m["m"] = make_comment_data_for_objective_c();
-    m["mm"] = make_comment_data_for_objective_c();
+    auto objective_c = std::make_shared<const syntax_lexer>(make_syntax_definition_for_objective_c());
+    m["m"] = objective_c;
+    m["mm"] = objective_c;
     */
     return m;
     }
@@ -237,7 +248,7 @@ namespace
     }
 
 
-  void read_syntax_from_json(std::map<std::string, comment_data>& m, std::map<std::string, keyword_data>& k, const std::string& filename)
+  void read_syntax_from_json(std::map<std::string, std::shared_ptr<const syntax_lexer>>& m, std::map<std::string, keyword_data>& k, const std::string& filename)
     {
     nlohmann::json j;
     
@@ -253,39 +264,60 @@ namespace
           auto element = *ext_it;
           if (element.is_object())
             {
-            comment_data cd;
+            // delimiters are separated by spaces, several begin delimiters are paired with the end delimiters in the same order
+            syntax_definition sd;
             keyword_data kd;
             for (auto it = element.begin(); it != element.end(); ++it)
               {
               if (it.key() == "multiline_comment_begin")
                 {
                 if (it.value().is_string())
-                  cd.multiline_begin = it.value().get<std::string>();
+                  sd.multiline_comment_begin = break_string(it.value().get<std::string>());
                 }
               if (it.key() == "multiline_comment_end")
                 {
                 if (it.value().is_string())
-                  cd.multiline_end = it.value().get<std::string>();
+                  sd.multiline_comment_end = break_string(it.value().get<std::string>());
                 }
               if (it.key() == "singleline_comment")
                 {
                 if (it.value().is_string())
-                  cd.single_line = it.value().get<std::string>();
+                  sd.single_line_comment = break_string(it.value().get<std::string>());
                 }
               if (it.key() == "multiline_string_begin")
                 {
                 if (it.value().is_string())
-                  cd.multistring_begin = it.value().get<std::string>();
+                  sd.multiline_string_begin = break_string(it.value().get<std::string>());
                 }
               if (it.key() == "multiline_string_end")
                 {
                 if (it.value().is_string())
-                  cd.multistring_end = it.value().get<std::string>();
+                  sd.multiline_string_end = break_string(it.value().get<std::string>());
+                }
+              if (it.key() == "raw_string_prefix")
+                {
+                if (it.value().is_string())
+                  sd.raw_string_prefix = break_string(it.value().get<std::string>());
+                }
+              if (it.key() == "preprocessor")
+                {
+                if (it.value().is_string())
+                  sd.preprocessor = jtk::convert_string_to_wstring(it.value().get<std::string>());
                 }
               if (it.key() == "uses_quotes_for_chars")
                 {
                 if (it.value().is_number_integer())
-                  cd.uses_quotes_for_chars = it.value().get<int>() != 0;
+                  sd.uses_quotes_for_chars = it.value().get<int>() != 0;
+                }
+              if (it.key() == "nested_comments")
+                {
+                if (it.value().is_number_integer())
+                  sd.nested_comments = it.value().get<int>() != 0;
+                }
+              if (it.key() == "numbers")
+                {
+                if (it.value().is_number_integer())
+                  sd.numbers = it.value().get<int>() != 0;
                 }
               if (it.key() == "keywords_1")
                 {
@@ -298,11 +330,12 @@ namespace
                   kd.keywords_2 = break_string(it.value().get<std::string>());
                 }
               }
+            auto lexer = std::make_shared<const syntax_lexer>(sd);
             auto extensions = break_string(ext_it.key());
             for (const auto& we : extensions)
               {
               std::string e = jtk::convert_wstring_to_string(we);
-              m[e] = cd;
+              m[e] = lexer;
               k[e] = kd;
               }
             }
@@ -318,13 +351,14 @@ namespace
 
 syntax_highlighter::syntax_highlighter()
   {
-  extension_to_data = build_comment_data_hardcoded();
+  extension_to_data = build_syntax_data_hardcoded();
   extension_to_keywords = build_keyword_data_hardcoded();
   read_syntax_from_json(extension_to_data, extension_to_keywords, get_file_in_executable_path("jedi_syntax.json"));
   for (auto& kd : extension_to_keywords)
     {
     std::sort(kd.second.keywords_1.begin(), kd.second.keywords_1.end());
     std::sort(kd.second.keywords_2.begin(), kd.second.keywords_2.end());
+    kd.second.matcher = keyword_matcher(kd.second.keywords_1, kd.second.keywords_2);
     }
   }
 
@@ -342,7 +376,7 @@ bool syntax_highlighter::extension_or_filename_has_keywords(const std::string& e
   return extension_to_keywords.find(ext_or_filename) != extension_to_keywords.end();
   }
 
-comment_data syntax_highlighter::get_syntax_highlighter(const std::string& ext_or_filename) const
+std::shared_ptr<const syntax_lexer> syntax_highlighter::get_syntax_highlighter(const std::string& ext_or_filename) const
   {
   assert(extension_or_filename_has_syntax_highlighter(ext_or_filename));
   return extension_to_data.find(ext_or_filename)->second;
@@ -0,0 +1,359 @@
+#include "syntax_lexer.h"
+
+#include <algorithm>
+
+namespace
+  {
+  enum delimiter_kind
+    {
+    dk_comment_begin,
+    dk_comment_end,
+    dk_string_begin,
+    dk_string_end,
+    dk_single_line_comment,
+    dk_quote,
+    dk_raw_quote
+    };
+
+  const uint8_t max_comment_depth = 8; // deeper nested comments are counted as this depth
+
+  uint32_t make_id(delimiter_kind kind, size_t index)
+    {
+    return ((uint32_t)kind << 16) | (uint32_t)index;
+    }
+
+  bool is_identifier_character(wchar_t ch)
+    {
+    return (ch >= L'a' && ch <= L'z') || (ch >= L'A' && ch <= L'Z') || (ch >= L'0' && ch <= L'9') || ch == L'_' || (uint32_t)ch >= 128;
+    }
+
+  bool is_digit(wchar_t ch)
+    {
+    return ch >= L'0' && ch <= L'9';
+    }
+
+  bool starts_with(line::const_iterator it, line::const_iterator it_end, const std::wstring& word)
+    {
+    for (wchar_t ch : word)
+      {
+      if (it == it_end || *it != ch)
+        return false;
+      ++it;
+      }
+    return true;
+    }
+
+  void add_span(token_spans* spans, int64_t col, text_type type)
+    {
+    if (!spans)
+      return;
+    if (spans->back().first == col)
+      {
+      spans->back().second = type;
+      if (spans->size() > 1 && (*spans)[spans->size() - 2].second == type)
+        spans->pop_back();
+      }
+    else if (spans->back().second != type)
+      spans->emplace_back(col, type);
+    }
+  }
+
+delimiter_automaton::delimiter_automaton() : _nr_of_classes(1), _next(2, 0), _id(2, -1)
+  {
+  std::fill(_ascii_class, _ascii_class + 128, 0);
+  }
+
+delimiter_automaton::delimiter_automaton(const std::vector<std::pair<std::wstring, uint32_t>>& delimiters) : _nr_of_classes(1)
+  {
+  std::fill(_ascii_class, _ascii_class + 128, 0);
+  std::vector<wchar_t> characters;
+  for (const auto& delimiter : delimiters)
+    characters.insert(characters.end(), delimiter.first.begin(), delimiter.first.end());
+  std::sort(characters.begin(), characters.end());
+  characters.erase(std::unique(characters.begin(), characters.end()), characters.end());
+  for (wchar_t ch : characters)
+    {
+    if ((uint32_t)ch < 128)
+      _ascii_class[ch] = _nr_of_classes++;
+    else
+      _other_classes.emplace_back(ch, _nr_of_classes++);
+    }
+  _next.assign(2 * _nr_of_classes, 0);
+  _id.assign(2, -1);
+  for (const auto& delimiter : delimiters)
+    {
+    if (delimiter.first.empty())
+      continue;
+    uint32_t state = 1;
+    for (wchar_t ch : delimiter.first)
+      {
+      const size_t index = (size_t)state * _nr_of_classes + _class(ch);
+      if (_next[index] == 0)
+        {
+        _next[index] = (uint32_t)_id.size();
+        _id.push_back(-1);
+        _next.resize(_next.size() + _nr_of_classes, 0);
+        }
+      state = _next[index];
+      }
+    // the first of equal delimiters wins
+    if (_id[state] < 0)
+      _id[state] = delimiter.second;
+    }
+  }
+
+uint32_t delimiter_automaton::_class(wchar_t ch) const
+  {
+  if ((uint32_t)ch < 128)
+    return _ascii_class[ch];
+  auto it = std::lower_bound(_other_classes.begin(), _other_classes.end(), std::pair<wchar_t, uint32_t>(ch, 0));
+  return (it != _other_classes.end() && it->first == ch) ? it->second : 0;
+  }
+
+bool delimiter_automaton::match(uint32_t& id, int64_t& length, line::const_iterator it, line::const_iterator it_end) const
+  {
+  uint32_t state = 1;
+  int64_t current_length = 0;
+  length = 0;
+  for (; it != it_end; ++it)
+    {
+    state = _next[(size_t)state * _nr_of_classes + _class(*it)];
+    if (state == 0)
+      break;
+    ++current_length;
+    if (_id[state] >= 0)
+      {
+      id = (uint32_t)_id[state];
+      length = current_length;
+      }
+    }
+  return length > 0;
+  }
+
+syntax_lexer::syntax_lexer(const syntax_definition& definition) : _definition(definition)
+  {
+  _max_depth = _definition.nested_comments ? max_comment_depth : 1;
+  _nr_of_comments = std::min(_definition.multiline_comment_begin.size(), _definition.multiline_comment_end.size());
+  _nr_of_strings = std::min(_definition.multiline_string_begin.size(), _definition.multiline_string_end.size());
+  // the statuses have to fit in a uint8_t
+  _nr_of_comments = std::min<size_t>(_nr_of_comments, 254 / _max_depth);
+  _nr_of_strings = std::min<size_t>(_nr_of_strings, 254 - _nr_of_comments * _max_depth);
+
+  std::vector<std::pair<std::wstring, uint32_t>> delimiters;
+  for (size_t i = 0; i < _nr_of_comments; ++i)
+    delimiters.emplace_back(_definition.multiline_comment_begin[i], make_id(dk_comment_begin, i));
+  for (size_t i = 0; i < _nr_of_strings; ++i)
+    {
+    delimiters.emplace_back(_definition.multiline_string_begin[i], make_id(dk_string_begin, i));
+    for (const auto& prefix : _definition.raw_string_prefix)
+      delimiters.emplace_back(prefix + _definition.multiline_string_begin[i], make_id(dk_string_begin, i));
+    }
+  for (const auto& single_line : _definition.single_line_comment)
+    delimiters.emplace_back(single_line, make_id(dk_single_line_comment, 0));
+  delimiters.emplace_back(L"\"", make_id(dk_quote, 0));
+  if (_definition.uses_quotes_for_chars)
+    delimiters.emplace_back(L"'", make_id(dk_quote, 1));
+  for (const auto& prefix : _definition.raw_string_prefix)
+    {
+    if (prefix.empty())
+      continue;
+    delimiters.emplace_back(prefix + L"\"", make_id(dk_raw_quote, 0));
+    if (_definition.uses_quotes_for_chars)
+      delimiters.emplace_back(prefix + L"'", make_id(dk_raw_quote, 1));
+    }
+  _normal = delimiter_automaton(delimiters);
+
+  for (size_t i = 0; i < _nr_of_comments; ++i)
+    {
+    delimiters.clear();
+    delimiters.emplace_back(_definition.multiline_comment_end[i], make_id(dk_comment_end, i));
+    if (_definition.nested_comments)
+      delimiters.emplace_back(_definition.multiline_comment_begin[i], make_id(dk_comment_begin, i));
+    _inside.emplace_back(delimiters);
+    }
+  for (size_t i = 0; i < _nr_of_strings; ++i)
+    {
+    delimiters.clear();
+    delimiters.emplace_back(_definition.multiline_string_end[i], make_id(dk_string_end, i));
+    _inside.emplace_back(delimiters);
+    }
+  }
+
+const syntax_definition& syntax_lexer::definition() const
+  {
+  return _definition;
+  }
+
+uint8_t syntax_lexer::number_of_statuses() const
+  {
+  return (uint8_t)(1 + _nr_of_comments * _max_depth + _nr_of_strings);
+  }
+
+uint8_t syntax_lexer::_comment_status(size_t comment, uint8_t depth) const
+  {
+  return (uint8_t)(1 + comment * _max_depth + (depth - 1));
+  }
+
+text_type syntax_lexer::get_text_type(uint8_t status) const
+  {
+  if (status == lexer_normal || status >= number_of_statuses())
+    return tt_normal;
+  return (size_t)status < 1 + _nr_of_comments * _max_depth ? tt_comment : tt_string;
+  }
+
+uint8_t syntax_lexer::lex(const line& ln, uint8_t status, token_spans* spans, const keyword_matcher* keywords) const
+  {
+  if (status >= number_of_statuses())
+    status = lexer_normal;
+  if (spans)
+    {
+    spans->clear();
+    spans->emplace_back((int64_t)0, get_text_type(status));
+    }
+  const bool match_keywords = spans && keywords && !keywords->empty();
+  auto it = ln.begin();
+  const auto it_end = ln.end();
+  int64_t col = 0;
+  int64_t keyword_remaining = 0; // the columns left of the word that was last matched against the keywords
+  text_type keyword = tt_normal;
+  auto advance = [&](int64_t n)
+    {
+    it += n;
+    col += n;
+    keyword_remaining = keyword_remaining > n ? keyword_remaining - n : 0;
+    };
+
+  // the text of a preprocessor row that is not a comment has type tt_preprocessor instead of tt_normal
+  text_type normal_type = tt_normal;
+  if (status == lexer_normal && !_definition.preprocessor.empty())
+    {
+    auto first = it;
+    while (first != it_end && (*first == L' ' || *first == L'\t'))
+      ++first;
+    uint32_t id;
+    int64_t length;
+    if (starts_with(first, it_end, _definition.preprocessor) && !(_normal.match(id, length, first, it_end) && ((id >> 16) == dk_comment_begin || (id >> 16) == dk_single_line_comment) && length >= (int64_t)_definition.preprocessor.size()))
+      normal_type = tt_preprocessor;
+    }
+
+  wchar_t previous = 0;
+  while (it != it_end)
+    {
+    if (status == lexer_normal)
+      {
+      uint32_t id;
+      int64_t length;
+      if (_normal.match(id, length, it, it_end))
+        {
+        const size_t index = id & 0xffff;
+        const delimiter_kind kind = (delimiter_kind)(id >> 16);
+        if (kind == dk_comment_begin)
+          {
+          add_span(spans, col, tt_comment);
+          status = _comment_status(index, 1);
+          advance(length);
+          continue;
+          }
+        if (kind == dk_string_begin)
+          {
+          add_span(spans, col, tt_string);
+          status = (uint8_t)(1 + _nr_of_comments * _max_depth + index);
+          advance(length);
+          continue;
+          }
+        if (kind == dk_single_line_comment)
+          {
+          add_span(spans, col, tt_comment);
+          return lexer_normal;
+          }
+        // a raw string prefix that ends a longer identifier, as the r in bar"", is normal text
+        if (kind == dk_quote || !is_identifier_character(previous))
+          {
+          const wchar_t quote = index == 0 ? L'"' : L'\'';
+          const bool raw = kind == dk_raw_quote;
+          add_span(spans, col, normal_type == tt_preprocessor ? tt_preprocessor : tt_string);
+          advance(length);
+          while (it != it_end)
+            {
+            if (!raw && *it == L'\\')
+              {
+              advance(1);
+              if (it != it_end)
+                advance(1);
+              continue;
+              }
+            const bool closing = *it == quote;
+            advance(1);
+            if (closing)
+              break;
+            }
+          add_span(spans, col, normal_type);
+          previous = quote;
+          continue;
+          }
+        }
+      if (_definition.numbers && normal_type == tt_normal && is_digit(*it) && !is_identifier_character(previous))
+        {
+        const bool hex = *it == L'0' && (it + 1) != it_end && (*(it + 1) == L'x' || *(it + 1) == L'X');
+        add_span(spans, col, tt_number);
+        previous = *it;
+        advance(1);
+        while (it != it_end)
+          {
+          const wchar_t ch = *it;
+          const bool exponent_sign = (ch == L'+' || ch == L'-') && (((previous == L'e' || previous == L'E') && !hex) || previous == L'p' || previous == L'P');
+          const bool separator = ch == L'\'' && (it + 1) != it_end && is_identifier_character(*(it + 1));
+          if (!is_identifier_character(ch) && ch != L'.' && !exponent_sign && !separator)
+            break;
+          previous = ch;
+          advance(1);
+          }
+        add_span(spans, col, tt_normal);
+        continue;
+        }
+      if (match_keywords && normal_type == tt_normal)
+        {
+        if (keyword_remaining == 0)
+          {
+          uint8_t keyword_type;
+          keyword_remaining = keywords->match(keyword_type, it, it_end);
+          keyword = keyword_type == 1 ? tt_keyword_1 : keyword_type == 2 ? tt_keyword_2 : tt_normal;
+          }
+        add_span(spans, col, keyword);
+        }
+      else
+        add_span(spans, col, normal_type);
+      previous = *it;
+      advance(1);
+      }
+    else
+      {
+      const bool inside_comment = (size_t)status < 1 + _nr_of_comments * _max_depth;
+      const size_t automaton = inside_comment ? (size_t)(status - 1) / _max_depth : _nr_of_comments + (size_t)(status - 1) - _nr_of_comments * _max_depth;
+      uint32_t id;
+      int64_t length;
+      if (!_inside[automaton].match(id, length, it, it_end))
+        {
+        advance(1);
+        continue;
+        }
+      advance(length);
+      if ((id >> 16) == dk_comment_begin)
+        {
+        const uint8_t depth = (uint8_t)((status - 1) % _max_depth + 1);
+        if (depth < _max_depth)
+          ++status;
+        continue;
+        }
+      if (inside_comment && (status - 1) % _max_depth != 0)
+        {
+        --status;
+        continue;
+        }
+      status = lexer_normal;
+      add_span(spans, col, normal_type);
+      previous = 0;
+      }
+    }
+  return status;
+  }
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "buffer.h"
+#include "keyword_matcher.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef std::vector<std::pair<int64_t, text_type>> token_spans;
+
+/*
+The lexical elements of a language, as read from jedi_syntax.json. There can be several multiline comments and
+multiline strings, their begin and end delimiters are paired by index.
+*/
+struct syntax_definition
+  {
+  syntax_definition() : uses_quotes_for_chars(false), nested_comments(false), numbers(false) {}
+  std::vector<std::wstring> multiline_comment_begin, multiline_comment_end;
+  std::vector<std::wstring> multiline_string_begin, multiline_string_end;
+  std::vector<std::wstring> single_line_comment;
+  std::vector<std::wstring> raw_string_prefix; // a string with one of these directly before its quote has no escapes, as r"" in python
+  std::wstring preprocessor; // a row that starts with this after white space is a preprocessor row, as #include in c
+  bool uses_quotes_for_chars;
+  bool nested_comments;
+  bool numbers;
+  };
+
+/*
+Finds the longest of a set of delimiters that starts at a position in a row, with one walk over a trie of character classes.
+Most characters start no delimiter, which is known after one table lookup.
+*/
+class delimiter_automaton
+  {
+  public:
+    delimiter_automaton();
+    explicit delimiter_automaton(const std::vector<std::pair<std::wstring, uint32_t>>& delimiters);
+
+    /*
+    Returns true if a delimiter starts at it, and sets id and length to the id and the length of the longest one.
+    */
+    bool match(uint32_t& id, int64_t& length, line::const_iterator it, line::const_iterator it_end) const;
+
+  private:
+    uint32_t _class(wchar_t ch) const;
+
+  private:
+    uint32_t _nr_of_classes; // class 0 holds the characters that occur in no delimiter
+    uint32_t _ascii_class[128];
+    std::vector<std::pair<wchar_t, uint32_t>> _other_classes; // sorted
+    std::vector<uint32_t> _next; // _next[state * _nr_of_classes + class], state 0 matches nothing, state 1 is the start
+    std::vector<int64_t> _id; // the id of the delimiter that ends in each state, or -1
+  };
+
+/*
+A syntax_definition compiled to a delimiter_automaton for each lexer status. The lexer status is the state that is
+carried from the end of a row to the begin of the next row: lexer_normal for normal text, then a status for each
+multiline comment, one per nesting depth if comments nest, and then a status for each multiline string. For a language
+with one multiline comment and one multiline string these are lexer_inside_multiline_comment and
+lexer_inside_multiline_string. One scan over a row gives both its lexer status at the end and the spans to draw.
+*/
+class syntax_lexer
+  {
+  public:
+    explicit syntax_lexer(const syntax_definition& definition);
+
+    const syntax_definition& definition() const;
+
+    uint8_t number_of_statuses() const;
+
+    /*
+    Returns the lexer status at the end of ln, when ln begins with status. If spans is not null, it is filled with the
+    text types of ln from left to right: the text from column (*spans)[i].first up to the next span has type
+    (*spans)[i].second. Words of keywords in normal text are then marked tt_keyword_1 or tt_keyword_2.
+    */
+    uint8_t lex(const line& ln, uint8_t status, token_spans* spans = nullptr, const keyword_matcher* keywords = nullptr) const;
+
+    /*
+    Returns the text type of the text that follows a row that ends in status.
+    */
+    text_type get_text_type(uint8_t status) const;
+
+  private:
+    uint8_t _comment_status(size_t comment, uint8_t depth) const;
+
+  private:
+    syntax_definition _definition;
+    size_t _nr_of_comments, _nr_of_strings;
+    uint8_t _max_depth; // the number of statuses for each multiline comment
+    delimiter_automaton _normal;
+    std::vector<delimiter_automaton> _inside; // the delimiters that matter inside each multiline comment, and then inside each multiline string
+  };
@@ -0,0 +1,1103 @@
+#include "text_regex.h"
+#include "search.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <limits>
+#include <list>
+#include <mutex>
+
+namespace
+  {
+  enum opcode
+    {
+    op_char,
+    op_any,
+    op_class,
+    op_split,
+    op_jump,
+    op_save,
+    op_line_begin,
+    op_line_end,
+    op_word_boundary,
+    op_not_word_boundary,
+    op_match
+    };
+
+  const int32_t no_character = -1; // before the start or after the end of the text
+  const uint32_t no_group = 0xffffffff;
+  const int max_repetitions = 1000;
+  const size_t max_program_size = 1 << 16;
+  const size_t regex_cache_size = 32;
+
+  std::mutex regex_cache_mutex;
+  std::list<std::shared_ptr<const text_regex>> regex_cache; // most recently used first
+
+  typedef std::vector<std::pair<wchar_t, wchar_t>> char_ranges;
+
+  [[noreturn]] void fail(const std::string& message)
+    {
+    throw text_regex_error(message);
+    }
+
+  bool is_word_character(int32_t c)
+    {
+    return (c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z') || (c >= L'0' && c <= L'9') || c == L'_';
+    }
+
+  void normalize(char_ranges& ranges)
+    {
+    std::sort(ranges.begin(), ranges.end());
+    size_t last = 0;
+    for (size_t i = 1; i < ranges.size(); ++i)
+      {
+      if ((uint32_t)ranges[i].first <= (uint32_t)ranges[last].second + 1)
+        {
+        if (ranges[last].second < ranges[i].second)
+          ranges[last].second = ranges[i].second;
+        }
+      else
+        ranges[++last] = ranges[i];
+      }
+    if (!ranges.empty())
+      ranges.resize(last + 1);
+    }
+
+  bool contains(const char_ranges& ranges, wchar_t c)
+    {
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), c, [](wchar_t ch, const std::pair<wchar_t, wchar_t>& r) { return ch < r.first; });
+    return it != ranges.begin() && c <= (it - 1)->second;
+    }
+
+  /*
+  Adds the ranges of \d, \w or \s, or of their negations \D, \W or \S, to ranges.
+  */
+  void add_predefined_class(char_ranges& ranges, wchar_t name)
+    {
+    char_ranges cls;
+    switch (std::towlower(name))
+      {
+      case L'd':
+        cls.emplace_back(L'0', L'9');
+        break;
+      case L'w':
+        cls.emplace_back(L'0', L'9');
+        cls.emplace_back(L'A', L'Z');
+        cls.emplace_back(L'_', L'_');
+        cls.emplace_back(L'a', L'z');
+        break;
+      default:
+        cls.emplace_back(L'\t', L'\r');
+        cls.emplace_back(L' ', L' ');
+        break;
+      }
+    if (std::iswlower(name))
+      {
+      ranges.insert(ranges.end(), cls.begin(), cls.end());
+      return;
+      }
+    wchar_t first = 0;
+    for (const auto& r : cls)
+      {
+      if (first < r.first)
+        ranges.emplace_back(first, (wchar_t)(r.first - 1));
+      first = (wchar_t)(r.second + 1);
+      }
+    ranges.emplace_back(first, std::numeric_limits<wchar_t>::max());
+    }
+
+  struct node
+    {
+    enum node_type
+      {
+      n_empty,
+      n_char,
+      n_any,
+      n_class,
+      n_assertion,
+      n_group,
+      n_concatenation,
+      n_alternation,
+      n_repetition
+      };
+    node_type type;
+    wchar_t ch;
+    uint32_t value; // class index, assertion opcode or group number
+    int min, max; // max < 0 if the repetition is unbounded
+    bool greedy;
+    std::vector<size_t> children;
+    };
+
+  /*
+  Recursive descent parser that turns a pattern into a tree of nodes.
+  */
+  class regex_parser
+    {
+    public:
+      regex_parser(const std::wstring& pattern, std::vector<regex_char_class>& classes) : _pattern(pattern), _classes(classes), _i(0), _nr_of_groups(0)
+        {
+        }
+
+      size_t parse()
+        {
+        const size_t root = _parse_alternation();
+        if (_i < _pattern.size())
+          fail("unmatched )");
+        return root;
+        }
+
+      const std::vector<node>& nodes() const
+        {
+        return _nodes;
+        }
+
+      uint32_t nr_of_groups() const
+        {
+        return _nr_of_groups;
+        }
+
+    private:
+      size_t _add(node::node_type type, std::vector<size_t> children = std::vector<size_t>())
+        {
+        node n;
+        n.type = type;
+        n.ch = 0;
+        n.value = 0;
+        n.min = n.max = 0;
+        n.greedy = true;
+        n.children.swap(children);
+        _nodes.push_back(n);
+        return _nodes.size() - 1;
+        }
+
+      size_t _add_char(wchar_t ch)
+        {
+        const size_t n = _add(node::n_char);
+        _nodes[n].ch = ch;
+        return n;
+        }
+
+      size_t _add_value(node::node_type type, uint32_t value, std::vector<size_t> children = std::vector<size_t>())
+        {
+        const size_t n = _add(type, children);
+        _nodes[n].value = value;
+        return n;
+        }
+
+      bool _at(wchar_t c) const
+        {
+        return _i < _pattern.size() && _pattern[_i] == c;
+        }
+
+      size_t _parse_alternation()
+        {
+        std::vector<size_t> alternatives(1, _parse_concatenation());
+        while (_at(L'|'))
+          {
+          ++_i;
+          alternatives.push_back(_parse_concatenation());
+          }
+        if (alternatives.size() == 1)
+          return alternatives.front();
+        return _add(node::n_alternation, alternatives);
+        }
+
+      size_t _parse_concatenation()
+        {
+        std::vector<size_t> items;
+        while (_i < _pattern.size() && !_at(L'|') && !_at(L')'))
+          items.push_back(_parse_repetition());
+        if (items.empty())
+          return _add(node::n_empty);
+        if (items.size() == 1)
+          return items.front();
+        return _add(node::n_concatenation, items);
+        }
+
+      /*
+      Parses {n}, {n,} or {n,m}. Returns false, and leaves the position unchanged, if the text at the position is not
+      such a bound, so that a { that does not start a bound is a literal.
+      */
+      bool _parse_bounds(int& min, int& max)
+        {
+        size_t j = _i + 1;
+        auto read_number = [&](int& value)
+          {
+          const size_t start = j;
+          value = 0;
+          while (j < _pattern.size() && _pattern[j] >= L'0' && _pattern[j] <= L'9')
+            {
+            if (value <= max_repetitions)
+              value = value * 10 + (_pattern[j] - L'0');
+            ++j;
+            }
+          return j > start;
+          };
+        if (!read_number(min))
+          return false;
+        max = min;
+        if (j < _pattern.size() && _pattern[j] == L',')
+          {
+          ++j;
+          if (!read_number(max))
+            max = -1;
+          }
+        if (j >= _pattern.size() || _pattern[j] != L'}')
+          return false;
+        _i = j + 1;
+        return true;
+        }
+
+      size_t _parse_repetition()
+        {
+        size_t atom = _parse_atom();
+        for (;;)
+          {
+          int min, max;
+          if (_at(L'*'))
+            {
+            min = 0;
+            max = -1;
+            ++_i;
+            }
+          else if (_at(L'+'))
+            {
+            min = 1;
+            max = -1;
+            ++_i;
+            }
+          else if (_at(L'?'))
+            {
+            min = 0;
+            max = 1;
+            ++_i;
+            }
+          else if (!_at(L'{') || !_parse_bounds(min, max))
+            return atom;
+          if (_nodes[atom].type == node::n_assertion)
+            fail("nothing to repeat");
+          if (min > max_repetitions || max > max_repetitions)
+            fail("too many repetitions");
+          if (max >= 0 && max < min)
+            fail("numbers out of order in {} quantifier");
+          bool greedy = true;
+          if (_at(L'?'))
+            {
+            greedy = false;
+            ++_i;
+            }
+          atom = _add(node::n_repetition, std::vector<size_t>(1, atom));
+          _nodes[atom].min = min;
+          _nodes[atom].max = max;
+          _nodes[atom].greedy = greedy;
+          }
+        }
+
+      wchar_t _parse_hex_digits(size_t count)
+        {
+        uint32_t value = 0;
+        for (size_t k = 0; k < count; ++k, ++_i)
+          {
+          if (_i >= _pattern.size() || !std::iswxdigit(_pattern[_i]))
+            fail("invalid escape sequence");
+          const wchar_t c = _pattern[_i];
+          value = value * 16 + (uint32_t)(c <= L'9' ? c - L'0' : (std::towlower(c) - L'a' + 10));
+          }
+        return (wchar_t)value;
+        }
+
+      wchar_t _parse_character_escape(wchar_t c)
+        {
+        switch (c)
+          {
+          case L'n': return L'\n';
+          case L't': return L'\t';
+          case L'r': return L'\r';
+          case L'f': return L'\f';
+          case L'v': return L'\v';
+          case L'0': return 0;
+          case L'x': return _parse_hex_digits(2);
+          case L'u': return _parse_hex_digits(4);
+          default: return c;
+          }
+        }
+
+      size_t _add_class(const regex_char_class& cls)
+        {
+        _classes.push_back(cls);
+        return _add_value(node::n_class, (uint32_t)(_classes.size() - 1));
+        }
+
+      size_t _parse_escape()
+        {
+        if (_i >= _pattern.size())
+          fail("trailing backslash");
+        const wchar_t c = _pattern[_i++];
+        switch (c)
+          {
+          case L'd': case L'D': case L'w': case L'W': case L's': case L'S':
+            {
+            regex_char_class cls;
+            cls.negated = false;
+            add_predefined_class(cls.ranges, c);
+            normalize(cls.ranges);
+            return _add_class(cls);
+            }
+          case L'b': return _add_value(node::n_assertion, op_word_boundary);
+          case L'B': return _add_value(node::n_assertion, op_not_word_boundary);
+          default:
+            if (c >= L'1' && c <= L'9')
+              fail("back references are not supported");
+            return _add_char(_parse_character_escape(c));
+          }
+        }
+
+      /*
+      Parses a character of a class in ch and returns true, or adds a predefined class to ranges and returns false.
+      */
+      bool _parse_class_atom(char_ranges& ranges, wchar_t& ch)
+        {
+        ch = _pattern[_i++];
+        if (ch != L'\\')
+          return true;
+        if (_i >= _pattern.size())
+          fail("unmatched [");
+        const wchar_t c = _pattern[_i++];
+        switch (c)
+          {
+          case L'd': case L'D': case L'w': case L'W': case L's': case L'S':
+            add_predefined_class(ranges, c);
+            return false;
+          case L'b':
+            ch = L'\b';
+            return true;
+          default:
+            ch = _parse_character_escape(c);
+            return true;
+          }
+        }
+
+      size_t _parse_class()
+        {
+        regex_char_class cls;
+        cls.negated = false;
+        if (_at(L'^'))
+          {
+          cls.negated = true;
+          ++_i;
+          }
+        bool first = true; // a ] right after [ or [^ is a literal
+        for (;;)
+          {
+          if (_i >= _pattern.size())
+            fail("unmatched [");
+          if (_at(L']') && !first)
+            {
+            ++_i;
+            break;
+            }
+          first = false;
+          wchar_t low, high;
+          if (!_parse_class_atom(cls.ranges, low))
+            continue;
+          high = low;
+          if (_i + 1 < _pattern.size() && _pattern[_i] == L'-' && _pattern[_i + 1] != L']')
+            {
+            ++_i;
+            if (!_parse_class_atom(cls.ranges, high) || high < low)
+              fail("invalid range in []");
+            }
+          cls.ranges.emplace_back(low, high);
+          }
+        normalize(cls.ranges);
+        return _add_class(cls);
+        }
+
+      size_t _parse_atom()
+        {
+        const wchar_t c = _pattern[_i++];
+        switch (c)
+          {
+          case L'(':
+            {
+            uint32_t group = no_group;
+            if (_pattern.compare(_i, 2, L"?:") == 0)
+              _i += 2;
+            else if (_at(L'?'))
+              fail("lookaround is not supported");
+            else
+              group = ++_nr_of_groups;
+            const size_t child = _parse_alternation();
+            if (!_at(L')'))
+              fail("unmatched (");
+            ++_i;
+            return _add_value(node::n_group, group, std::vector<size_t>(1, child));
+            }
+          case L'*': case L'+': case L'?': fail("nothing to repeat");
+          case L'[': return _parse_class();
+          case L'.': return _add(node::n_any);
+          case L'^': return _add_value(node::n_assertion, op_line_begin);
+          case L'$': return _add_value(node::n_assertion, op_line_end);
+          case L'\\': return _parse_escape();
+          default: return _add_char(c);
+          }
+        }
+
+    private:
+      const std::wstring& _pattern;
+      std::vector<regex_char_class>& _classes;
+      std::vector<node> _nodes;
+      size_t _i;
+      uint32_t _nr_of_groups;
+    };
+
+  /*
+  Translates the tree of nodes to the instructions of the automaton, as in Thompson's construction.
+  */
+  class regex_compiler
+    {
+    public:
+      regex_compiler(const std::vector<node>& nodes, std::vector<regex_instruction>& program, bool case_sensitive) : _nodes(nodes), _program(program), _case_sensitive(case_sensitive)
+        {
+        }
+
+      void compile(size_t root)
+        {
+        _program.clear();
+        _add(op_save, 0);
+        _emit(root);
+        _add(op_save, 1);
+        _add(op_match);
+        }
+
+    private:
+      size_t _add(uint32_t op, uint32_t x = 0, uint32_t y = 0, wchar_t ch = 0)
+        {
+        if (_program.size() >= max_program_size)
+          fail("regular expression is too large");
+        regex_instruction ins;
+        ins.op = op;
+        ins.ch = ch;
+        ins.x = x;
+        ins.y = y;
+        _program.push_back(ins);
+        return _program.size() - 1;
+        }
+
+      void _set_split(size_t split, uint32_t body, uint32_t out, bool greedy)
+        {
+        _program[split].x = greedy ? body : out;
+        _program[split].y = greedy ? out : body;
+        }
+
+      void _emit(size_t n)
+        {
+        const node& nd = _nodes[n];
+        switch (nd.type)
+          {
+          case node::n_empty:
+            break;
+          case node::n_char:
+            _add(op_char, 0, 0, _case_sensitive ? nd.ch : fold_case(nd.ch));
+            break;
+          case node::n_any:
+            _add(op_any);
+            break;
+          case node::n_class:
+            _add(op_class, nd.value);
+            break;
+          case node::n_assertion:
+            _add(nd.value);
+            break;
+          case node::n_group:
+            if (nd.value == no_group)
+              {
+              _emit(nd.children.front());
+              break;
+              }
+            _add(op_save, 2 * nd.value);
+            _emit(nd.children.front());
+            _add(op_save, 2 * nd.value + 1);
+            break;
+          case node::n_concatenation:
+            for (size_t child : nd.children)
+              _emit(child);
+            break;
+          case node::n_alternation:
+            {
+            std::vector<size_t> jumps;
+            for (size_t i = 0; i + 1 < nd.children.size(); ++i)
+              {
+              const size_t split = _add(op_split);
+              _emit(nd.children[i]);
+              jumps.push_back(_add(op_jump));
+              _set_split(split, (uint32_t)split + 1, (uint32_t)_program.size(), true);
+              }
+            _emit(nd.children.back());
+            for (size_t jump : jumps)
+              _program[jump].x = (uint32_t)_program.size();
+            break;
+            }
+          case node::n_repetition:
+            {
+            for (int i = 0; i < nd.min; ++i)
+              _emit(nd.children.front());
+            if (nd.max < 0)
+              {
+              const size_t split = _add(op_split);
+              _emit(nd.children.front());
+              _add(op_jump, (uint32_t)split);
+              _set_split(split, (uint32_t)split + 1, (uint32_t)_program.size(), nd.greedy);
+              break;
+              }
+            std::vector<size_t> splits;
+            for (int i = nd.min; i < nd.max; ++i)
+              {
+              splits.push_back(_add(op_split));
+              _emit(nd.children.front());
+              }
+            for (size_t split : splits)
+              _set_split(split, (uint32_t)split + 1, (uint32_t)_program.size(), nd.greedy);
+            break;
+            }
+          }
+        }
+
+    private:
+      const std::vector<node>& _nodes;
+      std::vector<regex_instruction>& _program;
+      bool _case_sensitive;
+    };
+
+  /*
+  Appends the literal text that every match of node n starts with to prefix. Returns true if all of n is literal text,
+  so that the prefix can continue with what follows n.
+  */
+  bool get_prefix(std::wstring& prefix, const std::vector<node>& nodes, size_t n)
+    {
+    const node& nd = nodes[n];
+    switch (nd.type)
+      {
+      case node::n_empty:
+      case node::n_assertion: // does not consume a character
+        return true;
+      case node::n_char:
+        if (nd.ch == L'\n') // the prefix is searched for within one row
+          return false;
+        prefix.push_back(nd.ch);
+        return true;
+      case node::n_group:
+        return get_prefix(prefix, nodes, nd.children.front());
+      case node::n_concatenation:
+        for (size_t child : nd.children)
+          {
+          if (!get_prefix(prefix, nodes, child))
+            return false;
+          }
+        return true;
+      case node::n_repetition:
+        if (nd.min > 0)
+          get_prefix(prefix, nodes, nd.children.front());
+        return false;
+      default:
+        return false;
+      }
+    }
+
+  /*
+  Collects the instructions that can consume the first character of a match. Returns false if a match can be empty or
+  can start with any character, in which case the first character of a match cannot be used to skip text.
+  */
+  bool get_first_instructions(std::vector<uint32_t>& first, std::vector<bool>& visited, const std::vector<regex_instruction>& program, uint32_t pc)
+    {
+    if (visited[pc])
+      return true;
+    visited[pc] = true;
+    const regex_instruction& ins = program[pc];
+    switch (ins.op)
+      {
+      case op_jump:
+        return get_first_instructions(first, visited, program, ins.x);
+      case op_split:
+        return get_first_instructions(first, visited, program, ins.x) && get_first_instructions(first, visited, program, ins.y);
+      case op_char:
+      case op_class:
+        first.push_back(pc);
+        return true;
+      case op_any:
+      case op_match:
+        return false;
+      default: // saves and assertions do not consume a character
+        return get_first_instructions(first, visited, program, pc + 1);
+      }
+    }
+
+  struct thread_list
+    {
+    std::vector<uint32_t> pcs; // in order of priority
+    std::vector<position> slots; // the group slots of each thread, one after the other
+    std::vector<uint64_t> marks; // the generation in which a pc was added, so that every pc is added once per step
+    uint64_t generation;
+
+    explicit thread_list(size_t program_size) : marks(program_size, 0), generation(1)
+      {
+      }
+
+    void clear()
+      {
+      pcs.clear();
+      slots.clear();
+      ++generation;
+      }
+    };
+
+  struct step_context
+    {
+    position pos;
+    int32_t previous, current; // the characters before and at pos
+    };
+
+  /*
+  Adds the thread at pc to the list, after following the jumps, splits, saves and assertions that do not consume a character.
+  */
+  void add_thread(thread_list& threads, const std::vector<regex_instruction>& program, uint32_t pc, std::vector<position>& slots, const step_context& ctx)
+    {
+    if (threads.marks[pc] == threads.generation)
+      return;
+    threads.marks[pc] = threads.generation;
+    const regex_instruction& ins = program[pc];
+    switch (ins.op)
+      {
+      case op_jump:
+        add_thread(threads, program, ins.x, slots, ctx);
+        break;
+      case op_split:
+        add_thread(threads, program, ins.x, slots, ctx);
+        add_thread(threads, program, ins.y, slots, ctx);
+        break;
+      case op_save:
+        {
+        const position old = slots[ins.x];
+        slots[ins.x] = ctx.pos;
+        add_thread(threads, program, pc + 1, slots, ctx);
+        slots[ins.x] = old;
+        break;
+        }
+      case op_line_begin:
+        if (ctx.pos.col == 0)
+          add_thread(threads, program, pc + 1, slots, ctx);
+        break;
+      case op_line_end:
+        if (ctx.current == L'\n' || ctx.current == no_character)
+          add_thread(threads, program, pc + 1, slots, ctx);
+        break;
+      case op_word_boundary:
+        if (is_word_character(ctx.previous) != is_word_character(ctx.current))
+          add_thread(threads, program, pc + 1, slots, ctx);
+        break;
+      case op_not_word_boundary:
+        if (is_word_character(ctx.previous) == is_word_character(ctx.current))
+          add_thread(threads, program, pc + 1, slots, ctx);
+        break;
+      default:
+        threads.pcs.push_back(pc);
+        threads.slots.insert(threads.slots.end(), slots.begin(), slots.end());
+        break;
+      }
+    }
+
+  /*
+  Gives the automaton the rows of a text. Rows are copied to a buffer once, the automaton looks one character ahead,
+  which can be in the next row, so the two most recently used rows are kept.
+  */
+  class text_input
+    {
+    public:
+      explicit text_input(text txt) : _txt(txt), _least_recent(0)
+        {
+        _rows[0] = _rows[1] = -1;
+        }
+
+      int64_t nr_of_rows() const
+        {
+        return (int64_t)_txt.size();
+        }
+
+      int64_t row_size(int64_t row) const
+        {
+        return (int64_t)_txt[row].size();
+        }
+
+      const std::wstring& get_row(int64_t row)
+        {
+        if (_rows[0] == row)
+          {
+          _least_recent = 1;
+          return _buffers[0];
+          }
+        if (_rows[1] == row)
+          {
+          _least_recent = 0;
+          return _buffers[1];
+          }
+        const int i = _least_recent;
+        _least_recent = 1 - i;
+        _rows[i] = row;
+        _buffers[i].assign(_txt[row].begin(), _txt[row].end());
+        return _buffers[i];
+        }
+
+    private:
+      text _txt;
+      int64_t _rows[2];
+      std::wstring _buffers[2];
+      int _least_recent;
+    };
+
+  class string_input
+    {
+    public:
+      explicit string_input(const std::wstring& str) : _str(str)
+        {
+        }
+
+      int64_t nr_of_rows() const
+        {
+        return 1;
+        }
+
+      int64_t row_size(int64_t) const
+        {
+        return (int64_t)_str.size();
+        }
+
+      const std::wstring& get_row(int64_t)
+        {
+        return _str;
+        }
+
+    private:
+      const std::wstring& _str;
+    };
+
+  /*
+  Moves a position at the end of a row that is not the last row to the start of the next row.
+  */
+  template <class TInput>
+  position normalize(TInput& input, position pos)
+    {
+    while (pos.row + 1 < input.nr_of_rows() && pos.col >= input.row_size(pos.row))
+      {
+      ++pos.row;
+      pos.col = 0;
+      }
+    return pos;
+    }
+
+  template <class TInput>
+  step_context get_step_context(TInput& input, position pos)
+    {
+    step_context ctx;
+    ctx.pos = pos;
+    const std::wstring& row = input.get_row(pos.row);
+    ctx.current = pos.col < (int64_t)row.size() ? (int32_t)row[pos.col] : no_character;
+    ctx.previous = pos.col > 0 ? (int32_t)row[pos.col - 1] : (pos.row > 0 ? (int32_t)L'\n' : no_character);
+    return ctx;
+    }
+  }
+
+text_regex::text_regex(const std::wstring& pattern, bool case_sensitive) : _pattern(pattern), _case_sensitive(case_sensitive), _nr_of_groups(0), _literal(false), _can_match_newline(false)
+  {
+  regex_parser parser(_pattern, _classes);
+  const size_t root = parser.parse();
+  _nr_of_groups = parser.nr_of_groups();
+  regex_compiler compiler(parser.nodes(), _program, _case_sensitive);
+  compiler.compile(root);
+  if (_case_sensitive)
+    get_prefix(_prefix, parser.nodes(), root);
+  for (const auto& ins : _program)
+    {
+    if (ins.op == op_char || ins.op == op_class)
+      _can_match_newline = _can_match_newline || _matches(ins, L'\n');
+    }
+  std::vector<bool> visited(_program.size(), false);
+  if (!get_first_instructions(_first, visited, _program, 0))
+    _first.clear();
+  // the program of a literal is save 0, its characters, save 1 and match
+  _literal = !_prefix.empty() && _nr_of_groups == 0 && _program.size() == _prefix.size() + 3;
+  for (size_t i = 0; _literal && i < _prefix.size(); ++i)
+    _literal = _program[i + 1].op == op_char && _program[i + 1].ch == _prefix[i];
+  }
+
+const std::wstring& text_regex::pattern() const
+  {
+  return _pattern;
+  }
+
+bool text_regex::case_sensitive() const
+  {
+  return _case_sensitive;
+  }
+
+bool text_regex::can_match_newline() const
+  {
+  return _can_match_newline;
+  }
+
+bool text_regex::_matches(const regex_instruction& ins, wchar_t c) const
+  {
+  switch (ins.op)
+    {
+    case op_char:
+      return (_case_sensitive ? c : fold_case(c)) == ins.ch;
+    case op_any:
+      return c != L'\n';
+    case op_class:
+      {
+      const regex_char_class& cls = _classes[ins.x];
+      bool in = contains(cls.ranges, c);
+      if (!in && !_case_sensitive)
+        in = contains(cls.ranges, fold_case(c)) || contains(cls.ranges, (wchar_t)std::towupper(c));
+      if (cls.negated)
+        return !in && c != L'\n';
+      return in;
+      }
+    default:
+      return false;
+    }
+  }
+
+bool text_regex::_can_start_with(wchar_t c) const
+  {
+  for (uint32_t pc : _first)
+    {
+    if (_matches(_program[pc], c))
+      return true;
+    }
+  return false;
+  }
+
+struct text_regex::run_state
+  {
+  run_state(size_t program_size, size_t nr_of_slots) : current(program_size), next(program_size), scratch(nr_of_slots), slots(nr_of_slots)
+    {
+    }
+
+  thread_list current, next;
+  std::vector<position> scratch;
+  std::vector<position> slots;
+  };
+
+template <class TInput>
+bool text_regex::_run(run_state& state, TInput& input, position first, position last, int64_t last_begin_row, bool whole) const
+  {
+  std::vector<position>& slots = state.slots;
+  const size_t nr_of_slots = slots.size();
+  first = normalize(input, first);
+  last = normalize(input, last);
+  if (last < first)
+    return false;
+  thread_list& current = state.current;
+  thread_list& next = state.next;
+  std::vector<position>& scratch = state.scratch;
+  current.clear();
+  bool matched = false;
+  position pos = first;
+  step_context ctx = get_step_context(input, pos);
+  for (;;)
+    {
+    if (!matched && pos.row <= last_begin_row && (!whole || pos == first))
+      {
+      if (current.pcs.empty() && !whole && (!_prefix.empty() || !_first.empty()))
+        {
+        // no thread is running, so a match can only start at the next occurrence of the prefix, or else at a character
+        // that one of the first instructions accepts
+        for (;;)
+          {
+          const std::wstring& row = input.get_row(pos.row);
+          const int64_t end = pos.row == last.row ? last.col : (int64_t)row.size();
+          int64_t col = pos.col;
+          if (!_prefix.empty())
+            col = col < end ? (int64_t)(search_forward(row.data() + col, row.data() + end, _prefix.data(), _prefix.size()) - row.data()) : end;
+          else
+            {
+            while (col < end && !_can_start_with(row[col]))
+              ++col;
+            }
+          if (col < end)
+            {
+            pos.col = col;
+            break;
+            }
+          if (pos.row >= last.row || pos.row >= last_begin_row)
+            return false;
+          pos = position(pos.row + 1, 0);
+          }
+        if (_literal)
+          {
+          slots[0] = pos;
+          slots[1] = normalize(input, position(pos.row, pos.col + (int64_t)_prefix.size()));
+          return true;
+          }
+        ctx = get_step_context(input, pos);
+        }
+      std::fill(scratch.begin(), scratch.end(), position(-1, -1));
+      add_thread(current, _program, 0, scratch, ctx);
+      }
+    else if (current.pcs.empty())
+      break;
+    const bool can_advance = pos < last && ctx.current != no_character;
+    position next_pos = pos;
+    step_context next_ctx = ctx;
+    if (can_advance)
+      {
+      next_pos = pos.col + 1 < (int64_t)input.get_row(pos.row).size() ? position(pos.row, pos.col + 1) : normalize(input, position(pos.row, pos.col + 1));
+      next_ctx = get_step_context(input, next_pos);
+      }
+    next.clear();
+    for (size_t t = 0; t < current.pcs.size(); ++t)
+      {
+      const regex_instruction& ins = _program[current.pcs[t]];
+      if (ins.op == op_match)
+        {
+        if (whole && pos != last)
+          continue;
+        std::copy(current.slots.begin() + t * nr_of_slots, current.slots.begin() + (t + 1) * nr_of_slots, slots.begin());
+        matched = true;
+        break; // the remaining threads have a lower priority
+        }
+      if (can_advance && _matches(ins, (wchar_t)ctx.current))
+        {
+        std::copy(current.slots.begin() + t * nr_of_slots, current.slots.begin() + (t + 1) * nr_of_slots, scratch.begin());
+        add_thread(next, _program, current.pcs[t] + 1, scratch, next_ctx);
+        }
+      }
+    std::swap(current, next);
+    if (!can_advance)
+      break;
+    pos = next_pos;
+    ctx = next_ctx;
+    }
+  return matched;
+  }
+
+namespace
+  {
+  void fill_match(regex_match& m, const std::vector<position>& slots)
+    {
+    m.begin = slots[0];
+    m.end = slots[1];
+    m.groups.clear();
+    for (size_t i = 0; i + 1 < slots.size(); i += 2)
+      {
+      if (slots[i].row < 0 || slots[i + 1].row < 0)
+        m.groups.emplace_back(position(-1, -1), position(-1, -1));
+      else
+        m.groups.emplace_back(slots[i], slots[i + 1]);
+      }
+    }
+  }
+
+bool text_regex::search(regex_match& m, text txt, position first, position last) const
+  {
+  if (txt.empty())
+    return false;
+  const position end = get_end_position(txt);
+  if (end < last)
+    last = end;
+  if (last < first)
+    return false;
+  text_input input(txt);
+  run_state state(_program.size(), 2 * (_nr_of_groups + 1));
+  if (!_run(state, input, first, last, last.row, false))
+    return false;
+  fill_match(m, state.slots);
+  return true;
+  }
+
+void text_regex::search_all(text txt, position first, position last, const std::function<bool(const regex_match&)>& found) const
+  {
+  if (txt.empty())
+    return;
+  const position end = get_end_position(txt);
+  if (end < last)
+    last = end;
+  text_input input(txt);
+  run_state state(_program.size(), 2 * (_nr_of_groups + 1));
+  regex_match m;
+  while (!(last < first) && _run(state, input, first, last, last.row, false))
+    {
+    fill_match(m, state.slots);
+    if (!found(m))
+      return;
+    // an empty match is not found again, the next match starts at least one character further
+    first = m.begin == m.end ? normalize(input, position(m.end.row, m.end.col + 1)) : m.end;
+    }
+  }
+
+bool text_regex::search_backward(regex_match& m, text txt, position first, position last) const
+  {
+  if (txt.empty())
+    return false;
+  const position end = get_end_position(txt);
+  if (end < last)
+    last = end;
+  if (last < first)
+    return false;
+  text_input input(txt);
+  run_state state(_program.size(), 2 * (_nr_of_groups + 1));
+  for (int64_t row = last.row; row >= first.row; --row)
+    {
+    position pos = row == first.row ? first : position(row, 0);
+    bool found = false;
+    while (_run(state, input, pos, last, row, false))
+      {
+      found = true;
+      fill_match(m, state.slots);
+      if (m.end == m.begin)
+        pos = normalize(input, position(m.begin.row, m.begin.col + 1));
+      else
+        pos = m.end;
+      if (last < pos || pos.row > row)
+        break;
+      }
+    if (found)
+      return true;
+    }
+  return false;
+  }
+
+bool text_regex::match(const std::wstring& str) const
+  {
+  string_input input(str);
+  run_state state(_program.size(), 2 * (_nr_of_groups + 1));
+  return _run(state, input, position(0, 0), position(0, (int64_t)str.size()), 0, true);
+  }
+
+std::shared_ptr<const text_regex> get_regex(const std::wstring& pattern, bool case_sensitive)
+  {
+    {
+    std::scoped_lock lock(regex_cache_mutex);
+    for (auto it = regex_cache.begin(); it != regex_cache.end(); ++it)
+      {
+      if ((*it)->case_sensitive() == case_sensitive && (*it)->pattern() == pattern)
+        {
+        regex_cache.splice(regex_cache.begin(), regex_cache, it);
+        return regex_cache.front();
+        }
+      }
+    }
+  auto rx = std::make_shared<const text_regex>(pattern, case_sensitive); // compiled outside the lock, throws for invalid patterns
+  std::scoped_lock lock(regex_cache_mutex);
+  regex_cache.push_front(rx);
+  if (regex_cache.size() > regex_cache_size)
+    regex_cache.pop_back();
+  return rx;
+  }
+
+position get_end_position(text txt)
+  {
+  if (txt.empty())
+    return position(0, 0);
+  return position((int64_t)txt.size() - 1, (int64_t)txt.back().size());
+  }
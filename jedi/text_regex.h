@@ -0,0 +1,118 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+Thrown by text_regex for patterns that are not valid regular expressions.
+*/
+class text_regex_error : public std::runtime_error
+  {
+  public:
+    explicit text_regex_error(const std::string& message) : std::runtime_error(message) {}
+  };
+
+struct regex_instruction
+  {
+  uint32_t op;
+  wchar_t ch;
+  uint32_t x, y; // jump targets, class index or group slot, depending on op
+  };
+
+struct regex_char_class
+  {
+  std::vector<std::pair<wchar_t, wchar_t>> ranges; // sorted and disjoint
+  bool negated;
+  };
+
+struct regex_match
+  {
+  position begin, end; // the match is [begin, end)
+  std::vector<std::pair<position, position>> groups; // groups[0] is the match, groups that did not take part are (-1, -1)
+  };
+
+/*
+A regular expression that is compiled once to a Thompson automaton, and that is simulated over the rows of a text
+directly, without converting the text to a utf8 string first (Pike's algorithm). The running time is linear in the length of the searched text,
+whatever the pattern. Matches can span rows, as in sam: a newline is matched by \n, \s or a class that contains it.
+The syntax is the ECMAScript subset that is useful for editing: literals, ., [] classes with ranges, \d \w \s and their
+negations, ^ $ \b \B, groups, (?:) groups, | and the greedy and lazy quantifiers * + ? {n} {n,} {n,m}.
+. and negated classes do not match a newline, ^ matches at the start of a row, $ before a newline or at the end.
+Back references and lookaround are not supported, they cannot be simulated by an automaton.
+*/
+class text_regex
+  {
+  public:
+    text_regex(const std::wstring& pattern, bool case_sensitive);
+
+    const std::wstring& pattern() const;
+
+    bool case_sensitive() const;
+
+    /*
+    Returns true if a match can contain a newline, so that a match that starts in a row can end in a later row.
+    */
+    bool can_match_newline() const;
+
+    /*
+    Finds the leftmost match that starts at or after first and ends at or before last. If several matches start at the
+    same position, the one that a backtracking engine would find first is taken.
+    */
+    bool search(regex_match& m, text txt, position first, position last) const;
+
+    /*
+    Finds the last match that starts at or after first and ends at or before last, when the text is matched from left to
+    right without overlap starting from the row that contains the match.
+    */
+    bool search_backward(regex_match& m, text txt, position first, position last) const;
+
+    /*
+    Calls found for each match that lies in [first, last), from left to right and without overlap, as repeated calls of
+    search would find them, until found returns false. The row buffers and the automaton are set up only once, which
+    matters when there are many matches.
+    */
+    void search_all(text txt, position first, position last, const std::function<bool(const regex_match&)>& found) const;
+
+    /*
+    Returns true if the regular expression matches the whole of str.
+    */
+    bool match(const std::wstring& str) const;
+
+  private:
+    struct run_state; // the thread lists of the automaton and the group slots, reused between runs
+
+    template <class TInput>
+    bool _run(run_state& state, TInput& input, position first, position last, int64_t last_begin_row, bool whole) const;
+
+    bool _matches(const regex_instruction& ins, wchar_t c) const;
+
+    bool _can_start_with(wchar_t c) const;
+
+  private:
+    std::wstring _pattern;
+    bool _case_sensitive;
+    std::vector<regex_instruction> _program;
+    std::vector<regex_char_class> _classes;
+    uint32_t _nr_of_groups;
+    std::wstring _prefix; // literal text that every match starts with, only for case sensitive expressions
+    bool _literal; // every match is _prefix, so that the automaton does not have to run
+    std::vector<uint32_t> _first; // the instructions that can consume the first character of a match, empty if any character can
+    bool _can_match_newline;
+  };
+
+/*
+Returns the compiled regular expression for pattern. The most recently used expressions are kept in a cache, so that
+commands that are repeated, or that run on every row, do not compile their pattern again. Thread safe.
+Throws text_regex_error if pattern is not a valid regular expression.
+*/
+std::shared_ptr<const text_regex> get_regex(const std::wstring& pattern, bool case_sensitive = true);
+
+/*
+Returns the end of txt, the position after its last character.
+*/
+position get_end_position(text txt);
@@ -0,0 +1,122 @@
+#include "token_span_cache.h"
+
+#include <algorithm>
+
+namespace
+  {
+  bool same_syntax(const syntax_settings& a, const syntax_settings& b)
+    {
+    return a.should_highlight == b.should_highlight && a.lexer == b.lexer;
+    }
+  }
+
+void get_token_spans(token_spans& spans, const file_buffer& fb, int64_t row, const keyword_matcher& keywords, const env_settings& s)
+  {
+  if (s.perform_syntax_highlighting && fb.syntax.should_highlight && fb.syntax.lexer)
+    {
+    fb.syntax.lexer->lex(fb.content[row], fb.lex[row], &spans, &keywords);
+    return;
+    }
+  // without a lexer only keywords are marked, as in the command windows that show the keywords of their editor
+  spans.clear();
+  spans.emplace_back((int64_t)0, tt_normal);
+  if (keywords.empty())
+    return;
+  const line ln = fb.content[row];
+  int64_t col = 0;
+  for (auto it = ln.begin(); it != ln.end(); )
+    {
+    uint8_t keyword_type;
+    const int64_t length = keywords.match(keyword_type, it, ln.end());
+    const text_type type = keyword_type == 1 ? tt_keyword_1 : keyword_type == 2 ? tt_keyword_2 : tt_normal;
+    if (col == 0)
+      spans.back().second = type;
+    else if (spans.back().second != type)
+      spans.emplace_back(col, type);
+    const int64_t step = length > 0 ? length : 1;
+    it += step;
+    col += step;
+    }
+  }
+
+token_span_cache::token_span_cache(size_t max_rows) : _content_version(0), _keywords(nullptr), _max_rows(max_rows)
+  {
+  _plain.emplace_back((int64_t)0, tt_normal);
+  }
+
+const token_spans& token_span_cache::get(const file_buffer& fb, int64_t row, const keyword_matcher& keywords, const env_settings& s)
+  {
+  if (!s.perform_syntax_highlighting)
+    return _plain;
+  if (!same_syntax(_syntax, fb.syntax) || _keywords != &keywords)
+    {
+    _clear();
+    _syntax = fb.syntax;
+    _keywords = &keywords;
+    }
+  if (_content_version != fb.content_version)
+    {
+    _by_row.clear();
+    _content_version = fb.content_version;
+    }
+  const uint8_t status = fb.lex[row];
+  auto found_row = _by_row.find(row);
+  if (found_row != _by_row.end() && found_row->second->status == status)
+    {
+    _rows.splice(_rows.begin(), _rows, found_row->second);
+    return _rows.front().spans;
+    }
+  const line ln = fb.content[row];
+  const size_t hash = hash_line(ln);
+  auto range = _by_hash.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it)
+    {
+    const entry& e = *it->second;
+    if (e.status == status && e.ln.size() == ln.size() && std::equal(ln.begin(), ln.end(), e.ln.begin()))
+      {
+      _rows.splice(_rows.begin(), _rows, it->second);
+      _by_row[row] = _rows.begin();
+      return _rows.front().spans;
+      }
+    }
+  _rows.emplace_front();
+  entry& e = _rows.front();
+  e.ln = ln;
+  e.status = status;
+  e.hash = hash;
+  get_token_spans(e.spans, fb, row, keywords, s);
+  _by_hash.emplace(hash, _rows.begin());
+  _by_row[row] = _rows.begin();
+  while (_rows.size() > _max_rows)
+    _evict();
+  return _rows.front().spans;
+  }
+
+size_t token_span_cache::size() const
+  {
+  return _rows.size();
+  }
+
+void token_span_cache::_clear()
+  {
+  _rows.clear();
+  _by_hash.clear();
+  _by_row.clear();
+  }
+
+void token_span_cache::_evict()
+  {
+  auto last = std::prev(_rows.end());
+  auto range = _by_hash.equal_range(last->hash);
+  for (auto it = range.first; it != range.second; ++it)
+    {
+    if (it->second == last)
+      {
+      _by_hash.erase(it);
+      break;
+      }
+    }
+  _rows.pop_back();
+  // rows can share an entry, so the rows that point to the dropped entry are not known
+  _by_row.clear();
+  }
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "buffer.h"
+#include "keyword_matcher.h"
+#include "syntax_lexer.h"
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+Fills spans with the text types of row of fb from left to right: the text from column spans[i].first up to the next
+span has type spans[i].second. Words in normal text that are keywords are marked tt_keyword_1 or tt_keyword_2.
+The row is scanned once by the syntax_lexer of fb, the same scan that gives the lexer status at its end.
+*/
+void get_token_spans(token_spans& spans, const file_buffer& fb, int64_t row, const keyword_matcher& keywords, const env_settings& s);
+
+/*
+A bounded cache of the token spans of the rows of a buffer, keyed on the content of a row and the lexer status at its
+begin, so that rows that are drawn again are not lexed again, also after other rows were edited. The least recently
+used rows are dropped first.
+*/
+class token_span_cache
+  {
+  public:
+    explicit token_span_cache(size_t max_rows = 4096);
+
+    /*
+    Returns the token spans of row of fb, see get_token_spans. The reference is valid until the next call.
+    */
+    const token_spans& get(const file_buffer& fb, int64_t row, const keyword_matcher& keywords, const env_settings& s);
+
+    size_t size() const;
+
+  private:
+    struct entry
+      {
+      line ln;
+      uint8_t status;
+      size_t hash;
+      token_spans spans;
+      };
+
+    void _clear();
+
+    void _evict();
+
+  private:
+    std::list<entry> _rows; // the most recently used first
+    std::unordered_multimap<size_t, std::list<entry>::iterator> _by_hash;
+    std::unordered_map<int64_t, std::list<entry>::iterator> _by_row; // rows of _content_version that were found before, cleared when an entry is dropped
+    uint64_t _content_version;
+    syntax_settings _syntax;
+    const keyword_matcher* _keywords;
+    size_t _max_rows;
+    token_spans _plain;
+  };
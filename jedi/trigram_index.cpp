@@ -0,0 +1,226 @@
+#include "trigram_index.h"
+#include "parallel.h"
+#include "search.h"
+
+#include <algorithm>
+
+namespace
+  {
+  const uint64_t max_density = 12 * 16; // 12 bits per trigram, which lets through about 8 percent of the groups without a trigram
+
+  inline uint32_t get_trigram_hash(wchar_t c0, wchar_t c1, wchar_t c2)
+    {
+    uint32_t h = ((uint32_t)c0 * 31 + (uint32_t)c1) * 31 + (uint32_t)c2;
+    return h * 0x9E3779B1u;
+    }
+
+  inline uint64_t get_bit(uint32_t hash, uint32_t nr_of_words)
+    {
+    // the high bits of the hash are the best mixed ones, so they select the bit
+    return ((uint64_t)hash * ((uint64_t)nr_of_words << 6)) >> 32;
+    }
+
+  inline uint64_t get_nr_of_trigrams(const line& ln)
+    {
+    return ln.size() < 3 ? 0 : (uint64_t)ln.size() - 2;
+    }
+
+  inline uint32_t get_nr_of_words(uint64_t nr_of_trigrams, uint64_t density)
+    {
+    return (uint32_t)std::min<uint64_t>(1 + nr_of_trigrams * density / (16 * 64), 0xffffffff);
+    }
+
+  const uint64_t bytes_per_group = 2 * sizeof(uint64_t) + sizeof(uint64_t); // a group and the first word of its signature
+
+  /*
+  The groups take at most half of the budget, the other half is for the signature bits that depend on the trigrams.
+  */
+  int64_t get_rows_per_group(int64_t nr_of_rows, uint64_t max_bytes)
+    {
+    const uint64_t max_groups = std::max<uint64_t>(max_bytes / 2 / bytes_per_group, 1);
+    return std::max<int64_t>((int64_t)(((uint64_t)nr_of_rows + max_groups - 1) / max_groups), 1);
+    }
+
+  uint64_t get_density(uint64_t nr_of_trigrams, uint64_t nr_of_groups, uint64_t max_bytes)
+    {
+    const uint64_t fixed_bytes = nr_of_groups * bytes_per_group;
+    if (nr_of_trigrams == 0)
+      return max_density;
+    if (fixed_bytes >= max_bytes)
+      return 0;
+    return std::min<uint64_t>(max_density, (max_bytes - fixed_bytes) * 8 * 16 / nr_of_trigrams);
+    }
+  }
+
+trigram_index::trigram_index(text txt, uint64_t content_version, uint64_t max_bytes) : _txt(txt), _content_version(content_version)
+  {
+  _build_all(max_bytes);
+  }
+
+trigram_index::trigram_index(const trigram_index& previous, text txt, uint64_t content_version, uint64_t max_bytes) : _txt(txt), _content_version(content_version)
+  {
+  int64_t equal_prefix, equal_suffix;
+  get_equal_rows(equal_prefix, equal_suffix, previous._txt, _txt);
+  _update(previous, max_bytes, equal_prefix, equal_suffix);
+  }
+
+trigram_index::trigram_index(const trigram_index& previous, text txt, uint64_t content_version, uint64_t max_bytes, int64_t equal_prefix, int64_t equal_suffix) : _txt(txt), _content_version(content_version)
+  {
+  _update(previous, max_bytes, equal_prefix, equal_suffix);
+  }
+
+void trigram_index::_build_all(uint64_t max_bytes)
+  {
+  const int64_t nr_of_rows = (int64_t)_txt.size();
+  _rows_per_group = get_rows_per_group(nr_of_rows, max_bytes);
+  uint64_t nr_of_trigrams = 0;
+  for (auto it = _txt.begin(); it != _txt.end(); ++it)
+    nr_of_trigrams += get_nr_of_trigrams(*it);
+  _density = get_density(nr_of_trigrams, (uint64_t)((nr_of_rows + _rows_per_group - 1) / _rows_per_group), max_bytes);
+  _groups.clear();
+  _words.clear();
+  _build(0, nr_of_rows);
+  }
+
+void trigram_index::_update(const trigram_index& previous, uint64_t max_bytes, int64_t equal_prefix, int64_t equal_suffix)
+  {
+  const int64_t old_rows = (int64_t)previous._txt.size();
+  const int64_t new_rows = (int64_t)_txt.size();
+  _rows_per_group = previous._rows_per_group;
+  _density = previous._density;
+  if (get_rows_per_group(new_rows, max_bytes) > _rows_per_group || previous._groups.empty())
+    {
+    _build_all(max_bytes);
+    return;
+    }
+  equal_prefix = std::min(equal_prefix, std::min(old_rows, new_rows));
+  equal_suffix = std::min(equal_suffix, std::min(old_rows, new_rows) - equal_prefix);
+
+  // find the groups [first_group, last_group) that contain the changed rows
+  const size_t nr_of_groups = previous._groups.size();
+  size_t first_group = 0;
+  int64_t first_row = 0;
+  while (first_group + 1 < nr_of_groups && first_row + previous._groups[first_group].nr_of_rows <= equal_prefix)
+    first_row += previous._groups[first_group++].nr_of_rows;
+  size_t last_group = first_group;
+  int64_t last_row = first_row;
+  while (last_group < nr_of_groups && (last_group == first_group || last_row < old_rows - equal_suffix))
+    last_row += previous._groups[last_group++].nr_of_rows;
+
+  const uint64_t first_word = previous._groups[first_group].first_word;
+  const uint64_t last_word = last_group < nr_of_groups ? previous._groups[last_group].first_word : (uint64_t)previous._words.size();
+  _groups.assign(previous._groups.begin(), previous._groups.begin() + first_group);
+  _words.assign(previous._words.begin(), previous._words.begin() + first_word);
+  _build(first_row, last_row + new_rows - old_rows);
+  const uint64_t moved_words = _words.size();
+  _groups.insert(_groups.end(), previous._groups.begin() + last_group, previous._groups.end());
+  _words.insert(_words.end(), previous._words.begin() + last_word, previous._words.end());
+  for (size_t g = _groups.size() - (nr_of_groups - last_group); g < _groups.size(); ++g)
+    _groups[g].first_word = _groups[g].first_word - last_word + moved_words;
+  _groups.shrink_to_fit();
+  _words.shrink_to_fit();
+
+  // many small groups at the edges of edits, or rows that got longer, can make the index exceed its budget
+  if (memory_used() > max_bytes)
+    _build_all(max_bytes);
+  }
+
+void trigram_index::_build(int64_t first_row, int64_t last_row)
+  {
+  if (last_row <= first_row)
+    return;
+  const size_t offset = _groups.size();
+  const size_t nr_of_groups = (size_t)((last_row - first_row + _rows_per_group - 1) / _rows_per_group);
+  _groups.resize(offset + nr_of_groups);
+  parallel_for(nr_of_groups, [&](uint64_t g)
+    {
+    const int64_t group_begin = first_row + (int64_t)g * _rows_per_group;
+    const int64_t group_end = std::min<int64_t>(group_begin + _rows_per_group, last_row);
+    uint64_t nr_of_trigrams = 0;
+    for (int64_t r = group_begin; r < group_end; ++r)
+      nr_of_trigrams += get_nr_of_trigrams(_txt[r]);
+    _groups[offset + g].nr_of_words = get_nr_of_words(nr_of_trigrams, _density);
+    _groups[offset + g].nr_of_rows = (uint32_t)(group_end - group_begin);
+    });
+  uint64_t word = _words.size();
+  for (size_t g = offset; g < _groups.size(); ++g)
+    {
+    _groups[g].first_word = word;
+    word += _groups[g].nr_of_words;
+    }
+  _words.resize(word, 0);
+  parallel_for(nr_of_groups, [&](uint64_t g)
+    {
+    const group& grp = _groups[offset + g];
+    uint64_t* words = _words.data() + grp.first_word;
+    const int64_t group_begin = first_row + (int64_t)g * _rows_per_group;
+    std::wstring row;
+    for (int64_t r = group_begin; r < group_begin + (int64_t)grp.nr_of_rows; ++r)
+      {
+      row.assign(_txt[r].begin(), _txt[r].end());
+      if (row.size() < 3)
+        continue;
+      fold_case(&row[0], &row[0] + row.size());
+      for (size_t i = 2; i < row.size(); ++i)
+        {
+        const uint64_t bit = get_bit(get_trigram_hash(row[i - 2], row[i - 1], row[i]), grp.nr_of_words);
+        words[bit >> 6] |= (uint64_t)1 << (bit & 63);
+        }
+      }
+    });
+  }
+
+uint64_t trigram_index::content_version() const
+  {
+  return _content_version;
+  }
+
+uint64_t trigram_index::memory_used() const
+  {
+  return _groups.capacity() * sizeof(group) + _words.capacity() * sizeof(uint64_t);
+  }
+
+int64_t trigram_index::rows_per_group() const
+  {
+  return _rows_per_group;
+  }
+
+bool trigram_index::get_candidate_rows(std::vector<std::pair<int64_t, int64_t>>& ranges, const std::wstring& pattern) const
+  {
+  ranges.clear();
+  if (pattern.size() < 3 || pattern.find(L'\n') != std::wstring::npos)
+    return false;
+  std::wstring folded(pattern);
+  fold_case(&folded[0], &folded[0] + folded.size());
+  std::vector<uint32_t> hashes;
+  for (size_t i = 2; i < folded.size(); ++i)
+    hashes.push_back(get_trigram_hash(folded[i - 2], folded[i - 1], folded[i]));
+  std::sort(hashes.begin(), hashes.end());
+  hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+  int64_t row = 0;
+  for (const group& grp : _groups)
+    {
+    const uint64_t* words = _words.data() + grp.first_word;
+    const bool candidate = std::all_of(hashes.begin(), hashes.end(), [&](uint32_t h)
+      {
+      const uint64_t bit = get_bit(h, grp.nr_of_words);
+      return (words[bit >> 6] & ((uint64_t)1 << (bit & 63))) != 0;
+      });
+    if (candidate)
+      {
+      if (!ranges.empty() && ranges.back().second == row)
+        ranges.back().second += grp.nr_of_rows;
+      else
+        ranges.emplace_back(row, row + grp.nr_of_rows);
+      }
+    row += grp.nr_of_rows;
+    }
+  return true;
+  }
+
+bool get_candidate_rows(std::vector<std::pair<int64_t, int64_t>>& ranges, const file_buffer& fb, const std::wstring& pattern)
+  {
+  if (!fb.trigrams || fb.trigrams->content_version() != fb.content_version)
+    return false;
+  return fb.trigrams->get_candidate_rows(ranges, pattern);
+  }
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <utility>
+#include <vector>
+
+/*
+Trigram signatures of the rows of a text, so that searches can skip the rows that cannot contain a pattern.
+Rows are grouped, and each group has a signature with one bit set for each case folded trigram in its rows. The size of
+a signature grows with the number of trigrams in its group, so that long rows do not fill it up: up to 12 bits per
+trigram, or less if the memory budget is too small for that. Groups contain one row, unless more rows per group are
+needed to stay within the memory budget.
+An index belongs to one content_version of a file_buffer. An index for a newer version can be made from an older
+index, in which case only the groups of the rows that differ between both versions are rebuilt. These rows are found
+by comparing both texts, unless they are given as by get_equal_rows.
+Building an index can take long for large texts, so it should be done on a background thread.
+*/
+class trigram_index
+  {
+  public:
+    trigram_index(text txt, uint64_t content_version, uint64_t max_bytes);
+    trigram_index(const trigram_index& previous, text txt, uint64_t content_version, uint64_t max_bytes);
+    trigram_index(const trigram_index& previous, text txt, uint64_t content_version, uint64_t max_bytes, int64_t equal_prefix, int64_t equal_suffix);
+
+    uint64_t content_version() const;
+
+    uint64_t memory_used() const;
+
+    int64_t rows_per_group() const;
+
+    /*
+    Sets ranges to the sorted row ranges [first, last) that can contain pattern, ignoring case. Returns false if the
+    index cannot help for pattern, because it is shorter than 3 characters or because it contains a newline.
+    */
+    bool get_candidate_rows(std::vector<std::pair<int64_t, int64_t>>& ranges, const std::wstring& pattern) const;
+
+  private:
+    void _build_all(uint64_t max_bytes);
+    void _build(int64_t first_row, int64_t last_row);
+    void _update(const trigram_index& previous, uint64_t max_bytes, int64_t equal_prefix, int64_t equal_suffix);
+
+  private:
+    struct group
+      {
+      uint64_t first_word; // the signature of the group is _words[first_word, first_word + nr_of_words)
+      uint32_t nr_of_words;
+      uint32_t nr_of_rows;
+      };
+    text _txt;
+    uint64_t _content_version;
+    int64_t _rows_per_group;
+    uint64_t _density; // signature bits per 16 trigrams
+    std::vector<group> _groups;
+    std::vector<uint64_t> _words;
+  };
+
+/*
+Sets ranges as trigram_index::get_candidate_rows does, if fb has a trigram index for its current content_version.
+Returns false otherwise, in which case all rows should be searched.
+*/
+bool get_candidate_rows(std::vector<std::pair<int64_t, int64_t>>& ranges, const file_buffer& fb, const std::wstring& pattern);